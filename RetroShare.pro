@@ -83,3 +83,21 @@ tests {
     unittests.depends = libretroshare librssimulator
     unittests.target = unittests
 }
+
+retroshare_friendserver:tests {
+    SUBDIRS += retroshare_friendserver_benchmarks
+    retroshare_friendserver_benchmarks.file = retroshare-friendserver/benchmarks/benchmarks.pro
+    retroshare_friendserver_benchmarks.depends = libretroshare
+    retroshare_friendserver_benchmarks.target = retroshare_friendserver_benchmarks
+}
+
+retroshare_plugins:tests {
+    SUBDIRS += feedreader_benchmarks
+    feedreader_benchmarks.file = plugins/FeedReader/benchmarks/benchmarks.pro
+    feedreader_benchmarks.depends = libretroshare
+    feedreader_benchmarks.target = feedreader_benchmarks
+
+    SUBDIRS += voip_benchmarks
+    voip_benchmarks.file = plugins/VOIP/benchmarks/benchmarks.pro
+    voip_benchmarks.target = voip_benchmarks
+}
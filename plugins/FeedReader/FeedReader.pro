@@ -33,6 +33,11 @@ target.files = lib/libFeedReader.so
 SOURCES =	FeedReaderPlugin.cpp \
 			services/p3FeedReader.cc \
 			services/p3FeedReaderThread.cc \
+			services/p3FeedReaderDownloader.cc \
+			services/p3FeedReaderImageCache.cc \
+			services/p3FeedReaderMsgStore.cc \
+			services/p3FeedReaderStats.cc \
+			services/p3FeedReaderTransformation.cc \
 			services/rsFeedReaderItems.cc \
 			gui/FeedReaderDialog.cpp \
 			gui/FeedReaderMessageWidget.cpp \
@@ -46,6 +51,7 @@ SOURCES =	FeedReaderPlugin.cpp \
 			gui/FeedReaderFeedItem.cpp \
 			util/CURLWrapper.cpp \
 			util/XMLWrapper.cpp \
+			util/XMLReaderWrapper.cpp \
 			util/HTMLWrapper.cpp \
 			util/XPathWrapper.cpp
 
@@ -53,6 +59,11 @@ HEADERS =	FeedReaderPlugin.h \
 			interface/rsFeedReader.h \
 			services/p3FeedReader.h \
 			services/p3FeedReaderThread.h \
+			services/p3FeedReaderDownloader.h \
+			services/p3FeedReaderImageCache.h \
+			services/p3FeedReaderMsgStore.h \
+			services/p3FeedReaderStats.h \
+			services/p3FeedReaderTransformation.h \
 			services/rsFeedReaderItems.h \
 			gui/FeedReaderDialog.h \
 			gui/FeedReaderMessageWidget.h \
@@ -66,6 +77,7 @@ HEADERS =	FeedReaderPlugin.h \
 			gui/FeedReaderFeedItem.h \
 			util/CURLWrapper.h \
 			util/XMLWrapper.h \
+			util/XMLReaderWrapper.h \
 			util/HTMLWrapper.h \
 			util/XPathWrapper.h
 
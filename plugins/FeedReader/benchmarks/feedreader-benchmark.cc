@@ -0,0 +1,631 @@
+/*******************************************************************************
+ * plugins/FeedReader/benchmarks/feedreader-benchmark.cc                       *
+ *                                                                             *
+ * Copyright (C) 2012 by Thunder <retroshare.project@gmail.com>                *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+/* End-to-end benchmark of the feed reader, without GUI.
+ *
+ * A small HTTP/1.1 server on a loopback port serves generated RSS 2.0, Atom and RDF feeds, their images and a
+ * favicon, with ETag validators. A p3FeedReader is started in-process and all feeds are updated several times:
+ * the first cycle downloads everything, in the following cycles only a part of the feeds publish new items.
+ *
+ * Reported are the feeds per second, the latency of the pipeline stages (download, process, processMsg,
+ * onProcessSuccess_addMsgs), the time the mutex of p3FeedReader is held by them, the latency of an API call
+ * while the feeds are updated and the memory usage.
+ *
+ * The stages are measured by p3FeedReaderStats, the sources are compiled with FEEDREADER_STATS.
+ * Only available on unix systems. */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "util/argstream.h"
+#include "util/rsdebug.h"
+#include "util/rsdir.h"
+#include "util/folderiterator.h"
+#include "retroshare/rsiface.h"
+
+#include "services/p3FeedReader.h"
+#include "services/p3FeedReaderStats.h"
+
+#define BENCHMARK_DIRECTORY "feedreader-benchmark-data"
+#define POLL_INTERVAL_MS    10
+
+/* 1x1 transparent png */
+static const unsigned char PNG_DATA[] = {
+	0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a, 0x00, 0x00, 0x00, 0x0d, 0x49, 0x48, 0x44, 0x52,
+	0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x08, 0x06, 0x00, 0x00, 0x00, 0x1f, 0x15, 0xc4,
+	0x89, 0x00, 0x00, 0x00, 0x0d, 0x49, 0x44, 0x41, 0x54, 0x78, 0x9c, 0x63, 0x00, 0x01, 0x00, 0x00,
+	0x05, 0x00, 0x01, 0x0d, 0x0a, 0x2d, 0xb4, 0x00, 0x00, 0x00, 0x00, 0x49, 0x45, 0x4e, 0x44, 0xae,
+	0x42, 0x60, 0x82
+};
+
+static size_t procStatus(const char *field)
+{
+	/* size in kB, from /proc */
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	size_t length = strlen(field);
+
+	while (std::getline(status, line)) {
+		if (line.compare(0, length, field) == 0 && line.size() > length && line[length] == ':') {
+			return strtoul(line.c_str() + length + 1, NULL, 10);
+		}
+	}
+
+	return 0;
+}
+
+static void cleanDirectory(const std::string &directory)
+{
+	librs::util::FolderIterator dirIt(directory, false);
+	for (; dirIt.isValid(); dirIt.next()) {
+		if (dirIt.file_type() == librs::util::FolderIterator::TYPE_FILE) {
+			remove(dirIt.file_fullpath().c_str());
+		}
+	}
+}
+
+static std::string formatTime(time_t value, const char *format)
+{
+	struct tm tm;
+	gmtime_r(&value, &tm);
+
+	char buffer[64];
+	strftime(buffer, sizeof(buffer), format, &tm);
+
+	return buffer;
+}
+
+/***************************************************************************/
+/****************************** Feeds **************************************/
+/***************************************************************************/
+
+/* The content of the feeds. Every feed shows the newest items, a changed feed publishes new items. */
+class FrSyntheticFeeds
+{
+public:
+	enum Format { RSS, ATOM, RDF };
+
+	FrSyntheticFeeds(uint32_t feedCount, uint32_t itemCount, uint32_t descriptionSize, uint32_t imageCount)
+		: mItemCount(itemCount), mImageCount(imageCount), mStartTime(time(NULL))
+	{
+		mNewest.resize(feedCount, itemCount);
+
+		static const char *words[] = { "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit" };
+		for (uint32_t i = 0; mFiller.size() < descriptionSize; ++i) {
+			mFiller += words[i % 8];
+			mFiller += (i % 12 == 11) ? ". " : " ";
+		}
+		mFiller.resize(descriptionSize);
+	}
+
+	static Format format(uint32_t feed) { return (Format) (feed % 3); }
+
+	/* the changed feeds publish newItems items, returns the number of changed feeds */
+	uint32_t change(uint32_t cycle, uint32_t changePercent, uint32_t newItems)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		uint32_t changed = 0;
+		for (uint32_t feed = 0; feed < mNewest.size(); ++feed) {
+			if ((feed * 31 + cycle * 17) % 100 < changePercent) {
+				mNewest[feed] += newItems;
+				++changed;
+			}
+		}
+
+		return changed;
+	}
+
+	bool get(uint32_t feed, const std::string &host, std::string &content, std::string &etag)
+	{
+		uint32_t newest;
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			if (feed >= mNewest.size()) {
+				return false;
+			}
+			newest = mNewest[feed];
+		}
+
+		etag = "\"" + std::to_string(feed) + "-" + std::to_string(newest) + "\"";
+		content = generate(feed, newest, host);
+
+		return true;
+	}
+
+private:
+	std::string description(uint32_t feed, uint32_t item, const std::string &host)
+	{
+		/* escaped html */
+		std::string text = "&lt;p&gt;" + mFiller + "&lt;/p&gt;";
+		for (uint32_t image = 0; image < mImageCount; ++image) {
+			text += "&lt;img src=\"http://" + host + "/img/" + std::to_string(feed) + "-" + std::to_string(item * mImageCount + image) + ".png\"/&gt;";
+		}
+
+		return text;
+	}
+
+	std::string generate(uint32_t feed, uint32_t newest, const std::string &host)
+	{
+		std::string feedName = "Feed " + std::to_string(feed);
+		std::string link = "http://" + host + "/feed/" + std::to_string(feed);
+		std::string xml = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+		uint32_t oldest = newest > mItemCount ? newest - mItemCount : 0;
+
+		switch (format(feed)) {
+		case RSS:
+			xml += "<rss version=\"2.0\"><channel><title>" + feedName + "</title><link>" + link + "</link><description>Synthetic RSS feed</description>\n";
+			for (uint32_t item = newest; item > oldest; --item) {
+				std::string itemLink = link + "/" + std::to_string(item);
+				xml += "<item><title>Item " + std::to_string(item) + "</title><link>" + itemLink + "</link><guid>" + itemLink + "</guid>"
+				       "<author>author@example.com</author><pubDate>" + formatTime(mStartTime + item * 60, "%a, %d %b %Y %H:%M:%S +0000") + "</pubDate>"
+				       "<description>" + description(feed, item, host) + "</description></item>\n";
+			}
+			xml += "</channel></rss>\n";
+			break;
+		case ATOM:
+			xml += "<feed xmlns=\"http://www.w3.org/2005/Atom\"><title>" + feedName + "</title><subtitle>Synthetic Atom feed</subtitle><link href=\"" + link + "\"/>\n";
+			for (uint32_t item = newest; item > oldest; --item) {
+				std::string itemLink = link + "/" + std::to_string(item);
+				xml += "<entry><title>Item " + std::to_string(item) + "</title><link href=\"" + itemLink + "\"/><id>" + itemLink + "</id>"
+				       "<author><name>Author</name></author><updated>" + formatTime(mStartTime + item * 60, "%Y-%m-%dT%H:%M:%SZ") + "</updated>"
+				       "<content type=\"html\">" + description(feed, item, host) + "</content></entry>\n";
+			}
+			xml += "</feed>\n";
+			break;
+		case RDF:
+			xml += "<rdf:RDF xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\" xmlns=\"http://purl.org/rss/1.0/\" xmlns:dc=\"http://purl.org/dc/elements/1.1/\">"
+			       "<channel rdf:about=\"" + link + "\"><title>" + feedName + "</title><link>" + link + "</link><description>Synthetic RDF feed</description></channel>\n";
+			for (uint32_t item = newest; item > oldest; --item) {
+				std::string itemLink = link + "/" + std::to_string(item);
+				xml += "<item rdf:about=\"" + itemLink + "\"><title>Item " + std::to_string(item) + "</title><link>" + itemLink + "</link>"
+				       "<dc:creator>Author</dc:creator><dc:date>" + formatTime(mStartTime + item * 60, "%Y-%m-%dT%H:%M:%SZ") + "</dc:date>"
+				       "<description>" + description(feed, item, host) + "</description></item>\n";
+			}
+			xml += "</rdf:RDF>\n";
+			break;
+		}
+
+		return xml;
+	}
+
+	std::mutex mMutex;
+	std::vector<uint32_t> mNewest;
+	uint32_t mItemCount;
+	uint32_t mImageCount;
+	time_t mStartTime;
+	std::string mFiller;
+};
+
+/***************************************************************************/
+/****************************** Server *************************************/
+/***************************************************************************/
+
+/* Minimal HTTP/1.1 server with keep-alive, one thread per connection */
+class FrHttpServer
+{
+public:
+	FrHttpServer(FrSyntheticFeeds &feeds) : mFeeds(feeds), mListenFd(-1), mPort(0), mRequests(0), mNotModified(0) {}
+
+	bool start(uint16_t port)
+	{
+		mListenFd = socket(AF_INET, SOCK_STREAM, 0);
+		if (mListenFd < 0) {
+			return false;
+		}
+
+		int one = 1;
+		setsockopt(mListenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		if (bind(mListenFd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(mListenFd, 128) < 0) {
+			close(mListenFd);
+			mListenFd = -1;
+			return false;
+		}
+
+		mPort = port;
+		mHost = "127.0.0.1:" + std::to_string(port);
+		mAcceptThread = std::thread([this]() { acceptConnections(); });
+
+		return true;
+	}
+
+	void stop()
+	{
+		if (mListenFd < 0) {
+			return;
+		}
+
+		shutdown(mListenFd, SHUT_RDWR);
+		mAcceptThread.join();
+		close(mListenFd);
+		mListenFd = -1;
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			for (int fd : mConnections) {
+				shutdown(fd, SHUT_RDWR);
+			}
+		}
+		for (std::thread &thread : mThreads) {
+			thread.join();
+		}
+		mThreads.clear();
+	}
+
+	const std::string &host() const { return mHost; }
+	uint64_t requests() const { return mRequests; }
+	uint64_t notModified() const { return mNotModified; }
+
+private:
+	void acceptConnections()
+	{
+		for (;;) {
+			int fd = accept(mListenFd, NULL, NULL);
+			if (fd < 0) {
+				break;
+			}
+
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+			std::lock_guard<std::mutex> lock(mMutex);
+			mConnections.push_back(fd);
+			mThreads.push_back(std::thread([this, fd]() { serve(fd); }));
+		}
+	}
+
+	static std::string header(const std::string &request, const char *name)
+	{
+		/* headers are case insensitive */
+		std::string lowerRequest = request;
+		std::transform(lowerRequest.begin(), lowerRequest.end(), lowerRequest.begin(), ::tolower);
+
+		std::string::size_type pos = lowerRequest.find("\r\n" + std::string(name) + ":");
+		if (pos == std::string::npos) {
+			return "";
+		}
+		pos += strlen(name) + 3;
+
+		std::string::size_type end = request.find("\r\n", pos);
+		std::string value = request.substr(pos, end - pos);
+		value.erase(0, value.find_first_not_of(" \t"));
+
+		return value;
+	}
+
+	bool answer(const std::string &request, std::string &response)
+	{
+		std::string::size_type pathStart = request.find(' ');
+		std::string::size_type pathEnd = (pathStart == std::string::npos) ? std::string::npos : request.find(' ', pathStart + 1);
+		if (pathEnd == std::string::npos) {
+			return false;
+		}
+		std::string path = request.substr(pathStart + 1, pathEnd - pathStart - 1);
+
+		std::string content;
+		std::string etag;
+		std::string contentType;
+		unsigned int feed;
+
+		if (sscanf(path.c_str(), "/feed/%u.xml", &feed) == 1 && mFeeds.get(feed, mHost, content, etag)) {
+			contentType = "application/xml";
+		} else if (path.compare(0, 5, "/img/") == 0) {
+			/* the images never change */
+			content.assign((const char*) PNG_DATA, sizeof(PNG_DATA));
+			etag = "\"image\"";
+			contentType = "image/png";
+		} else if (path == "/favicon.ico") {
+			content.assign((const char*) PNG_DATA, sizeof(PNG_DATA));
+			etag = "\"favicon\"";
+			contentType = "image/png";
+		} else {
+			response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+			return true;
+		}
+
+		++mRequests;
+
+		if (header(request, "if-none-match") == etag) {
+			++mNotModified;
+			response = "HTTP/1.1 304 Not Modified\r\nETag: " + etag + "\r\n\r\n";
+			return true;
+		}
+
+		response = "HTTP/1.1 200 OK\r\nContent-Type: " + contentType + "\r\nETag: " + etag + "\r\nContent-Length: " + std::to_string(content.size()) + "\r\n\r\n";
+		response += content;
+
+		return true;
+	}
+
+	void serve(int fd)
+	{
+		std::string buffer;
+		char data[16384];
+
+		for (;;) {
+			std::string::size_type end;
+			while ((end = buffer.find("\r\n\r\n")) == std::string::npos) {
+				ssize_t n = recv(fd, data, sizeof(data), 0);
+				if (n <= 0) {
+					closeConnection(fd);
+					return;
+				}
+				buffer.append(data, n);
+			}
+
+			/* only GET requests without body */
+			std::string request = buffer.substr(0, end + 2);
+			buffer.erase(0, end + 4);
+
+			std::string response;
+			if (!answer(request, response)) {
+				break;
+			}
+
+			for (size_t sent = 0; sent < response.size(); ) {
+				ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+				if (n <= 0) {
+					closeConnection(fd);
+					return;
+				}
+				sent += n;
+			}
+
+			if (header(request, "connection") == "close") {
+				break;
+			}
+		}
+
+		closeConnection(fd);
+	}
+
+	void closeConnection(int fd)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mConnections.remove(fd);
+		close(fd);
+	}
+
+	FrSyntheticFeeds &mFeeds;
+	int mListenFd;
+	uint16_t mPort;
+	std::string mHost;
+	std::thread mAcceptThread;
+
+	std::mutex mMutex;
+	std::list<int> mConnections;
+	std::list<std::thread> mThreads;
+
+	std::atomic<uint64_t> mRequests;
+	std::atomic<uint64_t> mNotModified;
+};
+
+/***************************************************************************/
+/****************************** Benchmark **********************************/
+/***************************************************************************/
+
+class FrBenchmarkNotify : public RsFeedReaderNotify
+{
+public:
+	FrBenchmarkNotify() : mAddedMsgs(0) {}
+
+	virtual void notifyMsgChanged(uint32_t /*feedId*/, const std::string &/*msgId*/, int type)
+	{
+		if (type == NOTIFY_TYPE_ADD) {
+			++mAddedMsgs;
+		}
+	}
+
+	std::atomic<uint64_t> mAddedMsgs;
+};
+
+static void printStages(const char *name, uint32_t feedCount, double elapsed, uint64_t addedMsgs, const std::vector<double> &apiLatencies)
+{
+	RsInfo() << name << ": " << feedCount << " feeds in " << elapsed << " s, " << feedCount / elapsed << " feeds/s, " << addedMsgs << " new messages";
+
+	for (int stage = 0; stage < p3FeedReaderStats::STAGE_COUNT; ++stage) {
+		p3FeedReaderStats::Summary summary;
+		p3FeedReaderStats::get((p3FeedReaderStats::Stage) stage, summary);
+
+		RsInfo() << "  " << p3FeedReaderStats::name((p3FeedReaderStats::Stage) stage) << " (us): count=" << summary.count
+		         << " avg=" << (summary.count ? summary.totalUs / summary.count : 0) << " p50<" << summary.p50Us
+		         << " p99<" << summary.p99Us << " max=" << summary.maxUs << " total=" << summary.totalUs / 1000 << " ms";
+	}
+
+	std::vector<double> sorted = apiLatencies;
+	std::sort(sorted.begin(), sorted.end());
+	auto percentile = [&sorted](double p) { return sorted.empty() ? 0.0 : sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))]; };
+
+	RsInfo() << "  getFeedList (us): count=" << sorted.size() << " p50=" << percentile(0.5) << " p99=" << percentile(0.99)
+	         << " max=" << (sorted.empty() ? 0.0 : sorted.back());
+	RsInfo() << "  RSS: " << procStatus("VmRSS") / 1024 << " MB, peak " << procStatus("VmHWM") / 1024 << " MB";
+}
+
+/* updates all feeds and waits until they are finished, getFeedList is timed meanwhile */
+static double runCycle(p3FeedReader *feedReader, uint32_t feedCount, std::vector<double> &apiLatencies, uint32_t &errors)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	feedReader->processFeed(0);
+
+	for (;;) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(POLL_INTERVAL_MS));
+
+		feedReader->tick();
+
+		std::list<FeedInfo> feedInfos;
+		auto callStart = std::chrono::steady_clock::now();
+		feedReader->getFeedList(0, feedInfos);
+		apiLatencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - callStart).count());
+
+		uint32_t finished = 0;
+		errors = 0;
+		for (const FeedInfo &feedInfo : feedInfos) {
+			if (feedInfo.workstate == FeedInfo::WAITING) {
+				++finished;
+				if (feedInfo.errorState != RS_FEED_ERRORSTATE_OK) {
+					++errors;
+				}
+			}
+		}
+
+		if (finished >= feedCount) {
+			break;
+		}
+	}
+
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t feedCount = 200;
+	uint32_t itemCount = 50;
+	uint32_t descriptionSize = 2000;
+	uint32_t imageCount = 0;
+	uint32_t changePercent = 20;
+	uint32_t newItems = 5;
+	uint32_t cycles = 5;
+	uint32_t parallelDownloads = 0;
+	uint16_t port = 8480;
+
+	argstream as(argc, argv);
+
+	as >> parameter('f', "feeds", feedCount, "number of feeds (default: 200)", false)
+	   >> parameter('i', "items", itemCount, "number of items in a feed (default: 50)", false)
+	   >> parameter('d', "description-size", descriptionSize, "size of the item descriptions in bytes (default: 2000)", false)
+	   >> parameter('m', "images", imageCount, "number of images in an item, they are embedded when > 0 (default: 0)", false)
+	   >> parameter('c', "change-percent", changePercent, "percentage of the feeds with new items in an update cycle (default: 20)", false)
+	   >> parameter('n', "new-items", newItems, "number of new items of a changed feed (default: 5)", false)
+	   >> parameter('u', "cycles", cycles, "number of update cycles after the first download (default: 5)", false)
+	   >> parameter('j', "parallel-downloads", parallelDownloads, "number of parallel downloads (default: feed reader default)", false)
+	   >> parameter('p', "port", port, "loopback port of the HTTP server (default: 8480)", false)
+	   >> help('h', "help", "Display this Help");
+
+	as.defaultErrorHandling(true, true);
+
+	std::string directory = BENCHMARK_DIRECTORY;
+	if (!RsDirUtil::checkCreateDirectory(directory)) {
+		RsErr() << "Cannot create directory " << directory;
+		return 1;
+	}
+	/* start with empty stores */
+	cleanDirectory(directory + "/feedreader_msgs");
+	cleanDirectory(directory + "/feedreader_images");
+
+	FrSyntheticFeeds feeds(feedCount, itemCount, descriptionSize, imageCount);
+	FrHttpServer server(feeds);
+	if (!server.start(port)) {
+		RsErr() << "Cannot listen on port " << port;
+		return 1;
+	}
+
+	FrBenchmarkNotify notify;
+	p3FeedReader *feedReader = new p3FeedReader(NULL, NULL, directory);
+	feedReader->setNotify(&notify);
+	if (parallelDownloads) {
+		feedReader->setMaxParallelDownloads(parallelDownloads);
+	}
+
+	for (uint32_t feed = 0; feed < feedCount; ++feed) {
+		FeedInfo feedInfo;
+		feedInfo.parentId = 0;
+		feedInfo.url = "http://" + server.host() + "/feed/" + std::to_string(feed) + ".xml";
+		feedInfo.name = "Feed " + std::to_string(feed);
+		feedInfo.flag.infoFromFeed = true;
+		feedInfo.flag.embedImages = (imageCount > 0);
+		/* updated by the benchmark only */
+		feedInfo.updateInterval = 0;
+
+		uint32_t feedId;
+		if (feedReader->addFeed(feedInfo, feedId) != RS_FEED_ADD_RESULT_SUCCESS) {
+			RsErr() << "Cannot add feed " << feedInfo.url;
+			return 1;
+		}
+	}
+
+	RsInfo() << "Feed reader benchmark: " << feedCount << " feeds (RSS, Atom, RDF) of " << itemCount << " items, "
+	         << descriptionSize << " bytes descriptions, " << imageCount << " images per item, " << changePercent
+	         << "% of the feeds with " << newItems << " new items per cycle";
+
+	std::vector<double> apiLatencies;
+	uint32_t errors = 0;
+
+	/* first download, all items are new */
+	double elapsed = runCycle(feedReader, feedCount, apiLatencies, errors);
+	printStages("First download", feedCount, elapsed, notify.mAddedMsgs, apiLatencies);
+	if (errors) {
+		RsErr() << errors << " feeds with errors";
+	}
+
+	/* updates */
+	p3FeedReaderStats::reset();
+	apiLatencies.clear();
+	notify.mAddedMsgs = 0;
+	uint64_t requestsBefore = server.requests();
+	uint64_t notModifiedBefore = server.notModified();
+
+	elapsed = 0;
+	uint32_t changedFeeds = 0;
+	for (uint32_t cycle = 1; cycle <= cycles; ++cycle) {
+		changedFeeds += feeds.change(cycle, changePercent, newItems);
+		elapsed += runCycle(feedReader, feedCount, apiLatencies, errors);
+	}
+	if (cycles) {
+		printStages("Updates", feedCount * cycles, elapsed, notify.mAddedMsgs, apiLatencies);
+		RsInfo() << "  " << changedFeeds << " changed feeds, " << server.requests() - requestsBefore << " requests, "
+		         << server.notModified() - notModifiedBefore << " not modified";
+		if (errors) {
+			RsErr() << errors << " feeds with errors";
+		}
+	}
+
+	feedReader->setNotify(NULL);
+	feedReader->stop();
+	delete(feedReader);
+
+	server.stop();
+
+	return 0;
+}
@@ -0,0 +1,71 @@
+################################################################################
+# feedreader-benchmark.pro                                                     #
+# Copyright (C) 2018, Retroshare team <retroshare.team@gmailcom>               #
+#                                                                              #
+# This program is free software: you can redistribute it and/or modify         #
+# it under the terms of the GNU Affero General Public License as               #
+# published by the Free Software Foundation, either version 3 of the           #
+# License, or (at your option) any later version.                              #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU Affero General Public License for more details.                          #
+#                                                                              #
+# You should have received a copy of the GNU Affero General Public License     #
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.       #
+################################################################################
+
+!include("../../../retroshare.pri"): error("Could not include file ../../../retroshare.pri")
+
+TARGET = feedreader-benchmark
+
+!include("../../../libretroshare/src/use_libretroshare.pri"):error("Including")
+
+CONFIG += console
+CONFIG -= qt
+
+# time the pipeline stages in p3FeedReaderStats
+DEFINES += FEEDREADER_STATS
+
+INCLUDEPATH += .. ../../../rapidjson-1.1.0
+
+SOURCES += feedreader-benchmark.cc \
+           ../services/p3FeedReader.cc \
+           ../services/p3FeedReaderThread.cc \
+           ../services/p3FeedReaderDownloader.cc \
+           ../services/p3FeedReaderImageCache.cc \
+           ../services/p3FeedReaderMsgStore.cc \
+           ../services/p3FeedReaderStats.cc \
+           ../services/p3FeedReaderTransformation.cc \
+           ../services/rsFeedReaderItems.cc \
+           ../util/CURLWrapper.cpp \
+           ../util/XMLWrapper.cpp \
+           ../util/XMLReaderWrapper.cpp \
+           ../util/HTMLWrapper.cpp \
+           ../util/XPathWrapper.cpp
+
+HEADERS += ../interface/rsFeedReader.h \
+           ../services/p3FeedReader.h \
+           ../services/p3FeedReaderThread.h \
+           ../services/p3FeedReaderDownloader.h \
+           ../services/p3FeedReaderImageCache.h \
+           ../services/p3FeedReaderMsgStore.h \
+           ../services/p3FeedReaderStats.h \
+           ../services/p3FeedReaderTransformation.h \
+           ../services/rsFeedReaderItems.h \
+           ../util/CURLWrapper.h \
+           ../util/XMLWrapper.h \
+           ../util/XMLReaderWrapper.h \
+           ../util/HTMLWrapper.h \
+           ../util/XPathWrapper.h
+
+linux-* {
+	CONFIG += link_pkgconfig
+
+	PKGCONFIG *= libcurl libxml-2.0 libxslt
+}
+
+!linux-* {
+	LIBS += -lcurl -lxml2 -lxslt
+}
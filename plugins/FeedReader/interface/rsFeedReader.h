@@ -200,6 +200,11 @@ public:
 	virtual void     setStandardProxy(bool useProxy, const std::string &proxyAddress, uint16_t proxyPort) = 0;
 	virtual bool     getSaveInBackground() = 0;
 	virtual void     setSaveInBackground(bool saveInBackground) = 0;
+	virtual uint32_t getMaxParallelDownloads() = 0;
+	virtual void     setMaxParallelDownloads(uint32_t maxParallelDownloads) = 0;
+	/* download feeds without new content less often */
+	virtual bool     getAdaptiveUpdateInterval() = 0;
+	virtual void     setAdaptiveUpdateInterval(bool adaptiveUpdateInterval) = 0;
 
 	virtual RsFeedAddResult addFolder(uint32_t parentId, const std::string &name, uint32_t &feedId) = 0;
 	virtual RsFeedAddResult setFolder(uint32_t feedId, const std::string &name) = 0;
@@ -213,6 +218,7 @@ public:
 	virtual bool            removeMsg(uint32_t feedId, const std::string &msgId) = 0;
 	virtual bool            removeMsgs(uint32_t feedId, const std::list<std::string> &msgIds) = 0;
 	virtual bool            getMessageCount(uint32_t feedId, uint32_t *msgCount, uint32_t *newCount, uint32_t *unreadCount) = 0;
+	/* the descriptions of the msgs are not filled in, use getMsgInfo */
 	virtual bool            getFeedMsgList(uint32_t feedId, std::list<FeedMsgInfo> &msgInfos) = 0;
 	virtual bool            getFeedMsgIdList(uint32_t feedId, std::list<std::string> &msgIds) = 0;
 	virtual bool            processFeed(uint32_t feedId) = 0;
@@ -21,14 +21,23 @@
 #include "rsFeedReaderItems.h"
 #include "p3FeedReader.h"
 #include "p3FeedReaderThread.h"
+#include "p3FeedReaderDownloader.h"
+#include "p3FeedReaderImageCache.h"
+#include "p3FeedReaderMsgStore.h"
+#include "p3FeedReaderTransformation.h"
+#include "p3FeedReaderStats.h"
 #include "rsitems/rsconfigitems.h"
 #include "retroshare/rsiface.h"
 #include "retroshare/rsgxsforums.h"
+#include "retroshare/rsinit.h"
 #include "util/rsstring.h"
 #include "util/rstime.h"
+#include "util/rsdir.h"
 #include "gxs/rsgenexchange.h"
 
 #include <unistd.h>
+#include <thread>
+#include <libxml/parser.h>
 
 RsFeedReader *rsFeedReader = NULL;
 
@@ -37,11 +46,21 @@ RsFeedReader *rsFeedReader = NULL;
 
 #define MAX_REQUEST_AGE 30 // 30 seconds
 
+#define DEFAULT_MAX_PARALLEL_DOWNLOADS 8
+/* one process thread per core */
+#define MAX_PROCESS_THREADS 16
+
+#define IMAGE_CACHE_MAX_AGE 30 * 60 * 60 * 24 // 30 days
+
+/* adaptive update interval: double the interval after every ADAPTIVE_UNCHANGED_DOWNLOADS unchanged downloads, up to 2^ADAPTIVE_MAX_SHIFT times */
+#define ADAPTIVE_UNCHANGED_DOWNLOADS 3
+#define ADAPTIVE_MAX_SHIFT           3
+
 /*********
  * #define FEEDREADER_DEBUG
  *********/
 
-p3FeedReader::p3FeedReader(RsPluginHandler* pgHandler, RsGxsForums *forums)
+p3FeedReader::p3FeedReader(RsPluginHandler* pgHandler, RsGxsForums *forums, const std::string &directory)
 	: RsPQIService(RS_SERVICE_TYPE_PLUGIN_FEEDREADER,  5, pgHandler),
 	  mFeedReaderMtx("p3FeedReader"), mDownloadMutex("p3FeedReaderDownload"), mProcessMutex("p3FeedReaderProcess"), mPreviewMutex("p3FeedReaderPreview")
 {
@@ -53,6 +72,11 @@ p3FeedReader::p3FeedReader(RsPluginHandler* pgHandler, RsGxsForums *forums)
 	mStandardStorageTime = 30 * 60 * 60 * 24; // 30 days
 	mStandardUseProxy = false;
 	mStandardProxyPort = 0;
+	mMaxParallelDownloads = DEFAULT_MAX_PARALLEL_DOWNLOADS;
+	mAdaptiveUpdateInterval = false;
+	mMsgCount = 0;
+	mNewCount = 0;
+	mUnreadCount = 0;
 	mLastClean = 0;
 	mForums = forums;
 	mNotify = NULL;
@@ -62,15 +86,32 @@ p3FeedReader::p3FeedReader(RsPluginHandler* pgHandler, RsGxsForums *forums)
 	mPreviewDownloadThread = NULL;
 	mPreviewProcessThread = NULL;
 
+	std::string storeDirectory = directory.empty() ? RsAccounts::AccountDirectory() : directory;
+	mImageCache = new p3FeedReaderImageCache(storeDirectory + "/feedreader_images");
+	mMsgStore = new p3FeedReaderMsgStore(storeDirectory + "/feedreader_msgs");
+
 	/* start download thread */
-	p3FeedReaderThread *frt = new p3FeedReaderThread(this, p3FeedReaderThread::DOWNLOAD, 0);
-	mThreads.push_back(frt);
-	frt->start("fr download");
+	mDownloader = new p3FeedReaderDownloader(this, mMaxParallelDownloads);
+	mDownloader->start("fr download");
+
+	/* libxml2 must be initialized before it is used by several threads */
+	xmlInitParser();
+
+	/* start process threads */
+	unsigned int processThreads = std::thread::hardware_concurrency();
+	if (processThreads < 1) {
+		processThreads = 1;
+	} else if (processThreads > MAX_PROCESS_THREADS) {
+		processThreads = MAX_PROCESS_THREADS;
+	}
+	for (unsigned int i = 0; i < processThreads; ++i) {
+		p3FeedReaderThread *frt = new p3FeedReaderThread(this, p3FeedReaderThread::PROCESS, 0);
+		mThreads.push_back(frt);
 
-	/* start process thread */
-	frt = new p3FeedReaderThread(this, p3FeedReaderThread::PROCESS, 0);
-	mThreads.push_back(frt);
-	frt->start("fr process");
+		std::string name;
+		rs_sprintf(name, "fr process %u", i + 1);
+		frt->start(name);
+	}
 }
 
 /***************************************************************************/
@@ -262,6 +303,25 @@ void p3FeedReader::setStandardUpdateInterval(uint32_t updateInterval)
 
 	if (mStandardUpdateInterval != updateInterval) {
 		mStandardUpdateInterval = updateInterval;
+		scheduleAll_locked();
+		IndicateConfigChanged();
+	}
+}
+
+bool p3FeedReader::getAdaptiveUpdateInterval()
+{
+	RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+
+	return mAdaptiveUpdateInterval;
+}
+
+void p3FeedReader::setAdaptiveUpdateInterval(bool adaptiveUpdateInterval)
+{
+	RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+
+	if (mAdaptiveUpdateInterval != adaptiveUpdateInterval) {
+		mAdaptiveUpdateInterval = adaptiveUpdateInterval;
+		scheduleAll_locked();
 		IndicateConfigChanged();
 	}
 }
@@ -305,27 +365,76 @@ void p3FeedReader::setSaveInBackground(bool saveInBackground)
 	}
 }
 
+uint32_t p3FeedReader::getMaxParallelDownloads()
+{
+	RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+
+	return mMaxParallelDownloads;
+}
+
+void p3FeedReader::setMaxParallelDownloads(uint32_t maxParallelDownloads)
+{
+	if (maxParallelDownloads == 0) {
+		maxParallelDownloads = 1;
+	}
+
+	{
+		RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+
+		if (maxParallelDownloads == mMaxParallelDownloads) {
+			return;
+		}
+		mMaxParallelDownloads = maxParallelDownloads;
+		IndicateConfigChanged();
+	}
+
+	{
+		RsStackMutex stack(mDownloadMutex); /******* LOCK STACK MUTEX *********/
+
+		if (mDownloader) {
+			mDownloader->setMaxParallelDownloads(maxParallelDownloads);
+		}
+	}
+}
+
 void p3FeedReader::stop()
 {
 	mStopped = true;
 
+	p3FeedReaderDownloader *downloader;
+	{
+		RsStackMutex stack(mDownloadMutex); /******* LOCK STACK MUTEX *********/
+
+		downloader = mDownloader;
+		mDownloader = NULL;
+	}
+	if (downloader) {
+		downloader->fullstop();
+		delete(downloader);
+	}
+
 	{
 		RsStackMutex stack(mPreviewMutex); /******* LOCK STACK MUTEX *********/
 
 		stopPreviewThreads_locked();
 	}
 
+	std::list<p3FeedReaderThread*> threads;
 	{
 		RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
 
-		/* stop threads */
-		std::list<p3FeedReaderThread*>::iterator it;
-		for (it = mThreads.begin(); it != mThreads.end(); ++it) {
-			(*it)->fullstop();
-			delete(*it);
-		}
-		mThreads.clear();
+		threads.swap(mThreads);
 	}
+
+	/* stop threads outside of the lock, they need it to finish their work */
+	std::list<p3FeedReaderThread*>::iterator it;
+	for (it = threads.begin(); it != threads.end(); ++it) {
+		(*it)->fullstop();
+		delete(*it);
+	}
+
+	/* write the last changes of the msgs */
+	mMsgStore->flush(true);
 }
 
 void p3FeedReader::stopPreviewThreads_locked()
@@ -460,6 +569,7 @@ RsFeedAddResult p3FeedReader::addFeed(const FeedInfo &feedInfo, uint32_t &feedId
 		fi->feedId = mNextFeedId++;
 
 		mFeeds[fi->feedId] = fi;
+		schedule_locked(fi);
 
 		feedId = fi->feedId;
 	}
@@ -523,9 +633,31 @@ RsFeedAddResult p3FeedReader::setFeed(uint32_t feedId, const FeedInfo &feedInfo)
 		std::string oldForumId = fi->forumId;
 		std::string oldName = fi->name;
 		std::string oldDescription = fi->description;
+		std::string oldUrl = fi->url;
 
 		infoToFeed(feedInfo, fi);
 
+		if (fi->url != oldUrl) {
+			/* download the icon of the new url with the next download */
+			fi->iconEtag.clear();
+			fi->iconLastModified.clear();
+			fi->iconUpdate = 0;
+		}
+
+		/* the interval or the deactivation may have changed */
+		fi->unchangedCount = 0;
+		if (fi->workstate == RsFeedReaderFeed::WAITING) {
+			schedule_locked(fi);
+		}
+
+		/* compile the transformation again */
+		mTransformations.erase(fi->feedId);
+
+		/* the settings may change the result of the processing, download and process everything again */
+		fi->etag.clear();
+		fi->lastModified.clear();
+		fi->contentHash.clear();
+
 		if ((fi->flag & RS_FEED_FLAG_FORUM) && (fi->flag & RS_FEED_FLAG_UPDATE_FORUM_INFO) && !fi->forumId.empty() &&
 		    (fi->forumId != oldForumId || fi->name != oldName || fi->description != oldDescription)) {
 			/* name or description changed, update forum */
@@ -559,12 +691,138 @@ void p3FeedReader::deleteAllMsgs_locked(RsFeedReaderFeed *fi)
 		return;
 	}
 
+	mTransformations.erase(fi->feedId);
+
 	std::map<std::string, RsFeedReaderMsg*>::iterator msgIt;
 	for (msgIt = fi->msgs.begin(); msgIt != fi->msgs.end(); ++msgIt) {
 		delete(msgIt->second);
 	}
 
 	fi->msgs.clear();
+	fi->msgIndex.clear();
+
+	if (!fi->preview) {
+		mMsgStore->removeFeed(fi->feedId);
+	}
+
+	mMsgCount -= fi->msgCount;
+	mNewCount -= fi->newCount;
+	mUnreadCount -= fi->unreadCount;
+	fi->msgCount = 0;
+	fi->newCount = 0;
+	fi->unreadCount = 0;
+}
+
+static size_t msgIdentity(const RsFeedReaderMsg *mi)
+{
+	std::string identity;
+	identity.reserve(mi->title.size() + mi->link.size() + mi->author.size() + 2);
+	identity += mi->title;
+	identity += '\0';
+	identity += mi->link;
+	identity += '\0';
+	identity += mi->author;
+
+	return std::hash<std::string>()(identity);
+}
+
+void p3FeedReader::addMsg_locked(RsFeedReaderFeed *fi, RsFeedReaderMsg *mi)
+{
+	fi->msgs[mi->msgId] = mi;
+	fi->msgIndex.insert(std::make_pair(msgIdentity(mi), mi));
+
+	countMsg_locked(fi, mi, 1);
+}
+
+void p3FeedReader::eraseMsg_locked(RsFeedReaderFeed *fi, std::map<std::string, RsFeedReaderMsg*>::iterator msgIt)
+{
+	RsFeedReaderMsg *mi = msgIt->second;
+
+	std::pair<std::unordered_multimap<size_t, RsFeedReaderMsg*>::iterator, std::unordered_multimap<size_t, RsFeedReaderMsg*>::iterator> range = fi->msgIndex.equal_range(msgIdentity(mi));
+	for (std::unordered_multimap<size_t, RsFeedReaderMsg*>::iterator it = range.first; it != range.second; ++it) {
+		if (it->second == mi) {
+			fi->msgIndex.erase(it);
+			break;
+		}
+	}
+
+	countMsg_locked(fi, mi, -1);
+
+	if (!fi->preview) {
+		mMsgStore->writeRemove(fi->feedId, mi->msgId);
+	}
+
+	fi->msgs.erase(msgIt);
+	delete(mi);
+}
+
+void p3FeedReader::setMsgFlag_locked(RsFeedReaderFeed *fi, RsFeedReaderMsg *mi, uint32_t flag)
+{
+	if (mi->flag == flag) {
+		return;
+	}
+
+	countMsg_locked(fi, mi, -1);
+	mi->flag = flag;
+	countMsg_locked(fi, mi, 1);
+}
+
+void p3FeedReader::storeMsg_locked(RsFeedReaderFeed *fi, RsFeedReaderMsg *mi)
+{
+	if (fi->preview) {
+		/* msgs of a preview are not stored */
+		return;
+	}
+
+	mMsgStore->writeMsg(fi->feedId, mi);
+}
+
+void p3FeedReader::storeMsgFlag_locked(RsFeedReaderFeed *fi, RsFeedReaderMsg *mi)
+{
+	if (fi->preview) {
+		return;
+	}
+
+	if (!mi->stored) {
+		/* not in the store yet */
+		mMsgStore->writeMsg(fi->feedId, mi);
+	} else {
+		mMsgStore->writeFlag(fi->feedId, mi);
+	}
+}
+
+void p3FeedReader::countMsg_locked(RsFeedReaderFeed *fi, const RsFeedReaderMsg *mi, int delta)
+{
+	if (mi->flag & RS_FEEDMSG_FLAG_DELETED) {
+		/* deleted msgs are not counted */
+		return;
+	}
+
+	fi->msgCount += delta;
+	mMsgCount += delta;
+
+	if (mi->flag & RS_FEEDMSG_FLAG_NEW) {
+		fi->newCount += delta;
+		mNewCount += delta;
+	}
+
+	if ((mi->flag & RS_FEEDMSG_FLAG_READ) == 0) {
+		fi->unreadCount += delta;
+		mUnreadCount += delta;
+	}
+}
+
+RsFeedReaderMsg *p3FeedReader::findMsg_locked(RsFeedReaderFeed *fi, const RsFeedReaderMsg *mi)
+{
+	std::pair<std::unordered_multimap<size_t, RsFeedReaderMsg*>::iterator, std::unordered_multimap<size_t, RsFeedReaderMsg*>::iterator> range = fi->msgIndex.equal_range(msgIdentity(mi));
+	for (std::unordered_multimap<size_t, RsFeedReaderMsg*>::iterator it = range.first; it != range.second; ++it) {
+		/* the digest can collide, compare the strings */
+		if (it->second->title == mi->title && it->second->link == mi->link && it->second->author == mi->author) {
+			return it->second;
+		}
+	}
+
+	return NULL;
 }
 
 bool p3FeedReader::removeFeed(uint32_t feedId)
@@ -613,6 +871,7 @@ bool p3FeedReader::removeFeed(uint32_t feedId)
 							feedIds.push_back(fi->feedId);
 						}
 
+						unschedule_locked(fi1);
 						deleteAllMsgs_locked(fi1);
 						delete(fi1);
 
@@ -623,11 +882,13 @@ bool p3FeedReader::removeFeed(uint32_t feedId)
 			}
 		}
 
+		unschedule_locked(fi);
 		deleteAllMsgs_locked(fi);
 		delete(fi);
 	}
 
 	if (changed) {
+		mMsgStore->flush();
 		IndicateConfigChanged();
 	}
 
@@ -747,36 +1008,44 @@ bool p3FeedReader::getFeedInfo(uint32_t feedId, FeedInfo &feedInfo)
 
 bool p3FeedReader::getMsgInfo(uint32_t feedId, const std::string &msgId, FeedMsgInfo &msgInfo)
 {
-	RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+	bool stored = false;
 
-	std::map<uint32_t, RsFeedReaderFeed*>::iterator feedIt = mFeeds.find(feedId);
-	if (feedIt == mFeeds.end()) {
+	{
+		RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+
+		std::map<uint32_t, RsFeedReaderFeed*>::iterator feedIt = mFeeds.find(feedId);
+		if (feedIt == mFeeds.end()) {
 #ifdef FEEDREADER_DEBUG
-		std::cerr << "p3FeedReader::getMsgInfo - feed " << feedId << " not found" << std::endl;
+			std::cerr << "p3FeedReader::getMsgInfo - feed " << feedId << " not found" << std::endl;
 #endif
-		return false;
-	}
+			return false;
+		}
 
-	RsFeedReaderFeed *fi = feedIt->second;
+		RsFeedReaderFeed *fi = feedIt->second;
 
-	std::map<std::string, RsFeedReaderMsg*>::iterator msgIt;
-	msgIt = fi->msgs.find(msgId);
-	if (msgIt == fi->msgs.end()) {
+		std::map<std::string, RsFeedReaderMsg*>::iterator msgIt;
+		msgIt = fi->msgs.find(msgId);
+		if (msgIt == fi->msgs.end()) {
 #ifdef FEEDREADER_DEBUG
-		std::cerr << "p3FeedReader::getMsgInfo - msg " << msgId << " not found" << std::endl;
+			std::cerr << "p3FeedReader::getMsgInfo - msg " << msgId << " not found" << std::endl;
 #endif
-		return false;
+			return false;
+		}
+
+		feedMsgToInfo(msgIt->second, msgInfo);
+		stored = msgIt->second->stored;
 	}
 
-	feedMsgToInfo(msgIt->second, msgInfo);
+	if (stored) {
+		/* outside of the lock, it works on the disk */
+		mMsgStore->readDescriptions(feedId, msgId, msgInfo.description, msgInfo.descriptionTransformed);
+	}
 
 	return true;
 }
 
 bool p3FeedReader::removeMsg(uint32_t feedId, const std::string &msgId)
 {
-	bool changed = false;
-
 	{
 		RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
 
@@ -789,7 +1058,6 @@ bool p3FeedReader::removeMsg(uint32_t feedId, const std::string &msgId)
 		}
 
 		RsFeedReaderFeed *fi = feedIt->second;
-		changed = !fi->preview;
 
 		std::map<std::string, RsFeedReaderMsg*>::iterator msgIt;
 		msgIt = fi->msgs.find(msgId);
@@ -801,15 +1069,14 @@ bool p3FeedReader::removeMsg(uint32_t feedId, const std::string &msgId)
 		}
 
 		RsFeedReaderMsg *mi = msgIt->second;
-		mi->flag |= RS_FEEDMSG_FLAG_DELETED | RS_FEEDMSG_FLAG_READ;
-		mi->flag &= ~RS_FEEDMSG_FLAG_NEW;
+		setMsgFlag_locked(fi, mi, (mi->flag | RS_FEEDMSG_FLAG_DELETED | RS_FEEDMSG_FLAG_READ) & ~RS_FEEDMSG_FLAG_NEW);
 		mi->description.clear();
 		mi->descriptionTransformed.clear();
+		mi->stored = false;
+		storeMsg_locked(fi, mi);
 	}
 
-	if (changed) {
-		IndicateConfigChanged();
-	}
+	mMsgStore->flush();
 
 	if (mNotify) {
 		mNotify->notifyFeedChanged(feedId, NOTIFY_TYPE_MOD);
@@ -822,7 +1089,6 @@ bool p3FeedReader::removeMsg(uint32_t feedId, const std::string &msgId)
 bool p3FeedReader::removeMsgs(uint32_t feedId, const std::list<std::string> &msgIds)
 {
 	std::list<std::string> removedMsgs;
-	bool changed = false;
 
 	{
 		RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
@@ -836,7 +1102,6 @@ bool p3FeedReader::removeMsgs(uint32_t feedId, const std::list<std::string> &msg
 		}
 
 		RsFeedReaderFeed *fi = feedIt->second;
-		changed = !fi->preview;
 
 		std::list<std::string>::const_iterator idIt;
 		for (idIt = msgIds.begin(); idIt != msgIds.end(); ++idIt) {
@@ -850,18 +1115,17 @@ bool p3FeedReader::removeMsgs(uint32_t feedId, const std::list<std::string> &msg
 			}
 
 			RsFeedReaderMsg *mi = msgIt->second;
-			mi->flag |= RS_FEEDMSG_FLAG_DELETED | RS_FEEDMSG_FLAG_READ;
-			mi->flag &= ~RS_FEEDMSG_FLAG_NEW;
+			setMsgFlag_locked(fi, mi, (mi->flag | RS_FEEDMSG_FLAG_DELETED | RS_FEEDMSG_FLAG_READ) & ~RS_FEEDMSG_FLAG_NEW);
 			mi->description.clear();
 			mi->descriptionTransformed.clear();
+			mi->stored = false;
+			storeMsg_locked(fi, mi);
 
 			removedMsgs.push_back(*idIt);
 		}
 	}
 
-	if (changed) {
-		IndicateConfigChanged();
-	}
+	mMsgStore->flush();
 
 	if (mNotify && !removedMsgs.empty()) {
 		mNotify->notifyFeedChanged(feedId, NOTIFY_TYPE_MOD);
@@ -888,23 +1152,9 @@ bool p3FeedReader::getMessageCount(uint32_t feedId, uint32_t *msgCount, uint32_t
 	RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
 
 	if (feedId == 0) {
-		std::map<uint32_t, RsFeedReaderFeed*>::iterator feedIt;
-		for (feedIt = mFeeds.begin(); feedIt != mFeeds.end(); ++feedIt) {
-			RsFeedReaderFeed *fi = feedIt->second;
-
-			std::map<std::string, RsFeedReaderMsg*>::iterator msgIt;
-			for (msgIt = fi->msgs.begin(); msgIt != fi->msgs.end(); ++msgIt) {
-				RsFeedReaderMsg *mi = msgIt->second;
-
-				if (mi->flag & RS_FEEDMSG_FLAG_DELETED) {
-					continue;
-				}
-
-				if (msgCount) ++(*msgCount);
-				if (newCount && (mi->flag & RS_FEEDMSG_FLAG_NEW)) ++(*newCount);
-				if (unreadCount && (mi->flag & RS_FEEDMSG_FLAG_READ) == 0) ++(*unreadCount);
-			}
-		}
+		if (msgCount) *msgCount = mMsgCount;
+		if (newCount) *newCount = mNewCount;
+		if (unreadCount) *unreadCount = mUnreadCount;
 	} else {
 		std::map<uint32_t, RsFeedReaderFeed*>::iterator feedIt = mFeeds.find(feedId);
 		if (feedIt == mFeeds.end()) {
@@ -916,18 +1166,9 @@ bool p3FeedReader::getMessageCount(uint32_t feedId, uint32_t *msgCount, uint32_t
 
 		RsFeedReaderFeed *fi = feedIt->second;
 
-		std::map<std::string, RsFeedReaderMsg*>::iterator msgIt;
-		for (msgIt = fi->msgs.begin(); msgIt != fi->msgs.end(); ++msgIt) {
-			RsFeedReaderMsg *mi = msgIt->second;
-
-			if (mi->flag & RS_FEEDMSG_FLAG_DELETED) {
-				continue;
-			}
-
-			if (msgCount) ++(*msgCount);
-			if (newCount && (mi->flag & RS_FEEDMSG_FLAG_NEW)) ++(*newCount);
-			if (unreadCount && (mi->flag & RS_FEEDMSG_FLAG_READ) == 0) ++(*unreadCount);
-		}
+		if (msgCount) *msgCount = fi->msgCount;
+		if (newCount) *newCount = fi->newCount;
+		if (unreadCount) *unreadCount = fi->unreadCount;
 	}
 
 	return true;
@@ -1107,6 +1348,10 @@ bool p3FeedReader::processFeed(uint32_t feedId)
 				notifyIds.push_back(*it);
 			}
 		}
+
+		if (mDownloader && !notifyIds.empty()) {
+			mDownloader->wakeup();
+		}
 	}
 
 	if (mNotify) {
@@ -1146,19 +1391,24 @@ bool p3FeedReader::setMessageRead(uint32_t feedId, const std::string &msgId, boo
 
 		RsFeedReaderMsg *mi = msgIt->second;
 		uint32_t oldFlag = mi->flag;
-		mi->flag &= ~RS_FEEDMSG_FLAG_NEW;
+		uint32_t flag = oldFlag & ~RS_FEEDMSG_FLAG_NEW;
 		if (read) {
 			/* remove flag new */
-			mi->flag |= RS_FEEDMSG_FLAG_READ;
+			flag |= RS_FEEDMSG_FLAG_READ;
 		} else {
-			mi->flag &= ~RS_FEEDMSG_FLAG_READ;
+			flag &= ~RS_FEEDMSG_FLAG_READ;
 		}
+		setMsgFlag_locked(fi, mi, flag);
 
 		changed = (mi->flag != oldFlag);
+		if (changed) {
+			storeMsgFlag_locked(fi, mi);
+		}
 	}
 
 	if (changed) {
-		IndicateConfigChanged();
+		mMsgStore->flush();
+
 		if (mNotify) {
 			mNotify->notifyFeedChanged(feedId, NOTIFY_TYPE_MOD);
 			mNotify->notifyMsgChanged(feedId, msgId, NOTIFY_TYPE_MOD);
@@ -1172,6 +1422,9 @@ bool p3FeedReader::retransformMsg(uint32_t feedId, const std::string &msgId)
 {
 	bool msgChanged = false;
 	bool feedChanged = false;
+	bool stored = false;
+	std::shared_ptr<p3FeedReaderTransformation> transformation;
+	RsFeedReaderMsg msg;
 
 	{
 		RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
@@ -1196,23 +1449,69 @@ bool p3FeedReader::retransformMsg(uint32_t feedId, const std::string &msgId)
 		}
 
 		RsFeedReaderMsg *mi = msgIt->second;
+		transformation = getTransformation_locked(fi);
 
-		std::string errorString;
-		std::string descriptionTransformed = mi->descriptionTransformed;
-		if (p3FeedReaderThread::processTransformation(*fi, mi, errorString) == RS_FEED_ERRORSTATE_OK) {
-			if (mi->descriptionTransformed != descriptionTransformed) {
-				msgChanged = true;
-			}
-		} else {
-			if (!errorString.empty()) {
-				fi->errorString = errorString;
-				feedChanged = true;
-			}
+		stored = mi->stored;
+		if (!stored) {
+			msg.description = mi->description;
+			msg.descriptionTransformed = mi->descriptionTransformed;
 		}
 	}
 
-	if (feedChanged || msgChanged) {
+	/* outside of the lock, the transformation needs the description from the disk */
+	if (stored) {
+		if (!mMsgStore->readDescriptions(feedId, msgId, msg.description, msg.descriptionTransformed)) {
+			return false;
+		}
+	}
+
+	std::string errorString;
+	std::string descriptionTransformed = msg.descriptionTransformed;
+	if (p3FeedReaderThread::processTransformation(*transformation, &msg, errorString) == RS_FEED_ERRORSTATE_OK) {
+		if (msg.descriptionTransformed != descriptionTransformed) {
+			msgChanged = true;
+		}
+		errorString.clear();
+	}
+
+	if (msgChanged || !errorString.empty()) {
+		RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+
+		std::map<uint32_t, RsFeedReaderFeed*>::iterator feedIt = mFeeds.find(feedId);
+		if (feedIt == mFeeds.end()) {
+			/* removed in the meantime */
+			return false;
+		}
+
+		RsFeedReaderFeed *fi = feedIt->second;
+
+		if (!errorString.empty()) {
+			fi->errorString = errorString;
+			feedChanged = true;
+		}
+
+		std::map<std::string, RsFeedReaderMsg*>::iterator msgIt;
+		msgIt = fi->msgs.find(msgId);
+		if (msgIt == fi->msgs.end()) {
+			msgChanged = false;
+		} else if (msgChanged) {
+			RsFeedReaderMsg *mi = msgIt->second;
+			mi->description.swap(msg.description);
+			mi->descriptionTransformed.swap(msg.descriptionTransformed);
+			mi->stored = false;
+			storeMsg_locked(fi, mi);
+		}
+	}
+
+	if (msgChanged) {
+		mMsgStore->flush();
+	}
+
+	if (feedChanged) {
 		IndicateConfigChanged();
+	}
+
+	if (feedChanged || msgChanged) {
 		if (mNotify) {
 			if (feedChanged) {
 				mNotify->notifyFeedChanged(feedId, NOTIFY_TYPE_MOD);
@@ -1257,16 +1556,15 @@ bool p3FeedReader::clearMessageCache(uint32_t feedId)
 			RsFeedReaderMsg *mi = msgIt->second;
 
 			if (mi->flag & RS_FEEDMSG_FLAG_DELETED) {
-				delete(mi);
 				std::map<std::string, RsFeedReaderMsg*>::iterator deleteIt = msgIt++;
-				fi->msgs.erase(deleteIt);
+				eraseMsg_locked(fi, deleteIt);
 				continue;
 			}
 			++msgIt;
 		}
 	}
 
-	IndicateConfigChanged();
+	mMsgStore->flush();
 
 	return true;
 }
@@ -1290,42 +1588,41 @@ int p3FeedReader::tick()
 	/* clean feeds */
 	cleanFeeds();
 
-	/* check feeds for update interval */
+	/* start the feeds which are due */
 	time_t currentTime = time(NULL);
 	std::list<uint32_t> feedToDownload;
 	std::map<uint32_t, RsFeedReaderFeed*>::iterator feedIt;
 
 	{
 		RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+		FEEDREADER_STATS_TIME(LOCK_HOLD);
 
-		for (feedIt = mFeeds.begin(); feedIt != mFeeds.end(); ++feedIt) {
-			RsFeedReaderFeed *fi = feedIt->second;
+		/* the schedule is ordered by time, only the due feeds are touched */
+		while (!mSchedule.empty() && mSchedule.begin()->first <= currentTime) {
+			uint32_t feedId = mSchedule.begin()->second;
+			mSchedule.erase(mSchedule.begin());
 
-			if (!canProcessFeed(fi)) {
+			feedIt = mFeeds.find(feedId);
+			if (feedIt == mFeeds.end()) {
 				continue;
 			}
 
-			uint32_t updateInterval;
-			if (fi->flag & RS_FEED_FLAG_STANDARD_UPDATE_INTERVAL) {
-				updateInterval = mStandardUpdateInterval;
-			} else {
-				updateInterval = fi->updateInterval;
-			}
+			RsFeedReaderFeed *fi = feedIt->second;
+			fi->nextUpdate = 0;
 
-			if (updateInterval == 0) {
+			if (!canProcessFeed(fi)) {
+				/* already working, it is scheduled again when finished */
 				continue;
 			}
 
-			if (fi->lastUpdate == 0 || fi->lastUpdate + (long) updateInterval <= currentTime) {
-				/* add to download list */
-				feedToDownload.push_back(fi->feedId);
-				fi->workstate = RsFeedReaderFeed::WAITING_TO_DOWNLOAD;
-				fi->content.clear();
+			/* add to download list */
+			feedToDownload.push_back(fi->feedId);
+			fi->workstate = RsFeedReaderFeed::WAITING_TO_DOWNLOAD;
+			fi->content.clear();
 
 #ifdef FEEDREADER_DEBUG
-				std::cerr << "p3FeedReader::tick - starting feed " << fi->feedId << " (" << fi->name << ")" << std::endl;
+			std::cerr << "p3FeedReader::tick - starting feed " << fi->feedId << " (" << fi->name << ")" << std::endl;
 #endif
-			}
 		}
 	}
 
@@ -1341,6 +1638,10 @@ int p3FeedReader::tick()
 				notifyIds.push_back(*it);
 			}
 		}
+
+		if (mDownloader && !notifyIds.empty()) {
+			mDownloader->wakeup();
+		}
 	}
 
 	if (mNotify) {
@@ -1355,9 +1656,14 @@ int p3FeedReader::tick()
 void p3FeedReader::cleanFeeds()
 {
 	time_t currentTime = time(NULL);
+	bool cleanImageCache = false;
+	std::list<uint32_t> compactFeedIds;
 
 	if (mLastClean == 0 || mLastClean + FEEDREADER_CLEAN_INTERVAL <= currentTime) {
 		RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+		FEEDREADER_STATS_TIME(LOCK_HOLD);
+
+		cleanImageCache = true;
 
 		std::list<std::pair<uint32_t, std::string> > removedMsgIds;
 		std::map<uint32_t, RsFeedReaderFeed*>::iterator feedIt;
@@ -1380,9 +1686,8 @@ void p3FeedReader::cleanFeeds()
 					if (mi->flag & RS_FEEDMSG_FLAG_DELETED) {
 						if (mi->pubDate < currentTime - (long) storageTime) {
 							removedMsgIds.push_back(std::pair<uint32_t, std::string> (fi->feedId, mi->msgId));
-							delete(mi);
 							std::map<std::string, RsFeedReaderMsg*>::iterator deleteIt = msgIt++;
-							fi->msgs.erase(deleteIt);
+							eraseMsg_locked(fi, deleteIt);
 							++removedMsgs;
 							continue;
 						}
@@ -1393,12 +1698,15 @@ void p3FeedReader::cleanFeeds()
 				std::cerr << "p3FeedReader::tick - feed " << fi->feedId << " (" << fi->name << ") cleaned, " << removedMsgs << " messages removed" << std::endl;
 #endif
 			}
+
+			/* rewrite the log of the msgs when it has too many outdated records */
+			if (!fi->preview && mMsgStore->needsCompaction(fi->feedId, fi->msgs.size())) {
+				compactFeedIds.push_back(fi->feedId);
+			}
 		}
 		mLastClean = currentTime;
 
 		if (removedMsgIds.size()) {
-			IndicateConfigChanged();
-
 			if (mNotify) {
 				std::list<std::pair<uint32_t, std::string> >::iterator it;
 				for (it = removedMsgIds.begin(); it != removedMsgIds.end(); ++it) {
@@ -1407,6 +1715,18 @@ void p3FeedReader::cleanFeeds()
 			}
 		}
 	}
+
+	/* outside of the lock, it works on the disk */
+	mMsgStore->flush();
+
+	std::list<uint32_t>::iterator compactIt;
+	for (compactIt = compactFeedIds.begin(); compactIt != compactFeedIds.end(); ++compactIt) {
+		mMsgStore->compact(*compactIt);
+	}
+
+	if (cleanImageCache) {
+		mImageCache->clean(IMAGE_CACHE_MAX_AGE);
+	}
 }
 
 /***************************************************************************/
@@ -1461,6 +1781,14 @@ bool p3FeedReader::saveList(bool &cleanup, std::list<RsItem *> &saveData)
 	rs_sprintf(kv.value, "%hu", mSaveInBackground ? 1 : 0);
 	rskv->tlvkvs.pairs.push_back(kv);
 
+	kv.key = "MaxParallelDownloads";
+	rs_sprintf(kv.value, "%u", mMaxParallelDownloads);
+	rskv->tlvkvs.pairs.push_back(kv);
+
+	kv.key = "AdaptiveUpdateInterval";
+	rs_sprintf(kv.value, "%hu", mAdaptiveUpdateInterval ? 1 : 0);
+	rskv->tlvkvs.pairs.push_back(kv);
+
 	/* Add KeyValue to saveList */
 	saveData.push_back(rskv);
 	if (!cleanup) {
@@ -1479,16 +1807,7 @@ bool p3FeedReader::saveList(bool &cleanup, std::list<RsItem *> &saveData)
 			saveData.push_back(fi);
 		}
 
-		std::map<std::string, RsFeedReaderMsg*>::iterator it2;
-		for (it2 = fi->msgs.begin(); it2 != fi->msgs.end(); ++it2) {
-			RsFeedReaderMsg *msg = it2->second;
-
-			if (cleanup) {
-				saveData.push_back(new RsFeedReaderMsg(*msg));
-			} else {
-				saveData.push_back(msg);
-			}
-		}
+		/* the msgs are written to mMsgStore when they change */
 	}
 
 	if (mSaveInBackground) {
@@ -1578,6 +1897,16 @@ bool p3FeedReader::loadList(std::list<RsItem *>& load)
 					if (sscanf(kit->value.c_str(), "%hu", &value) == 1) {
 						mSaveInBackground = value == 1 ? true : false;
 					}
+				} else if (kit->key == "MaxParallelDownloads") {
+					uint32_t value;
+					if (sscanf(kit->value.c_str(), "%u", &value) == 1 && value > 0) {
+						mMaxParallelDownloads = value;
+					}
+				} else if (kit->key == "AdaptiveUpdateInterval") {
+					uint16_t value;
+					if (sscanf(kit->value.c_str(), "%hu", &value) == 1) {
+						mAdaptiveUpdateInterval = value == 1 ? true : false;
+					}
 				}
 			}
 		} else {
@@ -1586,40 +1915,106 @@ bool p3FeedReader::loadList(std::list<RsItem *>& load)
 		}
 	}
 
-	RsStackMutex stack(mFeedReaderMtx); /********** STACK LOCKED MTX ******/
+	{
+		RsStackMutex stack(mDownloadMutex); /******* LOCK STACK MUTEX *********/
 
-	/* check feeds */
-	std::map<uint32_t, RsFeedReaderFeed*>::iterator feedIt;
-	for (feedIt = mFeeds.begin(); feedIt != mFeeds.end(); ++feedIt) {
-		RsFeedReaderFeed *feed = feedIt->second;
-		if (feed->parentId) {
-			/* check parent */
-			if (mFeeds.find(feed->parentId) == mFeeds.end()) {
-				/* parent not found, clear it */
-				feed->parentId = 0;
-			}
+		if (mDownloader) {
+			mDownloader->setMaxParallelDownloads(mMaxParallelDownloads);
 		}
 	}
 
-	/* now sort msgs into feeds */
-	std::map<std::string, RsFeedReaderMsg*>::iterator msgIt;
-	for (msgIt = msgs.begin(); msgIt != msgs.end(); ++msgIt) {
-		uint32_t msgId = 0;
-		if (sscanf(msgIt->first.c_str(), "%u", &msgId) == 1) {
-			feedIt = mFeeds.find(msgIt->second->feedId);
-			if (feedIt == mFeeds.end()) {
-				/* feed does not exist exists */
-				delete msgIt->second;
-				continue;
+	bool migrated = false;
+	std::list<uint32_t> compactFeedIds;
+
+	{
+		RsStackMutex stack(mFeedReaderMtx); /********** STACK LOCKED MTX ******/
+
+		/* check feeds */
+		std::map<uint32_t, RsFeedReaderFeed*>::iterator feedIt;
+		for (feedIt = mFeeds.begin(); feedIt != mFeeds.end(); ++feedIt) {
+			RsFeedReaderFeed *feed = feedIt->second;
+			if (feed->parentId) {
+				/* check parent */
+				if (mFeeds.find(feed->parentId) == mFeeds.end()) {
+					/* parent not found, clear it */
+					feed->parentId = 0;
+				}
 			}
-			feedIt->second->msgs[msgIt->first] = msgIt->second;
-			if (msgId + 1 > mNextMsgId) {
-				mNextMsgId = msgId + 1;
+
+			/* load the msgs of the feed, the descriptions stay on disk */
+			std::list<RsFeedReaderMsg*> storedMsgs;
+			mMsgStore->load(feed->feedId, storedMsgs);
+
+			std::list<RsFeedReaderMsg*>::iterator storedIt;
+			for (storedIt = storedMsgs.begin(); storedIt != storedMsgs.end(); ++storedIt) {
+				RsFeedReaderMsg *mi = *storedIt;
+				uint32_t msgId = 0;
+				if (sscanf(mi->msgId.c_str(), "%u", &msgId) != 1) {
+					/* invalid msg id */
+					delete(mi);
+					continue;
+				}
+				mi->feedId = feed->feedId;
+				addMsg_locked(feed, mi);
+				if (msgId + 1 > mNextMsgId) {
+					mNextMsgId = msgId + 1;
+				}
 			}
-		} else {
-			/* invalid msg id */
-			delete(msgIt->second);
+
+			schedule_locked(feed);
 		}
+
+		/* now sort msgs of older versions, saved with the config, into feeds and move them to the store */
+		std::map<std::string, RsFeedReaderMsg*>::iterator msgIt;
+		for (msgIt = msgs.begin(); msgIt != msgs.end(); ++msgIt) {
+			migrated = true;
+
+			uint32_t msgId = 0;
+			if (sscanf(msgIt->first.c_str(), "%u", &msgId) == 1) {
+				feedIt = mFeeds.find(msgIt->second->feedId);
+				if (feedIt == mFeeds.end()) {
+					/* feed does not exist exists */
+					delete msgIt->second;
+					continue;
+				}
+				RsFeedReaderFeed *feed = feedIt->second;
+				if (feed->msgs.find(msgIt->first) != feed->msgs.end()) {
+					/* the store is newer */
+					delete msgIt->second;
+					continue;
+				}
+				addMsg_locked(feed, msgIt->second);
+				storeMsg_locked(feed, msgIt->second);
+				if (msgId + 1 > mNextMsgId) {
+					mNextMsgId = msgId + 1;
+				}
+			} else {
+				/* invalid msg id */
+				delete(msgIt->second);
+			}
+		}
+
+		for (feedIt = mFeeds.begin(); feedIt != mFeeds.end(); ++feedIt) {
+			RsFeedReaderFeed *feed = feedIt->second;
+			if (mMsgStore->needsCompaction(feed->feedId, feed->msgs.size())) {
+				compactFeedIds.push_back(feed->feedId);
+			}
+		}
+	}
+
+	/* the migrated msgs must be on the disk before the config is saved without them */
+	if (!mMsgStore->flush(true)) {
+		migrated = false;
+	}
+
+	std::list<uint32_t>::iterator compactIt;
+	for (compactIt = compactFeedIds.begin(); compactIt != compactFeedIds.end(); ++compactIt) {
+		mMsgStore->compact(*compactIt);
+	}
+
+	if (migrated) {
+		/* save the config without the msgs */
+		IndicateConfigChanged();
 	}
 
 	return true;
@@ -1648,6 +2043,7 @@ bool p3FeedReader::getFeedToDownload(RsFeedReaderFeed &feed, uint32_t neededFeed
 
 	{
 		RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+		FEEDREADER_STATS_TIME(LOCK_HOLD);
 
 		/* find feed */
 		std::map<uint32_t, RsFeedReaderFeed*>::iterator it = mFeeds.find(feedId);
@@ -1683,12 +2079,120 @@ bool p3FeedReader::getFeedToDownload(RsFeedReaderFeed &feed, uint32_t neededFeed
 	return true;
 }
 
-void p3FeedReader::onDownloadSuccess(uint32_t feedId, const std::string &content, std::string &icon)
+void p3FeedReader::finishUnchangedFeed_locked(RsFeedReaderFeed *fi)
+{
+	fi->workstate = RsFeedReaderFeed::WAITING;
+	fi->lastUpdate = time(NULL);
+	fi->content.clear();
+	++fi->unchangedCount;
+	schedule_locked(fi);
+
+	if (!fi->preview) {
+		IndicateConfigChanged();
+	}
+}
+
+uint32_t p3FeedReader::getUpdateInterval_locked(RsFeedReaderFeed *fi)
+{
+	if (fi->flag & RS_FEED_FLAG_STANDARD_UPDATE_INTERVAL) {
+		return mStandardUpdateInterval;
+	}
+
+	return fi->updateInterval;
+}
+
+void p3FeedReader::schedule_locked(RsFeedReaderFeed *fi)
+{
+	unschedule_locked(fi);
+
+	if (fi->preview || (fi->flag & (RS_FEED_FLAG_FOLDER | RS_FEED_FLAG_DEACTIVATED))) {
+		/* started manually */
+		return;
+	}
+
+	time_t updateInterval = getUpdateInterval_locked(fi);
+	if (updateInterval == 0) {
+		return;
+	}
+
+	if (mAdaptiveUpdateInterval) {
+		/* feeds without new content are downloaded less often */
+		uint32_t shift = fi->unchangedCount / ADAPTIVE_UNCHANGED_DOWNLOADS;
+		if (shift > ADAPTIVE_MAX_SHIFT) {
+			shift = ADAPTIVE_MAX_SHIFT;
+		}
+		updateInterval <<= shift;
+	}
+
+	fi->nextUpdate = fi->lastUpdate ? fi->lastUpdate + updateInterval : time(NULL);
+	mSchedule.insert(std::make_pair(fi->nextUpdate, fi->feedId));
+
+#ifdef FEEDREADER_DEBUG
+	std::cerr << "p3FeedReader::schedule_locked - feed " << fi->feedId << " (" << fi->name << ") next update in " << (fi->nextUpdate - time(NULL)) << " seconds" << std::endl;
+#endif
+}
+
+void p3FeedReader::unschedule_locked(RsFeedReaderFeed *fi)
+{
+	if (fi->nextUpdate) {
+		mSchedule.erase(std::make_pair(fi->nextUpdate, fi->feedId));
+		fi->nextUpdate = 0;
+	}
+}
+
+void p3FeedReader::scheduleAll_locked()
+{
+	std::map<uint32_t, RsFeedReaderFeed*>::iterator feedIt;
+	for (feedIt = mFeeds.begin(); feedIt != mFeeds.end(); ++feedIt) {
+		RsFeedReaderFeed *fi = feedIt->second;
+		if (fi->workstate == RsFeedReaderFeed::WAITING) {
+			/* working feeds are scheduled when finished */
+			schedule_locked(fi);
+		}
+	}
+}
+
+void p3FeedReader::onFaviconDownloaded(uint32_t feedId, bool notModified, const std::string &icon, const std::string &etag, const std::string &lastModified)
+{
+	RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+	FEEDREADER_STATS_TIME(LOCK_HOLD);
+
+	/* find feed */
+	std::map<uint32_t, RsFeedReaderFeed*>::iterator it = mFeeds.find(feedId);
+	if (it == mFeeds.end()) {
+		/* feed not found */
+#ifdef FEEDREADER_DEBUG
+		std::cerr << "p3FeedReader::onFaviconDownloaded - feed " << feedId << " not found" << std::endl;
+#endif
+		return;
+	}
+
+	RsFeedReaderFeed *fi = it->second;
+	fi->iconUpdate = time(NULL);
+
+	if (!notModified) {
+		fi->icon = icon;
+		fi->iconEtag = etag;
+		fi->iconLastModified = lastModified;
+	}
+
+#ifdef FEEDREADER_DEBUG
+	std::cerr << "p3FeedReader::onFaviconDownloaded - feed " << fi->feedId << " (" << fi->name << ") icon " << (notModified ? "not modified" : "downloaded") << std::endl;
+#endif
+
+	/* saved and notified with the result of the feed download */
+}
+
+void p3FeedReader::onDownloadSuccess(uint32_t feedId, const std::string &content, const std::string &etag, const std::string &lastModified)
 {
 	bool preview;
+	bool unchanged = false;
+
+	std::string contentHash = RsDirUtil::sha1sum((const unsigned char*) content.c_str(), content.size()).toStdString();
 
 	{
 		RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+		FEEDREADER_STATS_TIME(LOCK_HOLD);
 
 		/* find feed */
 		std::map<uint32_t, RsFeedReaderFeed*>::iterator it = mFeeds.find(feedId);
@@ -1701,24 +2205,38 @@ void p3FeedReader::onDownloadSuccess(uint32_t feedId, const std::string &content
 		}
 
 		RsFeedReaderFeed *fi = it->second;
-		fi->workstate = RsFeedReaderFeed::WAITING_TO_PROCESS;
-		fi->content = content;
 		preview = fi->preview;
 
-		if (fi->icon != icon) {
-			fi->icon = icon;
+		if (!preview) {
+			/* same content as the last successfully processed download (server without validators) */
+			unchanged = (fi->errorState == RS_FEED_ERRORSTATE_OK && fi->contentHash == contentHash);
 
-			if (!preview) {
+			if (fi->etag != etag || fi->lastModified != lastModified || fi->contentHash != contentHash) {
+				fi->etag = etag;
+				fi->lastModified = lastModified;
+				fi->contentHash = contentHash;
 				IndicateConfigChanged();
 			}
 		}
 
+		if (unchanged) {
+			finishUnchangedFeed_locked(fi);
+
 #ifdef FEEDREADER_DEBUG
-		std::cerr << "p3FeedReader::onDownloadSuccess - feed " << fi->feedId << " (" << fi->name << ") add to process" << std::endl;
+			std::cerr << "p3FeedReader::onDownloadSuccess - feed " << fi->feedId << " (" << fi->name << ") is unchanged" << std::endl;
 #endif
+		} else {
+			fi->workstate = RsFeedReaderFeed::WAITING_TO_PROCESS;
+			fi->content = content;
+			fi->unchangedCount = 0;
+
+#ifdef FEEDREADER_DEBUG
+			std::cerr << "p3FeedReader::onDownloadSuccess - feed " << fi->feedId << " (" << fi->name << ") add to process" << std::endl;
+#endif
+		}
 	}
 
-	if (!preview) {
+	if (!preview && !unchanged) {
 		RsStackMutex stack(mProcessMutex); /******* LOCK STACK MUTEX *********/
 
 		if (std::find(mProcessFeeds.begin(), mProcessFeeds.end(), feedId) == mProcessFeeds.end()) {
@@ -1732,10 +2250,40 @@ void p3FeedReader::onDownloadSuccess(uint32_t feedId, const std::string &content
 	}
 }
 
+void p3FeedReader::onDownloadNotModified(uint32_t feedId)
+{
+	{
+		RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+		FEEDREADER_STATS_TIME(LOCK_HOLD);
+
+		/* find feed */
+		std::map<uint32_t, RsFeedReaderFeed*>::iterator it = mFeeds.find(feedId);
+		if (it == mFeeds.end()) {
+			/* feed not found */
+#ifdef FEEDREADER_DEBUG
+			std::cerr << "p3FeedReader::onDownloadNotModified - feed " << feedId << " not found" << std::endl;
+#endif
+			return;
+		}
+
+		RsFeedReaderFeed *fi = it->second;
+		finishUnchangedFeed_locked(fi);
+
+#ifdef FEEDREADER_DEBUG
+		std::cerr << "p3FeedReader::onDownloadNotModified - feed " << fi->feedId << " (" << fi->name << ") is not modified" << std::endl;
+#endif
+	}
+
+	if (mNotify) {
+		mNotify->notifyFeedChanged(feedId, NOTIFY_TYPE_MOD);
+	}
+}
+
 void p3FeedReader::onDownloadError(uint32_t feedId, RsFeedReaderErrorState result, const std::string &errorString)
 {
 	{
 		RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+		FEEDREADER_STATS_TIME(LOCK_HOLD);
 
 		/* find feed */
 		std::map<uint32_t, RsFeedReaderFeed*>::iterator it = mFeeds.find(feedId);
@@ -1754,6 +2302,7 @@ void p3FeedReader::onDownloadError(uint32_t feedId, RsFeedReaderErrorState resul
 
 		fi->errorState = result;
 		fi->errorString = errorString;
+		schedule_locked(fi);
 
 #ifdef FEEDREADER_DEBUG
 		std::cerr << "p3FeedReader::onDownloadError - feed " << fi->feedId << " (" << fi->name << ") error download, result = " << result << ", errorState = " << fi->errorState << ", error = " << errorString << std::endl;
@@ -1769,6 +2318,29 @@ void p3FeedReader::onDownloadError(uint32_t feedId, RsFeedReaderErrorState resul
 	}
 }
 
+std::shared_ptr<p3FeedReaderTransformation> p3FeedReader::getTransformation(uint32_t feedId)
+{
+	RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+
+	std::map<uint32_t, RsFeedReaderFeed*>::iterator feedIt = mFeeds.find(feedId);
+	if (feedIt == mFeeds.end()) {
+		return std::shared_ptr<p3FeedReaderTransformation>();
+	}
+
+	return getTransformation_locked(feedIt->second);
+}
+
+std::shared_ptr<p3FeedReaderTransformation> p3FeedReader::getTransformation_locked(RsFeedReaderFeed *fi)
+{
+	std::shared_ptr<p3FeedReaderTransformation> &transformation = mTransformations[fi->feedId];
+	if (!transformation || !transformation->isFor(*fi)) {
+		/* threads still using the old one keep it alive */
+		transformation = std::make_shared<p3FeedReaderTransformation>(*fi);
+	}
+
+	return transformation;
+}
+
 bool p3FeedReader::getFeedToProcess(RsFeedReaderFeed &feed, uint32_t neededFeedId)
 {
 	uint32_t feedId = neededFeedId;
@@ -1788,6 +2360,7 @@ bool p3FeedReader::getFeedToProcess(RsFeedReaderFeed &feed, uint32_t neededFeedI
 
 	{
 		RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+		FEEDREADER_STATS_TIME(LOCK_HOLD);
 
 		/* find feed */
 		std::map<uint32_t, RsFeedReaderFeed*>::iterator it = mFeeds.find(feedId);
@@ -1811,8 +2384,11 @@ bool p3FeedReader::getFeedToProcess(RsFeedReaderFeed &feed, uint32_t neededFeedI
 		fi->errorState = RS_FEED_ERRORSTATE_OK;
 		fi->errorString.clear();
 
-		/* return a copy of the feed */
+		/* return a copy of the feed, the content is only needed by the process thread */
+		std::string content;
+		content.swap(fi->content);
 		feed = *fi;
+		feed.content.swap(content);
 
 #ifdef FEEDREADER_DEBUG
 		std::cerr << "p3FeedReader::getFeedToProcess - feed " << fi->feedId << " (" << fi->name << ") is starting to process" << std::endl;
@@ -1826,6 +2402,21 @@ bool p3FeedReader::getFeedToProcess(RsFeedReaderFeed &feed, uint32_t neededFeedI
 	return true;
 }
 
+bool p3FeedReader::isMsgKnown(uint32_t feedId, const RsFeedReaderMsg *msg)
+{
+	RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+	FEEDREADER_STATS_TIME(LOCK_HOLD);
+
+	/* find feed */
+	std::map<uint32_t, RsFeedReaderFeed*>::iterator it = mFeeds.find(feedId);
+	if (it == mFeeds.end()) {
+		/* feed not found */
+		return false;
+	}
+
+	return findMsg_locked(it->second, msg) != NULL;
+}
+
 void p3FeedReader::onProcessSuccess_filterMsg(uint32_t feedId, std::list<RsFeedReaderMsg*> &msgs)
 {
 #ifdef FEEDREADER_DEBUG
@@ -1834,6 +2425,7 @@ void p3FeedReader::onProcessSuccess_filterMsg(uint32_t feedId, std::list<RsFeedR
 
 	{
 		RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+		FEEDREADER_STATS_TIME(LOCK_HOLD);
 
 		/* find feed */
 		std::map<uint32_t, RsFeedReaderFeed*>::iterator it = mFeeds.find(feedId);
@@ -1851,15 +2443,7 @@ void p3FeedReader::onProcessSuccess_filterMsg(uint32_t feedId, std::list<RsFeedR
 		for (newMsgIt = msgs.begin(); newMsgIt != msgs.end(); ) {
 			RsFeedReaderMsg *miNew = *newMsgIt;
 			/* search for existing msg */
-			std::map<std::string, RsFeedReaderMsg*>::iterator msgIt;
-			for (msgIt = fi->msgs.begin(); msgIt != fi->msgs.end(); ++msgIt) {
-				RsFeedReaderMsg *mi = msgIt->second;
-				if (mi->title == miNew->title && mi->link == miNew->link && mi->author == miNew->author) {
-					/* msg exist */
-					break;
-				}
-			}
-			if (msgIt != fi->msgs.end()) {
+			if (findMsg_locked(fi, miNew)) {
 				/* msg exists */
 				delete(miNew);
 				newMsgIt = msgs.erase(newMsgIt);
@@ -1879,6 +2463,8 @@ void p3FeedReader::onProcessSuccess_filterMsg(uint32_t feedId, std::list<RsFeedR
 
 void p3FeedReader::onProcessSuccess_addMsgs(uint32_t feedId, std::list<RsFeedReaderMsg*> &msgs, bool single)
 {
+	FEEDREADER_STATS_TIME(ADD_MSGS);
+
 #ifdef FEEDREADER_DEBUG
 	std::cerr << "p3FeedReader::onProcessSuccess_addMsgs - feed " << feedId << " got " << msgs.size() << " messages" << std::endl;
 #endif
@@ -1890,6 +2476,7 @@ void p3FeedReader::onProcessSuccess_addMsgs(uint32_t feedId, std::list<RsFeedRea
 
 	{
 		RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+		FEEDREADER_STATS_TIME(LOCK_HOLD);
 
 		/* find feed */
 		std::map<uint32_t, RsFeedReaderFeed*>::iterator it = mFeeds.find(feedId);
@@ -1958,7 +2545,8 @@ void p3FeedReader::onProcessSuccess_addMsgs(uint32_t feedId, std::list<RsFeedRea
 					miNew->flag = RS_FEEDMSG_FLAG_NEW;
 					addedMsgs.push_back(miNew->msgId);
 				}
-				fi->msgs[miNew->msgId] = miNew;
+				addMsg_locked(fi, miNew);
+				storeMsg_locked(fi, miNew);
 				newMsgIt = msgs.erase(newMsgIt);
 
 #ifdef FEEDREADER_DEBUG
@@ -1975,6 +2563,7 @@ void p3FeedReader::onProcessSuccess_addMsgs(uint32_t feedId, std::list<RsFeedRea
 			fi->content.clear();
 			fi->errorState = errorState;
 			fi->lastUpdate = time(NULL);
+			schedule_locked(fi);
 		}
 
 		if (!fi->preview) {
@@ -1982,6 +2571,9 @@ void p3FeedReader::onProcessSuccess_addMsgs(uint32_t feedId, std::list<RsFeedRea
 		}
 	}
 
+	/* outside of the lock, it works on the disk */
+	mMsgStore->flush();
+
 	if (!forumId.empty() && !forumMsgs.empty()) {
 		if (mForums) {
 			/* a bit tricky */
@@ -2040,6 +2632,7 @@ void p3FeedReader::onProcessError(uint32_t feedId, RsFeedReaderErrorState result
 {
 	{
 		RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+		FEEDREADER_STATS_TIME(LOCK_HOLD);
 
 		/* find feed */
 		std::map<uint32_t, RsFeedReaderFeed*>::iterator it = mFeeds.find(feedId);
@@ -2058,6 +2651,7 @@ void p3FeedReader::onProcessError(uint32_t feedId, RsFeedReaderErrorState result
 
 		fi->errorState = result;
 		fi->errorString = errorString;
+		schedule_locked(fi);
 
 #ifdef FEEDREADER_DEBUG
 		std::cerr << "p3FeedReader::onProcessError - feed " << fi->feedId << " (" << fi->name << ") error process, result = " << result << ", errorState = " << fi->errorState << std::endl;
@@ -2083,6 +2677,7 @@ void p3FeedReader::setFeedInfo(uint32_t feedId, const std::string &name, const s
 
 	{
 		RsStackMutex stack(mFeedReaderMtx); /******* LOCK STACK MUTEX *********/
+		FEEDREADER_STATS_TIME(LOCK_HOLD);
 
 		/* find feed */
 		std::map<uint32_t, RsFeedReaderFeed*>::iterator it = mFeeds.find(feedId);
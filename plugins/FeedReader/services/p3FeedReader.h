@@ -27,9 +27,16 @@
 
 #include "retroshare/rsgxsifacetypes.h"
 
+#include <memory>
+#include <set>
+
 class RsFeedReaderFeed;
 class RsFeedReaderMsg;
 class p3FeedReaderThread;
+class p3FeedReaderDownloader;
+class p3FeedReaderImageCache;
+class p3FeedReaderMsgStore;
+class p3FeedReaderTransformation;
 
 class RsGxsForums;
 struct RsGxsForumGroup;
@@ -37,7 +44,8 @@ struct RsGxsForumGroup;
 class p3FeedReader : public RsPQIService, public RsFeedReader
 {
 public:
-	p3FeedReader(RsPluginHandler *pgHandler, RsGxsForums *forums);
+	/* the msgs and images are stored in directory, the account directory when it is empty */
+	p3FeedReader(RsPluginHandler *pgHandler, RsGxsForums *forums, const std::string &directory = "");
 
 	/****************** FeedReader Interface *************/
 	virtual void stop();
@@ -51,6 +59,10 @@ public:
 	virtual void     setStandardProxy(bool useProxy, const std::string &proxyAddress, uint16_t proxyPort);
 	virtual bool     getSaveInBackground();
 	virtual void     setSaveInBackground(bool saveInBackground);
+	virtual uint32_t getMaxParallelDownloads();
+	virtual void     setMaxParallelDownloads(uint32_t maxParallelDownloads);
+	virtual bool     getAdaptiveUpdateInterval();
+	virtual void     setAdaptiveUpdateInterval(bool adaptiveUpdateInterval);
 
 	virtual RsFeedAddResult addFolder(uint32_t parentId, const std::string &name, uint32_t &feedId);
 	virtual RsFeedAddResult setFolder(uint32_t feedId, const std::string &name);
@@ -79,14 +91,22 @@ public:
 	virtual RsServiceInfo getServiceInfo() ;
 
 	/****************** internal STUFF *******************/
+	p3FeedReaderImageCache *getImageCache() { return mImageCache; }
+
 	bool getFeedToDownload(RsFeedReaderFeed &feed, uint32_t neededFeedId);
-	void onDownloadSuccess(uint32_t feedId, const std::string &content, std::string &icon);
+	void onFaviconDownloaded(uint32_t feedId, bool notModified, const std::string &icon, const std::string &etag, const std::string &lastModified);
+	void onDownloadSuccess(uint32_t feedId, const std::string &content, const std::string &etag, const std::string &lastModified);
+	void onDownloadNotModified(uint32_t feedId);
 	void onDownloadError(uint32_t feedId, RsFeedReaderErrorState result, const std::string &errorString);
 	void onProcessSuccess_filterMsg(uint32_t feedId, std::list<RsFeedReaderMsg*> &msgs);
 	void onProcessSuccess_addMsgs(uint32_t feedId, std::list<RsFeedReaderMsg*> &msgs, bool single);
 	void onProcessError(uint32_t feedId, RsFeedReaderErrorState result, const std::string &errorString);
 
 	bool getFeedToProcess(RsFeedReaderFeed &feed, uint32_t neededFeedId);
+	/* same title, link and author as a stored msg */
+	bool isMsgKnown(uint32_t feedId, const RsFeedReaderMsg *msg);
+	/* compiled transformation of the feed, shared by the process threads */
+	std::shared_ptr<p3FeedReaderTransformation> getTransformation(uint32_t feedId);
 
 	void setFeedInfo(uint32_t feedId, const std::string &name, const std::string &description);
 
@@ -105,6 +125,21 @@ private:
 	void cleanFeeds();
 	void deleteAllMsgs_locked(RsFeedReaderFeed *fi);
 	void stopPreviewThreads_locked();
+	void finishUnchangedFeed_locked(RsFeedReaderFeed *fi);
+	uint32_t getUpdateInterval_locked(RsFeedReaderFeed *fi);
+	void schedule_locked(RsFeedReaderFeed *fi);
+	void unschedule_locked(RsFeedReaderFeed *fi);
+	void scheduleAll_locked();
+
+	void addMsg_locked(RsFeedReaderFeed *fi, RsFeedReaderMsg *mi);
+	void eraseMsg_locked(RsFeedReaderFeed *fi, std::map<std::string, RsFeedReaderMsg*>::iterator msgIt);
+	void setMsgFlag_locked(RsFeedReaderFeed *fi, RsFeedReaderMsg *mi, uint32_t flag);
+	void storeMsg_locked(RsFeedReaderFeed *fi, RsFeedReaderMsg *mi);
+	void storeMsgFlag_locked(RsFeedReaderFeed *fi, RsFeedReaderMsg *mi);
+	void countMsg_locked(RsFeedReaderFeed *fi, const RsFeedReaderMsg *mi, int delta);
+	static RsFeedReaderMsg *findMsg_locked(RsFeedReaderFeed *fi, const RsFeedReaderMsg *mi);
+
+	std::shared_ptr<p3FeedReaderTransformation> getTransformation_locked(RsFeedReaderFeed *fi);
 
 private:
 	time_t   mLastClean;
@@ -125,10 +160,20 @@ private:
 	bool mStandardUseProxy;
 	std::string mStandardProxyAddress;
 	uint16_t mStandardProxyPort;
+	uint32_t mMaxParallelDownloads;
+	bool mAdaptiveUpdateInterval;
 	std::map<uint32_t, RsFeedReaderFeed*> mFeeds;
+	/* feeds ordered by the time of their next download (nextUpdate, feedId) */
+	std::set<std::pair<time_t, uint32_t> > mSchedule;
+	std::map<uint32_t, std::shared_ptr<p3FeedReaderTransformation> > mTransformations;
+	/* sum of the msg counts of all feeds */
+	uint32_t mMsgCount;
+	uint32_t mNewCount;
+	uint32_t mUnreadCount;
 
 	RsMutex mDownloadMutex;
 	std::list<uint32_t> mDownloadFeeds;
+	p3FeedReaderDownloader *mDownloader;
 
 	RsMutex mProcessMutex;
 	std::list<uint32_t> mProcessFeeds;
@@ -136,6 +181,10 @@ private:
 	RsMutex mPreviewMutex;
 	p3FeedReaderThread *mPreviewDownloadThread;
 	p3FeedReaderThread *mPreviewProcessThread;
+
+	p3FeedReaderImageCache *mImageCache;
+	/* the msgs are stored here and not in the config, protected by mFeedReaderMtx */
+	p3FeedReaderMsgStore *mMsgStore;
 };
 
 #endif 
@@ -0,0 +1,279 @@
+/*******************************************************************************
+ * plugins/FeedReader/services/p3FeedReaderDownloader.cc                       *
+ *                                                                             *
+ * Copyright (C) 2012 by Thunder <retroshare.project@gmail.com>                *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+#include "p3FeedReaderDownloader.h"
+#include "p3FeedReader.h"
+#include "p3FeedReaderThread.h"
+#include "rsFeedReaderItems.h"
+#include "p3FeedReaderStats.h"
+#include "util/CURLWrapper.h"
+#include "util/XMLWrapper.h"
+#include "util/rstime.h"
+
+/* connections per host, like a browser */
+#define MAX_HOST_CONNECTIONS   2
+/* wait time when nothing is downloaded */
+#define IDLE_WAIT_TIME_MS      1000
+/* wait time of curl_multi_wait, which can not be woken up */
+#define ACTIVE_WAIT_TIME_MS    100
+
+/*********
+ * #define FEEDREADER_DEBUG
+ *********/
+
+class RsFeedReaderFeedTransfer
+{
+public:
+	RsFeedReaderFeedTransfer(const RsFeedReaderFeed &downloadFeed, const std::string &proxy, CURLSH *share)
+		: wrapper(proxy, share), downloadingIcon(false), result(RS_FEED_ERRORSTATE_OK)
+	{
+		feed = downloadFeed;
+		startTime = p3FeedReaderStats::now();
+	}
+
+	RsFeedReaderFeed feed;
+	CURLWrapper wrapper;
+	bool downloadingIcon;
+
+	std::string content;
+	std::string etag;
+	std::string lastModified;
+	std::vector<unsigned char> iconData;
+	RsFeedReaderErrorState result;
+	std::string errorString;
+	uint64_t startTime;
+};
+
+p3FeedReaderDownloader::p3FeedReaderDownloader(p3FeedReader *feedReader, uint32_t maxParallelDownloads) :
+    RsTickingThread(), mFeedReader(feedReader), mMaxParallelDownloads(maxParallelDownloads)
+{
+	mShare = new CURLShare;
+
+	mMulti = curl_multi_init();
+	if (mMulti) {
+		curl_multi_setopt(mMulti, CURLMOPT_MAX_HOST_CONNECTIONS, (long) MAX_HOST_CONNECTIONS);
+		/* reuse connections through HTTP/2 multiplexing when the server supports it */
+		curl_multi_setopt(mMulti, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+	}
+}
+
+p3FeedReaderDownloader::~p3FeedReaderDownloader()
+{
+	/* the easy handles must be removed before the multi handle and the share are cleaned up */
+	while (!mTransfers.empty()) {
+		removeTransfer(mTransfers.begin()->second);
+	}
+
+	if (mMulti) {
+		curl_multi_cleanup(mMulti);
+	}
+
+	delete(mShare);
+}
+
+void p3FeedReaderDownloader::setMaxParallelDownloads(uint32_t maxParallelDownloads)
+{
+	mMaxParallelDownloads = maxParallelDownloads;
+	wakeup();
+}
+
+void p3FeedReaderDownloader::wakeup()
+{
+#if LIBCURL_VERSION_NUM >= 0x074400
+	/* curl_multi_wakeup needs curl 7.68.0, older versions wait for ACTIVE_WAIT_TIME_MS */
+	if (mMulti) {
+		curl_multi_wakeup(mMulti);
+	}
+#endif
+}
+
+/***************************************************************************/
+/****************************** Thread *************************************/
+/***************************************************************************/
+
+void p3FeedReaderDownloader::threadTick()
+{
+	if (!mMulti) {
+		rstime::rs_usleep(1000000);
+		return;
+	}
+
+	startDownloads();
+
+	int running = 0;
+	curl_multi_perform(mMulti, &running);
+
+	processFinishedTransfers();
+
+	/* wait for network activity, a curl timeout or a wakeup */
+#if LIBCURL_VERSION_NUM >= 0x074400
+	curl_multi_poll(mMulti, NULL, 0, IDLE_WAIT_TIME_MS, NULL);
+#else
+	if (mTransfers.empty()) {
+		/* curl_multi_wait returns immediately without handles */
+		rstime::rs_usleep(IDLE_WAIT_TIME_MS * 1000);
+	} else {
+		curl_multi_wait(mMulti, NULL, 0, ACTIVE_WAIT_TIME_MS, NULL);
+	}
+#endif
+}
+
+void p3FeedReaderDownloader::startDownloads()
+{
+	while (mTransfers.size() < mMaxParallelDownloads && isRunning()) {
+		RsFeedReaderFeed feed;
+		if (!mFeedReader->getFeedToDownload(feed, 0)) {
+			break;
+		}
+
+#ifdef FEEDREADER_DEBUG
+		std::cerr << "p3FeedReaderDownloader::startDownloads - feed " << feed.feedId << " (" << feed.name << ")" << std::endl;
+#endif
+
+		std::string proxy = p3FeedReaderThread::getProxyForFeed(mFeedReader, feed);
+		RsFeedReaderFeedTransfer *transfer = new RsFeedReaderFeedTransfer(feed, proxy, mShare->handle());
+		p3FeedReaderThread::setupConditionalRequest(transfer->wrapper, feed);
+
+		if (!transfer->wrapper.setupDownloadText(feed.url, transfer->content) ||
+		    curl_multi_add_handle(mMulti, transfer->wrapper.handle()) != CURLM_OK) {
+			mFeedReader->onDownloadError(feed.feedId, RS_FEED_ERRORSTATE_DOWNLOAD_ERROR, curl_easy_strerror(CURLE_FAILED_INIT));
+			delete(transfer);
+			continue;
+		}
+
+		mTransfers[transfer->wrapper.handle()] = transfer;
+	}
+}
+
+void p3FeedReaderDownloader::processFinishedTransfers()
+{
+	CURLMsg *msg;
+	int msgsInQueue;
+
+	while ((msg = curl_multi_info_read(mMulti, &msgsInQueue)) != NULL) {
+		if (msg->msg != CURLMSG_DONE) {
+			continue;
+		}
+
+		std::map<CURL*, RsFeedReaderFeedTransfer*>::iterator it = mTransfers.find(msg->easy_handle);
+		if (it == mTransfers.end()) {
+			continue;
+		}
+
+		RsFeedReaderFeedTransfer *transfer = it->second;
+		/* msg is invalid after the handle was removed */
+		CURLcode code = msg->data.result;
+
+		if (transfer->downloadingIcon) {
+			onIconDownloaded(transfer, code);
+		} else {
+			onFeedDownloaded(transfer, code);
+		}
+	}
+}
+
+void p3FeedReaderDownloader::onFeedDownloaded(RsFeedReaderFeedTransfer *transfer, CURLcode code)
+{
+	transfer->result = p3FeedReaderThread::checkFeedDownload(transfer->wrapper, code, transfer->errorString);
+
+	if (code != CURLE_OK) {
+		uint32_t feedId = transfer->feed.feedId;
+		RsFeedReaderErrorState result = transfer->result;
+		std::string errorString = transfer->errorString;
+
+		removeTransfer(transfer);
+
+		mFeedReader->onDownloadError(feedId, result, errorString);
+		return;
+	}
+
+	if (p3FeedReaderThread::isNotModified(transfer->wrapper, code)) {
+		uint32_t feedId = transfer->feed.feedId;
+
+		removeTransfer(transfer);
+
+		mFeedReader->onDownloadNotModified(feedId);
+		return;
+	}
+
+	/* the validators are overwritten by the favicon download */
+	transfer->etag = transfer->wrapper.etag();
+	transfer->lastModified = transfer->wrapper.lastModified();
+
+	if (!p3FeedReaderThread::needsFavicon(transfer->feed)) {
+		finishTransfer(transfer);
+		return;
+	}
+
+	/* download the favicon with the same handle, the connection to the host is still open */
+	CURL *handle = transfer->wrapper.handle();
+	curl_multi_remove_handle(mMulti, handle);
+
+	transfer->downloadingIcon = true;
+	if (!p3FeedReaderThread::setupFaviconDownload(transfer->wrapper, transfer->feed, transfer->iconData) ||
+	    curl_multi_add_handle(mMulti, handle) != CURLM_OK) {
+		onIconDownloaded(transfer, CURLE_FAILED_INIT);
+	}
+}
+
+void p3FeedReaderDownloader::onIconDownloaded(RsFeedReaderFeedTransfer *transfer, CURLcode code)
+{
+	p3FeedReaderThread::reportFaviconDownload(mFeedReader, transfer->feed.feedId, transfer->wrapper, code, transfer->iconData);
+
+	finishTransfer(transfer);
+}
+
+void p3FeedReaderDownloader::finishTransfer(RsFeedReaderFeedTransfer *transfer)
+{
+	uint32_t feedId = transfer->feed.feedId;
+	RsFeedReaderErrorState result = transfer->result;
+	std::string errorString = transfer->errorString;
+	std::string content;
+	content.swap(transfer->content);
+	std::string etag = transfer->etag;
+	std::string lastModified = transfer->lastModified;
+
+	removeTransfer(transfer);
+
+#ifdef FEEDREADER_DEBUG
+	std::cerr << "p3FeedReaderDownloader::finishTransfer - feed " << feedId << ", result " << result << ", error = " << errorString << std::endl;
+#endif
+
+	if (result == RS_FEED_ERRORSTATE_OK) {
+		/* trim */
+		XMLWrapper::trimString(content);
+
+		mFeedReader->onDownloadSuccess(feedId, content, etag, lastModified);
+	} else {
+		mFeedReader->onDownloadError(feedId, result, errorString);
+	}
+}
+
+void p3FeedReaderDownloader::removeTransfer(RsFeedReaderFeedTransfer *transfer)
+{
+	CURL *handle = transfer->wrapper.handle();
+
+	curl_multi_remove_handle(mMulti, handle);
+	mTransfers.erase(handle);
+
+	FEEDREADER_STATS_ADD(DOWNLOAD, transfer->startTime);
+
+	delete(transfer);
+}
@@ -0,0 +1,62 @@
+/*******************************************************************************
+ * plugins/FeedReader/services/p3FeedReaderDownloader.h                        *
+ *                                                                             *
+ * Copyright (C) 2012 by Thunder <retroshare.project@gmail.com>                *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+#ifndef P3_FEEDREADERDOWNLOADER
+#define P3_FEEDREADERDOWNLOADER
+
+#include "util/rsthreads.h"
+#include <map>
+#include <curl/curl.h>
+
+class p3FeedReader;
+class CURLShare;
+class RsFeedReaderFeedTransfer;
+
+/* Downloads the queued feeds of p3FeedReader concurrently with one curl multi handle.
+ * All handles share the DNS cache, TLS sessions and connections, so feeds of the same host reuse the connection. */
+class p3FeedReaderDownloader : public RsTickingThread
+{
+public:
+	p3FeedReaderDownloader(p3FeedReader *feedReader, uint32_t maxParallelDownloads);
+	virtual ~p3FeedReaderDownloader();
+
+	void setMaxParallelDownloads(uint32_t maxParallelDownloads);
+
+	/* called when new feeds are queued for download */
+	void wakeup();
+
+private:
+	virtual void threadTick() override; /// @see RsTickingThread
+
+	void startDownloads();
+	void processFinishedTransfers();
+	void onFeedDownloaded(RsFeedReaderFeedTransfer *transfer, CURLcode code);
+	void onIconDownloaded(RsFeedReaderFeedTransfer *transfer, CURLcode code);
+	void finishTransfer(RsFeedReaderFeedTransfer *transfer);
+	void removeTransfer(RsFeedReaderFeedTransfer *transfer);
+
+	p3FeedReader *mFeedReader;
+	CURLM *mMulti;
+	CURLShare *mShare;
+	std::map<CURL*, RsFeedReaderFeedTransfer*> mTransfers;
+	volatile uint32_t mMaxParallelDownloads;
+};
+
+#endif
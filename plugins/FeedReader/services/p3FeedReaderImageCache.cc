@@ -0,0 +1,240 @@
+/*******************************************************************************
+ * plugins/FeedReader/services/p3FeedReaderImageCache.cc                       *
+ *                                                                             *
+ * Copyright (C) 2012 by Thunder <retroshare.project@gmail.com>                *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+#include "p3FeedReaderImageCache.h"
+#include "util/rsdir.h"
+#include "util/folderiterator.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <set>
+#include <list>
+
+#define ENTRY_SUFFIX ".entry"
+
+/*********
+ * #define FEEDREADER_DEBUG
+ *********/
+
+p3FeedReaderImageCache::p3FeedReaderImageCache(const std::string &directory)
+	: mImageCacheMtx("p3FeedReaderImageCache"), mDirectory(directory)
+{
+	mDirectoryChecked = false;
+}
+
+bool p3FeedReaderImageCache::checkDirectory_locked()
+{
+	if (!mDirectoryChecked) {
+		mDirectoryChecked = RsDirUtil::checkCreateDirectory(mDirectory);
+	}
+
+	return mDirectoryChecked;
+}
+
+std::string p3FeedReaderImageCache::entryPath(const std::string &link)
+{
+	return mDirectory + "/" + RsDirUtil::sha1sum((const unsigned char*) link.c_str(), link.size()).toStdString() + ENTRY_SUFFIX;
+}
+
+std::string p3FeedReaderImageCache::dataPath(const std::string &contentHash)
+{
+	return mDirectory + "/" + contentHash;
+}
+
+static bool readLine(FILE *file, std::string &line)
+{
+	line.clear();
+
+	char buffer[1024];
+	while (fgets(buffer, sizeof(buffer), file)) {
+		line += buffer;
+		if (!line.empty() && line[line.size() - 1] == '\n') {
+			line.erase(line.size() - 1);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool p3FeedReaderImageCache::readEntry(const std::string &path, Image &image)
+{
+	FILE *file = RsDirUtil::rs_fopen(path.c_str(), "r");
+	if (!file) {
+		return false;
+	}
+
+	std::string fetchTime;
+	bool ok = readLine(file, image.contentType) &&
+	          readLine(file, image.etag) &&
+	          readLine(file, image.lastModified) &&
+	          readLine(file, image.contentHash) &&
+	          readLine(file, fetchTime);
+	fclose(file);
+
+	if (!ok || image.contentHash.empty()) {
+		return false;
+	}
+
+	long long value;
+	if (sscanf(fetchTime.c_str(), "%lld", &value) != 1) {
+		return false;
+	}
+	image.fetchTime = (time_t) value;
+
+	return true;
+}
+
+bool p3FeedReaderImageCache::get(const std::string &link, Image &image)
+{
+	RsStackMutex stack(mImageCacheMtx); /******* LOCK STACK MUTEX *********/
+
+	if (!checkDirectory_locked()) {
+		return false;
+	}
+
+	if (!readEntry(entryPath(link), image)) {
+		return false;
+	}
+
+	FILE *file = RsDirUtil::rs_fopen(dataPath(image.contentHash).c_str(), "rb");
+	if (!file) {
+		return false;
+	}
+
+	image.data.clear();
+
+	unsigned char buffer[16384];
+	size_t size;
+	while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		image.data.insert(image.data.end(), buffer, buffer + size);
+	}
+	bool ok = !ferror(file);
+	fclose(file);
+
+#ifdef FEEDREADER_DEBUG
+	std::cerr << "p3FeedReaderImageCache::get - " << link << " found, " << image.data.size() << " bytes" << std::endl;
+#endif
+
+	return ok;
+}
+
+void p3FeedReaderImageCache::put(const std::string &link, Image &image)
+{
+	image.contentHash = RsDirUtil::sha1sum(image.data.data(), image.data.size()).toStdString();
+	image.fetchTime = time(NULL);
+
+	RsStackMutex stack(mImageCacheMtx); /******* LOCK STACK MUTEX *********/
+
+	if (!checkDirectory_locked()) {
+		return;
+	}
+
+	/* the content is stored once for all links */
+	std::string path = dataPath(image.contentHash);
+	FILE *file = RsDirUtil::rs_fopen(path.c_str(), "rb");
+	if (file) {
+		fclose(file);
+	} else {
+		std::string tmpPath = path + ".tmp";
+		file = RsDirUtil::rs_fopen(tmpPath.c_str(), "wb");
+		if (!file) {
+			return;
+		}
+		bool ok = (fwrite(image.data.data(), 1, image.data.size(), file) == image.data.size());
+		ok = (fclose(file) == 0) && ok;
+
+		if (!ok || !RsDirUtil::renameFile(tmpPath, path)) {
+			remove(tmpPath.c_str());
+			return;
+		}
+	}
+
+	path = entryPath(link);
+	std::string tmpPath = path + ".tmp";
+	file = RsDirUtil::rs_fopen(tmpPath.c_str(), "w");
+	if (!file) {
+		return;
+	}
+	/* validators are single header lines */
+	bool ok = fprintf(file, "%s\n%s\n%s\n%s\n%lld\n", image.contentType.c_str(), image.etag.c_str(), image.lastModified.c_str(), image.contentHash.c_str(), (long long) image.fetchTime) > 0;
+	ok = (fclose(file) == 0) && ok;
+
+	if (!ok || !RsDirUtil::renameFile(tmpPath, path)) {
+		remove(tmpPath.c_str());
+	}
+}
+
+void p3FeedReaderImageCache::clean(time_t maxAge)
+{
+	RsStackMutex stack(mImageCacheMtx); /******* LOCK STACK MUTEX *********/
+
+	if (!checkDirectory_locked()) {
+		return;
+	}
+
+	time_t currentTime = time(NULL);
+	std::set<std::string> usedData;
+	std::list<std::string> dataFiles;
+#ifdef FEEDREADER_DEBUG
+	uint32_t removedEntries = 0;
+	uint32_t removedData = 0;
+#endif
+
+	/* first the entries, they tell which data is still used */
+	librs::util::FolderIterator dirIt(mDirectory, false);
+	for (; dirIt.isValid(); dirIt.next()) {
+		if (dirIt.file_type() != librs::util::FolderIterator::TYPE_FILE) {
+			continue;
+		}
+
+		const std::string &name = dirIt.file_name();
+		size_t suffixLength = strlen(ENTRY_SUFFIX);
+		if (name.size() <= suffixLength || name.compare(name.size() - suffixLength, suffixLength, ENTRY_SUFFIX) != 0) {
+			dataFiles.push_back(name);
+			continue;
+		}
+
+		Image image;
+		if (!readEntry(dirIt.file_fullpath(), image) || image.fetchTime < currentTime - maxAge) {
+			remove(dirIt.file_fullpath().c_str());
+#ifdef FEEDREADER_DEBUG
+			++removedEntries;
+#endif
+			continue;
+		}
+
+		usedData.insert(image.contentHash);
+	}
+
+	std::list<std::string>::iterator it;
+	for (it = dataFiles.begin(); it != dataFiles.end(); ++it) {
+		if (usedData.find(*it) == usedData.end()) {
+			remove(dataPath(*it).c_str());
+#ifdef FEEDREADER_DEBUG
+			++removedData;
+#endif
+		}
+	}
+
+#ifdef FEEDREADER_DEBUG
+	std::cerr << "p3FeedReaderImageCache::clean - removed " << removedEntries << " entries and " << removedData << " images" << std::endl;
+#endif
+}
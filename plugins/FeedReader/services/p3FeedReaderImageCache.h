@@ -0,0 +1,70 @@
+/*******************************************************************************
+ * plugins/FeedReader/services/p3FeedReaderImageCache.h                        *
+ *                                                                             *
+ * Copyright (C) 2012 by Thunder <retroshare.project@gmail.com>                *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+#ifndef P3_FEEDREADERIMAGECACHE
+#define P3_FEEDREADERIMAGECACHE
+
+#include "util/rsthreads.h"
+#include <string>
+#include <vector>
+#include <time.h>
+
+/* Disk cache of the images embedded in messages.
+ * Every link has a small entry with the validators of its last download and the hash of its content.
+ * The content is stored once per hash, so the same image behind different links is stored once. */
+class p3FeedReaderImageCache
+{
+public:
+	class Image
+	{
+	public:
+		Image() : fetchTime(0) {}
+
+		std::string contentType;
+		std::string etag;
+		std::string lastModified;
+		std::string contentHash;
+		time_t fetchTime;
+		std::vector<unsigned char> data;
+	};
+
+public:
+	p3FeedReaderImageCache(const std::string &directory);
+
+	/* returns false when the link is not cached */
+	bool get(const std::string &link, Image &image);
+	/* stores the data and the entry of the link, sets contentHash and fetchTime */
+	void put(const std::string &link, Image &image);
+
+	/* removes entries not downloaded during maxAge and the data no longer used */
+	void clean(time_t maxAge);
+
+private:
+	bool checkDirectory_locked();
+	std::string entryPath(const std::string &link);
+	std::string dataPath(const std::string &contentHash);
+	bool readEntry(const std::string &path, Image &image);
+
+	RsMutex mImageCacheMtx;
+	std::string mDirectory;
+	bool mDirectoryChecked;
+};
+
+#endif
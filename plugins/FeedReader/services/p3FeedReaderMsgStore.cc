@@ -0,0 +1,650 @@
+/*******************************************************************************
+ * plugins/FeedReader/services/p3FeedReaderMsgStore.cc                         *
+ *                                                                             *
+ * Copyright (C) 2012 by Thunder <retroshare.project@gmail.com>                *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+#include "p3FeedReaderMsgStore.h"
+#include "rsFeedReaderItems.h"
+#include "util/rsdir.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef WINDOWS_SYS
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+/* first bytes of a log */
+#define STORE_MAGIC            "RSFRMSG1"
+#define STORE_MAGIC_SIZE       8
+
+/* record = type (1 byte) + size of the payload (4 bytes, big endian) + payload */
+#define RECORD_HEADER_SIZE     5
+#define RECORD_MSG             'M' /* serialised RsFeedReaderMsg */
+#define RECORD_FLAG            'F' /* flag (4 bytes, big endian) + msgId */
+#define RECORD_REMOVE          'R' /* msgId */
+
+/* larger records are taken for a corrupted log */
+#define RECORD_MAX_SIZE        (64 * 1024 * 1024)
+
+/* a log is compacted when it has more than 2 * msgs + COMPACTION_SLACK records */
+#define COMPACTION_SLACK       100
+
+/*********
+ * #define FEEDREADER_DEBUG
+ *********/
+
+static void putUInt32(std::vector<uint8_t> &buffer, uint32_t value)
+{
+	buffer.push_back((value >> 24) & 0xff);
+	buffer.push_back((value >> 16) & 0xff);
+	buffer.push_back((value >> 8) & 0xff);
+	buffer.push_back(value & 0xff);
+}
+
+static uint32_t getUInt32(const uint8_t *data)
+{
+	return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | (uint32_t) data[3];
+}
+
+static bool serialiseMsg(RsFeedReaderMsg *msg, std::vector<uint8_t> &payload)
+{
+	RsFeedReaderSerialiser serialiser;
+
+	uint32_t size = serialiser.size(msg);
+	payload.resize(size);
+
+	if (!serialiser.serialise(msg, payload.data(), &size)) {
+		payload.clear();
+		return false;
+	}
+	payload.resize(size);
+
+	return true;
+}
+
+static RsFeedReaderMsg *deserialiseMsg(std::vector<uint8_t> &payload)
+{
+	RsFeedReaderSerialiser serialiser;
+
+	uint32_t size = payload.size();
+	RsItem *item = serialiser.deserialise(payload.data(), &size);
+	RsFeedReaderMsg *msg = dynamic_cast<RsFeedReaderMsg*>(item);
+	if (!msg) {
+		delete(item);
+	}
+
+	return msg;
+}
+
+static long fileSize(FILE *file)
+{
+	long position = ftell(file);
+	if (position < 0 || fseek(file, 0, SEEK_END) != 0) {
+		return -1;
+	}
+
+	long size = ftell(file);
+	fseek(file, position, SEEK_SET);
+
+	return size;
+}
+
+/* reads the record at the current position of a log of size bytes,
+ * returns false at the end of the log or for an incomplete or corrupted record */
+static bool readRecord(FILE *file, long size, uint8_t &type, std::vector<uint8_t> &payload)
+{
+	uint8_t header[RECORD_HEADER_SIZE];
+	if (fread(header, 1, RECORD_HEADER_SIZE, file) != RECORD_HEADER_SIZE) {
+		return false;
+	}
+
+	/* do not trust the size of the payload before allocating it */
+	uint32_t payloadSize = getUInt32(header + 1);
+	long position = ftell(file);
+	if (payloadSize > RECORD_MAX_SIZE || position < 0 || (long) payloadSize > size - position) {
+		return false;
+	}
+
+	type = header[0];
+	payload.resize(payloadSize);
+
+	return payload.empty() || fread(payload.data(), 1, payload.size(), file) == payload.size();
+}
+
+/* flushes the file and waits until it is on the disk */
+static bool syncFile(FILE *file)
+{
+	if (fflush(file) != 0) {
+		return false;
+	}
+
+#ifdef WINDOWS_SYS
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+static bool writeRecord(FILE *file, uint8_t type, const std::vector<uint8_t> &payload)
+{
+	std::vector<uint8_t> header;
+	header.push_back(type);
+	putUInt32(header, payload.size());
+
+	return fwrite(header.data(), 1, header.size(), file) == header.size() &&
+	       (payload.empty() || fwrite(payload.data(), 1, payload.size(), file) == payload.size());
+}
+
+p3FeedReaderMsgStore::p3FeedReaderMsgStore(const std::string &directory)
+	: mDirectory(directory), mStoreMtx("p3FeedReaderMsgStore"), mFileMtx("p3FeedReaderMsgStoreFile")
+{
+	mDirectoryChecked = false;
+}
+
+bool p3FeedReaderMsgStore::checkDirectory()
+{
+	if (!mDirectoryChecked) {
+		mDirectoryChecked = RsDirUtil::checkCreateDirectory(mDirectory);
+	}
+
+	return mDirectoryChecked;
+}
+
+std::string p3FeedReaderMsgStore::feedPath(uint32_t feedId)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/%u.msgs", feedId);
+
+	return mDirectory + name;
+}
+
+bool p3FeedReaderMsgStore::load(uint32_t feedId, std::list<RsFeedReaderMsg*> &msgs)
+{
+	RsStackMutex fileStack(mFileMtx); /******* LOCK STACK MUTEX *********/
+
+	{
+		RsStackMutex stack(mStoreMtx); /******* LOCK STACK MUTEX *********/
+
+		mLogs[feedId] = Log();
+	}
+
+	FILE *file = RsDirUtil::rs_fopen(feedPath(feedId).c_str(), "rb");
+	if (!file) {
+		/* no msgs stored */
+		return true;
+	}
+
+	char magic[STORE_MAGIC_SIZE];
+	if (fread(magic, 1, STORE_MAGIC_SIZE, file) != STORE_MAGIC_SIZE || memcmp(magic, STORE_MAGIC, STORE_MAGIC_SIZE) != 0) {
+		fclose(file);
+		std::cerr << "p3FeedReaderMsgStore::load - invalid log of feed " << feedId << std::endl;
+		return false;
+	}
+
+	std::map<std::string, RsFeedReaderMsg*> loadedMsgs;
+	std::map<std::string, RsFeedReaderMsg*>::iterator msgIt;
+	std::map<std::string, long> offsets;
+	uint32_t recordCount = 0;
+	uint8_t type;
+	std::vector<uint8_t> payload;
+
+	long size = fileSize(file);
+	long offset = ftell(file);
+	while (readRecord(file, size, type, payload)) {
+		++recordCount;
+
+		switch (type) {
+		case RECORD_MSG:
+			{
+				RsFeedReaderMsg *msg = deserialiseMsg(payload);
+				if (!msg) {
+					break;
+				}
+				msg->description.clear();
+				msg->descriptionTransformed.clear();
+				msg->stored = true;
+				offsets[msg->msgId] = offset;
+
+				msgIt = loadedMsgs.find(msg->msgId);
+				if (msgIt != loadedMsgs.end()) {
+					delete(msgIt->second);
+					msgIt->second = msg;
+				} else {
+					loadedMsgs[msg->msgId] = msg;
+				}
+			}
+			break;
+		case RECORD_FLAG:
+			if (payload.size() >= 4) {
+				msgIt = loadedMsgs.find(std::string(payload.begin() + 4, payload.end()));
+				if (msgIt != loadedMsgs.end()) {
+					msgIt->second->flag = getUInt32(payload.data());
+				}
+			}
+			break;
+		case RECORD_REMOVE:
+			msgIt = loadedMsgs.find(std::string(payload.begin(), payload.end()));
+			if (msgIt != loadedMsgs.end()) {
+				offsets.erase(msgIt->first);
+				delete(msgIt->second);
+				loadedMsgs.erase(msgIt);
+			}
+			break;
+		}
+
+		offset = ftell(file);
+	}
+
+	bool complete = (offset == size);
+	fclose(file);
+
+	if (!complete) {
+		/* incomplete or corrupted record, the rest of the log is ignored and the log is rewritten by the next compaction */
+		std::cerr << "p3FeedReaderMsgStore::load - incomplete log of feed " << feedId << std::endl;
+		recordCount = (uint32_t) -1;
+	}
+
+	{
+		RsStackMutex stack(mStoreMtx); /******* LOCK STACK MUTEX *********/
+
+		Log &log = mLogs[feedId];
+		log.offsets.swap(offsets);
+		log.recordCount = recordCount;
+	}
+
+	for (msgIt = loadedMsgs.begin(); msgIt != loadedMsgs.end(); ++msgIt) {
+		msgs.push_back(msgIt->second);
+	}
+
+#ifdef FEEDREADER_DEBUG
+	std::cerr << "p3FeedReaderMsgStore::load - feed " << feedId << ", " << msgs.size() << " msgs from " << recordCount << " records" << std::endl;
+#endif
+
+	return true;
+}
+
+void p3FeedReaderMsgStore::queueRecord(uint32_t feedId, uint8_t type, const std::string &msgId, std::vector<uint8_t> &payload)
+{
+	RsStackMutex stack(mStoreMtx); /******* LOCK STACK MUTEX *********/
+
+	Log &log = mLogs[feedId];
+	log.queue.push_back(Record());
+
+	Record &record = log.queue.back();
+	record.type = type;
+	record.msgId = msgId;
+	record.payload.swap(payload);
+}
+
+bool p3FeedReaderMsgStore::writeMsg(uint32_t feedId, RsFeedReaderMsg *msg)
+{
+	std::vector<uint8_t> payload;
+	if (!serialiseMsg(msg, payload)) {
+		std::cerr << "p3FeedReaderMsgStore::writeMsg - cannot serialise msg " << msg->msgId << " of feed " << feedId << std::endl;
+		return false;
+	}
+
+	queueRecord(feedId, RECORD_MSG, msg->msgId, payload);
+
+	msg->description.clear();
+	msg->descriptionTransformed.clear();
+	msg->stored = true;
+
+	return true;
+}
+
+void p3FeedReaderMsgStore::writeFlag(uint32_t feedId, const RsFeedReaderMsg *msg)
+{
+	std::vector<uint8_t> payload;
+	putUInt32(payload, msg->flag);
+	payload.insert(payload.end(), msg->msgId.begin(), msg->msgId.end());
+
+	queueRecord(feedId, RECORD_FLAG, msg->msgId, payload);
+}
+
+void p3FeedReaderMsgStore::writeRemove(uint32_t feedId, const std::string &msgId)
+{
+	std::vector<uint8_t> payload(msgId.begin(), msgId.end());
+
+	queueRecord(feedId, RECORD_REMOVE, msgId, payload);
+}
+
+void p3FeedReaderMsgStore::removeFeed(uint32_t feedId)
+{
+	RsStackMutex stack(mStoreMtx); /******* LOCK STACK MUTEX *********/
+
+	Log &log = mLogs[feedId];
+	log.queue.clear();
+	log.removed = true;
+}
+
+bool p3FeedReaderMsgStore::flush(bool sync)
+{
+	RsStackMutex fileStack(mFileMtx); /******* LOCK STACK MUTEX *********/
+
+	return flush_locked(sync);
+}
+
+bool p3FeedReaderMsgStore::flush_locked(bool sync)
+{
+	/* take the queues, the writes go on while they are written */
+	std::map<uint32_t, Log> pending;
+	std::map<uint32_t, Log>::iterator logIt;
+	{
+		RsStackMutex stack(mStoreMtx); /******* LOCK STACK MUTEX *********/
+
+		for (logIt = mLogs.begin(); logIt != mLogs.end(); ++logIt) {
+			if (logIt->second.removed || !logIt->second.queue.empty()) {
+				Log &log = pending[logIt->first];
+				log.queue.swap(logIt->second.queue);
+				log.removed = logIt->second.removed;
+				logIt->second.removed = false;
+			}
+		}
+	}
+
+	if (pending.empty()) {
+		return true;
+	}
+
+	if (!checkDirectory()) {
+		/* keep the records for the next try */
+		RsStackMutex stack(mStoreMtx); /******* LOCK STACK MUTEX *********/
+
+		for (logIt = pending.begin(); logIt != pending.end(); ++logIt) {
+			Log &log = mLogs[logIt->first];
+			log.queue.splice(log.queue.begin(), logIt->second.queue);
+			log.removed = log.removed || logIt->second.removed;
+		}
+		return false;
+	}
+
+	bool result = true;
+
+	for (logIt = pending.begin(); logIt != pending.end(); ++logIt) {
+		uint32_t feedId = logIt->first;
+		std::list<Record> &queue = logIt->second.queue;
+		std::string path = feedPath(feedId);
+
+		if (logIt->second.removed) {
+			remove(path.c_str());
+		}
+
+		std::list<long> offsets;
+		bool ok = true;
+
+		if (!queue.empty()) {
+			FILE *file = RsDirUtil::rs_fopen(path.c_str(), "ab");
+			ok = (file != NULL);
+
+			long position = 0;
+			if (ok) {
+				fseek(file, 0, SEEK_END);
+				position = ftell(file);
+				ok = (position >= 0);
+			}
+			if (ok && position == 0) {
+				ok = (fwrite(STORE_MAGIC, 1, STORE_MAGIC_SIZE, file) == STORE_MAGIC_SIZE);
+				position = STORE_MAGIC_SIZE;
+			}
+
+			std::list<Record>::iterator recordIt;
+			for (recordIt = queue.begin(); ok && recordIt != queue.end(); ++recordIt) {
+				offsets.push_back(position);
+				ok = writeRecord(file, recordIt->type, recordIt->payload);
+				position += RECORD_HEADER_SIZE + recordIt->payload.size();
+			}
+
+			if (file) {
+				ok = (fflush(file) == 0) && ok;
+				if (sync) {
+					ok = syncFile(file) && ok;
+				}
+				ok = (fclose(file) == 0) && ok;
+			}
+
+			if (!ok) {
+				std::cerr << "p3FeedReaderMsgStore::flush - cannot write log of feed " << feedId << std::endl;
+				result = false;
+			}
+		}
+
+		RsStackMutex stack(mStoreMtx); /******* LOCK STACK MUTEX *********/
+
+		Log &log = mLogs[feedId];
+		if (logIt->second.removed) {
+			log.offsets.clear();
+			log.recordCount = 0;
+		}
+
+		if (!ok) {
+			/* the records are lost, the msgs keep their previous records. The next compaction cleans the log. */
+			log.recordCount = (uint32_t) -1;
+			continue;
+		}
+
+		std::list<Record>::iterator recordIt;
+		std::list<long>::iterator offsetIt;
+		for (recordIt = queue.begin(), offsetIt = offsets.begin(); recordIt != queue.end(); ++recordIt, ++offsetIt) {
+			switch (recordIt->type) {
+			case RECORD_MSG:
+				log.offsets[recordIt->msgId] = *offsetIt;
+				break;
+			case RECORD_REMOVE:
+				log.offsets.erase(recordIt->msgId);
+				break;
+			}
+			if (log.recordCount != (uint32_t) -1) {
+				++log.recordCount;
+			}
+		}
+
+		if (logIt->second.removed && log.offsets.empty() && log.queue.empty() && !log.removed) {
+			/* feed removed */
+			mLogs.erase(feedId);
+		}
+	}
+
+	return result;
+}
+
+bool p3FeedReaderMsgStore::readMsg(FILE *file, long offset, RsFeedReaderMsg *&msg)
+{
+	msg = NULL;
+
+	uint8_t type;
+	std::vector<uint8_t> payload;
+	if (fseek(file, offset, SEEK_SET) == 0 && readRecord(file, fileSize(file), type, payload) && type == RECORD_MSG) {
+		msg = deserialiseMsg(payload);
+	}
+
+	return msg != NULL;
+}
+
+bool p3FeedReaderMsgStore::readDescriptions(uint32_t feedId, const std::string &msgId, std::string &description, std::string &descriptionTransformed)
+{
+	RsStackMutex fileStack(mFileMtx); /******* LOCK STACK MUTEX *********/
+
+	/* the record of the msg can still be queued */
+	flush_locked(false);
+
+	long offset = -1;
+	{
+		RsStackMutex stack(mStoreMtx); /******* LOCK STACK MUTEX *********/
+
+		std::map<uint32_t, Log>::iterator logIt = mLogs.find(feedId);
+		if (logIt != mLogs.end()) {
+			std::map<std::string, long>::iterator offsetIt = logIt->second.offsets.find(msgId);
+			if (offsetIt != logIt->second.offsets.end()) {
+				offset = offsetIt->second;
+			}
+		}
+	}
+
+	RsFeedReaderMsg *storedMsg = NULL;
+	FILE *file = (offset >= 0) ? RsDirUtil::rs_fopen(feedPath(feedId).c_str(), "rb") : NULL;
+	if (file) {
+		readMsg(file, offset, storedMsg);
+		fclose(file);
+	}
+
+	if (!storedMsg || storedMsg->msgId != msgId) {
+		std::cerr << "p3FeedReaderMsgStore::readDescriptions - cannot read msg " << msgId << " of feed " << feedId << std::endl;
+		delete(storedMsg);
+		return false;
+	}
+
+	description.swap(storedMsg->description);
+	descriptionTransformed.swap(storedMsg->descriptionTransformed);
+	delete(storedMsg);
+
+	return true;
+}
+
+bool p3FeedReaderMsgStore::needsCompaction(uint32_t feedId, uint32_t msgCount)
+{
+	RsStackMutex stack(mStoreMtx); /******* LOCK STACK MUTEX *********/
+
+	std::map<uint32_t, Log>::iterator it = mLogs.find(feedId);
+	if (it == mLogs.end()) {
+		return false;
+	}
+
+	return it->second.recordCount > 2 * msgCount + COMPACTION_SLACK;
+}
+
+bool p3FeedReaderMsgStore::compact(uint32_t feedId)
+{
+	RsStackMutex fileStack(mFileMtx); /******* LOCK STACK MUTEX *********/
+
+	/* the log is complete, the records queued from now on are written to the new log */
+	flush_locked(false);
+
+	std::string path = feedPath(feedId);
+	std::string tmpPath = path + ".tmp";
+
+	FILE *file = RsDirUtil::rs_fopen(path.c_str(), "rb");
+	if (!file) {
+		return false;
+	}
+
+	char magic[STORE_MAGIC_SIZE];
+	if (fread(magic, 1, STORE_MAGIC_SIZE, file) != STORE_MAGIC_SIZE || memcmp(magic, STORE_MAGIC, STORE_MAGIC_SIZE) != 0) {
+		fclose(file);
+		std::cerr << "p3FeedReaderMsgStore::compact - invalid log of feed " << feedId << std::endl;
+		return false;
+	}
+
+	/* replay the log: last complete record and flag of each msg */
+	struct CompactedMsg
+	{
+		long offset;
+		bool hasFlag;
+		uint32_t flag;
+	};
+	std::map<std::string, CompactedMsg> compactedMsgs;
+	std::map<std::string, CompactedMsg>::iterator msgIt;
+	uint8_t type;
+	std::vector<uint8_t> payload;
+
+	long size = fileSize(file);
+	long offset = ftell(file);
+	while (readRecord(file, size, type, payload)) {
+		switch (type) {
+		case RECORD_MSG:
+			{
+				RsFeedReaderMsg *msg = deserialiseMsg(payload);
+				if (!msg) {
+					break;
+				}
+				CompactedMsg &compactedMsg = compactedMsgs[msg->msgId];
+				compactedMsg.offset = offset;
+				compactedMsg.hasFlag = false;
+				compactedMsg.flag = 0;
+				delete(msg);
+			}
+			break;
+		case RECORD_FLAG:
+			if (payload.size() >= 4) {
+				msgIt = compactedMsgs.find(std::string(payload.begin() + 4, payload.end()));
+				if (msgIt != compactedMsgs.end()) {
+					msgIt->second.hasFlag = true;
+					msgIt->second.flag = getUInt32(payload.data());
+				}
+			}
+			break;
+		case RECORD_REMOVE:
+			compactedMsgs.erase(std::string(payload.begin(), payload.end()));
+			break;
+		}
+
+		offset = ftell(file);
+	}
+
+	FILE *tmpFile = RsDirUtil::rs_fopen(tmpPath.c_str(), "wb");
+	if (!tmpFile) {
+		fclose(file);
+		return false;
+	}
+
+	bool ok = (fwrite(STORE_MAGIC, 1, STORE_MAGIC_SIZE, tmpFile) == STORE_MAGIC_SIZE);
+
+	std::map<std::string, long> offsets;
+	for (msgIt = compactedMsgs.begin(); ok && msgIt != compactedMsgs.end(); ++msgIt) {
+		RsFeedReaderMsg *msg;
+		if (!readMsg(file, msgIt->second.offset, msg)) {
+			continue;
+		}
+		if (msgIt->second.hasFlag) {
+			msg->flag = msgIt->second.flag;
+		}
+
+		long position = ftell(tmpFile);
+		ok = serialiseMsg(msg, payload) && writeRecord(tmpFile, RECORD_MSG, payload);
+		offsets[msg->msgId] = position;
+		delete(msg);
+	}
+	fclose(file);
+
+	/* the new log must be on the disk before it replaces the old one */
+	ok = syncFile(tmpFile) && ok;
+	ok = (fclose(tmpFile) == 0) && ok;
+
+	if (!ok || !RsDirUtil::renameFile(tmpPath, path)) {
+		std::cerr << "p3FeedReaderMsgStore::compact - cannot write log of feed " << feedId << std::endl;
+		remove(tmpPath.c_str());
+		return false;
+	}
+
+	{
+		RsStackMutex stack(mStoreMtx); /******* LOCK STACK MUTEX *********/
+
+		Log &log = mLogs[feedId];
+		log.recordCount = offsets.size();
+		log.offsets.swap(offsets);
+	}
+
+#ifdef FEEDREADER_DEBUG
+	std::cerr << "p3FeedReaderMsgStore::compact - feed " << feedId << ", " << compactedMsgs.size() << " msgs" << std::endl;
+#endif
+
+	return true;
+}
@@ -0,0 +1,111 @@
+/*******************************************************************************
+ * plugins/FeedReader/services/p3FeedReaderMsgStore.h                          *
+ *                                                                             *
+ * Copyright (C) 2012 by Thunder <retroshare.project@gmail.com>                *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+#ifndef P3_FEEDREADERMSGSTORE
+#define P3_FEEDREADERMSGSTORE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <list>
+#include <map>
+#include <vector>
+
+#include "util/rsthreads.h"
+
+class RsFeedReaderMsg;
+
+/* Messages of the feeds, stored outside of the p3Config file.
+ *
+ * Every feed has an append-only log with three kinds of records:
+ *   - the complete msg, when it is added or its descriptions change
+ *   - the flags of a msg, when it is marked read/unread
+ *   - the removal of a msg
+ * so a change writes only the changed msg. The log is rewritten with one record per msg when it gets
+ * too long (compaction).
+ *
+ * The descriptions are not kept in memory, readDescriptions loads them on demand from the last complete
+ * record of the msg.
+ *
+ * The changes are called under the mutex of p3FeedReader, so that the records keep the order of the changes.
+ * They are only queued in memory; flush, readDescriptions and compact do the file I/O and are called
+ * without the mutex of p3FeedReader. */
+class p3FeedReaderMsgStore
+{
+public:
+	p3FeedReaderMsgStore(const std::string &directory);
+
+	/* reads the log of the feed, the msgs are returned without descriptions */
+	bool load(uint32_t feedId, std::list<RsFeedReaderMsg*> &msgs);
+
+	/* queues the complete msg, then releases its descriptions and sets msg->stored */
+	bool writeMsg(uint32_t feedId, RsFeedReaderMsg *msg);
+	void writeFlag(uint32_t feedId, const RsFeedReaderMsg *msg);
+	void writeRemove(uint32_t feedId, const std::string &msgId);
+	void removeFeed(uint32_t feedId);
+
+	/* writes the queued records, with sync they are on the disk when it returns */
+	bool flush(bool sync = false);
+
+	bool readDescriptions(uint32_t feedId, const std::string &msgId, std::string &description, std::string &descriptionTransformed);
+
+	bool needsCompaction(uint32_t feedId, uint32_t msgCount);
+	/* rewrites the log with one record per msg */
+	bool compact(uint32_t feedId);
+
+private:
+	struct Record
+	{
+		uint8_t type;
+		std::string msgId;
+		std::vector<uint8_t> payload;
+	};
+
+	struct Log
+	{
+		Log() : recordCount(0), removed(false) {}
+
+		/* last complete record of each msg in the file */
+		std::map<std::string, long> offsets;
+		uint32_t recordCount;
+
+		/* records not written yet, the file is removed before when the feed was removed */
+		std::list<Record> queue;
+		bool removed;
+	};
+
+	bool checkDirectory();
+	std::string feedPath(uint32_t feedId);
+	void queueRecord(uint32_t feedId, uint8_t type, const std::string &msgId, std::vector<uint8_t> &payload);
+	bool flush_locked(bool sync);
+	bool readMsg(FILE *file, long offset, RsFeedReaderMsg *&msg);
+
+	std::string mDirectory;
+	bool mDirectoryChecked;
+
+	/* protects mLogs, never held during file I/O */
+	RsMutex mStoreMtx;
+	std::map<uint32_t, Log> mLogs;
+
+	/* serialises the file I/O (mDirectoryChecked too), taken before mStoreMtx */
+	RsMutex mFileMtx;
+};
+
+#endif
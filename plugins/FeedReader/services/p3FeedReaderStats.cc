@@ -0,0 +1,122 @@
+/*******************************************************************************
+ * plugins/FeedReader/services/p3FeedReaderStats.cc                            *
+ *                                                                             *
+ * Copyright (C) 2012 by Thunder <retroshare.project@gmail.com>                *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+#include "p3FeedReaderStats.h"
+#include "util/rsthreads.h"
+
+/* bucket i counts the durations below 2^i microseconds */
+#define BUCKET_COUNT 40
+
+class StageData
+{
+public:
+	StageData() : count(0), totalUs(0), maxUs(0)
+	{
+		for (int i = 0; i < BUCKET_COUNT; ++i) {
+			buckets[i] = 0;
+		}
+	}
+
+	uint64_t count;
+	uint64_t totalUs;
+	uint64_t maxUs;
+	uint64_t buckets[BUCKET_COUNT];
+};
+
+static RsMutex statsMtx("p3FeedReaderStats");
+static StageData stageData[p3FeedReaderStats::STAGE_COUNT];
+
+static int bucketOf(uint64_t us)
+{
+	int bucket = 0;
+	while (bucket < BUCKET_COUNT - 1 && us >= (1ull << bucket)) {
+		++bucket;
+	}
+
+	return bucket;
+}
+
+static uint64_t percentile_locked(const StageData &data, uint32_t percent)
+{
+	uint64_t wanted = (data.count * percent + 99) / 100;
+	uint64_t count = 0;
+	for (int i = 0; i < BUCKET_COUNT; ++i) {
+		count += data.buckets[i];
+		if (count >= wanted) {
+			return 1ull << i;
+		}
+	}
+
+	return data.maxUs;
+}
+
+void p3FeedReaderStats::add(Stage stage, uint64_t us)
+{
+	RsStackMutex stack(statsMtx); /******* LOCK STACK MUTEX *********/
+
+	StageData &data = stageData[stage];
+	++data.count;
+	data.totalUs += us;
+	if (us > data.maxUs) {
+		data.maxUs = us;
+	}
+	++data.buckets[bucketOf(us)];
+}
+
+void p3FeedReaderStats::get(Stage stage, Summary &summary)
+{
+	RsStackMutex stack(statsMtx); /******* LOCK STACK MUTEX *********/
+
+	const StageData &data = stageData[stage];
+	summary.count = data.count;
+	summary.totalUs = data.totalUs;
+	summary.maxUs = data.maxUs;
+	summary.p50Us = data.count ? percentile_locked(data, 50) : 0;
+	summary.p99Us = data.count ? percentile_locked(data, 99) : 0;
+}
+
+void p3FeedReaderStats::reset()
+{
+	RsStackMutex stack(statsMtx); /******* LOCK STACK MUTEX *********/
+
+	for (int i = 0; i < STAGE_COUNT; ++i) {
+		stageData[i] = StageData();
+	}
+}
+
+const char *p3FeedReaderStats::name(Stage stage)
+{
+	switch (stage) {
+	case DOWNLOAD:
+		return "download";
+	case PROCESS:
+		return "process";
+	case PROCESS_MSG:
+		return "processMsg";
+	case ADD_MSGS:
+		return "onProcessSuccess_addMsgs";
+	case LOCK_HOLD:
+		return "mutex hold";
+	case STAGE_COUNT:
+		break;
+	}
+
+	return "";
+}
@@ -0,0 +1,87 @@
+/*******************************************************************************
+ * plugins/FeedReader/services/p3FeedReaderStats.h                             *
+ *                                                                             *
+ * Copyright (C) 2012 by Thunder <retroshare.project@gmail.com>                *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+#ifndef P3_FEEDREADERSTATS
+#define P3_FEEDREADERSTATS
+
+#include <stdint.h>
+#include <chrono>
+
+/* Durations of the stages of the download -> process -> store pipeline.
+ * They are only collected when FEEDREADER_STATS is defined (by the benchmark),
+ * otherwise the macros are empty. */
+class p3FeedReaderStats
+{
+public:
+	enum Stage
+	{
+		DOWNLOAD,      /* download of a feed with its favicon */
+		PROCESS,       /* p3FeedReaderThread::process */
+		PROCESS_MSG,   /* p3FeedReaderThread::processMsg */
+		ADD_MSGS,      /* p3FeedReader::onProcessSuccess_addMsgs */
+		LOCK_HOLD,     /* mFeedReaderMtx held by the pipeline */
+		STAGE_COUNT
+	};
+
+	class Summary
+	{
+	public:
+		Summary() : count(0), totalUs(0), maxUs(0), p50Us(0), p99Us(0) {}
+
+		uint64_t count;
+		uint64_t totalUs;
+		uint64_t maxUs;
+		/* upper bounds of the power of 2 buckets */
+		uint64_t p50Us;
+		uint64_t p99Us;
+	};
+
+	static uint64_t now()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static void add(Stage stage, uint64_t us);
+	static void get(Stage stage, Summary &summary);
+	static void reset();
+	static const char *name(Stage stage);
+};
+
+class p3FeedReaderStatsTimer
+{
+public:
+	p3FeedReaderStatsTimer(p3FeedReaderStats::Stage stage) : mStage(stage), mStart(p3FeedReaderStats::now()) {}
+	~p3FeedReaderStatsTimer() { p3FeedReaderStats::add(mStage, p3FeedReaderStats::now() - mStart); }
+
+private:
+	p3FeedReaderStats::Stage mStage;
+	uint64_t mStart;
+};
+
+#ifdef FEEDREADER_STATS
+/* measures until the end of the scope, put it behind the RsStackMutex to measure the hold time */
+#define FEEDREADER_STATS_TIME(stage) p3FeedReaderStatsTimer feedReaderStatsTimer##stage(p3FeedReaderStats::stage)
+#define FEEDREADER_STATS_ADD(stage, startTime) p3FeedReaderStats::add(p3FeedReaderStats::stage, p3FeedReaderStats::now() - (startTime))
+#else
+#define FEEDREADER_STATS_TIME(stage)
+#define FEEDREADER_STATS_ADD(stage, startTime)
+#endif
+
+#endif
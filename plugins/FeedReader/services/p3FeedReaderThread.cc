@@ -24,14 +24,24 @@
 #include "util/rstime.h"
 #include "util/CURLWrapper.h"
 #include "util/XMLWrapper.h"
+#include "util/XMLReaderWrapper.h"
 #include "util/HTMLWrapper.h"
 #include "util/XPathWrapper.h"
+#include "p3FeedReaderImageCache.h"
+#include "p3FeedReaderTransformation.h"
+#include "p3FeedReaderStats.h"
 
 #include <openssl/evp.h>
 #include <unistd.h> // for usleep
 
 enum FeedFormat { FORMAT_RSS, FORMAT_RDF, FORMAT_ATOM };
 
+/* images downloaded recently are used without asking the server */
+#define IMAGE_CACHE_FRESH_TIME (24 * 60 * 60) // 1 day
+#define FAVICON_UPDATE_INTERVAL (7 * 24 * 60 * 60) // 7 days
+/* known items in a row after which the rest of a feed is not parsed */
+#define STOP_KNOWN_ITEMS 3
+
 /*********
  * #define FEEDREADER_DEBUG
  *********/
@@ -51,25 +61,29 @@ p3FeedReaderThread::~p3FeedReaderThread()
 
 void p3FeedReaderThread::threadTick()
 {
-		rstime::rs_usleep(1000000);
-
-		/* every second */
-
 		switch (mType) {
 		case DOWNLOAD:
+			/* every second */
+			rstime::rs_usleep(1000000);
 			{
 				RsFeedReaderFeed feed;
 				if (mFeedReader->getFeedToDownload(feed, mFeedId)) {
+					bool notModified = false;
 					std::string content;
-					std::string icon;
+					std::string etag;
+					std::string lastModified;
 					std::string errorString;
 
-					RsFeedReaderErrorState result = download(feed, content, icon, errorString);
+					RsFeedReaderErrorState result = download(feed, notModified, content, etag, lastModified, errorString);
 					if (result == RS_FEED_ERRORSTATE_OK) {
-						/* trim */
-						XMLWrapper::trimString(content);
+						if (notModified) {
+							mFeedReader->onDownloadNotModified(feed.feedId);
+						} else {
+							/* trim */
+							XMLWrapper::trimString(content);
 
-						mFeedReader->onDownloadSuccess(feed.feedId, content, icon);
+							mFeedReader->onDownloadSuccess(feed.feedId, content, etag, lastModified);
+						}
 					} else {
 						mFeedReader->onDownloadError(feed.feedId, result, errorString);
 					}
@@ -80,6 +94,12 @@ void p3FeedReaderThread::threadTick()
 			{
 				RsFeedReaderFeed feed;
 				if (mFeedReader->getFeedToProcess(feed, mFeedId)) {
+					std::shared_ptr<p3FeedReaderTransformation> transformation;
+					if (!feed.preview) {
+						/* the preview transforms the msgs itself */
+						transformation = mFeedReader->getTransformation(feed.feedId);
+					}
+
 					std::list<RsFeedReaderMsg*> msgs;
 					std::string errorString;
 					std::list<RsFeedReaderMsg*>::iterator it;
@@ -96,7 +116,7 @@ void p3FeedReaderThread::threadTick()
 								}
 
 								RsFeedReaderMsg *mi = *it;
-								result = processMsg(feed, mi, errorString);
+								result = processMsg(feed, mi, transformation.get(), errorString);
 								if (result != RS_FEED_ERRORSTATE_OK) {
 									break;
 								}
@@ -115,10 +135,6 @@ void p3FeedReaderThread::threadTick()
 										delete (*it1);
 									}
 								} else {
-									result = processTransformation(feed, mi, errorString);
-									if (result != RS_FEED_ERRORSTATE_OK) {
-										break;
-									}
 									++it;
 								}
 							}
@@ -140,6 +156,9 @@ void p3FeedReaderThread::threadTick()
 						delete (*it);
 					}
 					msgs.clear();
+				} else {
+					/* nothing to do, look again in a second */
+					rstime::rs_usleep(1000000);
 				}
 			}
 			break;
@@ -234,14 +253,17 @@ static std::string calculateLink(const std::string &baseLink, const std::string
 	return resultLink;
 }
 
-static bool getFavicon(CURLWrapper &CURL, const std::string &url, std::string &icon)
+std::string p3FeedReaderThread::getFaviconLink(const std::string &url)
+{
+	return calculateLink(url, "/favicon.ico");
+}
+
+bool p3FeedReaderThread::checkFaviconDownload(CURLWrapper &CURL, CURLcode code, const std::vector<unsigned char> &vicon, std::string &icon)
 {
 	icon.clear();
 
 	bool result = false;
 
-	std::vector<unsigned char> vicon;
-	CURLcode code = CURL.downloadBinary(calculateLink(url, "/favicon.ico"), vicon);
 	if (code == CURLE_OK) {
 		if (CURL.responseCode() == 200) {
 			std::string contentType = CURL.contentType();
@@ -259,8 +281,58 @@ static bool getFavicon(CURLWrapper &CURL, const std::string &url, std::string &i
 	return result;
 }
 
-RsFeedReaderErrorState p3FeedReaderThread::download(const RsFeedReaderFeed &feed, std::string &content, std::string &icon, std::string &errorString)
+bool p3FeedReaderThread::needsFavicon(const RsFeedReaderFeed &feed)
+{
+	/* the icon rarely changes */
+	return feed.iconUpdate == 0 || feed.iconUpdate + FAVICON_UPDATE_INTERVAL <= time(NULL);
+}
+
+bool p3FeedReaderThread::setupFaviconDownload(CURLWrapper &CURL, const RsFeedReaderFeed &feed, std::vector<unsigned char> &vicon)
+{
+	if (!CURL.setupDownloadBinary(getFaviconLink(feed.url), vicon)) {
+		return false;
+	}
+
+	/* setupDownloadBinary resets the headers, so set them after it */
+	if (!feed.icon.empty()) {
+		CURL.setConditionalRequest(feed.iconEtag, feed.iconLastModified);
+	}
+
+	return true;
+}
+
+void p3FeedReaderThread::reportFaviconDownload(p3FeedReader *feedReader, uint32_t feedId, CURLWrapper &CURL, CURLcode code, const std::vector<unsigned char> &vicon)
 {
+	if (code != CURLE_OK) {
+		/* keep the icon and try again with the next download */
+		return;
+	}
+
+	bool notModified = isNotModified(CURL, code);
+	std::string icon;
+	if (!notModified && !checkFaviconDownload(CURL, code, vicon, icon)) {
+		/* error status, wrong content type or empty icon, keep the icon and its validators */
+		return;
+	}
+
+	feedReader->onFaviconDownloaded(feedId, notModified, icon, CURL.etag(), CURL.lastModified());
+}
+
+static void getFavicon(p3FeedReader *feedReader, CURLWrapper &CURL, const RsFeedReaderFeed &feed)
+{
+	std::vector<unsigned char> vicon;
+	CURLcode code = CURLE_FAILED_INIT;
+	if (p3FeedReaderThread::setupFaviconDownload(CURL, feed, vicon)) {
+		code = curl_easy_perform(CURL.handle());
+	}
+
+	p3FeedReaderThread::reportFaviconDownload(feedReader, feed.feedId, CURL, code, vicon);
+}
+
+RsFeedReaderErrorState p3FeedReaderThread::download(const RsFeedReaderFeed &feed, bool &notModified, std::string &content, std::string &etag, std::string &lastModified, std::string &errorString)
+{
+	FEEDREADER_STATS_TIME(DOWNLOAD);
+
 #ifdef FEEDREADER_DEBUG
 	std::cerr << "p3FeedReaderThread::download - feed " << feed.feedId << " (" << feed.name << ")" << std::endl;
 #endif
@@ -268,12 +340,47 @@ RsFeedReaderErrorState p3FeedReaderThread::download(const RsFeedReaderFeed &feed
 	content.clear();
 	errorString.clear();
 
-	RsFeedReaderErrorState result;
-
-	std::string proxy = getProxyForFeed(feed);
+	std::string proxy = getProxyForFeed(mFeedReader, feed);
 	CURLWrapper CURL(proxy);
+	setupConditionalRequest(CURL, feed);
 	CURLcode code = CURL.downloadText(feed.url, content);
 
+	RsFeedReaderErrorState result = checkFeedDownload(CURL, code, errorString);
+
+	notModified = isNotModified(CURL, code);
+	etag = CURL.etag();
+	lastModified = CURL.lastModified();
+
+	if (code == CURLE_OK && !notModified && needsFavicon(feed)) {
+		getFavicon(mFeedReader, CURL, feed);
+	}
+
+#ifdef FEEDREADER_DEBUG
+	std::cerr << "p3FeedReaderThread::download - feed " << feed.feedId << " (" << feed.name << "), result " << result << ", error = " << errorString << std::endl;
+#endif
+
+	return result;
+}
+
+void p3FeedReaderThread::setupConditionalRequest(CURLWrapper &CURL, const RsFeedReaderFeed &feed)
+{
+	/* download everything again after an error, the last content was not processed */
+	if (feed.preview || feed.errorState != RS_FEED_ERRORSTATE_OK) {
+		return;
+	}
+
+	CURL.setConditionalRequest(feed.etag, feed.lastModified);
+}
+
+bool p3FeedReaderThread::isNotModified(CURLWrapper &CURL, CURLcode code)
+{
+	return code == CURLE_OK && CURL.responseCode() == 304;
+}
+
+RsFeedReaderErrorState p3FeedReaderThread::checkFeedDownload(CURLWrapper &CURL, CURLcode code, std::string &errorString)
+{
+	RsFeedReaderErrorState result;
+
 	if (code == CURLE_OK) {
 		long responseCode = CURL.responseCode();
 
@@ -296,6 +403,10 @@ RsFeedReaderErrorState p3FeedReaderThread::download(const RsFeedReaderFeed &feed
 				}
 			}
 			break;
+		case 304:
+			/* not modified since the last download (conditional request) */
+			result = RS_FEED_ERRORSTATE_OK;
+			break;
 		case 404:
 			result = RS_FEED_ERRORSTATE_DOWNLOAD_NOT_FOUND;
 			break;
@@ -303,17 +414,11 @@ RsFeedReaderErrorState p3FeedReaderThread::download(const RsFeedReaderFeed &feed
 			result = RS_FEED_ERRORSTATE_DOWNLOAD_UNKOWN_RESPONSE_CODE;
 			rs_sprintf(errorString, "%ld", responseCode);
 		}
-
-		getFavicon(CURL, feed.url, icon);
 	} else {
 		result = RS_FEED_ERRORSTATE_DOWNLOAD_ERROR;
 		errorString = curl_easy_strerror(code);
 	}
 
-#ifdef FEEDREADER_DEBUG
-	std::cerr << "p3FeedReaderThread::download - feed " << feed.feedId << " (" << feed.name << "), result " << result << ", error = " << errorString << std::endl;
-#endif
-
 	return result;
 }
 
@@ -321,36 +426,6 @@ RsFeedReaderErrorState p3FeedReaderThread::download(const RsFeedReaderFeed &feed
 /****************************** Process ************************************/
 /***************************************************************************/
 
-static xmlNodePtr getNextItem(FeedFormat feedFormat, xmlNodePtr channel, xmlNodePtr item)
-{
-	if (!channel) {
-		return NULL;
-	}
-
-	if (!item) {
-		switch (feedFormat) {
-		case FORMAT_RSS:
-		case FORMAT_ATOM:
-				item = channel->children;
-				break;
-		case FORMAT_RDF:
-				item = channel->next;
-				break;
-		default:
-				return NULL;
-		}
-	} else {
-		item = item->next;
-	}
-	for (; item; item = item->next) {
-		if (item->type == XML_ELEMENT_NODE && xmlStrcasecmp(item->name, (feedFormat == FORMAT_ATOM) ? BAD_CAST"entry" : BAD_CAST"item") == 0) {
-			break;
-		}
-	}
-
-	return item;
-}
-
 static void splitString(std::string s, std::vector<std::string> &v, const char d)
 {
 	v.clear();
@@ -806,177 +881,247 @@ static time_t parseISO8601Date(const std::string &pubDate)
 	return result;
 }
 
+static RsFeedReaderMsg *parseItem(XMLWrapper &xml, FeedFormat feedFormat, xmlNodePtr node, uint32_t feedId)
+{
+	std::string title;
+	if (!xml.getChildText(node, "title", title) || title.empty()) {
+		return NULL;
+	}
+
+	/* remove newlines */
+	std::string::size_type p;
+	while ((p = title.find_first_of("\r\n")) != std::string::npos) {
+		title.erase(p, 1);
+	}
+
+	RsFeedReaderMsg *item = new RsFeedReaderMsg();
+	item->msgId.clear(); // is calculated later
+	item->feedId = feedId;
+	item->title = title;
+
+	/* try feedburner:origLink */
+	if (!xml.getChildText(node, "origLink", item->link) || item->link.empty()) {
+		xml.getChildText(node, "link", item->link);
+		if (item->link.empty()) {
+			xmlNodePtr linkNode = xml.findNode(node->children, "link", true);
+			item->link = xml.getAttr(linkNode, "href");
+		}
+	}
+
+	// remove sid=
+	std::string linkUpper;
+	stringToUpperCase(item->link, linkUpper);
+	std::string::size_type sidStart = linkUpper.find("SID=");
+	if (sidStart != std::string::npos) {
+		std::string::size_type sidEnd1 = linkUpper.find(";", sidStart);
+		std::string::size_type sidEnd2 = linkUpper.find("#", sidStart);
+
+		if (sidEnd1 == std::string::npos) {
+			sidEnd1 = linkUpper.size();
+		}
+		if (sidEnd2 == std::string::npos) {
+			sidEnd2 = linkUpper.size();
+		}
+
+		if (sidStart > 0 && linkUpper[sidStart - 1] == '&') {
+			sidStart--;
+		}
+
+		std::string::size_type sidEnd = std::min(sidEnd1, sidEnd2);
+		item->link.erase(sidStart, sidEnd - sidStart);
+	}
+
+	if (feedFormat == FORMAT_ATOM) {
+		/* <author><name>...</name></author> */
+		xmlNodePtr author = xml.findNode(node->children, "author", false);
+		if (author) {
+			xml.getChildText(node, "name", item->author);
+		}
+	} else {
+		if (!xml.getChildText(node, "author", item->author)) {
+			xml.getChildText(node, "creator", item->author);
+		}
+	}
+
+	switch (feedFormat) {
+	case FORMAT_RSS:
+	case FORMAT_RDF:
+		/* try content:encoded */
+		if (!xml.getChildText(node, "encoded", item->description)) {
+			/* use description */
+			xml.getChildText(node, "description", item->description);
+		}
+		break;
+	case FORMAT_ATOM:
+		/* try content */
+		if (!xml.getChildText(node, "content", item->description)) {
+			/* use summary */
+			xml.getChildText(node, "summary", item->description);
+		}
+		break;
+	}
+
+	std::string pubDate;
+	if (xml.getChildText(node, "pubDate", pubDate)) {
+		item->pubDate = parseRFC822Date(pubDate);
+	}
+	if (xml.getChildText(node, "date", pubDate)) {
+		item->pubDate = parseISO8601Date (pubDate);
+	}
+	if (xml.getChildText(node, "updated", pubDate)) {
+		// atom
+		item->pubDate = parseISO8601Date (pubDate);
+	}
+
+	return item;
+}
+
 RsFeedReaderErrorState p3FeedReaderThread::process(const RsFeedReaderFeed &feed, std::list<RsFeedReaderMsg*> &entries, std::string &errorString)
 {
+	FEEDREADER_STATS_TIME(PROCESS);
+
 #ifdef FEEDREADER_DEBUG
 	std::cerr << "p3FeedReaderThread::process - feed " << feed.feedId << " (" << feed.name << ")" << std::endl;
 #endif
 
 	RsFeedReaderErrorState result = RS_FEED_ERRORSTATE_OK;
 
-	XMLWrapper xml;
-	if (xml.readXML(feed.content.c_str())) {
-		xmlNodePtr root = xml.getRootElement();
-		if (root) {
-			FeedFormat feedFormat;
-			if (xmlStrcasecmp(root->name, BAD_CAST"rss") == 0) {
-				feedFormat = FORMAT_RSS;
-			} else if (xmlStrcasecmp (root->name, BAD_CAST"rdf") == 0) {
-				feedFormat = FORMAT_RDF;
-			} else if (xmlStrcasecmp (root->name, BAD_CAST"feed") == 0) {
-				feedFormat = FORMAT_ATOM;
-			} else {
-				result = RS_FEED_ERRORSTATE_PROCESS_UNKNOWN_FORMAT;
-				errorString = "Only RSS, RDF or ATOM supported";
-			}
+	/* the feed is read as a stream, only one item at a time is expanded to a tree */
+	XMLReaderWrapper xml;
+	if (xml.open(feed.content.c_str(), feed.content.size()) && xml.nextElement()) {
+		FeedFormat feedFormat = FORMAT_RSS;
+		const xmlChar *rootName = xml.localName();
+		if (xmlStrcasecmp(rootName, BAD_CAST"rss") == 0) {
+			feedFormat = FORMAT_RSS;
+		} else if (xmlStrcasecmp(rootName, BAD_CAST"rdf") == 0) {
+			feedFormat = FORMAT_RDF;
+		} else if (xmlStrcasecmp(rootName, BAD_CAST"feed") == 0) {
+			feedFormat = FORMAT_ATOM;
+		} else {
+			result = RS_FEED_ERRORSTATE_PROCESS_UNKNOWN_FORMAT;
+			errorString = "Only RSS, RDF or ATOM supported";
+		}
 
-			if (result == RS_FEED_ERRORSTATE_OK) {
-				xmlNodePtr channel = NULL;
-				switch (feedFormat) {
-				case FORMAT_RSS:
-				case FORMAT_RDF:
-					channel = xml.findNode(root->children, "channel");
-					break;
-				case FORMAT_ATOM:
-					channel = root;
+		if (result == RS_FEED_ERRORSTATE_OK) {
+			/* rss/channel/item, rdf/channel + rdf/item, feed/entry */
+			const char *itemName = (feedFormat == FORMAT_ATOM) ? "entry" : "item";
+			int itemDepth = (feedFormat == FORMAT_RSS) ? 2 : 1;
+			int infoDepth = (feedFormat == FORMAT_ATOM) ? 1 : 2;
+			bool channelFound = (feedFormat == FORMAT_ATOM);
+			bool inChannel = channelFound;
+
+			bool readInfo = (feed.flag & RS_FEED_FLAG_INFO_FROM_FEED);
+			std::string title;
+			std::string description;
+
+			/* the feeds list the newest items first, the items behind the known items are known too.
+			 * Stop after STOP_KNOWN_ITEMS consecutive known items in descending date order, but only as long
+			 * as the dates show that order. The first item never counts, it can be pinned. */
+			bool newestFirst = !feed.preview;
+			time_t lastPubDate = 0;
+			int knownItems = 0;
+
+			while (xml.nextElement()) {
+				if (!isRunning()) {
 					break;
 				}
 
-				if (channel) {
-					/* import header info */
-					if (feed.flag & RS_FEED_FLAG_INFO_FROM_FEED) {
-						std::string title;
-						if (xml.getChildText(channel, "title", title) && !title.empty()) {
-							std::string::size_type p;
-							while ((p = title.find_first_of("\r\n")) != std::string::npos) {
-								title.erase(p, 1);
-							}
-							std::string description;
-							xml.getChildText(channel, (feedFormat == FORMAT_ATOM) ? "subtitle" : "description", description);
-							mFeedReader->setFeedInfo(feed.feedId, title, description);
-						}
-					}
-
-					/* process items */
-					xmlNodePtr node;
-					for (node = NULL; (node = getNextItem(feedFormat, channel, node)) != NULL; ) {
-						if (!isRunning()) {
-							break;
-						}
-
-						std::string title;
-						if (!xml.getChildText(node, "title", title) || title.empty()) {
-							continue;
-						}
+				int depth = xml.depth();
+				const xmlChar *name = xml.localName();
 
-						/* remove newlines */
-						std::string::size_type p;
-						while ((p = title.find_first_of("\r\n")) != std::string::npos) {
-							title.erase(p, 1);
-						}
-
-						RsFeedReaderMsg *item = new RsFeedReaderMsg();
-						item->msgId.clear(); // is calculated later
-						item->feedId = feed.feedId;
-						item->title = title;
-
-						/* try feedburner:origLink */
-						if (!xml.getChildText(node, "origLink", item->link) || item->link.empty()) {
-							xml.getChildText(node, "link", item->link);
-							if (item->link.empty()) {
-								xmlNodePtr linkNode = xml.findNode(node, "link", true);
-								item->link = xml.getAttr(linkNode, "href");
-							}
-						}
-
-						// remove sid=
-						std::string linkUpper;
-						stringToUpperCase(item->link, linkUpper);
-						std::string::size_type sidStart = linkUpper.find("SID=");
-						if (sidStart != std::string::npos) {
-							std::string::size_type sidEnd1 = linkUpper.find(";", sidStart);
-							std::string::size_type sidEnd2 = linkUpper.find("#", sidStart);
-
-							if (sidEnd1 == std::string::npos) {
-								sidEnd1 = linkUpper.size();
-							}
-							if (sidEnd2 == std::string::npos) {
-								sidEnd2 = linkUpper.size();
-							}
+				if (depth == 1 && feedFormat != FORMAT_ATOM) {
+					/* only the first channel */
+					inChannel = !channelFound && xmlStrEqual(name, BAD_CAST"channel");
+					if (inChannel) {
+						channelFound = true;
+						continue;
+					}
+				}
 
-							if (sidStart > 0 && linkUpper[sidStart - 1] == '&') {
-								sidStart--;
-							}
+				if (depth == itemDepth && channelFound && (inChannel || feedFormat == FORMAT_RDF) && xmlStrcasecmp(name, BAD_CAST itemName) == 0) {
+					xmlNodePtr node = xml.expand();
+					if (!node) {
+						break;
+					}
 
-							std::string::size_type sidEnd = std::min(sidEnd1, sidEnd2);
-							item->link.erase(sidStart, sidEnd - sidStart);
-						}
+					RsFeedReaderMsg *item = parseItem(xml, feedFormat, node, feed.feedId);
+					if (!item) {
+						continue;
+					}
 
-						if (feedFormat == FORMAT_ATOM) {
-							/* <author><name>...</name></author> */
-							xmlNodePtr author = xml.findNode(node->children, "author", false);
-							if (author) {
-								xml.getChildText(node, "name", item->author);
-							}
-						} else {
-							if (!xml.getChildText(node, "author", item->author)) {
-								xml.getChildText(node, "creator", item->author);
-							}
-						}
+					if (item->pubDate == 0 || (lastPubDate && item->pubDate > lastPubDate)) {
+						newestFirst = false;
+					}
 
-						switch (feedFormat) {
-						case FORMAT_RSS:
-						case FORMAT_RDF:
-							/* try content:encoded */
-							if (!xml.getChildText(node, "encoded", item->description)) {
-								/* use description */
-								xml.getChildText(node, "description", item->description);
-							}
-							break;
-						case FORMAT_ATOM:
-							/* try content */
-							if (!xml.getChildText(node, "content", item->description)) {
-								/* use summary */
-								xml.getChildText(node, "summary", item->description);
-							}
+					if (newestFirst && lastPubDate && mFeedReader->isMsgKnown(feed.feedId, item)) {
+						if (++knownItems >= STOP_KNOWN_ITEMS) {
+#ifdef FEEDREADER_DEBUG
+							std::cerr << "p3FeedReaderThread::process - feed " << feed.feedId << " (" << feed.name << "), stop at known item " << item->title << std::endl;
+#endif
+							delete(item);
 							break;
 						}
+					} else {
+						knownItems = 0;
+					}
+					lastPubDate = item->pubDate;
 
-						std::string pubDate;
-						if (xml.getChildText(node, "pubDate", pubDate)) {
-							item->pubDate = parseRFC822Date(pubDate);
-						}
-						if (xml.getChildText(node, "date", pubDate)) {
-							item->pubDate = parseISO8601Date (pubDate);
-						}
-						if (xml.getChildText(node, "updated", pubDate)) {
-							// atom
-							item->pubDate = parseISO8601Date (pubDate);
-						}
+					if (item->pubDate == 0) {
+						/* use current time */
+						item->pubDate = time(NULL);
+					}
 
-						if (item->pubDate == 0) {
-							/* use current time */
-							item->pubDate = time(NULL);
-						}
+					entries.push_back(item);
+					continue;
+				}
 
-						entries.push_back(item);
+				if (readInfo && inChannel && depth == infoDepth) {
+					/* header info */
+					if (title.empty() && xmlStrEqual(name, BAD_CAST"title")) {
+						xml.getText(xml.expand(), title);
+						continue;
 					}
-				} else {
-					result = RS_FEED_ERRORSTATE_PROCESS_UNKNOWN_FORMAT;
-					errorString = "Channel not found";
+					if (description.empty() && xmlStrEqual(name, (feedFormat == FORMAT_ATOM) ? BAD_CAST"subtitle" : BAD_CAST"description")) {
+						xml.getText(xml.expand(), description);
+						continue;
+					}
+				}
+
+				if (depth > 0) {
+					/* not needed */
+					xml.skipElement();
+				}
+			}
+
+			if (xml.hasError()) {
+				xml.close();
+				result = RS_FEED_ERRORSTATE_PROCESS_INTERNAL_ERROR;
+				errorString = xml.lastError();
+			} else if (!channelFound) {
+				result = RS_FEED_ERRORSTATE_PROCESS_UNKNOWN_FORMAT;
+				errorString = "Channel not found";
+			} else if (!title.empty()) {
+				/* import header info */
+				std::string::size_type p;
+				while ((p = title.find_first_of("\r\n")) != std::string::npos) {
+					title.erase(p, 1);
 				}
+				mFeedReader->setFeedInfo(feed.feedId, title, description);
 			}
+		}
+	} else {
+		xml.close();
+		if (xml.hasError() || !xml.lastError().empty()) {
+			result = RS_FEED_ERRORSTATE_PROCESS_INTERNAL_ERROR;
+			errorString = xml.lastError();
 		} else {
 			result = RS_FEED_ERRORSTATE_PROCESS_UNKNOWN_FORMAT;
 			errorString = "Can't read document";
 		}
-	} else {
-		result = RS_FEED_ERRORSTATE_PROCESS_INTERNAL_ERROR;
-		errorString = xml.lastError();
 	}
 
 #ifdef FEEDREADER_DEBUG
-	std::cerr << "p3FeedReaderThread::process - feed " << feed.feedId << " (" << feed.name << "), result " << result << ", error = " << errorString << std::endl;
+	std::cerr << "p3FeedReaderThread::process - feed " << feed.feedId << " (" << feed.name << "), result " << result << ", " << entries.size() << " items, error = " << errorString << std::endl;
 	if (result == RS_FEED_ERRORSTATE_PROCESS_INTERNAL_ERROR) {
 		std::cerr << "  Error: " << errorString << std::endl;
 	}
@@ -985,13 +1130,13 @@ RsFeedReaderErrorState p3FeedReaderThread::process(const RsFeedReaderFeed &feed,
 	return result;
 }
 
-std::string p3FeedReaderThread::getProxyForFeed(const RsFeedReaderFeed &feed)
+std::string p3FeedReaderThread::getProxyForFeed(p3FeedReader *feedReader, const RsFeedReaderFeed &feed)
 {
 	std::string proxy;
 	if (feed.flag & RS_FEED_FLAG_STANDARD_PROXY) {
 		std::string standardProxyAddress;
 		uint16_t standardProxyPort;
-		if (mFeedReader->getStandardProxy(standardProxyAddress, standardProxyPort)) {
+		if (feedReader->getStandardProxy(standardProxyAddress, standardProxyPort)) {
 			rs_sprintf(proxy, "%s:%u", standardProxyAddress.c_str(), standardProxyPort);
 		}
 	} else {
@@ -1002,16 +1147,126 @@ std::string p3FeedReaderThread::getProxyForFeed(const RsFeedReaderFeed &feed)
 	return proxy;
 }
 
-RsFeedReaderErrorState p3FeedReaderThread::processMsg(const RsFeedReaderFeed &feed, RsFeedReaderMsg *msg, std::string &errorString)
+static bool imageToDataUrl(const std::string &contentType, const std::vector<unsigned char> &data, std::string &image)
+{
+	std::string base64;
+	if (!toBase64(data, base64)) {
+		return false;
+	}
+
+	rs_sprintf(image, "data:%s;base64,%s", contentType.c_str(), base64.c_str());
+	return true;
+}
+
+static bool isStopping(void *thread)
+{
+	return !((p3FeedReaderThread*) thread)->isRunning();
+}
+
+void p3FeedReaderThread::downloadImages(const RsFeedReaderFeed &feed, const std::string &proxy, const std::vector<std::string> &links, std::vector<std::string> &images)
+{
+	images.assign(links.size(), "");
+
+	if (links.empty() || !isRunning()) {
+		return;
+	}
+
+	p3FeedReaderImageCache *imageCache = mFeedReader->getImageCache();
+	time_t currentTime = time(NULL);
+
+	/* the share must outlive the handles */
+	CURLShare share;
+
+	std::vector<CURLWrapper*> wrappers;
+	std::vector<size_t> wrapperIndexes;
+	std::vector<p3FeedReaderImageCache::Image> cachedImages(links.size());
+	std::vector<std::vector<unsigned char> > data(links.size());
+	std::map<std::string, size_t> firstIndexes;
+
+	for (size_t index = 0; index < links.size(); ++index) {
+		if (!firstIndexes.insert(std::make_pair(links[index], index)).second) {
+			/* same link in the message, download it once */
+			continue;
+		}
+
+		p3FeedReaderImageCache::Image &cachedImage = cachedImages[index];
+		bool cached = imageCache->get(links[index], cachedImage);
+		if (cached && cachedImage.fetchTime + IMAGE_CACHE_FRESH_TIME > currentTime) {
+			/* recently downloaded, use it without asking the server */
+			imageToDataUrl(cachedImage.contentType, cachedImage.data, images[index]);
+			continue;
+		}
+
+#ifdef FEEDREADER_DEBUG
+		std::cerr << "p3FeedReaderThread::downloadImages - feed " << feed.feedId << " (" << feed.name << ") download image " << links[index] << std::endl;
+#endif
+
+		CURLWrapper *wrapper = new CURLWrapper(proxy, share.handle());
+		wrapper->setupDownloadBinary(links[index], data[index]);
+		if (cached) {
+			wrapper->setConditionalRequest(cachedImage.etag, cachedImage.lastModified);
+		} else {
+			cachedImage.data.clear();
+		}
+
+		wrappers.push_back(wrapper);
+		wrapperIndexes.push_back(index);
+	}
+
+	/* stopping the thread aborts the downloads */
+	std::vector<CURLcode> codes;
+	CURLWrapper::performParallel(wrappers, codes, isStopping, this);
+
+	for (size_t i = 0; i < wrappers.size(); ++i) {
+		CURLWrapper *wrapper = wrappers[i];
+		size_t index = wrapperIndexes[i];
+		p3FeedReaderImageCache::Image &cachedImage = cachedImages[index];
+
+		if (codes[i] == CURLE_OK) {
+			long responseCode = wrapper->responseCode();
+
+			if (responseCode == 304 && !cachedImage.data.empty()) {
+				/* not modified, store the new download time */
+				imageCache->put(links[index], cachedImage);
+				imageToDataUrl(cachedImage.contentType, cachedImage.data, images[index]);
+			} else if (responseCode == 200) {
+				std::string contentType = wrapper->contentType();
+				if (isContentType(contentType, "image/")) {
+					p3FeedReaderImageCache::Image image;
+					image.contentType = contentType;
+					image.etag = wrapper->etag();
+					image.lastModified = wrapper->lastModified();
+					image.data.swap(data[index]);
+
+					imageCache->put(links[index], image);
+					imageToDataUrl(image.contentType, image.data, images[index]);
+				}
+			}
+		}
+
+		delete(wrapper);
+	}
+
+	for (size_t index = 0; index < links.size(); ++index) {
+		size_t firstIndex = firstIndexes[links[index]];
+		if (firstIndex != index) {
+			images[index] = images[firstIndex];
+		}
+	}
+}
+
+RsFeedReaderErrorState p3FeedReaderThread::processMsg(const RsFeedReaderFeed &feed, RsFeedReaderMsg *msg, const p3FeedReaderTransformation *transformation, std::string &errorString)
 {
 	//long todo_fill_errorString;
 
+	FEEDREADER_STATS_TIME(PROCESS_MSG);
+
 	if (!msg) {
 		return RS_FEED_ERRORSTATE_PROCESS_INTERNAL_ERROR;
 	}
 
 	RsFeedReaderErrorState result = RS_FEED_ERRORSTATE_OK;
-	std::string proxy = getProxyForFeed(feed);
+	std::string proxy = getProxyForFeed(mFeedReader, feed);
 
 	std::string url;
 	if (feed.flag & RS_FEED_FLAG_SAVE_COMPLETE_PAGE) {
@@ -1176,49 +1431,42 @@ RsFeedReaderErrorState p3FeedReaderThread::processMsg(const RsFeedReaderFeed &fe
 					if (xpath) {
 						/* process images */
 						if (xpath->compile("//img")) {
+							std::vector<xmlNodePtr> imageNodes;
+							std::vector<std::string> imageLinks;
+
 							xpathCount = xpath->count();
 							for (xpathIndex = 0; xpathIndex < xpathCount; ++xpathIndex) {
-								if (!isRunning()) {
-									break;
-								}
 								xmlNodePtr node = xpath->node(xpathIndex);
 
 								if (node->type == XML_ELEMENT_NODE) {
-									bool removeImage = true;
-
+									std::string src;
 									if (feed.flag & RS_FEED_FLAG_EMBED_IMAGES) {
-										/* embed image */
-										std::string src = html.getAttr(node, "src");
-										if (!src.empty()) {
-											/* download image */
-#ifdef FEEDREADER_DEBUG
-											std::cerr << "p3FeedReaderThread::processHTML - feed " << feed.feedId << " (" << feed.name << ") download image " << src << std::endl;
-#endif
-											std::vector<unsigned char> data;
-											CURLWrapper CURL(proxy);
-											CURLcode code = CURL.downloadBinary(calculateLink(url, src), data);
-											if (code == CURLE_OK && CURL.responseCode() == 200) {
-												std::string contentType = CURL.contentType();
-												if (isContentType(contentType, "image/")) {
-													std::string base64;
-													if (toBase64(data, base64)) {
-														std::string imageBase64;
-														rs_sprintf(imageBase64, "data:%s;base64,%s", contentType.c_str(), base64.c_str());
-														if (html.setAttr(node, "src", imageBase64.c_str())) {
-															removeImage = false;
-														}
-													}
-												}
-											}
-										}
+										src = html.getAttr(node, "src");
 									}
 
-									if (removeImage) {
+									if (src.empty()) {
 										/* remove image */
 										xmlUnlinkNode(node);
 										nodesToDelete.push_back(node);
 										continue;
 									}
+
+									imageNodes.push_back(node);
+									imageLinks.push_back(calculateLink(url, src));
+								}
+							}
+
+							/* embed images, all images of the message are downloaded at once */
+							std::vector<std::string> images;
+							downloadImages(feed, proxy, imageLinks, images);
+
+							for (size_t imageIndex = 0; imageIndex < imageNodes.size(); ++imageIndex) {
+								xmlNodePtr node = imageNodes[imageIndex];
+
+								if (images[imageIndex].empty() || !html.setAttr(node, "src", images[imageIndex].c_str())) {
+									/* remove image */
+									xmlUnlinkNode(node);
+									nodesToDelete.push_back(node);
 								}
 							}
 						} else {
@@ -1251,6 +1499,24 @@ RsFeedReaderErrorState p3FeedReaderThread::processMsg(const RsFeedReaderFeed &fe
 						}
 					}
 				}
+
+				if (result == RS_FEED_ERRORSTATE_OK && transformation && !transformation->empty() && isRunning()) {
+					/* transform a copy of the parsed document instead of parsing the description again */
+					HTMLWrapper htmlTransformed;
+					htmlTransformed = html;
+
+					result = processTransformation(*transformation, htmlTransformed, errorString);
+					if (result == RS_FEED_ERRORSTATE_OK) {
+						if (htmlTransformed.saveHTML(msg->descriptionTransformed)) {
+							if (msg->descriptionTransformed == msg->description) {
+								msg->descriptionTransformed.clear();
+							}
+						} else {
+							errorString = htmlTransformed.lastError();
+							result = RS_FEED_ERRORSTATE_PROCESS_INTERNAL_ERROR;
+						}
+					}
+				}
 			} else {
 #ifdef FEEDREADER_DEBUG
 				std::cerr << "p3FeedReaderThread::processHTML - feed " << feed.feedId << " (" << feed.name << ") no root element" << std::endl;
@@ -1270,21 +1536,15 @@ RsFeedReaderErrorState p3FeedReaderThread::processMsg(const RsFeedReaderFeed &fe
 	return result;
 }
 
-RsFeedReaderErrorState p3FeedReaderThread::processTransformation(const RsFeedReaderFeed &feed, RsFeedReaderMsg *msg, std::string &errorString)
+RsFeedReaderErrorState p3FeedReaderThread::processTransformation(const p3FeedReaderTransformation &transformation, RsFeedReaderMsg *msg, std::string &errorString)
 {
 	RsFeedReaderErrorState result = RS_FEED_ERRORSTATE_OK;
 
-	switch (feed.transformationType) {
-	case RS_FEED_TRANSFORMATION_TYPE_NONE:
-		break;
-	case RS_FEED_TRANSFORMATION_TYPE_XPATH:
-		msg->descriptionTransformed = msg->description;
-		result = processXPath(feed.xpathsToUse.ids, feed.xpathsToRemove.ids, msg->descriptionTransformed, errorString);
-		break;
-	case RS_FEED_TRANSFORMATION_TYPE_XSLT:
+	if (transformation.type() != RS_FEED_TRANSFORMATION_TYPE_NONE) {
 		msg->descriptionTransformed = msg->description;
-		result = processXslt(feed.xslt, msg->descriptionTransformed, errorString);
-		break;
+		if (!transformation.empty()) {
+			result = processTransformation(transformation, msg->descriptionTransformed, errorString);
+		}
 	}
 
 	if (msg->descriptionTransformed == msg->description) {
@@ -1294,10 +1554,27 @@ RsFeedReaderErrorState p3FeedReaderThread::processTransformation(const RsFeedRea
 	return result;
 }
 
-RsFeedReaderErrorState p3FeedReaderThread::processXPath(const std::list<std::string> &xpathsToUse, const std::list<std::string> &xpathsToRemove, HTMLWrapper &html, std::string &errorString)
+RsFeedReaderErrorState p3FeedReaderThread::processTransformation(const p3FeedReaderTransformation &transformation, HTMLWrapper &html, std::string &errorString)
+{
+	switch (transformation.type()) {
+	case RS_FEED_TRANSFORMATION_TYPE_NONE:
+		break;
+	case RS_FEED_TRANSFORMATION_TYPE_XPATH:
+		return processXPath(transformation, html, errorString);
+	case RS_FEED_TRANSFORMATION_TYPE_XSLT:
+		return processXslt(transformation, html, errorString);
+	}
+
+	return RS_FEED_ERRORSTATE_OK;
+}
+
+RsFeedReaderErrorState p3FeedReaderThread::processXPath(const p3FeedReaderTransformation &transformation, HTMLWrapper &html, std::string &errorString)
 {
 #warning p3FeedReaderThread.cc TODO thunder2: fill_errorString;
 
+	const std::vector<p3FeedReaderTransformation::XPath> &xpathsToUse = transformation.xpathsToUse();
+	const std::vector<p3FeedReaderTransformation::XPath> &xpathsToRemove = transformation.xpathsToRemove();
+
 	if (xpathsToUse.empty() && xpathsToRemove.empty()) {
 		return RS_FEED_ERRORSTATE_OK;
 	}
@@ -1313,7 +1590,7 @@ RsFeedReaderErrorState p3FeedReaderThread::processXPath(const std::list<std::str
 
 	unsigned int xpathCount;
 	unsigned int xpathIndex;
-	std::list<std::string>::const_iterator xpathIt;
+	std::vector<p3FeedReaderTransformation::XPath>::const_iterator xpathIt;
 
 	if (!xpathsToUse.empty()) {
 		HTMLWrapper htmlNew;
@@ -1322,7 +1599,7 @@ RsFeedReaderErrorState p3FeedReaderThread::processXPath(const std::list<std::str
 			if (body) {
 				/* process use list */
 				for (xpathIt = xpathsToUse.begin(); xpathIt != xpathsToUse.end(); ++xpathIt) {
-					if (xpath->compile(xpathIt->c_str())) {
+					if (xpath->evaluate(xpathIt->compiled)) {
 						xpathCount = xpath->count();
 						if (xpathCount) {
 							for (xpathIndex = 0; xpathIndex < xpathCount; ++xpathIndex) {
@@ -1332,7 +1609,7 @@ RsFeedReaderErrorState p3FeedReaderThread::processXPath(const std::list<std::str
 							}
 						} else {
 							result = RS_FEED_ERRORSTATE_PROCESS_XPATH_NO_RESULT;
-							errorString = *xpathIt;
+							errorString = xpathIt->expression;
 							break;
 						}
 					} else {
@@ -1340,7 +1617,7 @@ RsFeedReaderErrorState p3FeedReaderThread::processXPath(const std::list<std::str
 #ifdef FEEDREADER_DEBUG
 						std::cerr << "p3FeedReaderThread::processXPath - unable to process xpath expression" << std::endl;
 #endif
-						errorString = *xpathIt;
+						errorString = xpathIt->expression;
 						result = RS_FEED_ERRORSTATE_PROCESS_XPATH_WRONG_EXPRESSION;
 					}
 				}
@@ -1361,7 +1638,7 @@ RsFeedReaderErrorState p3FeedReaderThread::processXPath(const std::list<std::str
 
 		/* process remove list */
 		for (xpathIt = xpathsToRemove.begin(); xpathIt != xpathsToRemove.end(); ++xpathIt) {
-			if (xpath->compile(xpathIt->c_str())) {
+			if (xpath->evaluate(xpathIt->compiled)) {
 				xpathCount = xpath->count();
 				if (xpathCount) {
 					for (xpathIndex = 0; xpathIndex < xpathCount; ++xpathIndex) {
@@ -1372,7 +1649,7 @@ RsFeedReaderErrorState p3FeedReaderThread::processXPath(const std::list<std::str
 					}
 				} else {
 					result = RS_FEED_ERRORSTATE_PROCESS_XPATH_NO_RESULT;
-					errorString = *xpathIt;
+					errorString = xpathIt->expression;
 					break;
 				}
 			} else {
@@ -1380,7 +1657,7 @@ RsFeedReaderErrorState p3FeedReaderThread::processXPath(const std::list<std::str
 #ifdef FEEDREADER_DEBUG
 				std::cerr << "p3FeedReaderThread::processXPath - unable to process xpath expression" << std::endl;
 #endif
-				errorString = *xpathIt;
+				errorString = xpathIt->expression;
 				result = RS_FEED_ERRORSTATE_PROCESS_XPATH_WRONG_EXPRESSION;
 				break;
 			}
@@ -1400,54 +1677,18 @@ RsFeedReaderErrorState p3FeedReaderThread::processXPath(const std::list<std::str
 
 RsFeedReaderErrorState p3FeedReaderThread::processXPath(const std::list<std::string> &xpathsToUse, const std::list<std::string> &xpathsToRemove, std::string &description, std::string &errorString)
 {
-	if (xpathsToUse.empty() && xpathsToRemove.empty()) {
+	p3FeedReaderTransformation transformation(RS_FEED_TRANSFORMATION_TYPE_XPATH, xpathsToUse, xpathsToRemove, "");
+	if (transformation.empty()) {
 		return RS_FEED_ERRORSTATE_OK;
 	}
 
-	RsFeedReaderErrorState result = RS_FEED_ERRORSTATE_OK;
-
-	/* process description */
-#warning p3FeedReaderThread.cc TODO thunder2: encoding
-	HTMLWrapper html;
-	if (html.readHTML(description.c_str(), "")) {
-		xmlNodePtr root = html.getRootElement();
-		if (root) {
-			result = processXPath(xpathsToUse, xpathsToRemove, html, errorString);
-
-			if (result == RS_FEED_ERRORSTATE_OK) {
-				if (!html.saveHTML(description)) {
-					errorString = html.lastError();
-#ifdef FEEDREADER_DEBUG
-					std::cerr << "p3FeedReaderThread::processXPath - cannot dump html" << std::endl;
-					std::cerr << "  Error: " << errorString << std::endl;
-#endif
-					result = RS_FEED_ERRORSTATE_PROCESS_INTERNAL_ERROR;
-				}
-			}
-		} else {
-#ifdef FEEDREADER_DEBUG
-			std::cerr << "p3FeedReaderThread::processXPath - no root element" << std::endl;
-#endif
-			errorString = "No root element found";
-			result = RS_FEED_ERRORSTATE_PROCESS_HTML_ERROR;
-		}
-	} else {
-		errorString = html.lastError();
-#ifdef FEEDREADER_DEBUG
-		std::cerr << "p3FeedReaderThread::processXPath - cannot read html" << std::endl;
-		std::cerr << "  Error: " << errorString << std::endl;
-#endif
-		result = RS_FEED_ERRORSTATE_PROCESS_HTML_ERROR;
-	}
-
-	return result;
+	return processTransformation(transformation, description, errorString);
 }
 
-RsFeedReaderErrorState p3FeedReaderThread::processXslt(const std::string &xslt, HTMLWrapper &html, std::string &errorString)
+RsFeedReaderErrorState p3FeedReaderThread::processXslt(const p3FeedReaderTransformation &transformation, HTMLWrapper &html, std::string &errorString)
 {
-	XMLWrapper style;
-	if (!style.readXML(xslt.c_str())) {
-		errorString = style.lastError();
+	xsltStylesheetPtr stylesheet = transformation.stylesheet(errorString);
+	if (!stylesheet) {
 #ifdef FEEDREADER_DEBUG
 		std::cerr << "p3FeedReaderThread::processXslt - error loading style" << std::endl;
 		std::cerr << "  Error: " << errorString << std::endl;
@@ -1456,7 +1697,7 @@ RsFeedReaderErrorState p3FeedReaderThread::processXslt(const std::string &xslt,
 	}
 
 	XMLWrapper xmlResult;
-	if (!html.transform(style, xmlResult)) {
+	if (!html.transform(stylesheet, xmlResult)) {
 		errorString = html.lastError();
 #ifdef FEEDREADER_DEBUG
 		std::cerr << "p3FeedReaderThread::processXslt - error transform" << std::endl;
@@ -1521,21 +1762,28 @@ RsFeedReaderErrorState p3FeedReaderThread::processXslt(const std::string &xslt,
 		return RS_FEED_ERRORSTATE_OK;
 	}
 
+	p3FeedReaderTransformation transformation(RS_FEED_TRANSFORMATION_TYPE_XSLT, std::list<std::string>(), std::list<std::string>(), xslt);
+
+	return processTransformation(transformation, description, errorString);
+}
+
+RsFeedReaderErrorState p3FeedReaderThread::processTransformation(const p3FeedReaderTransformation &transformation, std::string &description, std::string &errorString)
+{
 	RsFeedReaderErrorState result = RS_FEED_ERRORSTATE_OK;
 
 	/* process description */
-	//long todo; // encoding
+#warning p3FeedReaderThread.cc TODO thunder2: encoding
 	HTMLWrapper html;
 	if (html.readHTML(description.c_str(), "")) {
 		xmlNodePtr root = html.getRootElement();
 		if (root) {
-			result = processXslt(xslt, html, errorString);
+			result = processTransformation(transformation, html, errorString);
 
 			if (result == RS_FEED_ERRORSTATE_OK) {
 				if (!html.saveHTML(description)) {
 					errorString = html.lastError();
 #ifdef FEEDREADER_DEBUG
-					std::cerr << "p3FeedReaderThread::processXslt - cannot dump html" << std::endl;
+					std::cerr << "p3FeedReaderThread::processTransformation - cannot dump html" << std::endl;
 					std::cerr << "  Error: " << errorString << std::endl;
 #endif
 					result = RS_FEED_ERRORSTATE_PROCESS_INTERNAL_ERROR;
@@ -1543,7 +1791,7 @@ RsFeedReaderErrorState p3FeedReaderThread::processXslt(const std::string &xslt,
 			}
 		} else {
 #ifdef FEEDREADER_DEBUG
-			std::cerr << "p3FeedReaderThread::processXslt - no root element" << std::endl;
+			std::cerr << "p3FeedReaderThread::processTransformation - no root element" << std::endl;
 #endif
 			errorString = "No root element found";
 			result = RS_FEED_ERRORSTATE_PROCESS_HTML_ERROR;
@@ -1551,7 +1799,7 @@ RsFeedReaderErrorState p3FeedReaderThread::processXslt(const std::string &xslt,
 	} else {
 		errorString = html.lastError();
 #ifdef FEEDREADER_DEBUG
-		std::cerr << "p3FeedReaderThread::processXslt - cannot read html" << std::endl;
+		std::cerr << "p3FeedReaderThread::processTransformation - cannot read html" << std::endl;
 		std::cerr << "  Error: " << errorString << std::endl;
 #endif
 		result = RS_FEED_ERRORSTATE_PROCESS_HTML_ERROR;
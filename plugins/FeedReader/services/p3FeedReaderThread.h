@@ -25,12 +25,17 @@
 
 #include "util/rsthreads.h"
 #include <list>
+#include <vector>
+#include <memory>
+#include <curl/curl.h>
 
 class p3FeedReader;
 class RsFeedReaderFeed;
 class RsFeedReaderMsg;
 class HTMLWrapper;
 class RsFeedReaderXPath;
+class CURLWrapper;
+class p3FeedReaderTransformation;
 
 class p3FeedReaderThread : public RsTickingThread
 {
@@ -47,21 +52,37 @@ public:
 
 	uint32_t getFeedId() { return mFeedId; }
 
+	/* compile the expressions for every call, used by the preview */
 	static RsFeedReaderErrorState processXPath(const std::list<std::string> &xpathsToUse, const std::list<std::string> &xpathsToRemove, std::string &description, std::string &errorString);
-	static RsFeedReaderErrorState processXPath(const std::list<std::string> &xpathsToUse, const std::list<std::string> &xpathsToRemove, HTMLWrapper &html, std::string &errorString);
-
 	static RsFeedReaderErrorState processXslt(const std::string &xslt, std::string &description, std::string &errorString);
-	static RsFeedReaderErrorState processXslt(const std::string &xslt, HTMLWrapper &html, std::string &errorString);
 
-	static RsFeedReaderErrorState processTransformation(const RsFeedReaderFeed &feed, RsFeedReaderMsg *msg, std::string &errorString);
+	static RsFeedReaderErrorState processXPath(const p3FeedReaderTransformation &transformation, HTMLWrapper &html, std::string &errorString);
+	static RsFeedReaderErrorState processXslt(const p3FeedReaderTransformation &transformation, HTMLWrapper &html, std::string &errorString);
+
+	static RsFeedReaderErrorState processTransformation(const p3FeedReaderTransformation &transformation, RsFeedReaderMsg *msg, std::string &errorString);
+	static RsFeedReaderErrorState processTransformation(const p3FeedReaderTransformation &transformation, std::string &description, std::string &errorString);
+	static RsFeedReaderErrorState processTransformation(const p3FeedReaderTransformation &transformation, HTMLWrapper &html, std::string &errorString);
+
+	/* used by the download thread and by p3FeedReaderDownloader */
+	static std::string getProxyForFeed(p3FeedReader *feedReader, const RsFeedReaderFeed &feed);
+	static void setupConditionalRequest(CURLWrapper &CURL, const RsFeedReaderFeed &feed);
+	static bool isNotModified(CURLWrapper &CURL, CURLcode code);
+	static RsFeedReaderErrorState checkFeedDownload(CURLWrapper &CURL, CURLcode code, std::string &errorString);
+	static std::string getFaviconLink(const std::string &url);
+	static bool checkFaviconDownload(CURLWrapper &CURL, CURLcode code, const std::vector<unsigned char> &vicon, std::string &icon);
+	/* the favicon is downloaded again after some days, with the validators of the last download */
+	static bool needsFavicon(const RsFeedReaderFeed &feed);
+	static bool setupFaviconDownload(CURLWrapper &CURL, const RsFeedReaderFeed &feed, std::vector<unsigned char> &vicon);
+	static void reportFaviconDownload(p3FeedReader *feedReader, uint32_t feedId, CURLWrapper &CURL, CURLcode code, const std::vector<unsigned char> &vicon);
+
 private:
 	virtual void threadTick() override; /// @see RsTickingThread
 
-	RsFeedReaderErrorState download(const RsFeedReaderFeed &feed, std::string &content, std::string &icon, std::string &errorString);
+	RsFeedReaderErrorState download(const RsFeedReaderFeed &feed, bool &notModified, std::string &content, std::string &etag, std::string &lastModified, std::string &errorString);
 	RsFeedReaderErrorState process(const RsFeedReaderFeed &feed, std::list<RsFeedReaderMsg*> &entries, std::string &errorString);
 
-	std::string getProxyForFeed(const RsFeedReaderFeed &feed);
-	RsFeedReaderErrorState processMsg(const RsFeedReaderFeed &feed, RsFeedReaderMsg *msg, std::string &errorString);
+	RsFeedReaderErrorState processMsg(const RsFeedReaderFeed &feed, RsFeedReaderMsg *msg, const p3FeedReaderTransformation *transformation, std::string &errorString);
+	void downloadImages(const RsFeedReaderFeed &feed, const std::string &proxy, const std::vector<std::string> &links, std::vector<std::string> &images);
 
 	p3FeedReader *mFeedReader;
 	Type mType;
@@ -0,0 +1,153 @@
+/*******************************************************************************
+ * plugins/FeedReader/services/p3FeedReaderTransformation.cc                   *
+ *                                                                             *
+ * Copyright (C) 2012 by Thunder <retroshare.project@gmail.com>                *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+#include "p3FeedReaderTransformation.h"
+#include "rsFeedReaderItems.h"
+#include "util/XPathWrapper.h"
+
+/*********
+ * #define FEEDREADER_DEBUG
+ *********/
+
+p3FeedReaderTransformation::p3FeedReaderTransformation(RsFeedTransformationType type, const std::list<std::string> &xpathsToUse, const std::list<std::string> &xpathsToRemove, const std::string &xslt)
+	: mType(type), mXslt(xslt)
+{
+	init(xpathsToUse, xpathsToRemove);
+}
+
+p3FeedReaderTransformation::p3FeedReaderTransformation(const RsFeedReaderFeed &feed)
+	: mType(feed.transformationType), mXslt(feed.xslt)
+{
+	init(feed.xpathsToUse.ids, feed.xpathsToRemove.ids);
+}
+
+p3FeedReaderTransformation::~p3FeedReaderTransformation()
+{
+	std::vector<XPath>::iterator it;
+	for (it = mXPathsToUse.begin(); it != mXPathsToUse.end(); ++it) {
+		XPathWrapper::freeExpression(it->compiled);
+	}
+	for (it = mXPathsToRemove.begin(); it != mXPathsToRemove.end(); ++it) {
+		XPathWrapper::freeExpression(it->compiled);
+	}
+
+	/* before mStyle, the stylesheet uses its document */
+	XMLWrapper::freeStylesheet(mStylesheet);
+}
+
+void p3FeedReaderTransformation::init(const std::list<std::string> &xpathsToUse, const std::list<std::string> &xpathsToRemove)
+{
+	mStylesheet = NULL;
+
+	switch (mType) {
+	case RS_FEED_TRANSFORMATION_TYPE_NONE:
+		break;
+	case RS_FEED_TRANSFORMATION_TYPE_XPATH:
+		compileXPaths(xpathsToUse, mXPathsToUse);
+		compileXPaths(xpathsToRemove, mXPathsToRemove);
+		break;
+	case RS_FEED_TRANSFORMATION_TYPE_XSLT:
+		if (mXslt.empty()) {
+			break;
+		}
+		if (mStyle.readXML(mXslt.c_str())) {
+			mStylesheet = mStyle.parseStylesheet();
+		}
+		if (!mStylesheet) {
+			mStylesheetError = mStyle.lastError();
+#ifdef FEEDREADER_DEBUG
+			std::cerr << "p3FeedReaderTransformation::init - error loading style" << std::endl;
+			std::cerr << "  Error: " << mStylesheetError << std::endl;
+#endif
+		}
+		break;
+	}
+}
+
+void p3FeedReaderTransformation::compileXPaths(const std::list<std::string> &expressions, std::vector<XPath> &xpaths)
+{
+	xpaths.reserve(expressions.size());
+
+	std::list<std::string>::const_iterator it;
+	for (it = expressions.begin(); it != expressions.end(); ++it) {
+		XPath xpath;
+		xpath.expression = *it;
+		xpath.compiled = XPathWrapper::compileExpression(it->c_str());
+		xpaths.push_back(xpath);
+	}
+}
+
+bool p3FeedReaderTransformation::sameXPaths(const std::list<std::string> &expressions, const std::vector<XPath> &xpaths)
+{
+	if (expressions.size() != xpaths.size()) {
+		return false;
+	}
+
+	std::list<std::string>::const_iterator it;
+	std::vector<XPath>::const_iterator xpathIt;
+	for (it = expressions.begin(), xpathIt = xpaths.begin(); it != expressions.end(); ++it, ++xpathIt) {
+		if (*it != xpathIt->expression) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool p3FeedReaderTransformation::isFor(const RsFeedReaderFeed &feed) const
+{
+	if (feed.transformationType != mType) {
+		return false;
+	}
+
+	switch (mType) {
+	case RS_FEED_TRANSFORMATION_TYPE_NONE:
+		return true;
+	case RS_FEED_TRANSFORMATION_TYPE_XPATH:
+		return sameXPaths(feed.xpathsToUse.ids, mXPathsToUse) && sameXPaths(feed.xpathsToRemove.ids, mXPathsToRemove);
+	case RS_FEED_TRANSFORMATION_TYPE_XSLT:
+		return feed.xslt == mXslt;
+	}
+
+	return false;
+}
+
+bool p3FeedReaderTransformation::empty() const
+{
+	switch (mType) {
+	case RS_FEED_TRANSFORMATION_TYPE_NONE:
+		return true;
+	case RS_FEED_TRANSFORMATION_TYPE_XPATH:
+		return mXPathsToUse.empty() && mXPathsToRemove.empty();
+	case RS_FEED_TRANSFORMATION_TYPE_XSLT:
+		return mXslt.empty();
+	}
+
+	return true;
+}
+
+xsltStylesheetPtr p3FeedReaderTransformation::stylesheet(std::string &errorString) const
+{
+	if (!mStylesheet) {
+		errorString = mStylesheetError;
+	}
+
+	return mStylesheet;
+}
@@ -0,0 +1,79 @@
+/*******************************************************************************
+ * plugins/FeedReader/services/p3FeedReaderTransformation.h                    *
+ *                                                                             *
+ * Copyright (C) 2012 by Thunder <retroshare.project@gmail.com>                *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+#ifndef P3_FEEDREADERTRANSFORMATION
+#define P3_FEEDREADERTRANSFORMATION
+
+#include "interface/rsFeedReader.h"
+#include "util/XMLWrapper.h"
+
+#include <libxml/xpath.h>
+#include <list>
+#include <vector>
+#include <string>
+
+class RsFeedReaderFeed;
+
+/* Transformation of the descriptions of a feed with the xpath expressions and the xslt stylesheet compiled once.
+ * Compiled expressions and stylesheets are only read while they are applied, so one object can be used by
+ * several threads at the same time. */
+class p3FeedReaderTransformation
+{
+public:
+	class XPath
+	{
+	public:
+		std::string expression;
+		xmlXPathCompExprPtr compiled; // NULL when the expression is wrong
+	};
+
+public:
+	p3FeedReaderTransformation(RsFeedTransformationType type, const std::list<std::string> &xpathsToUse, const std::list<std::string> &xpathsToRemove, const std::string &xslt);
+	explicit p3FeedReaderTransformation(const RsFeedReaderFeed &feed);
+	~p3FeedReaderTransformation();
+
+	/* the transformation is compiled from the current settings of the feed */
+	bool isFor(const RsFeedReaderFeed &feed) const;
+
+	RsFeedTransformationType type() const { return mType; }
+	/* the transformation doesn't change the description */
+	bool empty() const;
+	const std::vector<XPath> &xpathsToUse() const { return mXPathsToUse; }
+	const std::vector<XPath> &xpathsToRemove() const { return mXPathsToRemove; }
+
+	/* NULL when the xslt can't be parsed, errorString is set */
+	xsltStylesheetPtr stylesheet(std::string &errorString) const;
+
+private:
+	void init(const std::list<std::string> &xpathsToUse, const std::list<std::string> &xpathsToRemove);
+	static void compileXPaths(const std::list<std::string> &expressions, std::vector<XPath> &xpaths);
+	static bool sameXPaths(const std::list<std::string> &expressions, const std::vector<XPath> &xpaths);
+
+	RsFeedTransformationType mType;
+	std::vector<XPath> mXPathsToUse;
+	std::vector<XPath> mXPathsToRemove;
+
+	std::string mXslt;
+	XMLWrapper mStyle;
+	xsltStylesheetPtr mStylesheet;
+	std::string mStylesheetError;
+};
+
+#endif
@@ -54,10 +54,22 @@ void RsFeedReaderFeed::clear()
 	xpathsToUse.ids.clear();
 	xpathsToRemove.ids.clear();
 	xslt.clear();
+	etag.clear();
+	lastModified.clear();
+	contentHash.clear();
+	iconEtag.clear();
+	iconLastModified.clear();
+	iconUpdate = 0;
 
 	preview = false;
 	workstate = WAITING;
 	content.clear();
+	nextUpdate = 0;
+	unchangedCount = 0;
+
+	msgCount = 0;
+	newCount = 0;
+	unreadCount = 0;
 }
 
 uint32_t RsFeedReaderSerialiser::sizeFeed(RsFeedReaderFeed *item)
@@ -85,6 +97,12 @@ uint32_t RsFeedReaderSerialiser::sizeFeed(RsFeedReaderFeed *item)
 	s += item->xpathsToUse.TlvSize();
 	s += item->xpathsToRemove.TlvSize();
 	s += GetTlvStringSize(item->xslt);
+	s += GetTlvStringSize(item->etag);
+	s += GetTlvStringSize(item->lastModified);
+	s += GetTlvStringSize(item->contentHash);
+	s += GetTlvStringSize(item->iconEtag);
+	s += GetTlvStringSize(item->iconLastModified);
+	s += sizeof(uint32_t); /* iconUpdate */
 
 	return s;
 }
@@ -108,7 +126,7 @@ bool RsFeedReaderSerialiser::serialiseFeed(RsFeedReaderFeed *item, void *data, u
 	offset += 8;
 
 	/* add values */
-	ok &= setRawUInt16(data, tlvsize, &offset, 2); /* version */
+	ok &= setRawUInt16(data, tlvsize, &offset, 4); /* version */
 	ok &= setRawUInt32(data, tlvsize, &offset, item->feedId);
 	ok &= setRawUInt32(data, tlvsize, &offset, item->parentId);
 	ok &= SetTlvString(data, tlvsize, &offset, TLV_TYPE_STR_LINK, item->url);
@@ -130,6 +148,12 @@ bool RsFeedReaderSerialiser::serialiseFeed(RsFeedReaderFeed *item, void *data, u
 	ok &= item->xpathsToUse.SetTlv(data, tlvsize, &offset);
 	ok &= item->xpathsToRemove.SetTlv(data, tlvsize, &offset);
 	ok &= SetTlvString(data, tlvsize, &offset, TLV_TYPE_STR_VALUE, item->xslt);
+	ok &= SetTlvString(data, tlvsize, &offset, TLV_TYPE_STR_VALUE, item->etag);
+	ok &= SetTlvString(data, tlvsize, &offset, TLV_TYPE_STR_VALUE, item->lastModified);
+	ok &= SetTlvString(data, tlvsize, &offset, TLV_TYPE_STR_VALUE, item->contentHash);
+	ok &= SetTlvString(data, tlvsize, &offset, TLV_TYPE_STR_VALUE, item->iconEtag);
+	ok &= SetTlvString(data, tlvsize, &offset, TLV_TYPE_STR_VALUE, item->iconLastModified);
+	ok &= setRawUInt32(data, tlvsize, &offset, item->iconUpdate);
 
 	if (offset != tlvsize)
 	{
@@ -225,6 +249,16 @@ RsFeedReaderFeed *RsFeedReaderSerialiser::deserialiseFeed(void *data, uint32_t *
 	if (version >= 1) {
 		ok &= GetTlvString(data, rssize, &offset, TLV_TYPE_STR_VALUE, item->xslt);
 	}
+	if (version >= 3) {
+		ok &= GetTlvString(data, rssize, &offset, TLV_TYPE_STR_VALUE, item->etag);
+		ok &= GetTlvString(data, rssize, &offset, TLV_TYPE_STR_VALUE, item->lastModified);
+		ok &= GetTlvString(data, rssize, &offset, TLV_TYPE_STR_VALUE, item->contentHash);
+	}
+	if (version >= 4) {
+		ok &= GetTlvString(data, rssize, &offset, TLV_TYPE_STR_VALUE, item->iconEtag);
+		ok &= GetTlvString(data, rssize, &offset, TLV_TYPE_STR_VALUE, item->iconLastModified);
+		ok &= getRawUInt32(data, rssize, &offset, (uint32_t*) &(item->iconUpdate));
+	}
 
 	if (version == 0)
 	{
@@ -268,6 +302,7 @@ void RsFeedReaderMsg::clear()
 	descriptionTransformed.clear();
 	pubDate = 0;
 	flag = 0;
+	stored = false;
 }
 
 std::ostream &RsFeedReaderMsg::print(std::ostream &out, uint16_t /*indent*/)
@@ -25,6 +25,8 @@
 #include "serialiser/rsserial.h"
 #include "serialiser/rstlvstring.h"
 
+#include <unordered_map>
+
 #include "p3FeedReader.h"
 
 const uint32_t CONFIG_TYPE_FEEDREADER = 0xf001; // is this correct?
@@ -86,12 +88,32 @@ public:
 	RsTlvStringSet           xpathsToRemove;
 	std::string              xslt;
 
+	/* validators of the last download, to skip unchanged feeds */
+	std::string              etag;
+	std::string              lastModified;
+	std::string              contentHash;
+
+	/* validators and time of the last download of the icon */
+	std::string              iconEtag;
+	std::string              iconLastModified;
+	time_t                   iconUpdate;
+
 	/* Not Serialised */
 	bool        preview;
 	WorkState   workstate;
 	std::string content;
+	/* time of the next download, 0 when the feed is not scheduled */
+	time_t      nextUpdate;
+	/* number of downloads without new content in a row */
+	uint32_t    unchangedCount;
 
 	std::map<std::string, RsFeedReaderMsg*> msgs;
+	/* msgs by digest of title, link and author, maintained by p3FeedReader::addMsg_locked/eraseMsg_locked */
+	std::unordered_multimap<size_t, RsFeedReaderMsg*> msgIndex;
+	/* counts of the not deleted msgs, maintained like msgIndex */
+	uint32_t    msgCount;
+	uint32_t    newCount;
+	uint32_t    unreadCount;
 };
 
 #define RS_FEEDMSG_FLAG_DELETED                   1
@@ -116,6 +138,10 @@ public:
 	std::string descriptionTransformed;
 	time_t      pubDate;
 	uint32_t    flag; // RS_FEEDMSG_FLAG_...
+
+	/* Not Serialised */
+	/* the descriptions are in the p3FeedReaderMsgStore, not in memory */
+	bool        stored;
 };
 
 class RsFeedReaderSerialiser: public RsSerialType
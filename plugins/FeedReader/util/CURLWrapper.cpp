@@ -20,17 +20,30 @@
 
 #include "CURLWrapper.h"
 #include <string.h>
+#include <map>
 
-CURLWrapper::CURLWrapper(const std::string &proxy)
+/* connections of performParallel */
+#define PARALLEL_MAX_HOST_CONNECTIONS  4
+#define PARALLEL_MAX_TOTAL_CONNECTIONS 8
+
+CURLWrapper::CURLWrapper(const std::string &proxy, CURLSH *share)
 {
+	mHeaders = NULL;
+
 	mCurl = curl_easy_init();
 	if (mCurl) {
+		if (share) {
+			curl_easy_setopt(mCurl, CURLOPT_SHARE, share);
+		}
+
 		curl_easy_setopt(mCurl, CURLOPT_NOPROGRESS, 0);
 //		curl_easy_setopt(mCurl, CURLOPT_PROGRESSFUNCTION, progressCallback);
 //		curl_easy_setopt(mCurl, CURLOPT_PROGRESSDATA, feedReader);
 		curl_easy_setopt(mCurl, CURLOPT_FOLLOWLOCATION, 1);
 		curl_easy_setopt(mCurl, CURLOPT_CONNECTTIMEOUT, 60);
 		curl_easy_setopt(mCurl, CURLOPT_TIMEOUT, 120);
+		curl_easy_setopt(mCurl, CURLOPT_HEADERFUNCTION, headerFunction);
+		curl_easy_setopt(mCurl, CURLOPT_HEADERDATA, this);
 
 		if (!proxy.empty()) {
 			curl_easy_setopt(mCurl, CURLOPT_PROXY, proxy.c_str());
@@ -43,6 +56,75 @@ CURLWrapper::~CURLWrapper()
 	if (mCurl) {
 		curl_easy_cleanup(mCurl);
 	}
+	if (mHeaders) {
+		curl_slist_free_all(mHeaders);
+	}
+}
+
+static bool isHeader(const std::string &line, const char *name, std::string &value)
+{
+	size_t length = strlen(name);
+	if (line.size() <= length || strncasecmp(line.c_str(), name, length) != 0 || line[length] != ':') {
+		return false;
+	}
+
+	size_t start = line.find_first_not_of(" \t", length + 1);
+	size_t end = line.find_last_not_of(" \t\r\n");
+	if (start == std::string::npos || end == std::string::npos || end < start) {
+		value.clear();
+	} else {
+		value = line.substr(start, end - start + 1);
+	}
+
+	return true;
+}
+
+size_t CURLWrapper::headerFunction(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+	CURLWrapper *wrapper = (CURLWrapper*) userdata;
+	std::string line(buffer, size * nitems);
+
+	if (line.compare(0, 5, "HTTP/") == 0) {
+		/* new response (redirect), forget the validators of the previous one */
+		wrapper->mETag.clear();
+		wrapper->mLastModified.clear();
+	} else if (!isHeader(line, "ETag", wrapper->mETag)) {
+		isHeader(line, "Last-Modified", wrapper->mLastModified);
+	}
+
+	return size * nitems;
+}
+
+void CURLWrapper::clearHeaders()
+{
+	mETag.clear();
+	mLastModified.clear();
+
+	if (mHeaders) {
+		curl_easy_setopt(mCurl, CURLOPT_HTTPHEADER, NULL);
+		curl_slist_free_all(mHeaders);
+		mHeaders = NULL;
+	}
+}
+
+void CURLWrapper::setConditionalRequest(const std::string &etag, const std::string &lastModified)
+{
+	if (!mCurl) {
+		return;
+	}
+
+	clearHeaders();
+
+	if (!etag.empty()) {
+		mHeaders = curl_slist_append(mHeaders, ("If-None-Match: " + etag).c_str());
+	}
+	if (!lastModified.empty()) {
+		mHeaders = curl_slist_append(mHeaders, ("If-Modified-Since: " + lastModified).c_str());
+	}
+
+	if (mHeaders) {
+		curl_easy_setopt(mCurl, CURLOPT_HTTPHEADER, mHeaders);
+	}
 }
 
 static size_t writeFunctionString (void *ptr, size_t size, size_t nmemb, void *stream)
@@ -53,12 +135,12 @@ static size_t writeFunctionString (void *ptr, size_t size, size_t nmemb, void *s
 	return nmemb * size;
 }
 
-CURLcode CURLWrapper::downloadText(const std::string &link, std::string &data)
+bool CURLWrapper::setupDownloadText(const std::string &link, std::string &data)
 {
 	data.clear();
 
 	if (!mCurl) {
-		return CURLE_FAILED_INIT;
+		return false;
 	}
 
 	curl_easy_setopt(mCurl, CURLOPT_URL, link.c_str());
@@ -66,35 +148,53 @@ CURLcode CURLWrapper::downloadText(const std::string &link, std::string &data)
 	curl_easy_setopt(mCurl, CURLOPT_WRITEDATA, &data);
 	curl_easy_setopt(mCurl, CURLOPT_SSL_VERIFYPEER, false);
 
+	return true;
+}
+
+CURLcode CURLWrapper::downloadText(const std::string &link, std::string &data)
+{
+	if (!setupDownloadText(link, data)) {
+		return CURLE_FAILED_INIT;
+	}
+
 	return curl_easy_perform(mCurl);
 }
 
 static size_t writeFunctionBinary (void *ptr, size_t size, size_t nmemb, void *stream)
 {
 	std::vector<unsigned char> *bytes = (std::vector<unsigned char>*) stream;
+	const unsigned char *newBytes = (const unsigned char*) ptr;
 
-	std::vector<unsigned char> newBytes;
-	newBytes.resize(size * nmemb);
-	memcpy(newBytes.data(), ptr, newBytes.size());
-
-	bytes->insert(bytes->end(), newBytes.begin(), newBytes.end());
+	bytes->insert(bytes->end(), newBytes, newBytes + size * nmemb);
 
 	return nmemb * size;
 }
 
-CURLcode CURLWrapper::downloadBinary(const std::string &link, std::vector<unsigned char> &data)
+bool CURLWrapper::setupDownloadBinary(const std::string &link, std::vector<unsigned char> &data)
 {
 	data.clear();
 
 	if (!mCurl) {
-		return CURLE_FAILED_INIT;
+		return false;
 	}
 
+	/* no conditional request for binary downloads */
+	clearHeaders();
+
 	curl_easy_setopt(mCurl, CURLOPT_NOPROGRESS, 1);
 	curl_easy_setopt(mCurl, CURLOPT_URL, link.c_str());
 	curl_easy_setopt(mCurl, CURLOPT_WRITEFUNCTION, writeFunctionBinary);
 	curl_easy_setopt(mCurl, CURLOPT_WRITEDATA, &data);
 
+	return true;
+}
+
+CURLcode CURLWrapper::downloadBinary(const std::string &link, std::vector<unsigned char> &data)
+{
+	if (!setupDownloadBinary(link, data)) {
+		return CURLE_FAILED_INIT;
+	}
+
 	return curl_easy_perform(mCurl);
 }
 
@@ -121,3 +221,81 @@ std::string CURLWrapper::stringInfo(CURLINFO info)
 
 	return value ? value : "";
 }
+
+void CURLWrapper::performParallel(const std::vector<CURLWrapper*> &wrappers, std::vector<CURLcode> &codes, bool (*stopFunction)(void *stopData), void *stopData)
+{
+	codes.assign(wrappers.size(), CURLE_FAILED_INIT);
+
+	CURLM *multi = curl_multi_init();
+	if (!multi) {
+		return;
+	}
+
+#if LIBCURL_VERSION_NUM >= 0x071e00
+	/* the remaining downloads wait for a free connection (needs curl 7.30.0) */
+	curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long) PARALLEL_MAX_HOST_CONNECTIONS);
+	curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long) PARALLEL_MAX_TOTAL_CONNECTIONS);
+#endif
+
+	std::map<CURL*, size_t> indexes;
+	for (size_t index = 0; index < wrappers.size(); ++index) {
+		CURL *curl = wrappers[index]->mCurl;
+		if (curl && curl_multi_add_handle(multi, curl) == CURLM_OK) {
+			indexes[curl] = index;
+			/* replaced when the download is finished */
+			codes[index] = CURLE_ABORTED_BY_CALLBACK;
+		}
+	}
+
+	int running = 0;
+	do {
+		if (stopFunction && stopFunction(stopData)) {
+			break;
+		}
+		if (curl_multi_perform(multi, &running) != CURLM_OK) {
+			break;
+		}
+		if (running) {
+			/* the timeout bounds the time until a stop is noticed */
+			curl_multi_wait(multi, NULL, 0, 1000, NULL);
+		}
+	} while (running);
+
+	CURLMsg *msg;
+	int msgsInQueue;
+	while ((msg = curl_multi_info_read(multi, &msgsInQueue)) != NULL) {
+		if (msg->msg == CURLMSG_DONE) {
+			std::map<CURL*, size_t>::iterator it = indexes.find(msg->easy_handle);
+			if (it != indexes.end()) {
+				codes[it->second] = msg->data.result;
+			}
+		}
+	}
+
+	std::map<CURL*, size_t>::iterator it;
+	for (it = indexes.begin(); it != indexes.end(); ++it) {
+		curl_multi_remove_handle(multi, it->first);
+	}
+	curl_multi_cleanup(multi);
+}
+
+CURLShare::CURLShare()
+{
+	/* no lock functions, the share must only be used by one thread */
+	mShare = curl_share_init();
+	if (mShare) {
+		curl_share_setopt(mShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(mShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+		/* shared connection cache needs curl 7.57.0 */
+		curl_share_setopt(mShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+	}
+}
+
+CURLShare::~CURLShare()
+{
+	if (mShare) {
+		curl_share_cleanup(mShare);
+	}
+}
@@ -28,22 +28,60 @@
 class CURLWrapper
 {
 public:
-	CURLWrapper(const std::string &proxy);
+	/* share can be used to share the DNS cache, TLS sessions and connections between handles (see CURLShare) */
+	CURLWrapper(const std::string &proxy, CURLSH *share = NULL);
 	~CURLWrapper();
 
 	CURLcode downloadText(const std::string &link, std::string &data);
 	CURLcode downloadBinary(const std::string &link, std::vector<unsigned char> &data);
 
+	/* prepare the download without performing it, for use with a multi handle */
+	bool setupDownloadText(const std::string &link, std::string &data);
+	bool setupDownloadBinary(const std::string &link, std::vector<unsigned char> &data);
+
+	/* send If-None-Match / If-Modified-Since with the next download, the server answers 304 when the content is unchanged.
+	 * setupDownloadBinary resets them, so call it after. */
+	void setConditionalRequest(const std::string &etag, const std::string &lastModified);
+
+	CURL *handle() { return mCurl; }
+
+	/* performs the prepared downloads concurrently and waits until all are finished.
+	 * When stopFunction returns true, the downloads are aborted and the unfinished ones get CURLE_ABORTED_BY_CALLBACK. */
+	static void performParallel(const std::vector<CURLWrapper*> &wrappers, std::vector<CURLcode> &codes, bool (*stopFunction)(void *stopData) = NULL, void *stopData = NULL);
+
 	long responseCode() { return longInfo(CURLINFO_RESPONSE_CODE); }
 	std::string contentType() { return stringInfo(CURLINFO_CONTENT_TYPE); }
 	std::string effectiveUrl() { return stringInfo(CURLINFO_EFFECTIVE_URL); }
+	/* validators of the last response */
+	const std::string &etag() { return mETag; }
+	const std::string &lastModified() { return mLastModified; }
 
 protected:
 	long longInfo(CURLINFO info);
 	std::string stringInfo(CURLINFO info);
 
 private:
+	static size_t headerFunction(char *buffer, size_t size, size_t nitems, void *userdata);
+	void clearHeaders();
+
 	CURL *mCurl;
+	struct curl_slist *mHeaders;
+	std::string mETag;
+	std::string mLastModified;
+};
+
+/* Data shared between CURLWrapper handles of one thread: DNS cache, TLS sessions and connections,
+ * so that several downloads from the same host need only one TCP and TLS handshake. */
+class CURLShare
+{
+public:
+	CURLShare();
+	~CURLShare();
+
+	CURLSH *handle() { return mShare; }
+
+private:
+	CURLSH *mShare;
 };
 
 #endif 
@@ -0,0 +1,127 @@
+/*******************************************************************************
+ * plugins/FeedReader/util/XMLReaderWrapper.cpp                                *
+ *                                                                             *
+ * Copyright (C) 2012 by Thunder <retroshare.project@gmail.com>                *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+#include "XMLReaderWrapper.h"
+
+XMLReaderWrapper::XMLReaderWrapper() : XMLWrapper()
+{
+	mReader = NULL;
+	mSkip = false;
+	mError = false;
+}
+
+XMLReaderWrapper::~XMLReaderWrapper()
+{
+	close();
+}
+
+bool XMLReaderWrapper::open(const char *xml, int size)
+{
+	close();
+	cleanup();
+
+	mSkip = false;
+	mError = false;
+
+	/* collect the errors until close */
+	handleError(true, mLastErrorString);
+	mReader = xmlReaderForMemory(xml, size, "", NULL, /*XML_PARSE_NOERROR | XML_PARSE_NOWARNING | */XML_PARSE_COMPACT | XML_PARSE_NOCDATA);
+	if (!mReader) {
+		handleError(false, mLastErrorString);
+		return false;
+	}
+
+	return true;
+}
+
+void XMLReaderWrapper::close()
+{
+	if (!mReader) {
+		return;
+	}
+
+	xmlFreeTextReader(mReader);
+	mReader = NULL;
+
+	handleError(false, mLastErrorString);
+}
+
+bool XMLReaderWrapper::nextElement()
+{
+	if (!mReader) {
+		return false;
+	}
+
+	int ret = mSkip ? xmlTextReaderNext(mReader) : xmlTextReaderRead(mReader);
+	mSkip = false;
+
+	while (ret == 1) {
+		if (xmlTextReaderNodeType(mReader) == XML_READER_TYPE_ELEMENT) {
+			return true;
+		}
+		ret = xmlTextReaderRead(mReader);
+	}
+
+	if (ret < 0) {
+		mError = true;
+	}
+
+	return false;
+}
+
+void XMLReaderWrapper::skipElement()
+{
+	mSkip = true;
+}
+
+int XMLReaderWrapper::depth()
+{
+	if (!mReader) {
+		return -1;
+	}
+
+	return xmlTextReaderDepth(mReader);
+}
+
+const xmlChar *XMLReaderWrapper::localName()
+{
+	if (!mReader) {
+		return NULL;
+	}
+
+	return xmlTextReaderConstLocalName(mReader);
+}
+
+xmlNodePtr XMLReaderWrapper::expand()
+{
+	if (!mReader) {
+		return NULL;
+	}
+
+	xmlNodePtr node = xmlTextReaderExpand(mReader);
+	if (!node) {
+		mError = true;
+	}
+
+	/* the reader moves behind the expanded element */
+	mSkip = true;
+
+	return node;
+}
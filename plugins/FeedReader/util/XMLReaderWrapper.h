@@ -0,0 +1,58 @@
+/*******************************************************************************
+ * plugins/FeedReader/util/XMLReaderWrapper.h                                  *
+ *                                                                             *
+ * Copyright (C) 2012 by Thunder <retroshare.project@gmail.com>                *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+#ifndef XMLREADERWRAPPER
+#define XMLREADERWRAPPER
+
+#include "XMLWrapper.h"
+#include <libxml/xmlreader.h>
+
+/* Pull parser for large documents. The document is never built completely,
+ * only the current element can be expanded to a tree with expand. The nodes
+ * can be used with the methods of XMLWrapper until the reader moves on. */
+class XMLReaderWrapper : public XMLWrapper
+{
+public:
+	XMLReaderWrapper();
+	~XMLReaderWrapper();
+
+	/* the text must stay valid until close */
+	bool open(const char *xml, int size);
+	void close();
+
+	/* moves to the start of the next element, returns false at the end or on an error */
+	bool nextElement();
+	/* the next call of nextElement does not enter the current element */
+	void skipElement();
+	bool hasError() { return mError; }
+
+	int depth();
+	/* name without namespace prefix */
+	const xmlChar *localName();
+	/* the current element with its children */
+	xmlNodePtr expand();
+
+private:
+	xmlTextReaderPtr mReader;
+	bool mSkip;
+	bool mError;
+};
+
+#endif
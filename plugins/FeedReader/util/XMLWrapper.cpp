@@ -29,8 +29,9 @@
 #include <libxslt/transform.h>
 #include <libxslt/xsltutils.h>
 
+/* the error function of libxslt is global, the one of libxml2 is per thread */
 static RsMutex xmlMtx("XMLWrapper");
-static std::string xmlErrorString;
+static thread_local std::string xmlErrorString;
 
 XMLWrapper::XMLWrapper()
 {
@@ -61,19 +62,29 @@ static void xmlErrorHandler(void */*context*/, const char *msg, ...)
 void XMLWrapper::handleError(bool init, std::string &errorString)
 {
 	if (init) {
-		xmlMtx.lock();
 		xmlErrorString.clear();
 		errorString.clear();
 
-		xsltSetGenericErrorFunc(this, xmlErrorHandler);
 		xmlSetGenericErrorFunc(this, xmlErrorHandler);
 	} else {
-		xsltSetGenericErrorFunc(NULL, NULL);
 		xmlSetGenericErrorFunc(NULL, NULL);
 
 		errorString = xmlErrorString;
 		xmlErrorString.clear();
+	}
+}
+
+void XMLWrapper::handleXsltError(bool init, std::string &errorString)
+{
+	if (init) {
+		xmlMtx.lock();
+		xsltSetGenericErrorFunc(this, xmlErrorHandler);
+
+		handleError(true, errorString);
+	} else {
+		handleError(false, errorString);
 
+		xsltSetGenericErrorFunc(NULL, NULL);
 		xmlMtx.unlock();
 	}
 }
@@ -235,11 +246,13 @@ bool XMLWrapper::nodeDump(xmlNodePtr node, std::string &content, bool trim)
 {
 	content.clear();
 
-	if (!mDocument) {
+	if (!node) {
 		return false;
 	}
 
-	if (!node) {
+	/* nodes of XMLReaderWrapper are not part of mDocument */
+	xmlDocPtr document = mDocument ? mDocument : node->doc;
+	if (!document) {
 		return false;
 	}
 
@@ -249,7 +262,7 @@ bool XMLWrapper::nodeDump(xmlNodePtr node, std::string &content, bool trim)
 	if (buffer) {
 		xmlOutputBufferPtr outputBuffer = xmlOutputBufferCreateBuffer(buffer, NULL);
 		if (outputBuffer) {
-			xmlNodeDumpOutput(outputBuffer, mDocument, node, 0, 0, "UTF8");
+			xmlNodeDumpOutput(outputBuffer, document, node, 0, 0, "UTF8");
 			xmlOutputBufferClose(outputBuffer);
 			outputBuffer = NULL;
 
@@ -327,17 +340,22 @@ bool XMLWrapper::getChildText(xmlNodePtr node, const char *childName, std::strin
 		return false;
 	}
 
-	if (child->type != XML_ELEMENT_NODE) {
+	return getText(child, text);
+}
+
+bool XMLWrapper::getText(xmlNodePtr node, std::string &text)
+{
+	if (node == NULL || node->type != XML_ELEMENT_NODE) {
 		return false;
 	}
 
-	if (!child->children) {
+	if (!node->children) {
 		return false;
 	}
 
-	if (getAttr(child, "type") == "xhtml") {
+	if (getAttr(node, "type") == "xhtml") {
 		/* search div */
-		xmlNodePtr div = findNode(child->children, "div", false);
+		xmlNodePtr div = findNode(node->children, "div", false);
 		if (!div) {
 			return false;
 		}
@@ -345,12 +363,12 @@ bool XMLWrapper::getChildText(xmlNodePtr node, const char *childName, std::strin
 		return nodeDump(div, text, true);
 	}
 
-	if (child->children->type != XML_TEXT_NODE) {
+	if (node->children->type != XML_TEXT_NODE) {
 		return false;
 	}
 
-	if (child->children->content) {
-		return convertToString(child->children->content, text);
+	if (node->children->content) {
+		return convertToString(node->children->content, text);
 	}
 
 	return true;
@@ -404,22 +422,53 @@ XPathWrapper *XMLWrapper::createXPath()
 	return NULL;
 }
 
-bool XMLWrapper::transform(const XMLWrapper &style, XMLWrapper &result)
+xsltStylesheetPtr XMLWrapper::parseStylesheet()
 {
-	handleError(true, mLastErrorString);
+	if (!mDocument) {
+		return NULL;
+	}
 
-	xmlDocPtr resultDoc = NULL;
+	handleXsltError(true, mLastErrorString);
+	xsltStylesheetPtr stylesheet = xsltParseStylesheetDoc(mDocument);
+	handleXsltError(false, mLastErrorString);
+
+	return stylesheet;
+}
 
-	xsltStylesheetPtr stylesheet = xsltParseStylesheetDoc(style.getDocument());
+void XMLWrapper::freeStylesheet(xsltStylesheetPtr stylesheet)
+{
 	if (stylesheet) {
-		resultDoc = xsltApplyStylesheet(stylesheet, getDocument(), NULL);
 		stylesheet->doc = NULL; // xsltFreeStylesheet is freeing doc
 		xsltFreeStylesheet(stylesheet);
 	}
+}
+
+bool XMLWrapper::transform(xsltStylesheetPtr stylesheet, XMLWrapper &result)
+{
+	handleXsltError(true, mLastErrorString);
+
+	xmlDocPtr resultDoc = NULL;
+	if (stylesheet) {
+		resultDoc = xsltApplyStylesheet(stylesheet, getDocument(), NULL);
+	}
 
 	result.attach(resultDoc);
 
-	handleError(false, mLastErrorString);
+	handleXsltError(false, mLastErrorString);
 
 	return resultDoc ? true : false;
 }
+
+bool XMLWrapper::transform(XMLWrapper &style, XMLWrapper &result)
+{
+	xsltStylesheetPtr stylesheet = style.parseStylesheet();
+	if (!stylesheet) {
+		mLastErrorString = style.lastError();
+		return false;
+	}
+
+	bool ok = transform(stylesheet, result);
+	freeStylesheet(stylesheet);
+
+	return ok;
+}
@@ -23,6 +23,7 @@
 
 #include <string>
 #include <libxml/parser.h>
+#include <libxslt/xsltInternals.h>
 
 class XPathWrapper;
 
@@ -53,6 +54,8 @@ public:
 
 	xmlNodePtr findNode(xmlNodePtr node, const char *name, bool children = false);
 	bool getChildText(xmlNodePtr node, const char *childName, std::string &text);
+	/* text of an element like <title>, used by getChildText */
+	bool getText(xmlNodePtr node, std::string &text);
 
 	bool getContent(xmlNodePtr node, std::string &content, bool trim);
 	bool setContent(xmlNodePtr node, const char *content);
@@ -65,11 +68,17 @@ public:
 
 	XPathWrapper *createXPath();
 
-	bool transform(const XMLWrapper &style, XMLWrapper &result);
+	bool transform(XMLWrapper &style, XMLWrapper &result);
+
+	/* the stylesheet uses the document, it can be applied several times and by several threads */
+	xsltStylesheetPtr parseStylesheet();
+	static void freeStylesheet(xsltStylesheetPtr stylesheet);
+	bool transform(xsltStylesheetPtr stylesheet, XMLWrapper &result);
 
 protected:
 	void attach(xmlDocPtr document);
 	void handleError(bool init, std::string &errorString);
+	void handleXsltError(bool init, std::string &errorString);
 
 protected:
 	xmlDocPtr mDocument;
@@ -70,6 +70,51 @@ bool XPathWrapper::compile(const char *expression)
 	return true;
 }
 
+bool XPathWrapper::evaluate(xmlXPathCompExprPtr expression)
+{
+	cleanup();
+
+	if (!expression) {
+		return false;
+	}
+
+	xmlDocPtr document = mXMLWrapper.getDocument();
+	if (!document) {
+		return false;
+	}
+
+	mContext = xmlXPathNewContext(document);
+	if (!mContext) {
+		cleanup();
+		return false;
+	}
+
+	mResult = xmlXPathCompiledEval(expression, mContext);
+
+	return true;
+}
+
+xmlXPathCompExprPtr XPathWrapper::compileExpression(const char *expression)
+{
+	XMLWrapper xml;
+
+	xmlChar *xmlExpression = NULL;
+	if (!xml.convertFromString(expression, xmlExpression)) {
+		return NULL;
+	}
+	xmlXPathCompExprPtr compiled = xmlXPathCompile(xmlExpression);
+	xmlFree(xmlExpression);
+
+	return compiled;
+}
+
+void XPathWrapper::freeExpression(xmlXPathCompExprPtr expression)
+{
+	if (expression) {
+		xmlXPathFreeCompExpr(expression);
+	}
+}
+
 xmlXPathObjectType XPathWrapper::type()
 {
 	if (mResult) {
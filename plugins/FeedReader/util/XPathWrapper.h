@@ -35,6 +35,11 @@ public:
 	void cleanup();
 
 	bool compile(const char *expression);
+	/* evaluates an expression of compileExpression, it can be used by several threads */
+	bool evaluate(xmlXPathCompExprPtr expression);
+
+	static xmlXPathCompExprPtr compileExpression(const char *expression);
+	static void freeExpression(xmlXPathCompExprPtr expression);
 
 	xmlXPathObjectType type();
 
@@ -86,11 +86,13 @@ SOURCES = VOIPPlugin.cpp               \
           gui/VOIPConfigPanel.cpp \
           services/p3VOIP.cc           \
           services/rsVOIPItems.cc      \
+          gui/AudioMixer.cpp           \
           gui/AudioStats.cpp           \
           gui/AudioWizard.cpp          \
           gui/SpeexProcessor.cpp       \
           gui/audiodevicehelper.cpp    \
           gui/VideoProcessor.cpp       \
+          gui/VideoConverter.cpp       \
           gui/QVideoDevice.cpp         \
           gui/VOIPChatWidgetHolder.cpp \
           gui/VOIPGUIHandler.cpp       \
@@ -101,12 +103,16 @@ SOURCES = VOIPPlugin.cpp               \
 HEADERS = VOIPPlugin.h                 \
           gui/VOIPConfigPanel.h \
           services/p3VOIP.h            \
+          services/VOIPChunkQueue.h    \
           services/rsVOIPItems.h       \
+          gui/AudioMixer.h             \
+          gui/AudioRingBuffer.h        \
           gui/AudioStats.h             \
           gui/AudioWizard.h            \
           gui/SpeexProcessor.h         \
           gui/audiodevicehelper.h      \
           gui/VideoProcessor.h         \
+          gui/VideoConverter.h         \
           gui/QVideoDevice.h           \
           gui/VOIPChatWidgetHolder.h   \
           gui/VOIPGUIHandler.h         \
@@ -0,0 +1,25 @@
+################################################################################
+# benchmarks.pro                                                               #
+# Copyright (C) 2018, Retroshare team <retroshare.team@gmailcom>               #
+#                                                                              #
+# This program is free software: you can redistribute it and/or modify         #
+# it under the terms of the GNU Affero General Public License as               #
+# published by the Free Software Foundation, either version 3 of the           #
+# License, or (at your option) any later version.                              #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU Affero General Public License for more details.                          #
+#                                                                              #
+# You should have received a copy of the GNU Affero General Public License     #
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.       #
+################################################################################
+
+TEMPLATE = subdirs
+
+SUBDIRS += voip_video_benchmark
+voip_video_benchmark.file = voip-video-benchmark.pro
+
+SUBDIRS += voip_audio_benchmark
+voip_audio_benchmark.file = voip-audio-benchmark.pro
@@ -0,0 +1,180 @@
+/*******************************************************************************
+ * plugins/VOIP/benchmarks/voip-audio-benchmark.cpp                            *
+ *                                                                             *
+ * Copyright (C) 2012 by Retroshare Team <retroshare.project@gmail.com>        *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+// Micro-benchmark of the mixing of the speakers of a call, without audio device nor network.
+//
+// Frames of 20 ms of synthetic speech for a growing number of speakers are mixed with each
+// implementation supported by the CPU, on a single thread. The former per-speaker float loop with
+// hard clipping is measured as reference. Results are microseconds per frame, and the share of the
+// 20 ms this takes.
+// The highest output amplitude is also printed: the mixer must stay under its limiter threshold.
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <math.h>
+#include <stdlib.h>
+
+#include "util/argstream.h"
+
+#include "gui/AudioMixer.h"
+
+static const int FRAME_SIZE = 320 ;	// as in SpeexProcessor: 20 ms at 16 kHz
+
+// Sum of a few tones per speaker, loud enough for the mix to clip without limiter
+//
+static void syntheticFrames(int nb_speakers, int frame, std::vector<std::vector<int16_t> >& frames)
+{
+    frames.resize(nb_speakers) ;
+
+    for(int s=0;s<nb_speakers;++s)
+    {
+        frames[s].resize(FRAME_SIZE) ;
+
+        for(int i=0;i<FRAME_SIZE;++i)
+        {
+            double t = (frame * FRAME_SIZE + i) / 16000.0 ;
+            double v = 9000.0 * sin(2 * M_PI * (150 + 37 * s) * t) + 5000.0 * sin(2 * M_PI * (700 + 113 * s) * t) + (rand() % 2000 - 1000) ;
+
+            frames[s][i] = (int16_t)v ;
+        }
+    }
+}
+
+// The mix used before AudioMixer, from SpeexOutputProcessor::readData()
+//
+static void referenceMix(const std::vector<std::vector<int16_t> >& frames, int16_t *out)
+{
+    for(int j=0;j<FRAME_SIZE;++j)
+        out[j] = 0 ;
+
+    for(unsigned int s=0;s<frames.size();++s)
+        for (int j = 0; j< FRAME_SIZE; j++) {
+            short sample1 = out[j];
+            short sample2 = frames[s][j];
+            float samplef1 = sample1 / 32768.0f;
+            float samplef2 = sample2 / 32768.0f;
+            float mixed = samplef1 + 0.8f * samplef2;
+            // hard clipping
+            if (mixed > 1.0f) mixed = 1.0f;
+            if (mixed < -1.0f) mixed = -1.0f;
+            out[j] = (short)(mixed * 32768.0f);
+        }
+}
+
+template<class F> static double microsecondsPerFrame(F mix, uint32_t duration_ms)
+{
+    // warm up, then run for the given duration
+    mix() ;
+
+    uint32_t frames = 0 ;
+    auto start = std::chrono::steady_clock::now() ;
+    double elapsed ;
+
+    do
+    {
+        mix() ;
+        ++frames ;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() ;
+    }
+    while(elapsed * 1000 < duration_ms) ;
+
+    return elapsed * 1e6 / frames ;
+}
+
+static int highestAmplitude(const int16_t *frame)
+{
+    int max = 0 ;
+
+    for(int i=0;i<FRAME_SIZE;++i)
+        max = std::max(max,std::abs((int)frame[i])) ;
+
+    return max ;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t duration_ms = 1000 ;
+    bool skip_reference = false ;
+
+    argstream as(argc,argv) ;
+
+    as >> parameter('d',"duration",duration_ms,"duration of each measure in milliseconds (default: 1000)",false)
+       >> option('r',"no-reference",skip_reference,"do not measure the former per-speaker mix")
+       >> help('h',"help","Display this Help") ;
+
+    as.defaultErrorHandling(true,true) ;
+
+    static const int speakers[] = { 1, 2, 4, 8, 16, 32 } ;
+
+    std::cerr << "Mix of " << FRAME_SIZE << " samples, best implementation: " << AudioMixer::implementationName(AudioMixer::bestImplementation()) << std::endl;
+
+    for(unsigned int n=0;n<sizeof(speakers)/sizeof(speakers[0]);++n)
+    {
+        int nb_speakers = speakers[n] ;
+
+        // a few different frames, so that the limiter works on a continuous signal
+        static const int NB_FRAMES = 16 ;
+        std::vector<std::vector<int16_t> > frames[NB_FRAMES] ;
+
+        for(int f=0;f<NB_FRAMES;++f)
+            syntheticFrames(nb_speakers,f,frames[f]) ;
+
+        int16_t out[FRAME_SIZE] ;
+
+        std::cerr << "  " << nb_speakers << " speakers:" ;
+
+        if(!skip_reference)
+        {
+            int f = 0, max = 0 ;
+            double us = microsecondsPerFrame([&]() { referenceMix(frames[f],out) ; max = std::max(max,highestAmplitude(out)) ; f = (f+1) % NB_FRAMES ; },duration_ms) ;
+
+            std::cerr << "  reference " << us << " us (" << us / 200.0 << "%, max " << max << ")" ;
+        }
+
+        for(int i=AudioMixer::IMPLEMENTATION_SCALAR;i<=AudioMixer::IMPLEMENTATION_NEON;++i)
+        {
+            if(!AudioMixer::isSupported((AudioMixer::Implementation)i))
+                continue ;
+
+            AudioMixer mixer(FRAME_SIZE) ;
+            mixer.setImplementation((AudioMixer::Implementation)i) ;
+
+            std::vector<AudioMixer::StreamState> states(nb_speakers) ;
+            std::vector<AudioMixer::StreamState*> state_pointers(nb_speakers) ;
+            std::vector<const int16_t*> frame_pointers[NB_FRAMES] ;
+
+            for(int s=0;s<nb_speakers;++s)
+                state_pointers[s] = &states[s] ;
+
+            for(int f=0;f<NB_FRAMES;++f)
+                for(int s=0;s<nb_speakers;++s)
+                    frame_pointers[f].push_back(frames[f][s].data()) ;
+
+            int f = 0, max = 0 ;
+            double us = microsecondsPerFrame([&]() { mixer.mix(frame_pointers[f].data(),state_pointers.data(),nb_speakers,out) ; max = std::max(max,highestAmplitude(out)) ; f = (f+1) % NB_FRAMES ; },duration_ms) ;
+
+            std::cerr << "  " << AudioMixer::implementationName(mixer.implementation()) << " " << us << " us (" << us / 200.0 << "%, max " << max << ")" ;
+        }
+        std::cerr << std::endl;
+    }
+
+    return 0 ;
+}
@@ -0,0 +1,286 @@
+/*******************************************************************************
+ * plugins/VOIP/benchmarks/voip-video-benchmark.cpp                            *
+ *                                                                             *
+ * Copyright (C) 2012 by Retroshare Team <retroshare.project@gmail.com>        *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+// Micro-benchmark of the video conversions of the VOIP plugin, without camera nor network.
+//
+// Synthetic frames at common camera resolutions are converted to the 640x480 YUV 4:2:0 planes
+// of the FFmpeg encoder, and decoded YUV 4:2:0 frames at the same resolutions are converted back
+// into a QImage, with each implementation supported by the CPU, on a single thread. The differential
+// frames of the JPEG codec are measured the same way.
+// Results are frames per second per core. The former per-pixel QImage code is measured as reference.
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+
+#include <QImage>
+#include <QColor>
+
+#include "util/argstream.h"
+
+#include "gui/VideoConverter.h"
+
+static const int ENCODER_WIDTH  = 640 ;
+static const int ENCODER_HEIGHT = 480 ;
+
+// Gradient with some noise, so that the data does not compress in caches
+//
+static QImage syntheticFrame(int width, int height)
+{
+    QImage image(width,height,QImage::Format_RGB32) ;
+    uint32_t seed = 12345 ;
+
+    for(int y=0;y<height;++y)
+    {
+        QRgb *line = (QRgb*)image.scanLine(y) ;
+
+        for(int x=0;x<width;++x)
+        {
+            seed = seed * 1103515245 + 12345 ;
+            int noise = (seed >> 24) & 0x1f ;
+
+            line[x] = qRgb((x * 255 / width + noise) & 0xff, (y * 255 / height + noise) & 0xff, ((x + y) & 0xff) ^ noise) ;
+        }
+    }
+    return image ;
+}
+
+// The conversion used before VideoConverter: Qt scaling, then QImage::pixel() and double arithmetic.
+//
+static void referenceRgbToYuv420(const QImage& image, uint8_t *const planes[3], const int linesizes[3], int width, int height)
+{
+    QImage input = (image.width() != width || image.height() != height) ? image.scaled(QSize(width,height),Qt::IgnoreAspectRatio,Qt::SmoothTransformation) : image ;
+
+    for (int y = 0; y < height/2; y++)
+        for (int x = 0; x < width/2; x++)
+        {
+            int R = 0, G = 0, B = 0 ;
+
+            for(int i=0;i<4;++i)
+            {
+                QRgb pix = input.pixel(QPoint(2*x+(i&1),2*y+(i>>1))) ;
+                int r = qRed(pix), g = qGreen(pix), b = qBlue(pix) ;
+                int Y = (0.257 * r) + (0.504 * g) + (0.098 * b) + 16 ;
+
+                planes[0][(2*y+(i>>1)) * linesizes[0] + 2*x+(i&1)] = std::min(255,std::max(0,Y)) ;
+                R += r ; G += g ; B += b ;
+            }
+
+            int U =  (0.439 * 0.25*R) - (0.368 * 0.25*G) - (0.071 * 0.25*B) + 128 ;
+            int V = -(0.148 * 0.25*R) - (0.291 * 0.25*G) + (0.439 * 0.25*B) + 128 ;
+
+            planes[1][y * linesizes[1] + x] = std::min(255,std::max(0,U)) ;
+            planes[2][y * linesizes[2] + x] = std::min(255,std::max(0,V)) ;
+        }
+}
+
+// The conversion used before VideoConverter in FFmpegVideo::decodeData(): a new image per frame,
+// double arithmetic and QImage::setPixel().
+//
+static void referenceYuv420ToRgb(const uint8_t *const planes[3], const int linesizes[3], int width, int height, QImage& image)
+{
+    image = QImage(QSize(width,height),QImage::Format_ARGB32) ;
+
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+        {
+            int Y  = planes[0][y * linesizes[0] + x] ;
+            int U  = planes[1][(y/2) * linesizes[1] + x/2] ;
+            int V  = planes[2][(y/2) * linesizes[2] + x/2] ;
+
+            int B = std::min(255,std::max(0,(int)(1.164*(Y - 16) + 1.596*(V - 128)))) ;
+            int G = std::min(255,std::max(0,(int)(1.164*(Y - 16) - 0.813*(V - 128) - 0.391*(U - 128)))) ;
+            int R = std::min(255,std::max(0,(int)(1.164*(Y - 16)                   + 2.018*(U - 128)))) ;
+
+            image.setPixel(QPoint(x,y),QRgb( 0xff000000 + (R << 16) + (G << 8) + B)) ;
+        }
+}
+
+// The differential frame computation used before in JPEGVideo::encodeData() and decodeData()
+//
+static void referenceFrameDifference(const QImage& image, const QImage& reference, QImage& diff, QImage& sum)
+{
+    diff = image ;
+
+    for(int i=0;i<image.byteCount();++i)
+    {
+        int d = ( (int)image.bits()[i] - (int)reference.bits()[i]) + 128;
+        diff.bits()[i] = (unsigned char)std::max(0,std::min(255,d)) ;
+    }
+
+    sum = reference ;
+
+    for(int i=0;i<diff.byteCount();++i)
+    {
+        int new_val = (int)sum.bits()[i] + ((int)diff.bits()[i] - 128) ;
+        sum.bits()[i] = std::max(0,std::min(255,new_val)) ;
+    }
+}
+
+template<class F> static double framesPerSecond(F convert, uint32_t duration_ms)
+{
+    // warm up, then run for the given duration
+    convert() ;
+
+    uint32_t frames = 0 ;
+    auto start = std::chrono::steady_clock::now() ;
+    double elapsed ;
+
+    do
+    {
+        convert() ;
+        ++frames ;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() ;
+    }
+    while(elapsed * 1000 < duration_ms) ;
+
+    return frames / elapsed ;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t duration_ms = 1000 ;
+    bool skip_reference = false ;
+
+    argstream as(argc,argv) ;
+
+    as >> parameter('d',"duration",duration_ms,"duration of each measure in milliseconds (default: 1000)",false)
+       >> option('r',"no-reference",skip_reference,"do not measure the former QImage::pixel() conversion")
+       >> help('h',"help","Display this Help") ;
+
+    as.defaultErrorHandling(true,true) ;
+
+    static const int sizes[][2] = { { 320,240 }, { 640,480 }, { 1280,720 }, { 1280,960 }, { 1920,1080 } } ;
+
+    // planes of the encoder, with the padding of av_image_alloc()
+    int linesizes[3] = { ENCODER_WIDTH + 32, ENCODER_WIDTH/2 + 32, ENCODER_WIDTH/2 + 32 } ;
+    std::vector<uint8_t> buffers[3] ;
+    uint8_t *planes[3] ;
+
+    for(int i=0;i<3;++i)
+    {
+        buffers[i].resize(linesizes[i] * ENCODER_HEIGHT) ;
+        planes[i] = buffers[i].data() ;
+    }
+
+    std::cerr << "RGB to YUV 4:2:0 " << ENCODER_WIDTH << "x" << ENCODER_HEIGHT << ", best implementation: "
+              << VideoConverter::implementationName(VideoConverter::bestImplementation()) << std::endl;
+
+    for(unsigned int s=0;s<sizeof(sizes)/sizeof(sizes[0]);++s)
+    {
+        QImage frame = syntheticFrame(sizes[s][0],sizes[s][1]) ;
+
+        std::cerr << "  " << sizes[s][0] << "x" << sizes[s][1] << ":" ;
+
+        if(!skip_reference)
+            std::cerr << "  QImage::pixel " << (int)framesPerSecond([&]() { referenceRgbToYuv420(frame,planes,linesizes,ENCODER_WIDTH,ENCODER_HEIGHT) ; },duration_ms) << " fps" ;
+
+        for(int i=VideoConverter::IMPLEMENTATION_SCALAR;i<=VideoConverter::IMPLEMENTATION_AVX2;++i)	// no NEON colour conversion
+        {
+            if(!VideoConverter::isSupported((VideoConverter::Implementation)i))
+                continue ;
+
+            VideoConverter converter ;
+            converter.setImplementation((VideoConverter::Implementation)i) ;
+
+            std::cerr << "  " << VideoConverter::implementationName(converter.implementation()) << " "
+                      << (int)framesPerSecond([&]() { converter.rgbToYuv420(frame,planes,linesizes,ENCODER_WIDTH,ENCODER_HEIGHT) ; },duration_ms) << " fps" ;
+        }
+        std::cerr << std::endl;
+    }
+
+    std::cerr << "YUV 4:2:0 to RGB, best implementation: " << VideoConverter::implementationName(VideoConverter::bestImplementation()) << std::endl;
+
+    for(unsigned int s=0;s<sizeof(sizes)/sizeof(sizes[0]);++s)
+    {
+        int width = sizes[s][0], height = sizes[s][1] ;
+
+        // decoded frame, with the line padding of the FFmpeg decoder
+        int decoded_linesizes[3] = { width + 32, width/2 + 32, width/2 + 32 } ;
+        std::vector<uint8_t> decoded_buffers[3] ;
+        uint8_t *decoded_planes[3] ;
+
+        for(int i=0;i<3;++i)
+        {
+            decoded_buffers[i].resize(decoded_linesizes[i] * height) ;
+            decoded_planes[i] = decoded_buffers[i].data() ;
+        }
+        VideoConverter().rgbToYuv420(syntheticFrame(width,height),decoded_planes,decoded_linesizes,width,height) ;
+
+        QImage image ;
+
+        std::cerr << "  " << width << "x" << height << ":" ;
+
+        if(!skip_reference)
+            std::cerr << "  QImage::setPixel " << (int)framesPerSecond([&]() { referenceYuv420ToRgb(decoded_planes,decoded_linesizes,width,height,image) ; },duration_ms) << " fps" ;
+
+        for(int i=VideoConverter::IMPLEMENTATION_SCALAR;i<=VideoConverter::IMPLEMENTATION_AVX2;++i)	// no NEON colour conversion
+        {
+            if(!VideoConverter::isSupported((VideoConverter::Implementation)i))
+                continue ;
+
+            VideoConverter converter ;
+            converter.setImplementation((VideoConverter::Implementation)i) ;
+
+            // same image for all frames, as in FFmpegVideo
+            std::cerr << "  " << VideoConverter::implementationName(converter.implementation()) << " "
+                      << (int)framesPerSecond([&]() { converter.yuv420ToRgb(decoded_planes,decoded_linesizes,width,height,image) ; },duration_ms) << " fps" ;
+        }
+        std::cerr << std::endl;
+    }
+
+    std::cerr << "JPEG differential frame (difference and sum), best implementation: " << VideoConverter::implementationName(VideoConverter::bestImplementation()) << std::endl;
+
+    for(unsigned int s=0;s<sizeof(sizes)/sizeof(sizes[0]);++s)
+    {
+        int width = sizes[s][0], height = sizes[s][1] ;
+
+        QImage reference = syntheticFrame(width,height) ;
+        QImage frame = syntheticFrame(width,height).mirrored(true,false) ;
+        QImage diff(width,height,QImage::Format_RGB32) ;
+        QImage sum(width,height,QImage::Format_RGB32) ;
+
+        std::cerr << "  " << width << "x" << height << ":" ;
+
+        if(!skip_reference)
+            std::cerr << "  QImage::bits " << (int)framesPerSecond([&]() { referenceFrameDifference(frame,reference,diff,sum) ; },duration_ms) << " fps" ;
+
+        diff = QImage(width,height,QImage::Format_RGB32) ;
+        sum = QImage(width,height,QImage::Format_RGB32) ;
+
+        for(int i=VideoConverter::IMPLEMENTATION_SCALAR;i<=VideoConverter::IMPLEMENTATION_NEON;++i)
+        {
+            if(!VideoConverter::isSupported((VideoConverter::Implementation)i))
+                continue ;
+
+            VideoConverter converter ;
+            converter.setImplementation((VideoConverter::Implementation)i) ;
+
+            int size = frame.byteCount() ;
+
+            std::cerr << "  " << VideoConverter::implementationName(converter.implementation()) << " "
+                      << (int)framesPerSecond([&]() { converter.frameDifference(frame.constBits(),reference.constBits(),diff.bits(),size) ;
+                                                      converter.addFrameDifference(reference.constBits(),diff.constBits(),sum.bits(),size) ; },duration_ms) << " fps" ;
+        }
+        std::cerr << std::endl;
+    }
+
+    return 0 ;
+}
@@ -0,0 +1,432 @@
+/*******************************************************************************
+ * plugins/VOIP/gui/AudioMixer.cpp                                             *
+ *                                                                             *
+ * Copyright (C) 2012 by Retroshare Team <retroshare.project@gmail.com>        *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+#include <math.h>
+#include <string.h>
+
+#include "AudioMixer.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AUDIO_MIXER_X86 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define AUDIO_MIXER_NEON 1
+#include <arm_neon.h>
+#endif
+
+const float AudioMixer::LIMITER_THRESHOLD = 29491.0f ;	// -0.9 dBFS
+const float AudioMixer::DEFAULT_GAIN = 0.8f ;		// what was applied to every speaker before the normalisation
+
+static const float LIMITER_RELEASE = 1.0f / 800.0f ;	// per sample: 50 ms at 16 kHz
+
+// gain normalisation: only the frames louder than SPEECH_LEVEL move the gain, by GAIN_ADAPTATION of the
+// way to the gain that brings them to TARGET_LEVEL (a few seconds to converge).
+static const float SPEECH_LEVEL    = 300.0f ;		// -40 dBFS
+static const float TARGET_LEVEL    = 5000.0f ;		// -16 dBFS
+static const float MIN_GAIN        = 0.5f ;
+static const float MAX_GAIN        = 2.0f ;
+static const float GAIN_ADAPTATION = 0.01f ;
+
+// meters, per frame
+static const float LEVEL_RELEASE = 0.2f ;
+static const float PEAK_DECAY    = 0.95f ;
+
+static inline float toDecibels(float amplitude)
+{
+    float db = 20.0f * log10f(amplitude / 32768.0f) ;
+    return (db > -96.0f) ? db : -96.0f ;	// also when amplitude is 0
+}
+
+AudioMixer::StreamState::StreamState()
+    : gain(DEFAULT_GAIN), level(0.0f), peak(0.0f)
+{
+}
+
+float AudioMixer::StreamState::levelDecibels() const { return toDecibels(level) ; }
+float AudioMixer::StreamState::peakDecibels() const { return toDecibels(peak) ; }
+
+// Samples begin to end, one pass over the streams per sample. energies and peaks are accumulated, so
+// the vector versions use it for their last samples.
+//
+static void mixRange(const int16_t *const *frames, const float *gains, int nb_streams, int begin, int end, float *out, bool accumulate, float *energies, float *peaks)
+{
+    for(int i=begin;i<end;++i)
+    {
+        float sum = accumulate ? out[i] : 0.0f ;
+
+        for(int s=0;s<nb_streams;++s)
+        {
+            float x = frames[s][i] ;
+
+            sum += gains[s] * x ;
+            energies[s] += x * x ;
+
+            if(fabsf(x) > peaks[s])
+                peaks[s] = fabsf(x) ;
+        }
+        out[i] = sum ;
+    }
+}
+
+static void mixScalar(const int16_t *const *frames, const float *gains, int nb_streams, int size, float *out, bool accumulate, float *energies, float *peaks)
+{
+    for(int s=0;s<nb_streams;++s)
+        energies[s] = peaks[s] = 0.0f ;
+
+    mixRange(frames,gains,nb_streams,0,size,out,accumulate,energies,peaks) ;
+}
+
+#ifdef AUDIO_MIXER_NEON
+
+static void mixNEON(const int16_t *const *frames, const float *gains, int nb_streams, int size, float *out, bool accumulate, float *energies, float *peaks)
+{
+    float32x4_t e[AudioMixer::MAX_KERNEL_STREAMS] ;
+    float32x4_t p[AudioMixer::MAX_KERNEL_STREAMS] ;
+
+    for(int s=0;s<nb_streams;++s)
+        e[s] = p[s] = vdupq_n_f32(0.0f) ;
+
+    int i = 0 ;
+
+    for(;i+8<=size;i+=8)
+    {
+        float32x4_t lo = accumulate ? vld1q_f32(out+i) : vdupq_n_f32(0.0f) ;
+        float32x4_t hi = accumulate ? vld1q_f32(out+i+4) : vdupq_n_f32(0.0f) ;
+
+        for(int s=0;s<nb_streams;++s)
+        {
+            int16x8_t x = vld1q_s16(frames[s]+i) ;
+            float32x4_t x0 = vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))) ;
+            float32x4_t x1 = vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))) ;
+
+            lo = vmlaq_n_f32(lo,x0,gains[s]) ;
+            hi = vmlaq_n_f32(hi,x1,gains[s]) ;
+            e[s] = vmlaq_f32(vmlaq_f32(e[s],x0,x0),x1,x1) ;
+            p[s] = vmaxq_f32(p[s],vmaxq_f32(vabsq_f32(x0),vabsq_f32(x1))) ;
+        }
+        vst1q_f32(out+i,lo) ;
+        vst1q_f32(out+i+4,hi) ;
+    }
+
+    for(int s=0;s<nb_streams;++s)
+    {
+        float ev[4], pv[4] ;
+        vst1q_f32(ev,e[s]) ;
+        vst1q_f32(pv,p[s]) ;
+
+        energies[s] = ev[0] + ev[1] + ev[2] + ev[3] ;
+        peaks[s] = fmaxf(fmaxf(pv[0],pv[1]),fmaxf(pv[2],pv[3])) ;
+    }
+    mixRange(frames,gains,nb_streams,i,size,out,accumulate,energies,peaks) ;
+}
+
+#endif // AUDIO_MIXER_NEON
+
+#ifdef AUDIO_MIXER_X86
+
+// 8 samples into two registers of 4 floats
+//
+TARGET_SSE2 static inline void sse2Samples(const int16_t *src, __m128& x0, __m128& x1)
+{
+    __m128i x = _mm_loadu_si128((const __m128i*)src) ;
+
+    x0 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x,x),16)) ;
+    x1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x,x),16)) ;
+}
+
+TARGET_SSE2 static void mixSSE2(const int16_t *const *frames, const float *gains, int nb_streams, int size, float *out, bool accumulate, float *energies, float *peaks)
+{
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff)) ;
+    __m128 e[AudioMixer::MAX_KERNEL_STREAMS] ;
+    __m128 p[AudioMixer::MAX_KERNEL_STREAMS] ;
+
+    for(int s=0;s<nb_streams;++s)
+        e[s] = p[s] = _mm_setzero_ps() ;
+
+    int i = 0 ;
+
+    for(;i+8<=size;i+=8)
+    {
+        __m128 lo = accumulate ? _mm_loadu_ps(out+i) : _mm_setzero_ps() ;
+        __m128 hi = accumulate ? _mm_loadu_ps(out+i+4) : _mm_setzero_ps() ;
+
+        for(int s=0;s<nb_streams;++s)
+        {
+            __m128 x0, x1 ;
+            sse2Samples(frames[s]+i,x0,x1) ;
+
+            __m128 g = _mm_set1_ps(gains[s]) ;
+
+            lo = _mm_add_ps(lo,_mm_mul_ps(x0,g)) ;
+            hi = _mm_add_ps(hi,_mm_mul_ps(x1,g)) ;
+            e[s] = _mm_add_ps(e[s],_mm_add_ps(_mm_mul_ps(x0,x0),_mm_mul_ps(x1,x1))) ;
+            p[s] = _mm_max_ps(p[s],_mm_max_ps(_mm_and_ps(x0,abs_mask),_mm_and_ps(x1,abs_mask))) ;
+        }
+        _mm_storeu_ps(out+i,lo) ;
+        _mm_storeu_ps(out+i+4,hi) ;
+    }
+
+    for(int s=0;s<nb_streams;++s)
+    {
+        float ev[4], pv[4] ;
+        _mm_storeu_ps(ev,e[s]) ;
+        _mm_storeu_ps(pv,p[s]) ;
+
+        energies[s] = ev[0] + ev[1] + ev[2] + ev[3] ;
+        peaks[s] = fmaxf(fmaxf(pv[0],pv[1]),fmaxf(pv[2],pv[3])) ;
+    }
+    mixRange(frames,gains,nb_streams,i,size,out,accumulate,energies,peaks) ;
+}
+
+TARGET_AVX2 static void mixAVX2(const int16_t *const *frames, const float *gains, int nb_streams, int size, float *out, bool accumulate, float *energies, float *peaks)
+{
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff)) ;
+    __m256 e[AudioMixer::MAX_KERNEL_STREAMS] ;
+    __m256 p[AudioMixer::MAX_KERNEL_STREAMS] ;
+
+    for(int s=0;s<nb_streams;++s)
+        e[s] = p[s] = _mm256_setzero_ps() ;
+
+    int i = 0 ;
+
+    for(;i+16<=size;i+=16)
+    {
+        __m256 lo = accumulate ? _mm256_loadu_ps(out+i) : _mm256_setzero_ps() ;
+        __m256 hi = accumulate ? _mm256_loadu_ps(out+i+8) : _mm256_setzero_ps() ;
+
+        for(int s=0;s<nb_streams;++s)
+        {
+            __m256i x = _mm256_loadu_si256((const __m256i*)(frames[s]+i)) ;
+            __m256 x0 = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(x))) ;
+            __m256 x1 = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(x,1))) ;
+            __m256 g = _mm256_set1_ps(gains[s]) ;
+
+            lo = _mm256_add_ps(lo,_mm256_mul_ps(x0,g)) ;
+            hi = _mm256_add_ps(hi,_mm256_mul_ps(x1,g)) ;
+            e[s] = _mm256_add_ps(e[s],_mm256_add_ps(_mm256_mul_ps(x0,x0),_mm256_mul_ps(x1,x1))) ;
+            p[s] = _mm256_max_ps(p[s],_mm256_max_ps(_mm256_and_ps(x0,abs_mask),_mm256_and_ps(x1,abs_mask))) ;
+        }
+        _mm256_storeu_ps(out+i,lo) ;
+        _mm256_storeu_ps(out+i+8,hi) ;
+    }
+
+    for(int s=0;s<nb_streams;++s)
+    {
+        float ev[8], pv[8] ;
+        _mm256_storeu_ps(ev,e[s]) ;
+        _mm256_storeu_ps(pv,p[s]) ;
+
+        energies[s] = ((ev[0] + ev[1]) + (ev[2] + ev[3])) + ((ev[4] + ev[5]) + (ev[6] + ev[7])) ;
+        peaks[s] = fmaxf(fmaxf(fmaxf(pv[0],pv[1]),fmaxf(pv[2],pv[3])),fmaxf(fmaxf(pv[4],pv[5]),fmaxf(pv[6],pv[7]))) ;
+    }
+    mixRange(frames,gains,nb_streams,i,size,out,accumulate,energies,peaks) ;
+}
+
+#endif // AUDIO_MIXER_X86
+
+AudioMixer::AudioMixer(int frame_size)
+    : _frame_size(frame_size), _sum(frame_size,0.0f)
+{
+    setImplementation(bestImplementation()) ;
+
+    // the limiter starts with no reduction
+    memset(_delay,0,sizeof(_delay)) ;
+
+    for(int i=0;i<LIMITER_LOOKAHEAD;++i)
+        _average_values[i] = 1.0f ;
+
+    _average_sum = LIMITER_LOOKAHEAD ;
+    _min_first = 0 ;
+    _min_count = 0 ;
+    _envelope = 1.0f ;
+    _position = 0 ;
+}
+
+bool AudioMixer::isSupported(Implementation i)
+{
+#ifdef AUDIO_MIXER_X86
+    __builtin_cpu_init() ;
+#endif
+
+    switch(i)
+    {
+    case IMPLEMENTATION_SCALAR: return true ;
+#ifdef AUDIO_MIXER_X86
+    case IMPLEMENTATION_SSE2: return __builtin_cpu_supports("sse2") ;
+    case IMPLEMENTATION_AVX2: return __builtin_cpu_supports("avx2") ;
+#endif
+#ifdef AUDIO_MIXER_NEON
+    case IMPLEMENTATION_NEON: return true ;
+#endif
+    default:
+        return false ;
+    }
+}
+
+AudioMixer::Implementation AudioMixer::bestImplementation()
+{
+    if(isSupported(IMPLEMENTATION_NEON))
+        return IMPLEMENTATION_NEON ;
+    if(isSupported(IMPLEMENTATION_AVX2))
+        return IMPLEMENTATION_AVX2 ;
+    if(isSupported(IMPLEMENTATION_SSE2))
+        return IMPLEMENTATION_SSE2 ;
+
+    return IMPLEMENTATION_SCALAR ;
+}
+
+const char *AudioMixer::implementationName(Implementation i)
+{
+    switch(i)
+    {
+    case IMPLEMENTATION_SSE2: return "SSE2" ;
+    case IMPLEMENTATION_AVX2: return "AVX2" ;
+    case IMPLEMENTATION_NEON: return "NEON" ;
+    default:
+        return "scalar" ;
+    }
+}
+
+void AudioMixer::setImplementation(Implementation i)
+{
+    if(!isSupported(i))
+        i = IMPLEMENTATION_SCALAR ;
+
+    _implementation = i ;
+    _mix = mixScalar ;
+
+    switch(i)
+    {
+#ifdef AUDIO_MIXER_X86
+    case IMPLEMENTATION_SSE2: _mix = mixSSE2 ;
+        break ;
+    case IMPLEMENTATION_AVX2: _mix = mixAVX2 ;
+        break ;
+#endif
+#ifdef AUDIO_MIXER_NEON
+    case IMPLEMENTATION_NEON: _mix = mixNEON ;
+        break ;
+#endif
+    default:
+        break ;
+    }
+}
+
+void AudioMixer::mix(const int16_t *const *frames, StreamState *const *states, int nb_streams, int16_t *out)
+{
+    // only grows when a new speaker joins
+    if((int)_gains.size() < nb_streams)
+    {
+        _gains.resize(nb_streams) ;
+        _energies.resize(nb_streams) ;
+        _peaks.resize(nb_streams) ;
+    }
+
+    for(int s=0;s<nb_streams;++s)
+        _gains[s] = states[s]->gain ;
+
+    if(nb_streams == 0)
+        memset(_sum.data(),0,_frame_size * sizeof(float)) ;
+
+    for(int s=0;s<nb_streams;s+=MAX_KERNEL_STREAMS)
+    {
+        int n = (nb_streams - s < MAX_KERNEL_STREAMS) ? (nb_streams - s) : MAX_KERNEL_STREAMS ;
+
+        _mix(frames+s,&_gains[s],n,_frame_size,_sum.data(),s > 0,&_energies[s],&_peaks[s]) ;
+    }
+
+    for(int s=0;s<nb_streams;++s)
+    {
+        StreamState& state(*states[s]) ;
+        float rms = sqrtf(_energies[s] / _frame_size) ;
+
+        state.level = (rms > state.level) ? rms : state.level + (rms - state.level) * LEVEL_RELEASE ;
+        state.peak = (_peaks[s] > state.peak * PEAK_DECAY) ? _peaks[s] : state.peak * PEAK_DECAY ;
+
+        if(rms > SPEECH_LEVEL)
+        {
+            float target = TARGET_LEVEL / rms ;
+
+            if(target < MIN_GAIN) target = MIN_GAIN ;
+            if(target > MAX_GAIN) target = MAX_GAIN ;
+
+            state.gain += (target - state.gain) * GAIN_ADAPTATION ;
+        }
+    }
+
+    limit(_sum.data(),out) ;
+}
+
+// For every sample, the gain that keeps it under the threshold is computed. The gain applied is the
+// minimum of these over the next LIMITER_LOOKAHEAD samples, averaged over LIMITER_LOOKAHEAD samples: it
+// goes down smoothly and has reached the needed gain when the peak is output, LIMITER_LOOKAHEAD-1
+// samples later. It then goes back up with the release time.
+//
+void AudioMixer::limit(const float *in, int16_t *out)
+{
+    const uint32_t mask = LIMITER_LOOKAHEAD - 1 ;
+
+    for(int i=0;i<_frame_size;++i)
+    {
+        uint32_t t = _position++ ;
+        float x = in[i] ;
+        float a = fabsf(x) ;
+        float needed = (a > LIMITER_THRESHOLD) ? LIMITER_THRESHOLD / a : 1.0f ;
+
+        // sliding minimum over the last LIMITER_LOOKAHEAD samples: increasing values in a queue
+        if(_min_count > 0 && t - _min_positions[_min_first & mask] >= (uint32_t)LIMITER_LOOKAHEAD)
+        {
+            ++_min_first ;
+            --_min_count ;
+        }
+        while(_min_count > 0 && _min_values[(_min_first + _min_count - 1) & mask] >= needed)
+            --_min_count ;
+
+        _min_values[(_min_first + _min_count) & mask] = needed ;
+        _min_positions[(_min_first + _min_count) & mask] = t ;
+        ++_min_count ;
+
+        float m = _min_values[_min_first & mask] ;
+
+        _average_sum += (double)m - (double)_average_values[t & mask] ;	// exact in double, so it does not drift
+        _average_values[t & mask] = m ;
+
+        float g = (float)(_average_sum / LIMITER_LOOKAHEAD) ;
+
+        _envelope = (g < _envelope) ? g : _envelope + (g - _envelope) * LIMITER_RELEASE ;
+
+        // the delay line holds the last LIMITER_LOOKAHEAD samples, the oldest is output
+        _delay[t & mask] = x ;
+
+        float y = _delay[(t+1) & mask] * _envelope ;
+
+        // only rounding errors can be left above the threshold
+        if(y > LIMITER_THRESHOLD) y = LIMITER_THRESHOLD ;
+        if(y < -LIMITER_THRESHOLD) y = -LIMITER_THRESHOLD ;
+
+        int v = (int)(y >= 0.0f ? y + 0.5f : y - 0.5f) ;
+
+        out[i] = (v > 32767) ? 32767 : ((v < -32768) ? -32768 : v) ;
+    }
+}
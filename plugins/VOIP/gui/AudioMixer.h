@@ -0,0 +1,110 @@
+/*******************************************************************************
+ * plugins/VOIP/gui/AudioMixer.h                                               *
+ *                                                                             *
+ * Copyright (C) 2012 by Retroshare Team <retroshare.project@gmail.com>        *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// Mixes the decoded frames of the speakers of a call into the frame that is played.
+//
+// All the streams are summed in one pass in floating point (SSE2 or AVX2 when the CPU supports it,
+// NEON on ARM), each with its own gain, which slowly brings every speaker to the same loudness. The
+// sum then goes through a look-ahead limiter: the gain is lowered smoothly before a peak reaches the
+// output instead of clipping it, at the cost of LIMITER_LOOKAHEAD samples of latency.
+//
+// The level of each stream is measured in the same pass, for the meters of the GUI.
+// The mixer keeps the limiter state and scratch buffers, so use one mixer per output.
+//
+class AudioMixer
+{
+public:
+    enum Implementation {
+        IMPLEMENTATION_SCALAR = 0x00,
+        IMPLEMENTATION_SSE2   = 0x01,
+        IMPLEMENTATION_AVX2   = 0x02,
+        IMPLEMENTATION_NEON   = 0x03
+    };
+
+    static const int   MAX_KERNEL_STREAMS = 16 ;	// streams summed per pass. More streams take several passes.
+    static const int   LIMITER_LOOKAHEAD  = 64 ;	// samples (4 ms at 16 kHz), power of 2
+    static const float LIMITER_THRESHOLD ;		// highest output amplitude
+    static const float DEFAULT_GAIN ;
+
+    // What the mixer remembers about one stream between two frames. Kept by the caller with the stream.
+    //
+    struct StreamState
+    {
+        StreamState() ;
+
+        float gain ;	// applied to the stream, adjusted when it is speaking
+        float level ;	// RMS amplitude, smoothed, in sample units (0 to 32768)
+        float peak ;	// highest amplitude, slowly decaying
+
+        // levels in dBFS, from -96 to 0
+        float levelDecibels() const ;
+        float peakDecibels() const ;
+    };
+
+    AudioMixer(int frame_size) ;
+
+    // Mixes nb_streams frames of frame_size samples into out, and updates the states of the streams.
+    //
+    void mix(const int16_t *const *frames, StreamState *const *states, int nb_streams, int16_t *out) ;
+
+    // The implementation is chosen from the CPU features. It can be forced for testing (falls back
+    // to the scalar code when not supported).
+    //
+    static Implementation bestImplementation() ;
+    static bool isSupported(Implementation) ;
+    static const char *implementationName(Implementation) ;
+    void setImplementation(Implementation i) ;
+    Implementation implementation() const { return _implementation ; }
+
+    // Sums nb_streams (at most MAX_KERNEL_STREAMS) frames of size samples, multiplied by their gain, into
+    // out (added to it when accumulate is set). Stores the sum of the squares and the highest amplitude of
+    // each stream in energies and peaks.
+    //
+    typedef void (*MixFunction)(const int16_t *const *frames, const float *gains, int nb_streams, int size, float *out, bool accumulate, float *energies, float *peaks) ;
+
+private:
+    void limit(const float *in, int16_t *out) ;
+
+    Implementation _implementation ;
+    MixFunction _mix ;
+    int _frame_size ;
+
+    std::vector<float> _sum ;
+    std::vector<float> _gains ;
+    std::vector<float> _energies ;
+    std::vector<float> _peaks ;
+
+    // limiter: input delay line, sliding minimum of the gains needed by the samples (monotonic queue)
+    // and moving average of that minimum.
+    float _delay[LIMITER_LOOKAHEAD] ;
+    float _min_values[LIMITER_LOOKAHEAD] ;
+    uint32_t _min_positions[LIMITER_LOOKAHEAD] ;
+    uint32_t _min_first ;
+    uint32_t _min_count ;
+    float _average_values[LIMITER_LOOKAHEAD] ;
+    double _average_sum ;
+    float _envelope ;
+    uint32_t _position ;
+};
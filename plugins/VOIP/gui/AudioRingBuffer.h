@@ -0,0 +1,182 @@
+/*******************************************************************************
+ * plugins/VOIP/gui/AudioRingBuffer.h                                          *
+ *                                                                             *
+ * Copyright (C) 2012 by Retroshare Team <retroshare.project@gmail.com>        *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+#include <speex/speex_types.h>
+
+// Buffers of the audio path. Both are allocated once and never allocate afterwards, so that the audio
+// callbacks do not touch the heap. They can be used without lock by one writer and one reader thread.
+
+// Ring of 16 bits samples, with a fixed capacity.
+//
+class AudioRingBuffer
+{
+public:
+    // capacity in samples, rounded up to a power of 2
+    AudioRingBuffer(uint32_t capacity)
+        : _head(0), _tail(0)
+    {
+        for(_capacity = 1 ; _capacity < capacity ; _capacity <<= 1) ;
+        _samples = new spx_int16_t[_capacity] ;
+    }
+    ~AudioRingBuffer() { delete[] _samples ; }
+
+    uint32_t available() const { return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_relaxed) ; }
+    uint32_t space() const { return _capacity - (_tail.load(std::memory_order_relaxed) - _head.load(std::memory_order_acquire)) ; }
+
+    // Writer side: copies at most count samples (whatever fits) and returns how many. src may be unaligned.
+    //
+    uint32_t write(const void *src, uint32_t count)
+    {
+        uint32_t tail = _tail.load(std::memory_order_relaxed) ;
+        uint32_t free_space = space() ;
+
+        if(count > free_space)
+            count = free_space ;
+
+        copy((const char*)src, tail, count, true) ;
+        _tail.store(tail + count,std::memory_order_release) ;
+
+        return count ;
+    }
+
+    // Reader side: copies at most count samples and returns how many. dst may be unaligned.
+    //
+    uint32_t read(void *dst, uint32_t count)
+    {
+        uint32_t head = _head.load(std::memory_order_relaxed) ;
+        uint32_t ready = available() ;
+
+        if(count > ready)
+            count = ready ;
+
+        copy((char*)dst, head, count, false) ;
+        _head.store(head + count,std::memory_order_release) ;
+
+        return count ;
+    }
+
+    // Reader side: drops everything
+    void clear() { _head.store(_tail.load(std::memory_order_acquire),std::memory_order_release) ; }
+
+private:
+    AudioRingBuffer(const AudioRingBuffer&) ;
+    AudioRingBuffer& operator=(const AudioRingBuffer&) ;
+
+    // copies count samples from/to the ring at position pos, in at most two parts
+    template<class P> void copy(P buf, uint32_t pos, uint32_t count, bool to_ring)
+    {
+        uint32_t start = pos & (_capacity-1) ;
+        uint32_t first = (count < _capacity - start) ? count : _capacity - start ;
+
+        if(to_ring)
+        {
+            memcpy(_samples + start, buf, first * sizeof(spx_int16_t)) ;
+            memcpy(_samples, buf + first * sizeof(spx_int16_t), (count - first) * sizeof(spx_int16_t)) ;
+        }
+        else
+        {
+            memcpy((void*)buf, _samples + start, first * sizeof(spx_int16_t)) ;
+            memcpy((void*)(buf + first * sizeof(spx_int16_t)), _samples, (count - first) * sizeof(spx_int16_t)) ;
+        }
+    }
+
+    spx_int16_t *_samples ;
+    uint32_t _capacity ;
+
+    // counters, wrapping around, on separate cache lines
+    std::atomic<uint32_t> _head ;
+    char _padding[64] ;
+    std::atomic<uint32_t> _tail ;
+};
+
+// Queue of encoded frames in preallocated slots of MAX_PACKET_SIZE bytes.
+//
+class AudioPacketQueue
+{
+public:
+    static const int MAX_PACKET_SIZE = 256 ;	// a speex wide band frame is at most 106 bytes
+
+    // count is rounded up to a power of 2
+    AudioPacketQueue(uint32_t count)
+        : _head(0), _tail(0)
+    {
+        for(_count = 1 ; _count < count ; _count <<= 1) ;
+        _slots = new Slot[_count] ;
+    }
+    ~AudioPacketQueue() { delete[] _slots ; }
+
+    bool empty() const { return _head.load(std::memory_order_relaxed) == _tail.load(std::memory_order_acquire) ; }
+
+    // Writer side: returns the slot to fill, or NULL when the queue is full. Then call push() with
+    // the size written.
+    //
+    char *slot()
+    {
+        uint32_t tail = _tail.load(std::memory_order_relaxed) ;
+
+        if(tail - _head.load(std::memory_order_acquire) == _count)
+            return NULL ;
+
+        return _slots[tail & (_count-1)].data ;
+    }
+    void push(int size)
+    {
+        uint32_t tail = _tail.load(std::memory_order_relaxed) ;
+
+        _slots[tail & (_count-1)].size = size ;
+        _tail.store(tail + 1,std::memory_order_release) ;
+    }
+
+    // Reader side: the oldest packet, valid until pop(). NULL when empty.
+    //
+    const char *front(int& size) const
+    {
+        if(empty())
+            return NULL ;
+
+        const Slot& s(_slots[_head.load(std::memory_order_relaxed) & (_count-1)]) ;
+        size = s.size ;
+        return s.data ;
+    }
+    void pop() { _head.store(_head.load(std::memory_order_relaxed) + 1,std::memory_order_release) ; }
+
+private:
+    AudioPacketQueue(const AudioPacketQueue&) ;
+    AudioPacketQueue& operator=(const AudioPacketQueue&) ;
+
+    struct Slot
+    {
+        char data[MAX_PACKET_SIZE] ;
+        int size ;
+    };
+
+    Slot *_slots ;
+    uint32_t _count ;
+
+    std::atomic<uint32_t> _head ;
+    char _padding[64] ;
+    std::atomic<uint32_t> _tail ;
+};
@@ -23,9 +23,11 @@
 #define iroundf(x) ( static_cast<int>(x) )
 
 #include <QPainter>
+#include <QHBoxLayout>
 
 #include "AudioStats.h"
 #include "VOIPConfigPanel.h"
+#include "SpeexProcessor.h"
 //#include "Global.h"
 //#include "smallft.h"
 
@@ -120,6 +122,61 @@ void AudioBar::paintEvent(QPaintEvent *) {
         }
 
 }
+
+AudioSpeakerLevels::AudioSpeakerLevels(QWidget *p) : QWidget(p) {
+	outputProcessor = NULL;
+
+	QHBoxLayout *layout = new QHBoxLayout(this);
+	layout->setContentsMargins(0, 0, 0, 0);
+
+	qtTick = new QTimer(this);
+	connect(qtTick, SIGNAL(timeout()), this, SLOT(updateLevels()));
+
+	hide();
+}
+
+void AudioSpeakerLevels::setOutputProcessor(QtSpeex::SpeexOutputProcessor *processor) {
+	outputProcessor = processor;
+
+	if (outputProcessor) {
+		qtTick->start(50);
+	} else {
+		qtTick->stop();
+		qDeleteAll(qmBars);
+		qmBars.clear();
+		hide();
+	}
+}
+
+void AudioSpeakerLevels::updateLevels() {
+	if (! outputProcessor)
+		return;
+
+	QMap<QString, AudioMixer::StreamState> levels;
+	outputProcessor->getSpeakerLevels(levels);
+
+	for (QMap<QString, AudioMixer::StreamState>::const_iterator it = levels.begin(); it != levels.end(); ++it) {
+		AudioBar *&bar = qmBars[it.key()];
+
+		if (! bar) {
+			// same dB scale as the speech meter of the settings: quiet under -40 dB, too loud over -6 dB
+			bar = new AudioBar(this);
+			bar->setMinimumSize(60, 12);
+			bar->setMaximumWidth(100);
+			bar->iBelow = iroundf((32767.f/96.0f) * (96.0f - 40.0f) + 0.5f);
+			bar->iAbove = iroundf((32767.f/96.0f) * (96.0f - 6.0f) + 0.5f);
+			layout()->addWidget(bar);
+		}
+
+		bar->iValue = iroundf((32767.f/96.0f) * (96.0f + it.value().levelDecibels()) + 0.5f);
+		bar->iPeak = iroundf((32767.f/96.0f) * (96.0f + it.value().peakDecibels()) + 0.5f);
+		bar->setToolTip(tr("Incoming audio: %1 dB, gain %2%").arg(it.value().levelDecibels(), 0, 'f', 1).arg(iroundf(it.value().gain * 100.0f)));
+		bar->update();
+	}
+
+	setVisible(! qmBars.isEmpty());
+}
+
 /*
 AudioEchoWidget::AudioEchoWidget(QWidget *p) : QWidget(p) {
 	setMinimumSize(100, 60);
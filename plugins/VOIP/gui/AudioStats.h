@@ -22,6 +22,7 @@
 
 #include <QTimer>
 #include <QWidget>
+#include <QMap>
 
 //#include "mumble_pch.hpp"
 
@@ -42,6 +43,27 @@ class AudioBar : public QWidget {
 		QList<QColor> qlReplacableColors;
 		QList<Qt::BrushStyle> qlReplacementBrushes;
 };
+
+namespace QtSpeex {
+	class SpeexOutputProcessor;
+}
+
+// One AudioBar per speaker of a call, with the levels measured by the mixer of the output processor.
+// Hidden as long as nobody is heard.
+class AudioSpeakerLevels : public QWidget {
+	private:
+		Q_OBJECT
+		Q_DISABLE_COPY(AudioSpeakerLevels)
+	public:
+		AudioSpeakerLevels(QWidget *parent = NULL);
+		void setOutputProcessor(QtSpeex::SpeexOutputProcessor *processor);
+	protected slots:
+		void updateLevels();
+	protected:
+		QTimer *qtTick;
+		QtSpeex::SpeexOutputProcessor *outputProcessor;
+		QMap<QString, AudioBar*> qmBars;
+};
 /*
 class AudioEchoWidget : public QWidget {
 	private:
@@ -43,14 +43,17 @@ using namespace QtSpeex;
 
 SpeexInputProcessor::SpeexInputProcessor(QObject *parent) : QIODevice(parent),
     iMaxBitRate(16800),
-    lastEchoFrame(NULL),
+    psEcho(NULL),
     enc_state(0),
     enc_bits(),
     send_timestamp(0),
     bResetProcessor(true),
     preprocessor(0),
     echo_state(0),
-    inputBuffer()
+    inputBuffer(SAMPLING_RATE),
+    cOddByte(0),
+    bHasOddByte(false),
+    outputNetworkBuffer(64)
 {
         enc_bits = new SpeexBits;
         speex_bits_init(enc_bits);
@@ -90,8 +93,10 @@ SpeexInputProcessor::SpeexInputProcessor(QObject *parent) : QIODevice(parent),
         //iJitterSeq = 0;
         //iMinBuffered = 1000;
 
-        //psMic = new short[iFrameSize];
+        psMic = new short[FRAME_SIZE];
         psClean = new short[SAMPLING_RATE];
+        psEcho = new short[FRAME_SIZE];
+        memset(psEcho, 0, FRAME_SIZE * sizeof(short));
 
         //psSpeaker = NULL;
 
@@ -129,11 +134,22 @@ SpeexInputProcessor::~SpeexInputProcessor() {
 
         speex_bits_destroy(enc_bits);
         delete enc_bits;
+        delete[] psMic;
         delete[] psClean;
+        delete[] psEcho;
 }
 
 QByteArray SpeexInputProcessor::getNetworkPacket() {
-        return outputNetworkBuffer.takeFirst();
+        int size = 0;
+        const char *packet = outputNetworkBuffer.front(size);
+
+        if (!packet)
+                return QByteArray();
+
+        QByteArray networkFrame(packet, size);
+        outputNetworkBuffer.pop();
+
+        return networkFrame;
 }
 
 bool SpeexInputProcessor::hasPendingPackets() {
@@ -146,12 +162,35 @@ qint64 SpeexInputProcessor::writeData(const char *data, qint64 maxSize) {
         float sum;
         short max;
 
-        inputBuffer += QByteArray(data, maxSize);
+        const char *src = data;
+        qint64 size = maxSize;
+
+        // a sample split between two writes: complete it with the byte kept from the previous one.
+        // There is always room for it, the buffer holds less than a frame between two writes.
+        if (bHasOddByte && size > 0) {
+                char sample[2] = { cOddByte, src[0] };
+                inputBuffer.write(sample, 1);
+                bHasOddByte = false;
+                ++src;
+                --size;
+        }
+
+        // the samples go through the ring buffer in as many times as needed, a frame is processed as soon as it is complete
+        qint64 nbSamples = size / sizeof(qint16);
+        qint64 written = 0;
 
-        while((size_t)inputBuffer.size() > FRAME_SIZE * sizeof(qint16)) {
+        if (size % sizeof(qint16)) {
+                cOddByte = src[size - 1];
+                bHasOddByte = true;
+        }
 
-                QByteArray source_frame = inputBuffer.left(FRAME_SIZE * sizeof(qint16));
-                short* psMic = (short *)source_frame.data();
+        while(written < nbSamples || inputBuffer.available() >= FRAME_SIZE) {
+
+                if (inputBuffer.available() < FRAME_SIZE) {
+                        written += inputBuffer.write(src + written * sizeof(qint16), static_cast<uint32_t>(qMin(nbSamples - written, static_cast<qint64>(SAMPLING_RATE))));
+                        continue;
+                }
+                inputBuffer.read(psMic, FRAME_SIZE);
 
                 //let's do volume detection
                 sum=1.0f;
@@ -211,7 +250,7 @@ qint64 SpeexInputProcessor::writeData(const char *data, qint64 maxSize) {
 
                 short * psSource = psMic;
                 if (echo_state && rsVOIP->getVoipEchoCancel()) {
-                    speex_echo_playback(echo_state, (short*)lastEchoFrame->data());
+                    speex_echo_playback(echo_state, psEcho);
                     speex_echo_capture(echo_state,psMic,psClean);
                     psSource = psClean;
                 }
@@ -318,13 +357,20 @@ qint64 SpeexInputProcessor::writeData(const char *data, qint64 maxSize) {
                 if (bIsSpeech) {
                     speex_bits_reset(enc_bits);
                     speex_encode_int(enc_state, psSource, enc_bits);
-                    QByteArray networkFrame;
-                    networkFrame.resize(speex_bits_nbytes(enc_bits)+4);//add 4 for the frame timestamp for the jitter buffer
-                    int packetSize = speex_bits_write(enc_bits, networkFrame.data()+4, networkFrame.size()-4);
-                    ((int*)networkFrame.data())[0] = send_timestamp;
 
-                    outputNetworkBuffer.append(networkFrame);
-                    emit networkPacketReady();
+                    char *networkFrame = outputNetworkBuffer.slot();
+                    int packetSize = speex_bits_nbytes(enc_bits);
+
+                    if (networkFrame && packetSize + 4 <= AudioPacketQueue::MAX_PACKET_SIZE) {
+                        //add 4 for the frame timestamp for the jitter buffer
+                        packetSize = speex_bits_write(enc_bits, networkFrame+4, AudioPacketQueue::MAX_PACKET_SIZE-4);
+                        memcpy(networkFrame, &send_timestamp, 4);
+
+                        outputNetworkBuffer.push(packetSize+4);
+                        emit networkPacketReady();
+                    } else {
+                        std::cerr << "SpeexInputProcessor: dropping audio frame of " << packetSize << " bytes (network queue full or frame too large)." << std::endl;
+                    }
 
                     iRealTimeBitrate = packetSize * SAMPLING_RATE / FRAME_SIZE * 8;
                 } else {
@@ -337,8 +383,6 @@ qint64 SpeexInputProcessor::writeData(const char *data, qint64 maxSize) {
                 send_timestamp += FRAME_SIZE;
                 if (send_timestamp >= INT_MAX)
                     send_timestamp = 0;
-
-                inputBuffer = inputBuffer.right(inputBuffer.size() - FRAME_SIZE * sizeof(qint16));
 	}
 
 	return maxSize;
@@ -346,8 +390,11 @@ qint64 SpeexInputProcessor::writeData(const char *data, qint64 maxSize) {
 
 
 SpeexOutputProcessor::SpeexOutputProcessor(QObject *parent) : QIODevice(parent),
-    outputBuffer()
+    outputBuffer(2 * SAMPLING_RATE),
+    mixer(FRAME_SIZE)
 {
+    mixFrame = new spx_int16_t[FRAME_SIZE];
+    echoFrame.resize(FRAME_SIZE * sizeof(qint16));
 }
 
 SpeexOutputProcessor::~SpeexOutputProcessor() {
@@ -357,6 +404,7 @@ SpeexOutputProcessor::~SpeexOutputProcessor() {
         speex_jitter_destroy(*(i.value()));
         free (i.value());
     }
+    delete[] mixFrame;
 }
 
 void SpeexOutputProcessor::putNetworkPacket(QString name, QByteArray packet) {
@@ -380,6 +428,10 @@ void SpeexOutputProcessor::putNetworkPacket(QString name, QByteArray packet) {
             int on = 1;
             speex_decoder_ctl(userJitter->dec, SPEEX_SET_ENH, &on);
             userJitterHash.insert(name, userJitter);
+
+            speakerFrames.resize(userJitterHash.size() * FRAME_SIZE);
+            mixerFrames.resize(userJitterHash.size());
+            mixerStates.resize(userJitterHash.size());
         }
 
         int recv_timestamp = ((int*)packet.data())[0];
@@ -398,14 +450,13 @@ bool SpeexInputProcessor::isSequential() const {
 void SpeexInputProcessor::addEchoFrame(QByteArray* echo_frame) {
     if (rsVOIP->getVoipEchoCancel() && echo_frame) {
         QMutexLocker l(&qmSpeex);
-        lastEchoFrame = echo_frame;
         if (!echo_state) {//init echo_state
             echo_state = speex_echo_state_init(FRAME_SIZE, ECHOTAILSIZE*FRAME_SIZE);
             int tmp = SAMPLING_RATE;
             speex_echo_ctl(echo_state, SPEEX_ECHO_SET_SAMPLING_RATE, &tmp);
             bResetProcessor = true;
         }
-        lastEchoFrame = echo_frame;
+        memcpy(psEcho, echo_frame->constData(), qMin(echo_frame->size(), static_cast<int>(FRAME_SIZE * sizeof(short))));
     }
 }
 
@@ -413,44 +464,45 @@ void SpeexInputProcessor::addEchoFrame(QByteArray* echo_frame) {
 qint64 SpeexOutputProcessor::readData(char *data, qint64 maxSize) {
 
     int ts = 0; //time stamp for the jitter call
-    while(outputBuffer.size() < maxSize) {
-        QByteArray* result_frame = new QByteArray();
-        result_frame->resize(FRAME_SIZE * sizeof(qint16));
-        result_frame->fill(0,FRAME_SIZE * sizeof(qint16));
+    uint32_t nbSamples = static_cast<uint32_t>(qMin(maxSize / static_cast<qint64>(sizeof(qint16)), static_cast<qint64>(2 * SAMPLING_RATE)));
+
+    while(outputBuffer.available() < nbSamples && outputBuffer.space() >= FRAME_SIZE) {
+        int nbSpeakers = 0;
         QHashIterator<QString, SpeexJitter*> i(userJitterHash);
         while (i.hasNext()) {
             i.next();
             SpeexJitter* jitter = i.value();
-            QByteArray intermediate_frame;
-            intermediate_frame.resize(FRAME_SIZE * sizeof(qint16));
             if (jitter->firsttimecalling_get)
             {
                 //int ts = jitter->mostUpdatedTSatPut;
                 jitter->firsttimecalling_get = false;
             }
-            speex_jitter_get(*jitter, (spx_int16_t*)intermediate_frame.data(), &ts);
-            for (int j = 0; j< FRAME_SIZE; j++) {
-                short sample1 = ((short*)result_frame->data())[j];
-                short sample2 = ((short*)intermediate_frame.data())[j];
-                float samplef1 = sample1 / 32768.0f;
-                float samplef2 = sample2 / 32768.0f;
-                float mixed = samplef1 + 0.8f * samplef2;
-                // hard clipping
-                if (mixed > 1.0f) mixed = 1.0f;
-                if (mixed < -1.0f) mixed = -1.0f;
-                ((spx_int16_t*)result_frame->data())[j] = (short)(mixed * 32768.0f);
-            }
+            spx_int16_t *speakerFrame = &speakerFrames[nbSpeakers * FRAME_SIZE];
+            speex_jitter_get(*jitter, speakerFrame, &ts);
+
+            mixerFrames[nbSpeakers] = speakerFrame;
+            mixerStates[nbSpeakers] = &jitter->mixing;
+            ++nbSpeakers;
         }
-        outputBuffer += *result_frame;
-        emit playingFrame(result_frame);
+        mixer.mix(mixerFrames.data(), mixerStates.data(), nbSpeakers, mixFrame);
+
+        outputBuffer.write(mixFrame, FRAME_SIZE);
+
+        memcpy(echoFrame.data(), mixFrame, FRAME_SIZE * sizeof(qint16));
+        emit playingFrame(&echoFrame);
     }
 
-    QByteArray resultBuffer = outputBuffer.left(maxSize);
-    memcpy(data, resultBuffer.data(), resultBuffer.size());
+    return outputBuffer.read(data, nbSamples) * sizeof(qint16);
+}
 
-    outputBuffer = outputBuffer.right(outputBuffer.size() - resultBuffer.size());
+void SpeexOutputProcessor::getSpeakerLevels(QMap<QString, AudioMixer::StreamState>& levels) const {
+    levels.clear();
 
-    return resultBuffer.size();
+    QHashIterator<QString, SpeexJitter*> i(userJitterHash);
+    while (i.hasNext()) {
+        i.next();
+        levels.insert(i.key(), i.value()->mixing);
+    }
 }
 
 bool SpeexOutputProcessor::isSequential() const {
@@ -468,6 +520,7 @@ void SpeexOutputProcessor::speex_jitter_init(SpeexJitter *jit, void *decoder, in
    jit->valid_bits = 0;
    jit->firsttimecalling_get = true;
    jit->mostUpdatedTSatPut = 0;
+   jit->mixing = AudioMixer::StreamState();
 }
 
 void SpeexOutputProcessor::speex_jitter_destroy(SpeexJitter jitter)
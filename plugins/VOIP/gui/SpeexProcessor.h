@@ -31,10 +31,15 @@
 #include <QMap>
 #include <QStack>
 
+#include <vector>
+
 #include <speex/speex_preprocess.h>
 #include <speex/speex_echo.h>
 #include <speex/speex_jitter.h>
 
+#include "AudioMixer.h"
+#include "AudioRingBuffer.h"
+
 #define SAMPLING_RATE 16000 //must be the same as the speex setted mode (speex_wb_mode)
 #define FRAME_SIZE 320 //must be the same as the speex setted mode (speex_wb_mode)
 #define ECHOTAILSIZE  10
@@ -50,6 +55,7 @@ typedef struct SpeexJitter {
    spx_int32_t frame_size;           /**< Frame size of Speex decoder */
    int mostUpdatedTSatPut;           /**< timestamp of the last packet put */
    bool firsttimecalling_get;
+   AudioMixer::StreamState mixing;   /**< gain and levels of the speaker in the mix */
 } SpeexJitter;
 
 namespace QtSpeex {
@@ -70,7 +76,7 @@ namespace QtSpeex {
                 bool bPreviousVoice;
 
         public slots:
-                void addEchoFrame(QByteArray*);
+                void addEchoFrame(QByteArray*);	// the frame is copied, it is only valid during the call
 
 	signals:
 		void networkPacketReady();
@@ -81,7 +87,7 @@ namespace QtSpeex {
                 virtual bool isSequential() const;
 
         private:
-                QByteArray* lastEchoFrame;
+                short * psEcho; //last frame played, for the echo cancellation
                 int iSilentFrames;
                 int iHoldFrames;
 
@@ -94,10 +100,13 @@ namespace QtSpeex {
 
                 SpeexPreprocessState* preprocessor;
                 SpeexEchoState       *echo_state;
+                short * psMic;   //current frame taken from the input buffer
                 short * psClean; //temp buffer for audio sampling after echo cleaning (if enabled)
 
-                QByteArray inputBuffer;
-                QList<QByteArray> outputNetworkBuffer;
+                AudioRingBuffer inputBuffer;
+                char cOddByte;      //first byte of a sample split between two writes
+                bool bHasOddByte;
+                AudioPacketQueue outputNetworkBuffer;
         };
 
 
@@ -110,15 +119,25 @@ namespace QtSpeex {
 
                 void putNetworkPacket(QString name, QByteArray packet);
 
+                // gain and levels of each speaker, for the meters. From the same thread as putNetworkPacket().
+                void getSpeakerLevels(QMap<QString, AudioMixer::StreamState>& levels) const;
+
         protected:
                 virtual qint64 readData(char *data, qint64 maxSize);
                 virtual qint64 writeData(const char * /*data*/, qint64 /*maxSize*/) {return 0;} //not used for output processor
                 virtual bool isSequential() const;
 
         signals:
-                void playingFrame(QByteArray*);
+                void playingFrame(QByteArray*);	// always the same buffer, to be copied by the receiver
         private:
-                QByteArray outputBuffer;
+                AudioRingBuffer outputBuffer;
+                spx_int16_t * mixFrame;     //frame being mixed
+                QByteArray echoFrame;
+
+                AudioMixer mixer;
+                std::vector<spx_int16_t> speakerFrames;        //frames decoded for each speaker, resized when one joins
+                std::vector<const spx_int16_t *> mixerFrames;
+                std::vector<AudioMixer::StreamState *> mixerStates;
                 QList<QByteArray> inputNetworkBuffer;
 
                 QHash<QString, SpeexJitter*> userJitterHash;
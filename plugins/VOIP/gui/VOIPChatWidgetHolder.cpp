@@ -31,6 +31,7 @@
 #include "VOIPChatWidgetHolder.h"
 #include "VideoProcessor.h"
 #include "QVideoDevice.h"
+#include "AudioStats.h"
 //retroshare GUI
 #include "gui/SoundManager.h"
 #include "util/HandleRichText.h"
@@ -39,6 +40,7 @@
 //libretroshare
 #include <retroshare/rsstatus.h>
 #include <retroshare/rspeers.h>
+#include "util/rsmemory.h"
 
 #define CALL_START ":/images/call-start.png"
 #define CALL_STOP  ":/images/call-stop.png"
@@ -158,6 +160,9 @@ VOIPChatWidgetHolder::VOIPChatWidgetHolder(ChatWidget *chatWidget, VOIPNotify *n
 	connect(hideChatTextToggleButton, SIGNAL(clicked()), this , SLOT(toggleHideChatText()));
 	connect(fullscreenToggleButton, SIGNAL(clicked()), this , SLOT(toggleFullScreen()));
 
+	audioSpeakerLevels = new AudioSpeakerLevels ;
+
+	mChatWidget->addTitleBarWidget(audioSpeakerLevels) ;
 	mChatWidget->addTitleBarWidget(audioListenToggleButton) ;
 	mChatWidget->addTitleBarWidget(audioCaptureToggleButton) ;
 	mChatWidget->addTitleBarWidget(videoCaptureToggleButton) ;
@@ -626,6 +631,11 @@ void VOIPChatWidgetHolder::toggleAudioCapture()
 			if (inputAudioDevice) {
 				inputAudioDevice->stop();
 			}
+			//desactivate audio output and the speaker meters with it
+			if (outputAudioDevice) {
+				outputAudioDevice->stop();
+			}
+			audioSpeakerLevels->setOutputProcessor(NULL);
 
 			//send system message
 			if (mChatWidget)
@@ -728,7 +738,7 @@ void VOIPChatWidgetHolder::toggleVideoCapture()
 	videoCaptureToggleButtonFS->setToolTip(videoCaptureToggleButton->toolTip());
 }
 
-void VOIPChatWidgetHolder::addVideoData(const RsPeerId &peer_id, QByteArray* array)
+void VOIPChatWidgetHolder::addVideoData(const RsPeerId &peer_id, const RsVOIPDataChunk& chunk)
 {
 	sendVideoRingTime = -2;//Receive Video so Accepted
 	if (!videoCaptureToggleButton->isChecked()) {
@@ -736,11 +746,6 @@ void VOIPChatWidgetHolder::addVideoData(const RsPeerId &peer_id, QByteArray* arr
 		return;
 	}
 
-	RsVOIPDataChunk chunk ;
-	chunk.type = RsVOIPDataChunk::RS_VOIP_DATA_TYPE_VIDEO ;
-	chunk.size = array->size() ;
-	chunk.data = array->data() ;
-
 	videoProcessor->receiveEncodedData(chunk) ;
 
 }
@@ -905,7 +910,12 @@ void VOIPChatWidgetHolder::addAudioData(const RsPeerId &peer_id, QByteArray* arr
             connect(outputAudioProcessor, SIGNAL(playingFrame(QByteArray*)), inputAudioProcessor, SLOT(addEchoFrame(QByteArray*)));
         }
         outputAudioProcessor->open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    }
+
+    if (outputAudioDevice->state() == QAudio::StoppedState) {
+        //first packet of the call, or call resumed after a hang up
         outputAudioDevice->start(outputAudioProcessor);
+        audioSpeakerLevels->setOutputProcessor(outputAudioProcessor);
     }
 
     if (outputAudioDevice && outputAudioDevice->error() != QAudio::NoError) {
@@ -932,7 +942,7 @@ void VOIPChatWidgetHolder::sendVideoData()
 	RsVOIPDataChunk chunk ;
 
 	while(inputVideoDevice && inputVideoDevice->getNextEncodedPacket(chunk))
-		rsVOIP->sendVoipData(mChatWidget->getChatId().toPeerId(),chunk) ;
+		rsVOIP->sendVoipData(mChatWidget->getChatId().toPeerId(),std::move(chunk)) ;
 }
 
 void VOIPChatWidgetHolder::sendAudioData()
@@ -940,10 +950,15 @@ void VOIPChatWidgetHolder::sendAudioData()
     while(inputAudioProcessor && inputAudioProcessor->hasPendingPackets()) {
         QByteArray qbarray = inputAudioProcessor->getNetworkPacket();
         RsVOIPDataChunk chunk;
+        chunk.data = rs_malloc(qbarray.size());
+
+        if(!chunk.data)
+            continue ;
+
+        memcpy(chunk.data,qbarray.constData(),qbarray.size()) ;
         chunk.size = qbarray.size();
-        chunk.data = (void*)qbarray.constData();
         chunk.type = RsVOIPDataChunk::RS_VOIP_DATA_TYPE_AUDIO ;
-        rsVOIP->sendVoipData(mChatWidget->getChatId().toPeerId(),chunk);
+        rsVOIP->sendVoipData(mChatWidget->getChatId().toPeerId(),std::move(chunk));
     }
 }
 
@@ -28,6 +28,7 @@
 #include "gui/VOIPNotify.h"
 #include <gui/SpeexProcessor.h>
 #include "services/rsVOIPItems.h"
+#include "interface/rsVOIP.h"
 //retroshare-gui
 #include <gui/chat/ChatWidget.h>
 #include <gui/common/RsButtonOnText.h>
@@ -38,6 +39,7 @@ class QAudioOutput;
 class QVideoInputDevice ;
 class QVideoOutputDevice ;
 class VideoProcessor ;
+class AudioSpeakerLevels ;
 
 #define VOIP_SOUND_INCOMING_AUDIO_CALL "VOIP_incoming_audio_call"
 #define VOIP_SOUND_INCOMING_VIDEO_CALL "VOIP_incoming_video_call"
@@ -55,7 +57,7 @@ public:
 	virtual void updateStatus(int status);
 
 	void addAudioData(const RsPeerId &peer_id, QByteArray* array) ;
-	void addVideoData(const RsPeerId &peer_id, QByteArray* array) ;
+	void addVideoData(const RsPeerId &peer_id, const RsVOIPDataChunk& chunk) ;
 	void setAcceptedBandwidth(uint32_t bytes_per_sec) ;
 
 	void ReceivedInvitation(const RsPeerId &peer_id, int flags) ;
@@ -104,6 +106,7 @@ protected:
 
 	QtSpeex::SpeexInputProcessor* inputAudioProcessor;
 	QtSpeex::SpeexOutputProcessor* outputAudioProcessor;
+	AudioSpeakerLevels *audioSpeakerLevels;	// meters of the speakers heard
 
 	// Video input/output
 	QVideoOutputDevice *outputVideoDevice;
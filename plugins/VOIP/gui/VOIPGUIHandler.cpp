@@ -126,12 +126,14 @@ void VOIPGUIHandler::ReceivedVoipData(const RsPeerId &peer_id)
 				if (acwh) {
 						for (unsigned int chunkIndex=0; chunkIndex<chunks.size(); chunkIndex++)
 						{
-							QByteArray qb(reinterpret_cast<const char *>(chunks[chunkIndex].data),chunks[chunkIndex].size);
-
 							if(chunks[chunkIndex].type == RsVOIPDataChunk::RS_VOIP_DATA_TYPE_AUDIO)
-							acwh->addAudioData(peer_id, &qb);
+							{
+								// no copy: the packet is decoded before the chunk is freed
+								QByteArray qb = QByteArray::fromRawData(reinterpret_cast<const char *>(chunks[chunkIndex].data),chunks[chunkIndex].size);
+								acwh->addAudioData(peer_id, &qb);
+							}
 							else if(chunks[chunkIndex].type == RsVOIPDataChunk::RS_VOIP_DATA_TYPE_VIDEO)
-							acwh->addVideoData(peer_id, &qb);
+							acwh->addVideoData(peer_id, chunks[chunkIndex]);
 							else
 								std::cerr << "VOIPGUIHandler::ReceivedVoipData(): Unknown data type received. type=" << chunks[chunkIndex].type << std::endl;
 						}
@@ -142,10 +144,7 @@ void VOIPGUIHandler::ReceivedVoipData(const RsPeerId &peer_id)
 	} else {
 		std::cerr << "VOIPGUIHandler::ReceivedVoipData() Error: received data for a chat dialog that does not stand VOIP (Peer id = " << peer_id.toStdString() << "!" << std::endl;
 	}
-
-	for(unsigned int chunkIndex=0; chunkIndex<chunks.size(); chunkIndex++){
-		free(chunks[chunkIndex].data);
-	}
+	// the chunks free their data
 }
 
 void VOIPGUIHandler::ReceivedVoipBandwidthInfo(const RsPeerId &peer_id, int bytes_per_sec)
@@ -0,0 +1,683 @@
+/*******************************************************************************
+ * plugins/VOIP/gui/VideoConverter.cpp                                         *
+ *                                                                             *
+ * Copyright (C) 2012 by Retroshare Team <retroshare.project@gmail.com>        *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+#include <algorithm>
+
+#include <QImage>
+
+#include "VideoConverter.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VIDEO_CONVERTER_X86 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define VIDEO_CONVERTER_NEON 1
+#include <arm_neon.h>
+#endif
+
+// BT.601 studio range, 8 bits fixed point:
+//    Y  = (( 66 R + 129 G +  25 B + 128) >> 8) + 16
+//    Cr = ((112 R -  94 G -  18 B + 128) >> 8) + 128
+//    Cb = ((-38 R -  74 G + 112 B + 128) >> 8) + 128
+// Chroma is computed on the sum of the 2x2 block, hence >> 10.
+//
+// And back, with C = Y - 16, D = Cb - 128, E = Cr - 128:
+//    R = (298 C         + 409 E + 128) >> 8
+//    G = (298 C - 100 D - 208 E + 128) >> 8
+//    B = (298 C + 516 D         + 128) >> 8
+//
+// Differential frames are clamped rather than computed modulo 256, because the decompressed JPEG
+// frames are clamped too. With the sign bit flipped (x ^ 0x80 = x - 128 as a signed byte),
+// clamp(a - b + 128) and clamp(a + b - 128) are the signed saturated subtraction and addition.
+
+static inline uint8_t clampByte(int v) { return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v)) ; }
+
+static inline int lumaOf(uint32_t p)
+{
+    return (((66 * ((p >> 16) & 0xff) + 129 * ((p >> 8) & 0xff) + 25 * (p & 0xff) + 128) >> 8) + 16) ;
+}
+
+static void rgbToYuvRowScalar(const uint32_t *row0, const uint32_t *row1, int width, uint8_t *y0, uint8_t *y1, uint8_t *cr, uint8_t *cb)
+{
+    for(int x=0;x+1<width;x+=2)
+    {
+        uint32_t p00 = row0[x], p01 = row0[x+1], p10 = row1[x], p11 = row1[x+1] ;
+
+        y0[x] = lumaOf(p00) ; y0[x+1] = lumaOf(p01) ;
+        y1[x] = lumaOf(p10) ; y1[x+1] = lumaOf(p11) ;
+
+        int R = ((p00 >> 16) & 0xff) + ((p01 >> 16) & 0xff) + ((p10 >> 16) & 0xff) + ((p11 >> 16) & 0xff) ;
+        int G = ((p00 >>  8) & 0xff) + ((p01 >>  8) & 0xff) + ((p10 >>  8) & 0xff) + ((p11 >>  8) & 0xff) ;
+        int B = ( p00        & 0xff) + ( p01        & 0xff) + ( p10        & 0xff) + ( p11        & 0xff) ;
+
+        cr[x/2] = clampByte((( 112 * R -  94 * G -  18 * B + 512) >> 10) + 128) ;
+        cb[x/2] = clampByte(((- 38 * R -  74 * G + 112 * B + 512) >> 10) + 128) ;
+    }
+}
+
+static void yuvToRgbRowScalar(const uint8_t *y, const uint8_t *cr, const uint8_t *cb, int width, uint32_t *out)
+{
+    for(int x=0;x<width;++x)
+    {
+        int C = 298 * (y[x] - 16) + 128 ;
+        int D = cb[x/2] - 128 ;
+        int E = cr[x/2] - 128 ;
+
+        out[x] = 0xff000000 | (clampByte((C + 409 * E) >> 8) << 16) | (clampByte((C - 100 * D - 208 * E) >> 8) << 8) | clampByte((C + 516 * D) >> 8) ;
+    }
+}
+
+static void frameDifferenceScalar(const uint8_t *image, const uint8_t *reference, uint8_t *out, int size)
+{
+    for(int i=0;i<size;++i)
+        out[i] = clampByte((int)image[i] - (int)reference[i] + 128) ;
+}
+
+static void addFrameDifferenceScalar(const uint8_t *reference, const uint8_t *diff, uint8_t *out, int size)
+{
+    for(int i=0;i<size;++i)
+        out[i] = clampByte((int)reference[i] + (int)diff[i] - 128) ;
+}
+
+#ifdef VIDEO_CONVERTER_NEON
+
+static void frameDifferenceNEON(const uint8_t *image, const uint8_t *reference, uint8_t *out, int size)
+{
+    const uint8x16_t sign = vdupq_n_u8(0x80) ;
+    int i = 0 ;
+
+    for(;i+16<=size;i+=16)
+    {
+        int8x16_t a = vreinterpretq_s8_u8(veorq_u8(vld1q_u8(image+i),sign)) ;
+        int8x16_t b = vreinterpretq_s8_u8(veorq_u8(vld1q_u8(reference+i),sign)) ;
+
+        vst1q_u8(out+i,veorq_u8(vreinterpretq_u8_s8(vqsubq_s8(a,b)),sign)) ;
+    }
+    frameDifferenceScalar(image+i,reference+i,out+i,size-i) ;
+}
+
+static void addFrameDifferenceNEON(const uint8_t *reference, const uint8_t *diff, uint8_t *out, int size)
+{
+    const uint8x16_t sign = vdupq_n_u8(0x80) ;
+    int i = 0 ;
+
+    for(;i+16<=size;i+=16)
+    {
+        int8x16_t a = vreinterpretq_s8_u8(veorq_u8(vld1q_u8(reference+i),sign)) ;
+        int8x16_t b = vreinterpretq_s8_u8(veorq_u8(vld1q_u8(diff+i),sign)) ;
+
+        vst1q_u8(out+i,veorq_u8(vreinterpretq_u8_s8(vqaddq_s8(a,b)),sign)) ;
+    }
+    addFrameDifferenceScalar(reference+i,diff+i,out+i,size-i) ;
+}
+
+#endif // VIDEO_CONVERTER_NEON
+
+#ifdef VIDEO_CONVERTER_X86
+
+TARGET_SSE2 static void frameDifferenceSSE2(const uint8_t *image, const uint8_t *reference, uint8_t *out, int size)
+{
+    const __m128i sign = _mm_set1_epi8((char)0x80) ;
+    int i = 0 ;
+
+    for(;i+16<=size;i+=16)
+    {
+        __m128i a = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(image+i)),sign) ;
+        __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(reference+i)),sign) ;
+
+        _mm_storeu_si128((__m128i*)(out+i),_mm_xor_si128(_mm_subs_epi8(a,b),sign)) ;
+    }
+    frameDifferenceScalar(image+i,reference+i,out+i,size-i) ;
+}
+
+TARGET_SSE2 static void addFrameDifferenceSSE2(const uint8_t *reference, const uint8_t *diff, uint8_t *out, int size)
+{
+    const __m128i sign = _mm_set1_epi8((char)0x80) ;
+    int i = 0 ;
+
+    for(;i+16<=size;i+=16)
+    {
+        __m128i a = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(reference+i)),sign) ;
+        __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(diff+i)),sign) ;
+
+        _mm_storeu_si128((__m128i*)(out+i),_mm_xor_si128(_mm_adds_epi8(a,b),sign)) ;
+    }
+    addFrameDifferenceScalar(reference+i,diff+i,out+i,size-i) ;
+}
+
+TARGET_AVX2 static void frameDifferenceAVX2(const uint8_t *image, const uint8_t *reference, uint8_t *out, int size)
+{
+    const __m256i sign = _mm256_set1_epi8((char)0x80) ;
+    int i = 0 ;
+
+    for(;i+32<=size;i+=32)
+    {
+        __m256i a = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(image+i)),sign) ;
+        __m256i b = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(reference+i)),sign) ;
+
+        _mm256_storeu_si256((__m256i*)(out+i),_mm256_xor_si256(_mm256_subs_epi8(a,b),sign)) ;
+    }
+    frameDifferenceSSE2(image+i,reference+i,out+i,size-i) ;
+}
+
+TARGET_AVX2 static void addFrameDifferenceAVX2(const uint8_t *reference, const uint8_t *diff, uint8_t *out, int size)
+{
+    const __m256i sign = _mm256_set1_epi8((char)0x80) ;
+    int i = 0 ;
+
+    for(;i+32<=size;i+=32)
+    {
+        __m256i a = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(reference+i)),sign) ;
+        __m256i b = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(diff+i)),sign) ;
+
+        _mm256_storeu_si256((__m256i*)(out+i),_mm256_xor_si256(_mm256_adds_epi8(a,b),sign)) ;
+    }
+    addFrameDifferenceSSE2(reference+i,diff+i,out+i,size-i) ;
+}
+
+// 8 pixels (two registers of 4) into 8 x 16 bits R, G and B
+//
+TARGET_SSE2 static inline void sse2Unpack(__m128i p0, __m128i p1, __m128i& r, __m128i& g, __m128i& b)
+{
+    const __m128i mask = _mm_set1_epi32(0xff) ;
+
+    b = _mm_packs_epi32(_mm_and_si128(p0,mask),                    _mm_and_si128(p1,mask)) ;
+    g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8),mask), _mm_and_si128(_mm_srli_epi32(p1, 8),mask)) ;
+    r = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0,16),mask), _mm_and_si128(_mm_srli_epi32(p1,16),mask)) ;
+}
+
+// The sum is at most 220*255+128 < 65536, so 16 bits unsigned arithmetic is enough.
+//
+TARGET_SSE2 static inline __m128i sse2Luma(__m128i r, __m128i g, __m128i b)
+{
+    __m128i y = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r,_mm_set1_epi16(66)), _mm_mullo_epi16(g,_mm_set1_epi16(129))),
+                              _mm_add_epi16(_mm_mullo_epi16(b,_mm_set1_epi16(25)), _mm_set1_epi16(128))) ;
+
+    return _mm_add_epi16(_mm_srli_epi16(y,8), _mm_set1_epi16(16)) ;
+}
+
+// 4 chroma values from the sums of 2x2 blocks (16 bits, interleaved with a constant 1 for the rounding term)
+//
+TARGET_SSE2 static inline __m128i sse2Chroma(__m128i rg, __m128i b1, __m128i crg, __m128i cb1)
+{
+    __m128i c = _mm_add_epi32(_mm_madd_epi16(rg,crg), _mm_madd_epi16(b1,cb1)) ;
+
+    return _mm_add_epi32(_mm_srai_epi32(c,10), _mm_set1_epi32(128)) ;
+}
+
+TARGET_SSE2 static void rgbToYuvRowSSE2(const uint32_t *row0, const uint32_t *row1, int width, uint8_t *y0, uint8_t *y1, uint8_t *cr, uint8_t *cb)
+{
+    const __m128i ones = _mm_set1_epi16(1) ;
+    const __m128i cr_rg = _mm_setr_epi16(112,-94,112,-94,112,-94,112,-94) ;
+    const __m128i cr_b1 = _mm_setr_epi16(-18,512,-18,512,-18,512,-18,512) ;
+    const __m128i cb_rg = _mm_setr_epi16(-38,-74,-38,-74,-38,-74,-38,-74) ;
+    const __m128i cb_b1 = _mm_setr_epi16(112,512,112,512,112,512,112,512) ;
+
+    int x = 0 ;
+
+    for(;x+16<=width;x+=16)
+    {
+        __m128i r[4],g[4],b[4] ;	// rows 0 and 1, pixels 0-7 and 8-15
+
+        sse2Unpack(_mm_loadu_si128((const __m128i*)(row0+x   )), _mm_loadu_si128((const __m128i*)(row0+x+ 4)), r[0],g[0],b[0]) ;
+        sse2Unpack(_mm_loadu_si128((const __m128i*)(row0+x+ 8)), _mm_loadu_si128((const __m128i*)(row0+x+12)), r[1],g[1],b[1]) ;
+        sse2Unpack(_mm_loadu_si128((const __m128i*)(row1+x   )), _mm_loadu_si128((const __m128i*)(row1+x+ 4)), r[2],g[2],b[2]) ;
+        sse2Unpack(_mm_loadu_si128((const __m128i*)(row1+x+ 8)), _mm_loadu_si128((const __m128i*)(row1+x+12)), r[3],g[3],b[3]) ;
+
+        _mm_storeu_si128((__m128i*)(y0+x), _mm_packus_epi16(sse2Luma(r[0],g[0],b[0]), sse2Luma(r[1],g[1],b[1]))) ;
+        _mm_storeu_si128((__m128i*)(y1+x), _mm_packus_epi16(sse2Luma(r[2],g[2],b[2]), sse2Luma(r[3],g[3],b[3]))) ;
+
+        // sums of the 2x2 blocks: vertical add, then horizontal pairs
+        __m128i sr = _mm_packs_epi32(_mm_madd_epi16(_mm_add_epi16(r[0],r[2]),ones), _mm_madd_epi16(_mm_add_epi16(r[1],r[3]),ones)) ;
+        __m128i sg = _mm_packs_epi32(_mm_madd_epi16(_mm_add_epi16(g[0],g[2]),ones), _mm_madd_epi16(_mm_add_epi16(g[1],g[3]),ones)) ;
+        __m128i sb = _mm_packs_epi32(_mm_madd_epi16(_mm_add_epi16(b[0],b[2]),ones), _mm_madd_epi16(_mm_add_epi16(b[1],b[3]),ones)) ;
+
+        __m128i rg_lo = _mm_unpacklo_epi16(sr,sg), rg_hi = _mm_unpackhi_epi16(sr,sg) ;
+        __m128i b1_lo = _mm_unpacklo_epi16(sb,ones), b1_hi = _mm_unpackhi_epi16(sb,ones) ;
+
+        __m128i vcr = _mm_packs_epi32(sse2Chroma(rg_lo,b1_lo,cr_rg,cr_b1), sse2Chroma(rg_hi,b1_hi,cr_rg,cr_b1)) ;
+        __m128i vcb = _mm_packs_epi32(sse2Chroma(rg_lo,b1_lo,cb_rg,cb_b1), sse2Chroma(rg_hi,b1_hi,cb_rg,cb_b1)) ;
+
+        _mm_storel_epi64((__m128i*)(cr+x/2), _mm_packus_epi16(vcr,vcr)) ;
+        _mm_storel_epi64((__m128i*)(cb+x/2), _mm_packus_epi16(vcb,vcb)) ;
+    }
+
+    rgbToYuvRowScalar(row0+x,row1+x,width-x,y0+x,y1+x,cr+x/2,cb+x/2) ;
+}
+
+// R, G and B of 8 pixels from 16 bits C = Y - 16, D and E
+//
+TARGET_SSE2 static inline void sse2Rgb(__m128i c, __m128i d, __m128i e, __m128i& r, __m128i& g, __m128i& b)
+{
+    const __m128i c_1     = _mm_setr_epi16(298,128,298,128,298,128,298,128) ;
+    const __m128i r_de    = _mm_setr_epi16(0,409,0,409,0,409,0,409) ;
+    const __m128i g_de    = _mm_setr_epi16(-100,-208,-100,-208,-100,-208,-100,-208) ;
+    const __m128i b_de    = _mm_setr_epi16(516,0,516,0,516,0,516,0) ;
+    const __m128i ones    = _mm_set1_epi16(1) ;
+
+    __m128i c1_lo = _mm_madd_epi16(_mm_unpacklo_epi16(c,ones),c_1) ;
+    __m128i c1_hi = _mm_madd_epi16(_mm_unpackhi_epi16(c,ones),c_1) ;
+    __m128i de_lo = _mm_unpacklo_epi16(d,e) ;
+    __m128i de_hi = _mm_unpackhi_epi16(d,e) ;
+
+    r = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(c1_lo,_mm_madd_epi16(de_lo,r_de)),8), _mm_srai_epi32(_mm_add_epi32(c1_hi,_mm_madd_epi16(de_hi,r_de)),8)) ;
+    g = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(c1_lo,_mm_madd_epi16(de_lo,g_de)),8), _mm_srai_epi32(_mm_add_epi32(c1_hi,_mm_madd_epi16(de_hi,g_de)),8)) ;
+    b = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(c1_lo,_mm_madd_epi16(de_lo,b_de)),8), _mm_srai_epi32(_mm_add_epi32(c1_hi,_mm_madd_epi16(de_hi,b_de)),8)) ;
+}
+
+TARGET_SSE2 static void yuvToRgbRowSSE2(const uint8_t *y, const uint8_t *cr, const uint8_t *cb, int width, uint32_t *out)
+{
+    const __m128i zero = _mm_setzero_si128() ;
+    const __m128i alpha = _mm_set1_epi8((char)0xff) ;
+    const __m128i y_offset = _mm_set1_epi16(16) ;
+    const __m128i c_offset = _mm_set1_epi16(128) ;
+
+    int x = 0 ;
+
+    for(;x+16<=width;x+=16)
+    {
+        __m128i vy  = _mm_loadu_si128((const __m128i*)(y+x)) ;
+        __m128i vcr = _mm_loadl_epi64((const __m128i*)(cr+x/2)) ;
+        __m128i vcb = _mm_loadl_epi64((const __m128i*)(cb+x/2)) ;
+
+        // each chroma sample is used by two pixels
+        vcr = _mm_unpacklo_epi8(vcr,vcr) ;
+        vcb = _mm_unpacklo_epi8(vcb,vcb) ;
+
+        __m128i r[2],g[2],b[2] ;
+
+        sse2Rgb(_mm_sub_epi16(_mm_unpacklo_epi8(vy,zero),y_offset), _mm_sub_epi16(_mm_unpacklo_epi8(vcb,zero),c_offset), _mm_sub_epi16(_mm_unpacklo_epi8(vcr,zero),c_offset), r[0],g[0],b[0]) ;
+        sse2Rgb(_mm_sub_epi16(_mm_unpackhi_epi8(vy,zero),y_offset), _mm_sub_epi16(_mm_unpackhi_epi8(vcb,zero),c_offset), _mm_sub_epi16(_mm_unpackhi_epi8(vcr,zero),c_offset), r[1],g[1],b[1]) ;
+
+        __m128i vr = _mm_packus_epi16(r[0],r[1]) ;
+        __m128i vg = _mm_packus_epi16(g[0],g[1]) ;
+        __m128i vb = _mm_packus_epi16(b[0],b[1]) ;
+
+        // interleave into 0xAARRGGBB words
+        __m128i bg_lo = _mm_unpacklo_epi8(vb,vg), bg_hi = _mm_unpackhi_epi8(vb,vg) ;
+        __m128i ra_lo = _mm_unpacklo_epi8(vr,alpha), ra_hi = _mm_unpackhi_epi8(vr,alpha) ;
+
+        _mm_storeu_si128((__m128i*)(out+x   ), _mm_unpacklo_epi16(bg_lo,ra_lo)) ;
+        _mm_storeu_si128((__m128i*)(out+x+ 4), _mm_unpackhi_epi16(bg_lo,ra_lo)) ;
+        _mm_storeu_si128((__m128i*)(out+x+ 8), _mm_unpacklo_epi16(bg_hi,ra_hi)) ;
+        _mm_storeu_si128((__m128i*)(out+x+12), _mm_unpackhi_epi16(bg_hi,ra_hi)) ;
+    }
+
+    yuvToRgbRowScalar(y+x,cr+x/2,cb+x/2,width-x,out+x) ;
+}
+
+// AVX2 version of the above, 16 pixels per register. The packs work inside 128 bits lanes,
+// so their results are put back in order with a 64 bits permutation.
+//
+TARGET_AVX2 static inline void avx2Unpack(__m256i p0, __m256i p1, __m256i& r, __m256i& g, __m256i& b)
+{
+    const __m256i mask = _mm256_set1_epi32(0xff) ;
+
+    b = _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_and_si256(p0,mask),                       _mm256_and_si256(p1,mask)),0xd8) ;
+    g = _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(p0, 8),mask), _mm256_and_si256(_mm256_srli_epi32(p1, 8),mask)),0xd8) ;
+    r = _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(p0,16),mask), _mm256_and_si256(_mm256_srli_epi32(p1,16),mask)),0xd8) ;
+}
+
+TARGET_AVX2 static inline __m256i avx2Luma(__m256i r, __m256i g, __m256i b)
+{
+    __m256i y = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(r,_mm256_set1_epi16(66)), _mm256_mullo_epi16(g,_mm256_set1_epi16(129))),
+                                 _mm256_add_epi16(_mm256_mullo_epi16(b,_mm256_set1_epi16(25)), _mm256_set1_epi16(128))) ;
+
+    return _mm256_add_epi16(_mm256_srli_epi16(y,8), _mm256_set1_epi16(16)) ;
+}
+
+TARGET_AVX2 static inline __m256i avx2Chroma(__m256i rg, __m256i b1, __m256i crg, __m256i cb1)
+{
+    __m256i c = _mm256_add_epi32(_mm256_madd_epi16(rg,crg), _mm256_madd_epi16(b1,cb1)) ;
+
+    return _mm256_add_epi32(_mm256_srai_epi32(c,10), _mm256_set1_epi32(128)) ;
+}
+
+TARGET_AVX2 static inline __m256i avx2BlockSums(__m256i a0, __m256i a1, __m256i b0, __m256i b1)
+{
+    const __m256i ones = _mm256_set1_epi16(1) ;
+
+    return _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_madd_epi16(_mm256_add_epi16(a0,b0),ones), _mm256_madd_epi16(_mm256_add_epi16(a1,b1),ones)),0xd8) ;
+}
+
+TARGET_AVX2 static void rgbToYuvRowAVX2(const uint32_t *row0, const uint32_t *row1, int width, uint8_t *y0, uint8_t *y1, uint8_t *cr, uint8_t *cb)
+{
+    const __m256i ones = _mm256_set1_epi16(1) ;
+    const __m256i cr_rg = _mm256_setr_epi16(112,-94,112,-94,112,-94,112,-94,112,-94,112,-94,112,-94,112,-94) ;
+    const __m256i cr_b1 = _mm256_setr_epi16(-18,512,-18,512,-18,512,-18,512,-18,512,-18,512,-18,512,-18,512) ;
+    const __m256i cb_rg = _mm256_setr_epi16(-38,-74,-38,-74,-38,-74,-38,-74,-38,-74,-38,-74,-38,-74,-38,-74) ;
+    const __m256i cb_b1 = _mm256_setr_epi16(112,512,112,512,112,512,112,512,112,512,112,512,112,512,112,512) ;
+
+    int x = 0 ;
+
+    for(;x+32<=width;x+=32)
+    {
+        __m256i r[4],g[4],b[4] ;	// rows 0 and 1, pixels 0-15 and 16-31
+
+        avx2Unpack(_mm256_loadu_si256((const __m256i*)(row0+x   )), _mm256_loadu_si256((const __m256i*)(row0+x+ 8)), r[0],g[0],b[0]) ;
+        avx2Unpack(_mm256_loadu_si256((const __m256i*)(row0+x+16)), _mm256_loadu_si256((const __m256i*)(row0+x+24)), r[1],g[1],b[1]) ;
+        avx2Unpack(_mm256_loadu_si256((const __m256i*)(row1+x   )), _mm256_loadu_si256((const __m256i*)(row1+x+ 8)), r[2],g[2],b[2]) ;
+        avx2Unpack(_mm256_loadu_si256((const __m256i*)(row1+x+16)), _mm256_loadu_si256((const __m256i*)(row1+x+24)), r[3],g[3],b[3]) ;
+
+        _mm256_storeu_si256((__m256i*)(y0+x), _mm256_permute4x64_epi64(_mm256_packus_epi16(avx2Luma(r[0],g[0],b[0]), avx2Luma(r[1],g[1],b[1])),0xd8)) ;
+        _mm256_storeu_si256((__m256i*)(y1+x), _mm256_permute4x64_epi64(_mm256_packus_epi16(avx2Luma(r[2],g[2],b[2]), avx2Luma(r[3],g[3],b[3])),0xd8)) ;
+
+        __m256i sr = avx2BlockSums(r[0],r[1],r[2],r[3]) ;
+        __m256i sg = avx2BlockSums(g[0],g[1],g[2],g[3]) ;
+        __m256i sb = avx2BlockSums(b[0],b[1],b[2],b[3]) ;
+
+        // unpack lo/hi and the packs below are both per lane, so they restore the order of each other
+        __m256i rg_lo = _mm256_unpacklo_epi16(sr,sg), rg_hi = _mm256_unpackhi_epi16(sr,sg) ;
+        __m256i b1_lo = _mm256_unpacklo_epi16(sb,ones), b1_hi = _mm256_unpackhi_epi16(sb,ones) ;
+
+        __m256i vcr = _mm256_packs_epi32(avx2Chroma(rg_lo,b1_lo,cr_rg,cr_b1), avx2Chroma(rg_hi,b1_hi,cr_rg,cr_b1)) ;
+        __m256i vcb = _mm256_packs_epi32(avx2Chroma(rg_lo,b1_lo,cb_rg,cb_b1), avx2Chroma(rg_hi,b1_hi,cb_rg,cb_b1)) ;
+
+        _mm_storeu_si128((__m128i*)(cr+x/2), _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi16(vcr,vcr),0x08))) ;
+        _mm_storeu_si128((__m128i*)(cb+x/2), _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi16(vcb,vcb),0x08))) ;
+    }
+
+    rgbToYuvRowSSE2(row0+x,row1+x,width-x,y0+x,y1+x,cr+x/2,cb+x/2) ;
+}
+
+TARGET_AVX2 static inline void avx2Rgb(__m256i c, __m256i d, __m256i e, __m256i& r, __m256i& g, __m256i& b)
+{
+    const __m256i c_1     = _mm256_setr_epi16(298,128,298,128,298,128,298,128,298,128,298,128,298,128,298,128) ;
+    const __m256i r_de    = _mm256_setr_epi16(0,409,0,409,0,409,0,409,0,409,0,409,0,409,0,409) ;
+    const __m256i g_de    = _mm256_setr_epi16(-100,-208,-100,-208,-100,-208,-100,-208,-100,-208,-100,-208,-100,-208,-100,-208) ;
+    const __m256i b_de    = _mm256_setr_epi16(516,0,516,0,516,0,516,0,516,0,516,0,516,0,516,0) ;
+    const __m256i ones    = _mm256_set1_epi16(1) ;
+
+    __m256i c1_lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(c,ones),c_1) ;
+    __m256i c1_hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(c,ones),c_1) ;
+    __m256i de_lo = _mm256_unpacklo_epi16(d,e) ;
+    __m256i de_hi = _mm256_unpackhi_epi16(d,e) ;
+
+    r = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(c1_lo,_mm256_madd_epi16(de_lo,r_de)),8), _mm256_srai_epi32(_mm256_add_epi32(c1_hi,_mm256_madd_epi16(de_hi,r_de)),8)) ;
+    g = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(c1_lo,_mm256_madd_epi16(de_lo,g_de)),8), _mm256_srai_epi32(_mm256_add_epi32(c1_hi,_mm256_madd_epi16(de_hi,g_de)),8)) ;
+    b = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(c1_lo,_mm256_madd_epi16(de_lo,b_de)),8), _mm256_srai_epi32(_mm256_add_epi32(c1_hi,_mm256_madd_epi16(de_hi,b_de)),8)) ;
+}
+
+// 32 pixels per iteration. The 16 bits values are in pixel order (unpack and pack undo each other
+// inside the lanes); the byte packing and interleaving below leave pixels 0-3 and 8-11 in the first
+// register, 4-7 and 12-15 in the second, and so on, which the final 128 bits permutations fix.
+//
+TARGET_AVX2 static void yuvToRgbRowAVX2(const uint8_t *y, const uint8_t *cr, const uint8_t *cb, int width, uint32_t *out)
+{
+    const __m256i alpha = _mm256_set1_epi8((char)0xff) ;
+    const __m256i y_offset = _mm256_set1_epi16(16) ;
+    const __m256i c_offset = _mm256_set1_epi16(128) ;
+
+    int x = 0 ;
+
+    for(;x+32<=width;x+=32)
+    {
+        __m128i vcr = _mm_loadu_si128((const __m128i*)(cr+x/2)) ;
+        __m128i vcb = _mm_loadu_si128((const __m128i*)(cb+x/2)) ;
+
+        __m256i r[2],g[2],b[2] ;
+
+        for(int i=0;i<2;++i)
+        {
+            __m256i vy   = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(y+x+16*i))) ;
+            __m256i vcr2 = _mm256_cvtepu8_epi16(i ? _mm_unpackhi_epi8(vcr,vcr) : _mm_unpacklo_epi8(vcr,vcr)) ;
+            __m256i vcb2 = _mm256_cvtepu8_epi16(i ? _mm_unpackhi_epi8(vcb,vcb) : _mm_unpacklo_epi8(vcb,vcb)) ;
+
+            avx2Rgb(_mm256_sub_epi16(vy,y_offset), _mm256_sub_epi16(vcb2,c_offset), _mm256_sub_epi16(vcr2,c_offset), r[i],g[i],b[i]) ;
+        }
+
+        // lane 0: pixels 0-7 and 16-23, lane 1: pixels 8-15 and 24-31
+        __m256i vr = _mm256_packus_epi16(r[0],r[1]) ;
+        __m256i vg = _mm256_packus_epi16(g[0],g[1]) ;
+        __m256i vb = _mm256_packus_epi16(b[0],b[1]) ;
+
+        __m256i bg_lo = _mm256_unpacklo_epi8(vb,vg), bg_hi = _mm256_unpackhi_epi8(vb,vg) ;
+        __m256i ra_lo = _mm256_unpacklo_epi8(vr,alpha), ra_hi = _mm256_unpackhi_epi8(vr,alpha) ;
+
+        __m256i p0 = _mm256_unpacklo_epi16(bg_lo,ra_lo) ;	// pixels 0-3, 8-11
+        __m256i p1 = _mm256_unpackhi_epi16(bg_lo,ra_lo) ;	// pixels 4-7, 12-15
+        __m256i p2 = _mm256_unpacklo_epi16(bg_hi,ra_hi) ;	// pixels 16-19, 24-27
+        __m256i p3 = _mm256_unpackhi_epi16(bg_hi,ra_hi) ;	// pixels 20-23, 28-31
+
+        _mm256_storeu_si256((__m256i*)(out+x   ), _mm256_permute2x128_si256(p0,p1,0x20)) ;
+        _mm256_storeu_si256((__m256i*)(out+x+ 8), _mm256_permute2x128_si256(p0,p1,0x31)) ;
+        _mm256_storeu_si256((__m256i*)(out+x+16), _mm256_permute2x128_si256(p2,p3,0x20)) ;
+        _mm256_storeu_si256((__m256i*)(out+x+24), _mm256_permute2x128_si256(p2,p3,0x31)) ;
+    }
+
+    yuvToRgbRowSSE2(y+x,cr+x/2,cb+x/2,width-x,out+x) ;
+}
+
+#endif // VIDEO_CONVERTER_X86
+
+VideoConverter::VideoConverter()
+    : _scale_src_width(0),_scale_src_height(0),_scale_width(0),_scale_height(0)
+{
+    setImplementation(bestImplementation()) ;
+}
+
+bool VideoConverter::isSupported(Implementation i)
+{
+#ifdef VIDEO_CONVERTER_X86
+    __builtin_cpu_init() ;
+#endif
+
+    switch(i)
+    {
+    case IMPLEMENTATION_SCALAR: return true ;
+#ifdef VIDEO_CONVERTER_X86
+    case IMPLEMENTATION_SSE2: return __builtin_cpu_supports("sse2") ;
+    case IMPLEMENTATION_AVX2: return __builtin_cpu_supports("avx2") ;
+#endif
+#ifdef VIDEO_CONVERTER_NEON
+    case IMPLEMENTATION_NEON: return true ;
+#endif
+    default:
+        return false ;
+    }
+}
+
+VideoConverter::Implementation VideoConverter::bestImplementation()
+{
+    if(isSupported(IMPLEMENTATION_NEON))
+        return IMPLEMENTATION_NEON ;
+    if(isSupported(IMPLEMENTATION_AVX2))
+        return IMPLEMENTATION_AVX2 ;
+    if(isSupported(IMPLEMENTATION_SSE2))
+        return IMPLEMENTATION_SSE2 ;
+
+    return IMPLEMENTATION_SCALAR ;
+}
+
+const char *VideoConverter::implementationName(Implementation i)
+{
+    switch(i)
+    {
+    case IMPLEMENTATION_SSE2: return "SSE2" ;
+    case IMPLEMENTATION_AVX2: return "AVX2" ;
+    case IMPLEMENTATION_NEON: return "NEON" ;
+    default:
+        return "scalar" ;
+    }
+}
+
+void VideoConverter::setImplementation(Implementation i)
+{
+    if(!isSupported(i))
+        i = IMPLEMENTATION_SCALAR ;
+
+    _implementation = i ;
+
+    _rgb_to_yuv_row = rgbToYuvRowScalar ;
+    _yuv_to_rgb_row = yuvToRgbRowScalar ;
+    _frame_difference = frameDifferenceScalar ;
+    _add_frame_difference = addFrameDifferenceScalar ;
+
+    switch(i)
+    {
+#ifdef VIDEO_CONVERTER_X86
+    case IMPLEMENTATION_SSE2: _rgb_to_yuv_row = rgbToYuvRowSSE2 ;
+                              _yuv_to_rgb_row = yuvToRgbRowSSE2 ;
+                              _frame_difference = frameDifferenceSSE2 ;
+                              _add_frame_difference = addFrameDifferenceSSE2 ;
+        break ;
+    case IMPLEMENTATION_AVX2: _rgb_to_yuv_row = rgbToYuvRowAVX2 ;
+                              _yuv_to_rgb_row = yuvToRgbRowAVX2 ;
+                              _frame_difference = frameDifferenceAVX2 ;
+                              _add_frame_difference = addFrameDifferenceAVX2 ;
+        break ;
+#endif
+#ifdef VIDEO_CONVERTER_NEON
+    case IMPLEMENTATION_NEON: _frame_difference = frameDifferenceNEON ;	// the colour conversions have no NEON version
+                              _add_frame_difference = addFrameDifferenceNEON ;
+        break ;
+#endif
+    default:
+        break ;
+    }
+}
+
+void VideoConverter::rgbToYuv420(const QImage& image, uint8_t *const planes[3], const int linesizes[3], int width, int height)
+{
+    if(image.format() == QImage::Format_RGB32 || image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_ARGB32_Premultiplied)
+        rgbToYuv420(image.constBits(),image.bytesPerLine(),image.width(),image.height(),planes,linesizes,width,height) ;
+    else
+    {
+        QImage rgb = image.convertToFormat(QImage::Format_RGB32) ;
+        rgbToYuv420(rgb.constBits(),rgb.bytesPerLine(),rgb.width(),rgb.height(),planes,linesizes,width,height) ;
+    }
+}
+
+void VideoConverter::rgbToYuv420(const uint8_t *src, int src_stride, int src_width, int src_height,
+                                 uint8_t *const planes[3], const int linesizes[3], int width, int height)
+{
+    bool scale = (src_width != width || src_height != height) ;
+
+    if(scale)
+    {
+        prepareScaling(src_width,src_height,width,height) ;
+        _scaled_rows[0].resize(width) ;
+        _scaled_rows[1].resize(width) ;
+    }
+
+    for(int y=0;y+1<height;y+=2)
+    {
+        const uint32_t *row0, *row1 ;
+
+        if(scale)
+        {
+            scaleRow(src,src_stride,y  ,_scaled_rows[0].data()) ;
+            scaleRow(src,src_stride,y+1,_scaled_rows[1].data()) ;
+            row0 = _scaled_rows[0].data() ;
+            row1 = _scaled_rows[1].data() ;
+        }
+        else
+        {
+            row0 = (const uint32_t*)(src +  y    * src_stride) ;
+            row1 = (const uint32_t*)(src + (y+1) * src_stride) ;
+        }
+
+        _rgb_to_yuv_row(row0,row1,width,planes[0] + y*linesizes[0],planes[0] + (y+1)*linesizes[0],
+                        planes[1] + (y/2)*linesizes[1],planes[2] + (y/2)*linesizes[2]) ;
+    }
+}
+
+void VideoConverter::yuv420ToRgb(const uint8_t *const planes[3], const int linesizes[3], int width, int height, QImage& image)
+{
+    // isDetached() is false while a previous frame is still used elsewhere: writing would copy it first.
+    if(image.width() != width || image.height() != height || image.format() != QImage::Format_RGB32 || !image.isDetached())
+        image = QImage(width,height,QImage::Format_RGB32) ;
+
+    yuv420ToRgb(planes,linesizes,width,height,image.bits(),image.bytesPerLine()) ;
+}
+
+void VideoConverter::yuv420ToRgb(const uint8_t *const planes[3], const int linesizes[3], int width, int height, uint8_t *dst, int dst_stride)
+{
+    for(int y=0;y<height;++y)
+        _yuv_to_rgb_row(planes[0] + y*linesizes[0],planes[1] + (y/2)*linesizes[1],planes[2] + (y/2)*linesizes[2],width,(uint32_t*)(dst + y*dst_stride)) ;
+}
+
+// Position of the centre of output pixel i in the source, in 8 bits fixed point: (i+0.5)*src/dst - 0.5
+//
+static void scalingPositions(int src_size, int size, std::vector<int>& offsets, std::vector<uint8_t>& weights)
+{
+    offsets.resize(size) ;
+    weights.resize(size) ;
+
+    for(int i=0;i<size;++i)
+    {
+        int64_t pos = ((int64_t)(2*i+1) * src_size * 256) / (2*size) - 128 ;
+
+        if(pos < 0)
+            pos = 0 ;
+        if(pos > (int64_t)(src_size-1) * 256)
+            pos = (int64_t)(src_size-1) * 256 ;
+
+        offsets[i] = (int)(pos >> 8) ;
+        weights[i] = (uint8_t)(pos & 0xff) ;
+    }
+}
+
+void VideoConverter::prepareScaling(int src_width, int src_height, int width, int height)
+{
+    if(src_width == _scale_src_width && src_height == _scale_src_height && width == _scale_width && height == _scale_height)
+        return ;
+
+    scalingPositions(src_width ,width ,_x_offsets,_x_weights) ;
+    scalingPositions(src_height,height,_y_offsets,_y_weights) ;
+
+    _scale_src_width = src_width ;
+    _scale_src_height = src_height ;
+    _scale_width = width ;
+    _scale_height = height ;
+}
+
+// Blends two pixels, two channels at a time (0x00RR00BB and 0x00AA00GG)
+//
+static inline uint32_t blend(uint32_t a, uint32_t b, uint32_t w)
+{
+    uint32_t rb = (((a & 0x00ff00ff) * (256-w) + (b & 0x00ff00ff) * w) >> 8) & 0x00ff00ff ;
+    uint32_t ag = (((a >> 8) & 0x00ff00ff) * (256-w) + ((b >> 8) & 0x00ff00ff) * w) & 0xff00ff00 ;
+
+    return rb | ag ;
+}
+
+void VideoConverter::scaleRow(const uint8_t *src, int src_stride, int y, uint32_t *out) const
+{
+    int sy = _y_offsets[y] ;
+    uint32_t wy = _y_weights[y] ;
+
+    const uint32_t *row0 = (const uint32_t*)(src + sy * src_stride) ;
+    const uint32_t *row1 = (const uint32_t*)(src + std::min(sy+1,_scale_src_height-1) * src_stride) ;
+    int last = _scale_src_width - 1 ;
+
+    for(int x=0;x<_scale_width;++x)
+    {
+        int sx = _x_offsets[x] ;
+        int sx1 = std::min(sx+1,last) ;
+        uint32_t wx = _x_weights[x] ;
+
+        out[x] = blend(blend(row0[sx],row0[sx1],wx), blend(row1[sx],row1[sx1],wx), wy) ;
+    }
+}
@@ -0,0 +1,118 @@
+/*******************************************************************************
+ * plugins/VOIP/gui/VideoConverter.h                                           *
+ *                                                                             *
+ * Copyright (C) 2012 by Retroshare Team <retroshare.project@gmail.com>        *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+class QImage ;
+
+// Conversion between the 32 bits RGB images of Qt and the planar YUV 4:2:0 frames of the FFmpeg codec,
+// in 8 bits fixed point arithmetic (ITU-R BT.601, studio range).
+//
+// The chroma planes follow the layout used on the wire since the first versions of the plugin:
+// plane 1 holds Cr and plane 2 holds Cb.
+//
+// It also computes the differential frames of the JPEG codec.
+//
+// Rows are converted with SSE2 or AVX2 when the CPU supports it, with a scalar fallback otherwise.
+// The differential frame kernels also have a NEON version on ARM.
+// The converter keeps scratch buffers, so use one converter per thread.
+//
+class VideoConverter
+{
+public:
+    enum Implementation {
+        IMPLEMENTATION_SCALAR = 0x00,
+        IMPLEMENTATION_SSE2   = 0x01,
+        IMPLEMENTATION_AVX2   = 0x02,
+        IMPLEMENTATION_NEON   = 0x03
+    };
+
+    VideoConverter() ;
+
+    // Converts the image into planes of width x height pixels, scaling it in the same pass when its
+    // size differs (bilinear, which is a 2x2 box filter when halving). width and height must be even.
+    //
+    void rgbToYuv420(const QImage& image, uint8_t *const planes[3], const int linesizes[3], int width, int height) ;
+
+    // Same on raw 32 bits pixels (0xAARRGGBB words, QImage::Format_RGB32 / ARGB32)
+    //
+    void rgbToYuv420(const uint8_t *src, int src_stride, int src_width, int src_height,
+                     uint8_t *const planes[3], const int linesizes[3], int width, int height) ;
+
+    // Converts decoded planes into image, which is reused when it already has the right size and is not
+    // shared, so that no image is allocated per frame. Chroma is upsampled by repeating samples.
+    //
+    void yuv420ToRgb(const uint8_t *const planes[3], const int linesizes[3], int width, int height, QImage& image) ;
+
+    // Same into raw 32 bits pixels
+    //
+    void yuv420ToRgb(const uint8_t *const planes[3], const int linesizes[3], int width, int height, uint8_t *dst, int dst_stride) ;
+
+    // Differential frames, on size bytes: out = clamp(image - reference + 128), and back
+    // out = clamp(reference + diff - 128). out may be one of the inputs.
+    //
+    void frameDifference(const uint8_t *image, const uint8_t *reference, uint8_t *out, int size) const { _frame_difference(image,reference,out,size) ; }
+    void addFrameDifference(const uint8_t *reference, const uint8_t *diff, uint8_t *out, int size) const { _add_frame_difference(reference,diff,out,size) ; }
+
+    // The implementation is chosen from the CPU features. It can be forced for testing (falls back
+    // to the scalar code when not supported).
+    //
+    static Implementation bestImplementation() ;
+    static bool isSupported(Implementation) ;
+    static const char *implementationName(Implementation) ;
+    void setImplementation(Implementation i) ;
+    Implementation implementation() const { return _implementation ; }
+
+    // Converts two rows of width pixels into two luma rows and one row of each chroma plane.
+    //
+    typedef void (*RgbToYuvRowFunction)(const uint32_t *row0, const uint32_t *row1, int width, uint8_t *y0, uint8_t *y1, uint8_t *cr, uint8_t *cb) ;
+
+    // Converts one luma row and the matching chroma rows into width pixels.
+    //
+    typedef void (*YuvToRgbRowFunction)(const uint8_t *y, const uint8_t *cr, const uint8_t *cb, int width, uint32_t *out) ;
+
+    // Saturated operation on size bytes of a and b.
+    //
+    typedef void (*ByteFunction)(const uint8_t *a, const uint8_t *b, uint8_t *out, int size) ;
+
+private:
+    void prepareScaling(int src_width, int src_height, int width, int height) ;
+    void scaleRow(const uint8_t *src, int src_stride, int y, uint32_t *out) const ;
+
+    Implementation _implementation ;
+    RgbToYuvRowFunction _rgb_to_yuv_row ;
+    YuvToRgbRowFunction _yuv_to_rgb_row ;
+    ByteFunction _frame_difference ;
+    ByteFunction _add_frame_difference ;
+
+    // bilinear scaling: 8 bits fixed point positions of the output pixels in the source
+    int _scale_src_width ;
+    int _scale_src_height ;
+    int _scale_width ;
+    int _scale_height ;
+    std::vector<int> _x_offsets ;
+    std::vector<uint8_t> _x_weights ;
+    std::vector<int> _y_offsets ;
+    std::vector<uint8_t> _y_weights ;
+    std::vector<uint32_t> _scaled_rows[2] ;
+};
@@ -20,15 +20,11 @@
 
 #include <iostream>
 #include <assert.h>
-#ifdef __MACH__
-#include <malloc/malloc.h>
-#else
-#include <malloc.h>
-#endif
 
 #include <QByteArray>
 #include <QBuffer>
 #include <QImage>
+#include <QImageReader>
 
 #include "util/rsmemory.h"
 
@@ -183,11 +179,14 @@ bool VideoProcessor::processImage(const QImage& img)
     {
 	    RsVOIPDataChunk chunk ;
 
-	    if(codec->encodeData(img.scaled(_encoded_frame_size,Qt::IgnoreAspectRatio,Qt::SmoothTransformation),_target_bandwidth_out,chunk) && chunk.size > 0)
+	    // The FFmpeg codec scales the image itself while converting it to YUV.
+	    bool scaled_by_codec = (codec == &_mpeg_video_codec) ;
+
+	    if(codec->encodeData(scaled_by_codec ? img : img.scaled(_encoded_frame_size,Qt::IgnoreAspectRatio,Qt::SmoothTransformation),_target_bandwidth_out,chunk) && chunk.size > 0)
 	    {
 		    RS_STACK_MUTEX(vpMtx) ;
-		    _encoded_out_queue.push_back(chunk) ;
 		    _total_encoded_size_out += chunk.size ;
+		    _encoded_out_queue.push_back(std::move(chunk)) ;
 	    }
 
 	    time_t now = time(NULL) ;
@@ -221,7 +220,7 @@ bool VideoProcessor::nextEncodedPacket(RsVOIPDataChunk& chunk)
 	if(_encoded_out_queue.empty())
 		return false ;
 
-	chunk = _encoded_out_queue.front() ;
+	chunk = std::move(_encoded_out_queue.front()) ;
 	_encoded_out_queue.pop_front() ;
 
 	return true ;
@@ -319,9 +318,19 @@ void VideoProcessor::setMaximumBandwidth(uint32_t bytes_per_sec)
 //
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Gives image the size and format, keeping its data when it is not shared with another image.
+//
+static void reuseImage(QImage& image, const QSize& size, QImage::Format format)
+{
+    if(image.size() != size || image.format() != format || !image.isDetached())
+        image = QImage(size,format) ;
+}
+
 JPEGVideo::JPEGVideo()
     : _encoded_ref_frame_max_distance(10),_encoded_ref_frame_count(10)
 {
+    // With a reserved capacity, resize(0) keeps the buffer. Frames are a few tens of KB.
+    _encoded_jpeg.reserve(64*1024) ;
 }
 
 bool JPEGVideo::decodeData(const RsVOIPDataChunk& chunk,QImage& image)
@@ -333,37 +342,47 @@ bool JPEGVideo::decodeData(const RsVOIPDataChunk& chunk,QImage& image)
 
     assert(codec == VideoProcessor::VIDEO_PROCESSOR_CODEC_ID_JPEG_VIDEO) ;
 
-    //  un-compress image data
+    //  un-compress image data, without copying the chunk. The reader decodes into the image of the
+    //  previous frame when it has the same size and format, and is not used anymore.
+
+    QByteArray qb = QByteArray::fromRawData((char*)&((uint8_t*)chunk.data)[HEADER_SIZE],(int)chunk.size - HEADER_SIZE) ;
+    QBuffer buffer(&qb) ;
+    buffer.open(QIODevice::ReadOnly) ;
+
+    if(!_decoded_frame.isDetached())
+        _decoded_frame = QImage() ;
 
-    QByteArray qb((char*)&((uint8_t*)chunk.data)[HEADER_SIZE],(int)chunk.size - HEADER_SIZE) ;
+    QImageReader reader(&buffer,"JPEG") ;
 
-    if(!image.loadFromData(qb,"JPEG"))
+    if(!reader.read(&_decoded_frame))
     {
-	    std::cerr << "image.loadFromData(): returned an error.: " << std::endl;
+	    std::cerr << "QImageReader::read(): returned an error: " << reader.errorString().toStdString() << std::endl;
 	    return false ;
     }
 
     if(flags & JPEG_VIDEO_FLAGS_DIFFERENTIAL_FRAME)
     {
-	    if(_decoded_reference_frame.size() != image.size())
+	    if(_decoded_reference_frame.size() != _decoded_frame.size() || _decoded_reference_frame.bytesPerLine() != _decoded_frame.bytesPerLine())
 	    {
 		    std::cerr << "Bad reference frame!" << std::endl;
 		    return false ;
 	    }
 
-	    QImage res = _decoded_reference_frame ;
+	    reuseImage(_decoded_sum_frame,_decoded_reference_frame.size(),_decoded_reference_frame.format()) ;
 
-	    for(int i=0;i<image.byteCount();++i)
-	    {
-		    int new_val = (int)res.bits()[i] + ((int)image.bits()[i] - 128) ;
+	    int line_size = _decoded_frame.bytesPerLine() ;
+	    uchar *out = _decoded_sum_frame.bits() ;
 
-		    res.bits()[i] = std::max(0,std::min(255,new_val)) ;
-	    }
+	    for(int y=0;y<_decoded_frame.height();++y)
+		    _converter.addFrameDifference(_decoded_reference_frame.constScanLine(y),_decoded_frame.constScanLine(y),out + y*line_size,line_size) ;
 
-	    image = res ;
+	    image = _decoded_sum_frame ;
     }
     else
-        _decoded_reference_frame = image ;
+    {
+        _decoded_reference_frame = _decoded_frame ;
+        image = _decoded_frame ;
+    }
 
     return true ;
 }
@@ -372,43 +391,47 @@ bool JPEGVideo::encodeData(const QImage& image,uint32_t /* size_hint */,RsVOIPDa
 {
     // check if we make a diff image, or if we use the full frame.
 
-    QImage encoded_frame ;
+    const QImage *encoded_frame ;
     bool differential_frame ;
 
     if (_encoded_ref_frame_count++ < _encoded_ref_frame_max_distance
         && image.size() == _encoded_reference_frame.size()
         && image.byteCount() == _encoded_reference_frame.byteCount())
 	{
-	    // compute difference with reference frame.
-	    encoded_frame = image ;
+	    // compute difference with reference frame, into a buffer kept between frames. The input
+	    // images are only read, so that they are never detached.
+	    //
+	    // We cannot use basic modulo 256 arithmetic, because the decompressed JPeg frames do not follow the same rules (values are clamped)
+	    // and cause color blotches when perturbated by a differential frame.
 
-	    for(int i=0;i<image.byteCount();++i)
-	    {
-		    // We cannot use basic modulo 256 arithmetic, because the decompressed JPeg frames do not follow the same rules (values are clamped)
-		    // and cause color blotches when perturbated by a differential frame.
+	    reuseImage(_encoded_difference_frame,image.size(),image.format()) ;
 
-		    int diff = ( (int)image.bits()[i] - (int)_encoded_reference_frame.bits()[i]) + 128;
-		    encoded_frame.bits()[i] = (unsigned char)std::max(0,std::min(255,diff)) ;
-	    }
+	    int line_size = image.bytesPerLine() ;
+	    uchar *out = _encoded_difference_frame.bits() ;
 
+	    for(int y=0;y<image.height();++y)
+		    _converter.frameDifference(image.constScanLine(y),_encoded_reference_frame.constScanLine(y),out + y*line_size,line_size) ;
+
+	    encoded_frame = &_encoded_difference_frame ;
 	    differential_frame = true ;
     }
     else
     {
 	    _encoded_ref_frame_count = 0 ;
 	    _encoded_reference_frame = image.copy() ;
-	    encoded_frame = image ;
+	    encoded_frame = &image ;
 
 	    differential_frame = false ;
     }
 
-    QByteArray qb ;
+    _encoded_jpeg.resize(0) ;
 
-    QBuffer buffer(&qb) ;
+    QBuffer buffer(&_encoded_jpeg) ;
     buffer.open(QIODevice::WriteOnly) ;
-    encoded_frame.save(&buffer,"JPEG") ;
+    encoded_frame->save(&buffer,"JPEG") ;
 
-    voip_chunk.data = rs_malloc(HEADER_SIZE + qb.size());
+    // the chunk is given to the caller, so it cannot be reused
+    voip_chunk.data = rs_malloc(HEADER_SIZE + _encoded_jpeg.size());
     
     if(!voip_chunk.data)
         return false ;
@@ -421,9 +444,9 @@ bool JPEGVideo::encodeData(const QImage& image,uint32_t /* size_hint */,RsVOIPDa
     ((unsigned char *)voip_chunk.data)[2] = flags & 0xff ;
     ((unsigned char *)voip_chunk.data)[3] = (flags >> 8) & 0xff ;
 
-    memcpy(&((unsigned char*)voip_chunk.data)[HEADER_SIZE],qb.data(),qb.size()) ;
+    memcpy(&((unsigned char*)voip_chunk.data)[HEADER_SIZE],_encoded_jpeg.constData(),_encoded_jpeg.size()) ;
 
-    voip_chunk.size = HEADER_SIZE + qb.size() ;
+    voip_chunk.size = HEADER_SIZE + _encoded_jpeg.size() ;
     voip_chunk.type = RsVOIPDataChunk::RS_VOIP_DATA_TYPE_VIDEO ;
 
     return true ;
@@ -588,6 +611,9 @@ FFmpegVideo::FFmpegVideo()
     decoding_buffer.data = NULL ;
     decoding_buffer.size = 0 ;
 
+    decoding_input = NULL ;
+    decoding_input_size = 0 ;
+
     //ret = av_image_alloc(decoding_frame_buffer->data, decoding_frame_buffer->linesize, decoding_context->width, decoding_context->height, decoding_context->pix_fmt, 32);
 
     //if (ret < 0)
@@ -606,6 +632,7 @@ FFmpegVideo::~FFmpegVideo()
     avcodec_free_context(&decoding_context);
     av_frame_free(&encoding_frame_buffer);
     av_frame_free(&decoding_frame_buffer);
+    av_freep(&decoding_input);
 }
 
 #define MAX_FFMPEG_ENCODING_BITRATE 81920
@@ -615,8 +642,6 @@ bool FFmpegVideo::encodeData(const QImage& image, uint32_t target_encoding_bitra
 #ifdef DEBUG_MPEG_VIDEO
 	std::cerr << "Encoding frame of size " << image.width() << "x" << image.height() << ", resized to " << encoding_frame_buffer->width << "x" << encoding_frame_buffer->height << " : ";
 #endif
-	QImage input ;
-
     if(target_encoding_bitrate > MAX_FFMPEG_ENCODING_BITRATE)
     {
         std::cerr << "Max encodign bitrate eexceeded. Capping to " << MAX_FFMPEG_ENCODING_BITRATE << std::endl;
@@ -626,47 +651,8 @@ bool FFmpegVideo::encodeData(const QImage& image, uint32_t target_encoding_bitra
 	encoding_context->rc_max_rate = target_encoding_bitrate;
 	//encoding_context->bit_rate_tolerance = target_encoding_bitrate;
 
-	if(image.width() != encoding_frame_buffer->width || image.height() != encoding_frame_buffer->height)
-		input = image.scaled(QSize(encoding_frame_buffer->width,encoding_frame_buffer->height),Qt::IgnoreAspectRatio,Qt::SmoothTransformation) ;
-	else
-		input = image ;
-
-	/* prepare a dummy image */
-	/* Y */
-	for (int y = 0; y < encoding_context->height/2; y++)
-		for (int x = 0; x < encoding_context->width/2; x++)
-		{
-			QRgb pix00 = input.pixel(QPoint(2*x+0,2*y+0)) ;
-			QRgb pix01 = input.pixel(QPoint(2*x+0,2*y+1)) ;
-			QRgb pix10 = input.pixel(QPoint(2*x+1,2*y+0)) ;
-			QRgb pix11 = input.pixel(QPoint(2*x+1,2*y+1)) ;
-
-			int R00 = (pix00 >> 16) & 0xff ; int G00 = (pix00 >>  8) & 0xff ; int B00 = (pix00 >>  0) & 0xff ;
-			int R01 = (pix01 >> 16) & 0xff ; int G01 = (pix01 >>  8) & 0xff ; int B01 = (pix01 >>  0) & 0xff ;
-			int R10 = (pix10 >> 16) & 0xff ; int G10 = (pix10 >>  8) & 0xff ; int B10 = (pix10 >>  0) & 0xff ;
-			int R11 = (pix11 >> 16) & 0xff ; int G11 = (pix11 >>  8) & 0xff ; int B11 = (pix11 >>  0) & 0xff ;
-
-			int Y00 =  (0.257 * R00) + (0.504 * G00) + (0.098 * B00) + 16  ;
-			int Y01 =  (0.257 * R01) + (0.504 * G01) + (0.098 * B01) + 16  ;
-			int Y10 =  (0.257 * R10) + (0.504 * G10) + (0.098 * B10) + 16  ;
-			int Y11 =  (0.257 * R11) + (0.504 * G11) + (0.098 * B11) + 16  ;
-
-			float R = 0.25*(R00+R01+R10+R11) ;
-			float G = 0.25*(G00+G01+G10+G11) ;
-			float B = 0.25*(B00+B01+B10+B11) ;
-
-			int U =  (0.439 * R) - (0.368 * G) - (0.071 * B) + 128 ;
-			int V = -(0.148 * R) - (0.291 * G) + (0.439 * B) + 128 ;
-
-			encoding_frame_buffer->data[0][(2*y+0) * encoding_frame_buffer->linesize[0] + 2*x+0] = std::min(255,std::max(0,Y00)); // Y
-			encoding_frame_buffer->data[0][(2*y+0) * encoding_frame_buffer->linesize[0] + 2*x+1] = std::min(255,std::max(0,Y01)); // Y
-			encoding_frame_buffer->data[0][(2*y+1) * encoding_frame_buffer->linesize[0] + 2*x+0] = std::min(255,std::max(0,Y10)); // Y
-			encoding_frame_buffer->data[0][(2*y+1) * encoding_frame_buffer->linesize[0] + 2*x+1] = std::min(255,std::max(0,Y11)); // Y
-
-			encoding_frame_buffer->data[1][y * encoding_frame_buffer->linesize[1] + x] = std::min(255,std::max(0,U));// Cr
-			encoding_frame_buffer->data[2][y * encoding_frame_buffer->linesize[2] + x] = std::min(255,std::max(0,V));// Cb
-		}
-
+	/* convert to YUV, scaling to the size of the encoder in the same pass */
+	_converter.rgbToYuv420(image,encoding_frame_buffer->data,encoding_frame_buffer->linesize,encoding_context->width,encoding_context->height) ;
 
 	encoding_frame_buffer->pts = encoding_frame_count++;
 
@@ -748,32 +734,23 @@ bool FFmpegVideo::decodeData(const RsVOIPDataChunk& chunk,QImage& image)
 {
 #ifdef DEBUG_MPEG_VIDEO
 	std::cerr << "Decoding data of size " << chunk.size << std::endl;
-	std::cerr << "Allocating new buffer of size " << chunk.size - HEADER_SIZE << std::endl;
 #endif
 
 	uint32_t s = chunk.size - HEADER_SIZE ;
-#if defined(__MINGW32__)
-	unsigned char *tmp = (unsigned char*)_aligned_malloc(s + AV_INPUT_BUFFER_PADDING_SIZE, 16) ;
-#else
-#ifdef __MACH__
-	//Mac OS X appears to be 16-byte mem aligned.
-	unsigned char *tmp = (unsigned char*)malloc(s + AV_INPUT_BUFFER_PADDING_SIZE) ;
-#else //MAC
-	unsigned char *tmp = (unsigned char*)memalign(16, s + AV_INPUT_BUFFER_PADDING_SIZE) ;
-#endif //MAC
-#endif //MINGW
-	if (tmp == NULL) {
+
+	/* The input buffer is kept between chunks and only grows. av_fast_padded_malloc() also sets the
+	 * padding after s to 0 (this ensures that no overreading happens for damaged mpeg streams) */
+	av_fast_padded_malloc(&decoding_input, &decoding_input_size, s) ;
+
+	if (decoding_input == NULL) {
 		std::cerr << "FFmpegVideo::decodeData() Unable to allocate new buffer of size " << s << std::endl;
 		return false;
 	}
-	/* copy chunk data without header to new buffer */
-	memcpy(tmp, &((unsigned char*)chunk.data)[HEADER_SIZE], s);
-
-	/* set end of buffer to 0 (this ensures that no overreading happens for damaged mpeg streams) */
-	memset(&tmp[s], 0, AV_INPUT_BUFFER_PADDING_SIZE) ;
+	/* copy chunk data without header to the buffer */
+	memcpy(decoding_input, &((unsigned char*)chunk.data)[HEADER_SIZE], s);
 
 	decoding_buffer.size = s ;
-	decoding_buffer.data = tmp;
+	decoding_buffer.data = decoding_input;
 	int got_frame = 1 ;
 
 	while (decoding_buffer.size > 0 || (!decoding_buffer.data && got_frame)) {
@@ -790,25 +767,13 @@ bool FFmpegVideo::decodeData(const RsVOIPDataChunk& chunk,QImage& image)
 
 		if(got_frame)
 		{
-			image = QImage(QSize(decoding_frame_buffer->width,decoding_frame_buffer->height),QImage::Format_ARGB32) ;
+			// Converted into the image of the previous frame, which is free again once it has been displayed.
+			_converter.yuv420ToRgb(decoding_frame_buffer->data,decoding_frame_buffer->linesize,decoding_frame_buffer->width,decoding_frame_buffer->height,_decoded_image) ;
+			image = _decoded_image ;
 
 #ifdef DEBUG_MPEG_VIDEO
 			std::cerr << "Decoded frame. Size=" << image.width() << "x" << image.height() << std::endl;
 #endif
-
-			for (int y = 0; y < decoding_frame_buffer->height; y++)
-				for (int x = 0; x < decoding_frame_buffer->width; x++)
-				{
-					int Y  = decoding_frame_buffer->data[0][y * decoding_frame_buffer->linesize[0] + x] ;
-					int U  = decoding_frame_buffer->data[1][(y/2) * decoding_frame_buffer->linesize[1] + x/2] ;
-					int V  = decoding_frame_buffer->data[2][(y/2) * decoding_frame_buffer->linesize[2] + x/2] ;
-
-					int B = std::min(255,std::max(0,(int)(1.164*(Y - 16) + 1.596*(V - 128)))) ;
-					int G = std::min(255,std::max(0,(int)(1.164*(Y - 16) - 0.813*(V - 128) - 0.391*(U - 128)))) ;
-					int R = std::min(255,std::max(0,(int)(1.164*(Y - 16)                   + 2.018*(U - 128)))) ;
-
-					image.setPixel(QPoint(x,y),QRgb( 0xff000000 + (R << 16) + (G << 8) + B)) ;
-				}
 		}
 	}
 	/* flush the decoder */
@@ -22,7 +22,9 @@
 
 #include <stdint.h>
 #include <QImage>
+#include <QByteArray>
 #include "interface/rsVOIP.h"
+#include "VideoConverter.h"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -57,6 +59,14 @@ private:
     QImage _decoded_reference_frame ;
     QImage _encoded_reference_frame ;
 
+    // scratch buffers, reused from frame to frame
+    QImage _decoded_frame ;
+    QImage _decoded_sum_frame ;
+    QImage _encoded_difference_frame ;
+    QByteArray _encoded_jpeg ;
+
+    VideoConverter _converter ;
+
     uint32_t _encoded_ref_frame_max_distance ;	// max distance between two reference frames.
     uint32_t _encoded_ref_frame_count ;
 };
@@ -84,7 +94,12 @@ private:
     AVFrame *encoding_frame_buffer ;
     AVFrame *decoding_frame_buffer ;
     AVPacket decoding_buffer;
+    uint8_t *decoding_input ;			// padded copy of the incoming chunks, reused
+    unsigned int decoding_input_size ;
     uint64_t encoding_frame_count ;
+
+    VideoConverter _converter ;
+    QImage _decoded_image ;
     
 #ifdef DEBUG_MPEG_VIDEO
     FILE *encoding_debug_file ;
@@ -48,12 +48,27 @@ class RsVOIPPongResult
 	double mOffset;
 };
 
+// Encoded audio or video. The chunk owns its data and can only be moved, so that the payload of the
+// network items is handed over to the GUI, and back, without copies.
+//
 struct RsVOIPDataChunk
 {
 	typedef enum { RS_VOIP_DATA_TYPE_UNKNOWN = 0x00,
 	               RS_VOIP_DATA_TYPE_AUDIO   = 0x01,
 	               RS_VOIP_DATA_TYPE_VIDEO   = 0x02 } RsVOIPDataType ;
 
+	RsVOIPDataChunk() : data(NULL), size(0), type(RS_VOIP_DATA_TYPE_UNKNOWN) {}
+	RsVOIPDataChunk(RsVOIPDataChunk&& chunk) : data(chunk.data), size(chunk.size), type(chunk.type) { chunk.data = NULL ; chunk.size = 0 ; }
+	~RsVOIPDataChunk() { clear() ; }
+
+	RsVOIPDataChunk& operator=(RsVOIPDataChunk&& chunk) ;
+
+	RsVOIPDataChunk(const RsVOIPDataChunk&) = delete ;
+	RsVOIPDataChunk& operator=(const RsVOIPDataChunk&) = delete ;
+
+	// Gives up the data, which the caller must free.
+	void *release() ;
+
 	void *data ; // create/delete using malloc/free.
 	uint32_t size ;
 	RsVOIPDataType type ;	// video or audio
@@ -68,11 +83,10 @@ class RsVOIP
 		virtual int sendVoipRinging(const RsPeerId& peer_id, uint32_t flags) = 0;
 		virtual int sendVoipAcceptCall(const RsPeerId& peer_id, uint32_t flags) = 0;
 
-		// Sending data. The client keeps the memory ownership and must delete it after calling this.
-		virtual int sendVoipData(const RsPeerId& peer_id,const RsVOIPDataChunk& chunk) = 0;
+		// Sending data. The data of the chunk is given to the network item, so the chunk is empty after this.
+		virtual int sendVoipData(const RsPeerId& peer_id,RsVOIPDataChunk&& chunk) = 0;
 
-		// The server fill in the data and gives up memory ownership. The client must delete the memory
-		// in each chunk once it has been used.
+		// The server fills in the chunks with the data of the received items, and gives up their memory.
 		//
 		virtual bool getIncomingData(const RsPeerId& peer_id,std::vector<RsVOIPDataChunk>& chunks) = 0;
 
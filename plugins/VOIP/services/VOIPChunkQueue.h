@@ -0,0 +1,77 @@
+/*******************************************************************************
+ * plugins/VOIP/services/VOIPChunkQueue.h                                      *
+ *                                                                             *
+ * Copyright (C) 2015 by Retroshare Team <retroshare.project@gmail.com>        *
+ *                                                                             *
+ * This program is free software: you can redistribute it and/or modify        *
+ * it under the terms of the GNU Affero General Public License as              *
+ * published by the Free Software Foundation, either version 3 of the          *
+ * License, or (at your option) any later version.                             *
+ *                                                                             *
+ * This program is distributed in the hope that it will be useful,             *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the                *
+ * GNU Affero General Public License for more details.                         *
+ *                                                                             *
+ * You should have received a copy of the GNU Affero General Public License    *
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.       *
+ *                                                                             *
+ *******************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <utility>
+
+#include <interface/rsVOIP.h>
+
+// Queue of the incoming chunks of one peer, without lock: the service thread is the only one to push
+// and the GUI thread the only one to pop. The capacity is fixed, so when the GUI does not keep up the
+// new chunks are refused rather than piling up (they would be played too late anyway).
+//
+class VOIPChunkQueue
+{
+	public:
+		static const uint32_t CAPACITY = 256 ;	// power of 2. About 5 seconds of audio.
+
+		VOIPChunkQueue() : _head(0), _tail(0) {}
+
+		// Producer side. On success the chunk is moved into the queue, otherwise it is left untouched.
+		//
+		bool push(RsVOIPDataChunk& chunk)
+		{
+			uint32_t tail = _tail.load(std::memory_order_relaxed) ;
+
+			if(tail - _head.load(std::memory_order_acquire) == CAPACITY)
+				return false ;
+
+			_slots[tail & (CAPACITY-1)] = std::move(chunk) ;
+			_tail.store(tail+1,std::memory_order_release) ;
+
+			return true ;
+		}
+
+		// Consumer side.
+		//
+		bool pop(RsVOIPDataChunk& chunk)
+		{
+			uint32_t head = _head.load(std::memory_order_relaxed) ;
+
+			if(head == _tail.load(std::memory_order_acquire))
+				return false ;
+
+			chunk = std::move(_slots[head & (CAPACITY-1)]) ;
+			_head.store(head+1,std::memory_order_release) ;
+
+			return true ;
+		}
+
+	private:
+		RsVOIPDataChunk _slots[CAPACITY] ;
+
+		// counters, wrapping around. Kept on separate cache lines, since each is written by one thread.
+		std::atomic<uint32_t> _head ;
+		char _padding[64] ;
+		std::atomic<uint32_t> _tail ;
+};
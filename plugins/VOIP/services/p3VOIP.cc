@@ -112,7 +112,7 @@ static double convert64bitsToTs(uint64_t bits)
 }
 
 p3VOIP::p3VOIP(RsPluginHandler *handler,VOIPNotify *notifier)
-     : RsPQIService(RS_SERVICE_TYPE_VOIP_PLUGIN,0,handler), mVOIPMtx("p3VOIP"), mServiceControl(handler->getServiceControl()) , mNotify(notifier)
+     : RsPQIService(RS_SERVICE_TYPE_VOIP_PLUGIN,0,handler), mVOIPMtx("p3VOIP"), mIncomingQueuesMtx("p3VOIP incoming queues"), mServiceControl(handler->getServiceControl()) , mNotify(notifier)
 {
 	addSerialType(new RsVOIPSerialiser());
 
@@ -146,6 +146,12 @@ RsServiceInfo p3VOIP::getServiceInfo()
                          TURTLE_MIN_MINOR_VERSION);
 }
 
+p3VOIP::~p3VOIP()
+{
+	for(std::map<RsPeerId,VOIPChunkQueue*>::iterator it(mIncomingQueues.begin());it!=mIncomingQueues.end();++it)
+		delete it->second ;
+}
+
 void RsVOIPDataChunk::clear()
 { 
     
@@ -154,6 +160,32 @@ void RsVOIPDataChunk::clear()
     data=NULL; 
     size=0 ;
 }
+
+RsVOIPDataChunk& RsVOIPDataChunk::operator=(RsVOIPDataChunk&& chunk)
+{
+    if(this != &chunk)
+    {
+        clear() ;
+
+        data = chunk.data ;
+        size = chunk.size ;
+        type = chunk.type ;
+
+        chunk.data = NULL ;
+        chunk.size = 0 ;
+    }
+    return *this ;
+}
+
+void *RsVOIPDataChunk::release()
+{
+    void *d = data ;
+
+    data = NULL ;
+    size = 0 ;
+
+    return d ;
+}
 int	p3VOIP::tick()
 {
 #ifdef DEBUG_VOIP
@@ -266,7 +298,7 @@ int p3VOIP::sendVoipBandwidth(const RsPeerId &peer_id,uint32_t bytes_per_sec)
 
 	return true ;
 }
-int p3VOIP::sendVoipData(const RsPeerId& peer_id,const RsVOIPDataChunk& chunk)
+int p3VOIP::sendVoipData(const RsPeerId& peer_id,RsVOIPDataChunk&& chunk)
 {
 #ifdef DEBUG_VOIP
 	std::cerr << "Sending " << chunk.size << " bytes of voip data." << std::endl;
@@ -279,16 +311,7 @@ int p3VOIP::sendVoipData(const RsPeerId& peer_id,const RsVOIPDataChunk& chunk)
 		std::cerr << "Cannot allocate RsVOIPDataItem !" << std::endl;
 		return false ;
 	}
-	item->voip_data = rs_malloc(chunk.size) ;
-
-	if(item->voip_data == NULL)
-	{
-		delete item ;
-		return false ;
-	}
-	memcpy(item->voip_data,chunk.data,chunk.size) ;
-	item->PeerId(peer_id) ;
-	item->data_size = chunk.size;
+	item->voip_data = NULL ;
 
 	if(chunk.type == RsVOIPDataChunk::RS_VOIP_DATA_TYPE_AUDIO) 
 		item->flags = RS_VOIP_FLAGS_AUDIO_DATA ;
@@ -298,9 +321,15 @@ int p3VOIP::sendVoipData(const RsPeerId& peer_id,const RsVOIPDataChunk& chunk)
 	{
 		std::cerr << "(EE) p3VOIP: cannot send chunk data. Unknown data type = " << chunk.type << std::endl;
 		delete item ;
+		chunk.clear() ;
 		return false ;
 	}
 
+	// the item takes the memory of the chunk
+	item->PeerId(peer_id) ;
+	item->data_size = chunk.size;
+	item->voip_data = chunk.release() ;
+
 	sendItem(item) ;
 
 	return true ;
@@ -391,74 +420,77 @@ void p3VOIP::handleProtocol(RsVOIPProtocolItem *item)
 
 void p3VOIP::handleData(RsVOIPDataItem *item)
 {
-	RsStackMutex stack(mVOIPMtx); /****** LOCKED MUTEX *******/
+	{
+		RsStackMutex stack(mVOIPMtx); /****** LOCKED MUTEX *******/
 
-	// store the data in a queue.
+		std::map<RsPeerId,VOIPPeerInfo>::iterator it = mPeerInfo.find(item->PeerId()) ;
 
-	std::map<RsPeerId,VOIPPeerInfo>::iterator it = mPeerInfo.find(item->PeerId()) ;
+		if(it == mPeerInfo.end())
+		{
+			std::cerr << "Peer unknown to VOIP process. Dropping data" << std::endl;
+			delete item ;
+			return ;
+		}
 
-	if(it == mPeerInfo.end())
+		// For Video data, measure the bandwidth
+
+		if(item->flags & RS_VOIP_FLAGS_VIDEO_DATA)
+			it->second.total_bytes_received += item->data_size ;
+	}
+
+	RsVOIPDataChunk chunk ;
+
+	uint32_t type_flags = item->flags & (RS_VOIP_FLAGS_AUDIO_DATA | RS_VOIP_FLAGS_VIDEO_DATA) ;
+	if(type_flags == RS_VOIP_FLAGS_AUDIO_DATA)
+		chunk.type = RsVOIPDataChunk::RS_VOIP_DATA_TYPE_AUDIO ;
+	else if(type_flags == RS_VOIP_FLAGS_VIDEO_DATA)
+		chunk.type = RsVOIPDataChunk::RS_VOIP_DATA_TYPE_VIDEO ;
+	else
 	{
-		std::cerr << "Peer unknown to VOIP process. Dropping data" << std::endl;
+		std::cerr << "(EE) p3VOIP::handleData(): error. Cannot handle item with unknown type " << type_flags << std::endl;
 		delete item ;
 		return ;
 	}
-	it->second.incoming_queue.push_back(item) ;	// be careful with the delete action!
 
-	// For Video data, measure the bandwidth
-	
-	if(item->flags & RS_VOIP_FLAGS_VIDEO_DATA)
-		it->second.total_bytes_received += item->data_size ;
+	// store the data in the queue of the peer. The chunk takes the memory of the item.
+
+	chunk.size = item->data_size ;
+	chunk.data = item->voip_data ;
+	item->voip_data = NULL ;
+
+	RsPeerId peer_id = item->PeerId() ;
+	delete item ;
 
-	mNotify->notifyReceivedVoipData(item->PeerId());
+	if(!getIncomingQueue(peer_id)->push(chunk))
+	{
+		std::cerr << "VOIP incoming queue full for peer " << peer_id << ". Dropping data" << std::endl;
+		return ;
+	}
+
+	mNotify->notifyReceivedVoipData(peer_id);
 }
 
-bool p3VOIP::getIncomingData(const RsPeerId& peer_id,std::vector<RsVOIPDataChunk>& incoming_data_chunks)
+VOIPChunkQueue *p3VOIP::getIncomingQueue(const RsPeerId& id)
 {
-	RsStackMutex stack(mVOIPMtx); /****** LOCKED MUTEX *******/
+	RsStackMutex stack(mIncomingQueuesMtx); /****** LOCKED MUTEX *******/
 
-	incoming_data_chunks.clear() ;
+	VOIPChunkQueue *& queue(mIncomingQueues[id]) ;
 
-	std::map<RsPeerId,VOIPPeerInfo>::iterator it = mPeerInfo.find(peer_id) ;
+	if(queue == NULL)
+		queue = new VOIPChunkQueue ;
 
-	if(it == mPeerInfo.end())
-	{
-		std::cerr << "Peer unknown to VOIP process. No data returned. Probably a bug !" << std::endl;
-		return false ;
-	}
-	for(std::list<RsVOIPDataItem*>::const_iterator it2(it->second.incoming_queue.begin());it2!=it->second.incoming_queue.end();++it2)
-	{
-		RsVOIPDataChunk chunk ;
-		chunk.size = (*it2)->data_size ;
-		chunk.data = rs_malloc((*it2)->data_size) ;
-        
-        	if(chunk.data == NULL)
-	    	{
-                	delete *it2 ;
-                	continue ;
-            	}
-
-		uint32_t type_flags = (*it2)->flags & (RS_VOIP_FLAGS_AUDIO_DATA | RS_VOIP_FLAGS_VIDEO_DATA) ;
-		if(type_flags == RS_VOIP_FLAGS_AUDIO_DATA)
-			chunk.type = RsVOIPDataChunk::RS_VOIP_DATA_TYPE_AUDIO ;
-		else if(type_flags == RS_VOIP_FLAGS_VIDEO_DATA)
-			chunk.type = RsVOIPDataChunk::RS_VOIP_DATA_TYPE_VIDEO ;
-		else
-		{
-			std::cerr << "(EE) p3VOIP::getIncomingData(): error. Cannot handle item with unknown type " << type_flags << std::endl;
-			delete *it2 ;
-			free(chunk.data) ;
-			continue ;
-		}
-
-		memcpy(chunk.data,(*it2)->voip_data,(*it2)->data_size) ;
+	return queue ;
+}
 
-		incoming_data_chunks.push_back(chunk) ;
+bool p3VOIP::getIncomingData(const RsPeerId& peer_id,std::vector<RsVOIPDataChunk>& incoming_data_chunks)
+{
+	incoming_data_chunks.clear() ;
 
-		delete *it2 ;
-	}
+	VOIPChunkQueue *queue = getIncomingQueue(peer_id) ;
+	RsVOIPDataChunk chunk ;
 
-	it->second.incoming_queue.clear() ;
+	while(queue->pop(chunk))
+		incoming_data_chunks.push_back(std::move(chunk)) ;
 
 	return true ;
 }
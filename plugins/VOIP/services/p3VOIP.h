@@ -29,6 +29,7 @@
 #include "rsitems/rsconfigitems.h"
 #include "plugins/rspqiservice.h"
 #include <interface/rsVOIP.h>
+#include "services/VOIPChunkQueue.h"
 
 class p3LinkMgr;
 class VOIPNotify ;
@@ -50,7 +51,6 @@ class VOIPPeerInfo
 	uint32_t average_incoming_bandwidth ;
 
 	std::list<RsVOIPPongResult> mPongResults;
-	std::list<RsVOIPDataItem*> incoming_queue ;
 };
 
 
@@ -66,6 +66,7 @@ class p3VOIP: public RsPQIService, public RsVOIP
 {
 	public:
 		p3VOIP(RsPluginHandler *cm,VOIPNotify *);
+		virtual ~p3VOIP();
 
 		/***** overloaded from rsVOIP *****/
 
@@ -74,11 +75,11 @@ class p3VOIP: public RsPQIService, public RsVOIP
 		// Call stuff.
 		//
 
-		// Sending data. The client keeps the memory ownership and must delete it after calling this.
-		virtual int sendVoipData(const RsPeerId &peer_id,const RsVOIPDataChunk& chunk) ;
+		// Sending data. The data of the chunk is given to the network item, so the chunk is empty after this.
+		virtual int sendVoipData(const RsPeerId &peer_id,RsVOIPDataChunk&& chunk) ;
 
-		// The server fill in the data and gives up memory ownership. The client must delete the memory
-		// in each chunk once it has been used.
+		// The server fills in the chunks with the data of the received items, and gives up their memory.
+		// Does not take mVOIPMtx: the chunks come from a lock-free queue per peer.
 		//
 		virtual bool getIncomingData(const RsPeerId& peer_id,std::vector<RsVOIPDataChunk>& chunks) ;
 
@@ -148,6 +149,13 @@ class p3VOIP: public RsPQIService, public RsVOIP
 
 		VOIPPeerInfo *locked_GetPeerInfo(const RsPeerId& id);
 
+		// Incoming data, one queue per peer. The queues are never removed, so that the pointers stay
+		// valid once mIncomingQueuesMtx is released. That mutex is only held to find them.
+		VOIPChunkQueue *getIncomingQueue(const RsPeerId& id) ;
+
+		RsMutex mIncomingQueuesMtx;
+		std::map<RsPeerId, VOIPChunkQueue*> mIncomingQueues;
+
 		static RsTlvKeyValue push_int_value(const std::string& key,int value) ;
 		static int pop_int_value(const std::string& s) ;
 
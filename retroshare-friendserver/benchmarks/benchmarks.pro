@@ -0,0 +1,33 @@
+# RetroShare friend server benchmarks qmake build script
+#
+# Copyright (C) 2021-2021, retroshare team <retroshare.project@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify it under
+# the terms of the GNU Affero General Public License as published by the
+# Free Software Foundation, either version 3 of the License, or (at your option)
+# any later version.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.
+# See the GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License along
+# with this program. If not, see <http://www.gnu.org/licenses/>.
+#
+# SPDX-FileCopyrightText: Retroshare Team <contact@retroshare.cc>
+# SPDX-License-Identifier: AGPL-3.0-or-later
+
+TEMPLATE = subdirs
+
+SUBDIRS += fs_publish_benchmark
+fs_publish_benchmark.file = fs-publish-benchmark.pro
+
+SUBDIRS += fs_encryption_benchmark
+fs_encryption_benchmark.file = fs-encryption-benchmark.pro
+
+# The load generator uses unix sockets directly.
+!win32 {
+    SUBDIRS += fs_load_benchmark
+    fs_load_benchmark.file = fs-load-benchmark.pro
+}
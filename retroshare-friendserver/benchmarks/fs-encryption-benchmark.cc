@@ -0,0 +1,167 @@
+/*
+ * RetroShare Friend Server
+ * Copyright (C) 2021-2021  retroshare team <retroshare.project@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-FileCopyrightText: Retroshare Team <contact@retroshare.cc>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+// Measures the throughput of the response encryption stage of the friend server (serialization, PGP encryption
+// and hand-over to the network) against the number of encryption threads. Responses are built with synthetic
+// invites, encrypted for a freshly generated key, and dropped instead of being sent.
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "util/argstream.h"
+#include "util/rsdebug.h"
+#include "util/rsdir.h"
+#include "util/rsrandom.h"
+#include "pgp/openpgpsdkhandler.h"
+#include "friend_server/fsitem.h"
+
+#include "fsencryptionpool.h"
+
+static const std::string BENCHMARK_DIRECTORY = "fs-encryption-benchmark-data";
+
+// Stands for the network interface. Only counts the items that would be sent.
+
+class FsCountingInterface: public PQInterface
+{
+public:
+    FsCountingInterface() : PQInterface(RsPeerId()),mNbSent(0),mNbErrors(0) {}
+
+    int SendItem(RsItem *item) override
+    {
+        if(dynamic_cast<RsFriendServerEncryptedServerResponseItem*>(item))
+            ++mNbSent;
+        else
+            ++mNbErrors;
+
+        delete item;
+        return 1;
+    }
+    bool RecvItem(RsItem *item) override { delete item; return false; }
+    RsItem *GetItem() override { return nullptr; }
+
+    std::atomic<uint32_t> mNbSent;
+    std::atomic<uint32_t> mNbErrors;
+};
+
+static RsFriendServerServerResponseItem *makeResponse(uint32_t nb_invites)
+{
+    RsFriendServerServerResponseItem *item = new RsFriendServerServerResponseItem;
+
+    item->PeerId(RsPeerId::random());
+    item->unique_identifier = RsRandom::random_u64();
+
+    // Short invites are around 150 characters long.
+
+    for(uint32_t i=0;i<nb_invites;++i)
+        item->friend_invites[RsRandom::random_alphaNumericString(150)] = RsFriendServer::PeerFriendshipLevel::UNKNOWN;
+
+    return item;
+}
+
+int main(int argc, char* argv[])
+{
+    uint32_t nb_requests = 2000;
+    uint32_t nb_invites = 10;
+    uint32_t key_bits = 3072;
+    uint32_t max_threads = std::max(1u,std::thread::hardware_concurrency());
+
+    argstream as(argc,argv);
+
+    as >> parameter( 'n',"requests", nb_requests, "number of responses encrypted for each thread count (default: 2000)", false )
+       >> parameter( 'i',"invites", nb_invites, "number of invites in each response (default: 10)", false )
+       >> parameter( 'b',"key-bits", key_bits, "size of the client PGP key (default: 3072)", false )
+       >> parameter( 't',"max-threads", max_threads, "largest number of encryption threads (default: number of cores)", false )
+       >> help( 'h', "help", "Display this Help" );
+
+    as.defaultErrorHandling(true, true);
+
+    if(!RsDirUtil::checkCreateDirectory(BENCHMARK_DIRECTORY))
+    {
+        RsErr() << "Cannot create benchmark data directory." ;
+        return 1;
+    }
+
+    // Generate the key of the synthetic client, and save it in the public keyring that the workers load.
+
+    OpenPGPSDKHandler pgp_handler(RsDirUtil::makePath(BENCHMARK_DIRECTORY,"pgp_public_keyring"),
+                                  RsDirUtil::makePath(BENCHMARK_DIRECTORY,"pgp_private_keyring"),
+                                  RsDirUtil::makePath(BENCHMARK_DIRECTORY,"pgp_trustdb"),
+                                  RsDirUtil::makePath(BENCHMARK_DIRECTORY,"pgp_lock"));
+    RsPgpId pgp_id;
+    std::string error_string;
+
+    if(!pgp_handler.GeneratePGPCertificate("fs benchmark","fs@benchmark","benchmark",pgp_id,key_bits,error_string))
+    {
+        RsErr() << "Cannot generate PGP key: " << error_string ;
+        return 1;
+    }
+
+    unsigned char *key_data = nullptr;
+    size_t key_size = 0;
+
+    if(!pgp_handler.exportPublicKey(pgp_id,key_data,key_size,false,true))
+    {
+        RsErr() << "Cannot export PGP public key." ;
+        return 1;
+    }
+    std::vector<uint8_t> public_key(key_data,key_data+key_size);
+    free(key_data);
+
+    pgp_handler.syncDatabase();
+
+    RsInfo() << "Friend server encryption benchmark: " << nb_requests << " responses with " << nb_invites << " invites, "
+             << key_bits << " bits key:" ;
+
+    // Powers of two, then the largest number of threads.
+
+    std::vector<uint32_t> thread_counts;
+
+    for(uint32_t n=1;n<max_threads;n *= 2)
+        thread_counts.push_back(n);
+
+    thread_counts.push_back(max_threads);
+
+    double single_thread_rate = 0;
+
+    for(auto nb_threads:thread_counts)
+    {
+        FsCountingInterface network;
+        FsEncryptionPool pool(&network,BENCHMARK_DIRECTORY,nb_threads,16*nb_threads);
+
+        auto start = std::chrono::steady_clock::now();
+
+        for(uint32_t i=0;i<nb_requests;++i)
+            pool.queueResponse(makeResponse(nb_invites),pgp_id,public_key);
+
+        pool.waitForCompletion();
+
+        double rate = nb_requests / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if(single_thread_rate == 0)
+            single_thread_rate = rate;
+
+        RsInfo() << "  " << nb_threads << " threads: " << rate << " requests/s, speedup x" << rate / single_thread_rate
+                 << ((network.mNbErrors > 0)?" (some encryptions failed!)":"") ;
+    }
+
+    return 0;
+}
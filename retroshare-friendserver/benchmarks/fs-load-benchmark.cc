@@ -0,0 +1,740 @@
+/*
+ * RetroShare Friend Server
+ * Copyright (C) 2021-2021  retroshare team <retroshare.project@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-FileCopyrightText: Retroshare Team <contact@retroshare.cc>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+// End-to-end load generator for the friend server.
+//
+// A FriendServer is started in-process, listening on a loopback TCP port, without Tor. Synthetic clients then send
+// publish and remove requests over real TCP connections, with a configurable mix, and the benchmark reports the
+// latency percentiles, the throughput and the memory usage. The server does not respond to removals, so only the
+// publish latencies are round trips, and removals are reported apart with their send time.
+//
+// Each client has its own PGP key, like real clients, and a short invite built in the same format as
+// p3Peers::getShortInvite(). Generating keys is slow, so they are kept in the benchmark directory and only the
+// missing ones are generated at the next runs. Responses are decrypted, so that clients report the peers they
+// received in their next requests, like real clients do.
+//
+// Connections are non-blocking and driven by a few event loops, each one owning a share of the clients and of the
+// simultaneous connections, so that thousands of connections do not need thousands of threads.
+//
+// Only available on unix systems.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <thread>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "util/argstream.h"
+#include "util/rsbase64.h"
+#include "util/radix64.h"
+#include "util/rsdebug.h"
+#include "util/rsdir.h"
+#include "util/rsrandom.h"
+#include "serialiser/rsserial.h"
+#include "pqi/pqinetwork.h"
+#include "pgp/pgpkeyutil.h"
+#include "pgp/rscertificate.h"
+#include "pgp/openpgpsdkhandler.h"
+#include "friend_server/fsitem.h"
+
+#include "friendserver.h"
+#include "fspoller.h"
+
+static const std::string BENCHMARK_DIRECTORY = "fs-load-benchmark-data";
+static const std::string KEY_PASSPHRASE      = "benchmark";
+static const int         REQUEST_TIMEOUT_S   = 30;
+static const int         POLL_TIMEOUT_MS     = 100;		// bounds the time needed to notice timeouts and the end of a phase
+static const uint32_t    READ_CHUNK_SIZE     = 16384;
+
+struct FsSyntheticClient
+{
+    FsSyntheticClient() : joined(false),identifier(0) {}
+
+    RsPeerId ssl_id;
+    RsPgpId pgp_id;
+    std::string public_key_b64;
+    std::string short_invite;
+
+    bool joined;
+    uint64_t identifier;
+    std::map<RsPeerId,RsFriendServer::PeerFriendshipLevel> known_peers;
+};
+
+// A request in flight on a non-blocking connection.
+
+struct FsPendingRequest
+{
+    FsPendingRequest() : client(nullptr),remove(false),connected(false),sent(0) {}
+
+    FsSyntheticClient *client;
+    bool remove;
+    bool connected;
+    std::vector<uint8_t> out_buffer;
+    uint32_t sent;
+    std::vector<uint8_t> in_buffer;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Timings of the completed requests of an event loop, in ms.
+
+struct FsLatencies
+{
+    std::vector<double> publish;	// from the connection to the last byte of the response
+    std::vector<double> remove_send;	// from the connection to the last byte of the request, no response is sent
+};
+
+static std::string passphraseCallback(void *,const char *,const char *,const char *,int,bool *cancelled)
+{
+    if(cancelled)
+        *cancelled = false;
+
+    return KEY_PASSPHRASE;
+}
+
+static std::string pgpPath(const std::string& file) { return RsDirUtil::makePath(RsDirUtil::makePath(BENCHMARK_DIRECTORY,"clients"),file); }
+
+static OpenPGPSDKHandler *makePgpHandler()
+{
+    return new OpenPGPSDKHandler(pgpPath("pgp_public_keyring"),pgpPath("pgp_secret_keyring"),pgpPath("pgp_trustdb"),pgpPath("pgp_lock"));
+}
+
+// Gives its own key to each client. The keys stay in the keyring of the benchmark directory, and their ids are
+// listed in a cache file per key size, so that only the keys that are missing from the cache are generated.
+
+static bool setupClientKeys(OpenPGPSDKHandler& pgp_handler,uint32_t key_bits,std::vector<FsSyntheticClient>& clients,std::vector<RsPgpFingerprint>& fingerprints)
+{
+    std::string cache_path = pgpPath("keys-" + std::to_string(key_bits) + ".txt");
+    std::vector<RsPgpId> ids;
+
+    std::ifstream cache(cache_path);
+    std::string line;
+
+    while(std::getline(cache,line))
+    {
+        RsPgpId id(line);
+
+        if(!id.isNull() && pgp_handler.haveSecretKey(id))	// the keyring may have been removed in the meantime
+            ids.push_back(id);
+    }
+    cache.close();
+
+    RsInfo() << "Found " << std::min(ids.size(),clients.size()) << " cached PGP keys of " << key_bits << " bits" ;
+
+    if(ids.size() < clients.size())
+    {
+        RsInfo() << "Generating " << clients.size() - ids.size() << " PGP keys of " << key_bits << " bits. They are kept for the next runs." ;
+
+        while(ids.size() < clients.size())
+        {
+            RsPgpId id;
+            std::string error_string;
+
+            if(!pgp_handler.GeneratePGPCertificate("fs load " + std::to_string(ids.size()),"fs@benchmark",KEY_PASSPHRASE,id,key_bits,error_string))
+            {
+                RsErr() << "Cannot generate PGP key: " << error_string ;
+                return false;
+            }
+            ids.push_back(id);
+
+            if(ids.size() % 100 == 0)
+                RsInfo() << "  " << ids.size() << " keys" ;
+        }
+        pgp_handler.syncDatabase();
+
+        std::ofstream out(cache_path,std::ios::trunc);
+
+        for(const auto& id:ids)
+            out << id.toStdString() << std::endl;
+
+        if(!out)
+            RsWarn() << "Cannot write the key cache " << cache_path << ". Keys will be generated again at the next run." ;
+    }
+
+    fingerprints.resize(clients.size());
+
+    for(uint32_t i=0;i<clients.size();++i)
+    {
+        unsigned char *key_data = nullptr;
+        size_t key_size = 0;
+
+        if(!pgp_handler.getKeyFingerprint(ids[i],fingerprints[i]) || !pgp_handler.exportPublicKey(ids[i],key_data,key_size,false,true))
+        {
+            RsErr() << "Cannot export PGP key " << ids[i] ;
+            return false;
+        }
+
+        clients[i].pgp_id = ids[i];
+        RsBase64::encode(key_data,key_size,clients[i].public_key_b64,true,false);
+        free(key_data);
+    }
+    return true;
+}
+
+// Same format as p3Peers::getShortInvite(): a list of tagged fields followed by a CRC, in radix64.
+
+static std::string makeShortInvite(const RsPeerId& ssl_id,const RsPgpFingerprint& fpr,const std::string& name)
+{
+    size_t buf_size = 1000;
+    size_t offset = 0;
+    unsigned char *buf = (unsigned char*)malloc(buf_size);
+
+    RsCertificate::addPacket((uint8_t)RsShortInviteFieldType::SSL_ID,ssl_id.toByteArray(),RsPeerId::SIZE_IN_BYTES,buf,offset,buf_size);
+    RsCertificate::addPacket((uint8_t)RsShortInviteFieldType::PEER_NAME,(const unsigned char*)name.c_str(),name.size(),buf,offset,buf_size);
+    RsCertificate::addPacket((uint8_t)RsShortInviteFieldType::PGP_FINGERPRINT,fpr.toByteArray(),RsPgpFingerprint::SIZE_IN_BYTES,buf,offset,buf_size);
+
+    uint32_t crc = PGPKeyManagement::compute24bitsCRC(buf,offset);
+    unsigned char mem[3] = { (unsigned char)(crc & 0xff),(unsigned char)((crc >> 8) & 0xff),(unsigned char)((crc >> 16) & 0xff) };
+
+    RsCertificate::addPacket((uint8_t)RsShortInviteFieldType::CHECKSUM,mem,3,buf,offset,buf_size);
+
+    std::string invite;
+    Radix64::encode(buf,offset,invite);
+    free(buf);
+
+    return invite;
+}
+
+static size_t currentRSS()
+{
+    // Resident set size in kB, from /proc. The server runs in the same process, so this is server + load generator.
+
+    std::ifstream status("/proc/self/status");
+    std::string line;
+
+    while(std::getline(status,line))
+        if(line.compare(0,6,"VmRSS:") == 0)
+            return strtoul(line.c_str()+6,nullptr,10);
+
+    return 0;
+}
+
+//=========================================================================================================//
+//                                          Network                                                        //
+//=========================================================================================================//
+
+// When non_blocking is set, the connection is usually still in progress when the socket is returned. It becomes
+// writable once the connection is established (or has failed).
+
+static int connectToServer(uint16_t port,bool non_blocking)
+{
+    int fd = socket(AF_INET,SOCK_STREAM,0);
+
+    if(fd < 0)
+        return -1;
+
+    int one = 1;
+    setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+
+    if(non_blocking)
+        unix_fcntl_nonblock(fd);
+
+    struct sockaddr_in addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if(connect(fd,(struct sockaddr*)&addr,sizeof(addr)) < 0 && !(non_blocking && errno == EINPROGRESS))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool serialiseItem(RsItem *item,std::vector<uint8_t>& buf)
+{
+    uint32_t size = FsSerializer().size(item);
+    buf.resize(size);
+
+    if(!FsSerializer().serialise(item,buf.data(),&size))
+        return false;
+
+    buf.resize(size);
+    return true;
+}
+
+// Sends what the socket accepts. Returns false on error.
+
+static bool sendPending(int fd,FsPendingRequest& r)
+{
+    while(r.sent < r.out_buffer.size())
+    {
+        ssize_t n = send(fd,r.out_buffer.data()+r.sent,r.out_buffer.size()-r.sent,MSG_NOSIGNAL);
+
+        if(n > 0)
+        {
+            r.sent += n;
+            continue;
+        }
+
+        if(n < 0 && errno == EINTR)
+            continue;
+
+        return n < 0 && (errno == EWOULDBLOCK || errno == EAGAIN);
+    }
+    return true;
+}
+
+// Reads what is available, and tells whether the response item is complete. Returns false on error, or if the
+// server closed the connection before the end of the item.
+
+static bool receivePending(int fd,FsPendingRequest& r,bool& complete)
+{
+    uint8_t buf[READ_CHUNK_SIZE];
+
+    complete = false;
+
+    for(;;)
+    {
+        if(r.in_buffer.size() >= getRsPktBaseSize())
+        {
+            uint32_t size = getRsItemSize(r.in_buffer.data());
+
+            if(size < getRsPktBaseSize() || size > getRsPktMaxSize())
+                return false;
+
+            if(r.in_buffer.size() >= size)
+            {
+                complete = true;
+                return true;
+            }
+        }
+
+        ssize_t n = recv(fd,buf,sizeof(buf),0);
+
+        if(n > 0)
+        {
+            r.in_buffer.insert(r.in_buffer.end(),buf,buf+n);
+            continue;
+        }
+
+        if(n < 0 && errno == EINTR)
+            continue;
+
+        return n < 0 && (errno == EWOULDBLOCK || errno == EAGAIN);
+    }
+}
+
+//=========================================================================================================//
+//                                          Load generator                                                 //
+//=========================================================================================================//
+
+class FsLoadGenerator
+{
+public:
+    FsLoadGenerator(uint16_t port,const std::map<std::string,RsPeerId>& invites,uint32_t nb_requested_friends,uint32_t remove_percent)
+        : mPort(port),mInvites(invites),mNbRequestedFriends(nb_requested_friends),mRemovePercent(remove_percent),mNbErrors(0) {}
+
+    // Event loop running requests for the given clients, with at most nb_connections requests in flight, until the
+    // deadline. Clients are only used by one loop, which never has two requests in flight for the same client.
+    // When join_only is true, each client publishes once, and the loop stops.
+
+    void run(const std::vector<FsSyntheticClient*>& clients,uint32_t nb_connections,std::chrono::steady_clock::time_point deadline,
+             bool join_only,FsLatencies& latencies)
+    {
+        std::unique_ptr<OpenPGPSDKHandler> pgp_handler(makePgpHandler());	// own handler, so that decryption is not serialized between loops
+
+        FsPoller poller;
+        std::map<int,FsPendingRequest> requests;
+        std::vector<FsSyntheticClient*> idle(clients);		// clients with no request in flight
+        std::vector<FsPoller::Event> events;
+
+        auto finish = [&](std::map<int,FsPendingRequest>::iterator it,bool ok)
+        {
+            FsPendingRequest& r(it->second);
+            double latency_ms = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() - r.start).count();
+
+            poller.remove(it->first);
+            close(it->first);
+
+            // The response is timed up to its last byte: it is part of what a client waits for. Decryption is not.
+            // Removals end when the request is sent.
+
+            if(ok)
+                ok = r.remove ? removeDone(*r.client) : publishDone(*r.client,r.in_buffer,*pgp_handler);
+
+            if(ok)
+                (r.remove ? latencies.remove_send : latencies.publish).push_back(latency_ms);
+            else
+                ++mNbErrors;
+
+            if(!join_only)
+                idle.push_back(r.client);
+
+            requests.erase(it);
+        };
+
+        for(;;)
+        {
+            auto now = std::chrono::steady_clock::now();
+            bool starting = join_only || now < deadline;
+
+            while(starting && requests.size() < nb_connections && !idle.empty())
+            {
+                uint32_t n = join_only ? idle.size()-1 : RsRandom::random_u32() % idle.size();
+                FsSyntheticClient *client = idle[n];
+
+                idle[n] = idle.back();
+                idle.pop_back();
+
+                bool remove = !join_only && client->joined && (RsRandom::random_u32() % 100) < mRemovePercent;
+
+                if(!startRequest(*client,remove,poller,requests))
+                {
+                    ++mNbErrors;
+
+                    if(!join_only)
+                        idle.push_back(client);
+                    break;	// out of sockets, probably. Retry after some requests have ended.
+                }
+            }
+
+            if(requests.empty() && (!starting || idle.empty()))
+                break;
+
+            for(auto it=requests.begin();it!=requests.end();)
+                if(now - it->second.start > std::chrono::seconds(REQUEST_TIMEOUT_S))
+                    finish(it++,false);
+                else
+                    ++it;
+
+            if(poller.wait(events,POLL_TIMEOUT_MS) < 0)
+                continue;
+
+            for(const auto& ev:events)
+            {
+                auto it = requests.find(ev.fd);
+
+                if(it == requests.end())
+                    continue;
+
+                bool done = false;
+                bool ok = processEvent(ev.fd,ev.flags,it->second,poller,done);
+
+                if(!ok || done)
+                    finish(it,ok);
+            }
+        }
+    }
+
+    uint32_t nbErrors() const { return mNbErrors; }
+
+private:
+    bool startRequest(FsSyntheticClient& client,bool remove,FsPoller& poller,std::map<int,FsPendingRequest>& requests)
+    {
+        FsPendingRequest r;
+        r.client = &client;
+        r.remove = remove;
+        r.start = std::chrono::steady_clock::now();
+
+        if(remove)
+        {
+            RsFriendServerClientRemoveItem item;
+            item.peer_id = client.ssl_id;
+            item.unique_identifier = client.identifier;
+
+            if(!serialiseItem(&item,r.out_buffer))
+                return false;
+        }
+        else
+        {
+            RsFriendServerClientPublishItem item;
+            item.n_requested_friends = mNbRequestedFriends;
+            item.short_invite = client.short_invite;
+            item.pgp_public_key_b64 = client.public_key_b64;
+            item.already_received_peers = client.known_peers;
+
+            if(!serialiseItem(&item,r.out_buffer))
+                return false;
+        }
+
+        int fd = connectToServer(mPort,true);
+
+        if(fd < 0)
+            return false;
+
+        if(!poller.add(fd,FsPoller::FS_POLL_WRITE))
+        {
+            close(fd);
+            return false;
+        }
+
+        requests[fd] = std::move(r);
+        return true;
+    }
+
+    // Moves the request forward: connection, then sending, then receiving the response for publishes.
+    // Returns false on error. done is set when the exchange is over.
+
+    bool processEvent(int fd,uint32_t flags,FsPendingRequest& r,FsPoller& poller,bool& done)
+    {
+        if(!r.connected)
+        {
+            int err = 0;
+            socklen_t len = sizeof(err);
+
+            if(getsockopt(fd,SOL_SOCKET,SO_ERROR,&err,&len) < 0 || err != 0)
+                return false;
+
+            r.connected = true;
+        }
+
+        if(r.sent < r.out_buffer.size())
+        {
+            if(!sendPending(fd,r))
+                return false;
+
+            if(r.sent < r.out_buffer.size())
+                return true;
+
+            if(r.remove)	// the server does not answer removals.
+            {
+                done = true;
+                return true;
+            }
+            return poller.modify(fd,FsPoller::FS_POLL_READ);
+        }
+
+        if(flags & (FsPoller::FS_POLL_READ | FsPoller::FS_POLL_ERROR))
+            return receivePending(fd,r,done);
+
+        return true;
+    }
+
+    bool publishDone(FsSyntheticClient& client,std::vector<uint8_t>& response_data,OpenPGPSDKHandler& pgp_handler)
+    {
+        uint32_t size = response_data.size();
+        std::unique_ptr<RsItem> response(FsSerializer().deserialise(response_data.data(),&size));
+        auto encrypted = dynamic_cast<RsFriendServerEncryptedServerResponseItem*>(response.get());
+
+        if(!encrypted)
+            return false;
+
+        uint32_t decrypted_size = encrypted->bin_len + 1000;
+        std::vector<uint8_t> decrypted(decrypted_size);
+
+        if(!pgp_handler.decryptDataBin(client.pgp_id,encrypted->bin_data,encrypted->bin_len,decrypted.data(),&decrypted_size))
+            return false;
+
+        std::unique_ptr<RsItem> clear_item(FsSerializer().deserialise(decrypted.data(),&decrypted_size));
+        auto sr_item = dynamic_cast<RsFriendServerServerResponseItem*>(clear_item.get());
+
+        if(!sr_item)
+            return false;
+
+        // Received peers are reported in the next requests, as if the client had added some of them as friends.
+
+        for(const auto& it:sr_item->friend_invites)
+        {
+            auto p = mInvites.find(it.first);
+
+            if(p != mInvites.end())
+                client.known_peers[p->second] = (RsRandom::random_u32() & 1) ? RsFriendServer::PeerFriendshipLevel::HAS_ACCEPTED_KEY
+                                                                              : RsFriendServer::PeerFriendshipLevel::HAS_KEY;
+        }
+
+        client.identifier = sr_item->unique_identifier;
+        client.joined = true;
+        return true;
+    }
+
+    bool removeDone(FsSyntheticClient& client)
+    {
+        client.joined = false;
+        client.known_peers.clear();
+        return true;
+    }
+
+    uint16_t mPort;
+    const std::map<std::string,RsPeerId>& mInvites;
+    uint32_t mNbRequestedFriends;
+    uint32_t mRemovePercent;
+    std::atomic<uint32_t> mNbErrors;
+};
+
+static void printPercentiles(const std::string& name,std::vector<double>& values_ms)
+{
+    if(values_ms.empty())
+        return;
+
+    std::sort(values_ms.begin(),values_ms.end());
+
+    auto percentile = [&values_ms](double p) { return values_ms[std::min(values_ms.size()-1,static_cast<size_t>(p * values_ms.size()))]; };
+
+    RsInfo() << "  " << name << " (ms, " << values_ms.size() << " requests): p50=" << percentile(0.5) << " p90=" << percentile(0.9)
+             << " p99=" << percentile(0.99) << " p99.9=" << percentile(0.999) << " max=" << values_ms.back() ;
+}
+
+static void runPhase(const std::string& name,FsLoadGenerator& generator,std::vector<FsSyntheticClient>& clients,uint32_t nb_loops,
+                     uint32_t nb_connections,uint32_t duration_s,bool join_only)
+{
+    // Clients and connections are split between the loops, so that a client never has two requests in flight.
+
+    std::vector<std::vector<FsSyntheticClient*> > slices(nb_loops);
+
+    for(uint32_t i=0;i<clients.size();++i)
+        slices[i % nb_loops].push_back(&clients[i]);
+
+    std::vector<FsLatencies> latencies(nb_loops);
+    std::vector<std::thread> threads;
+
+    uint32_t errors_before = generator.nbErrors();
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::seconds(duration_s);
+
+    for(uint32_t i=0;i<nb_loops;++i)
+    {
+        uint32_t loop_connections = nb_connections / nb_loops + (i < nb_connections % nb_loops ? 1 : 0);
+        threads.push_back(std::thread([&,i,loop_connections]() { generator.run(slices[i],loop_connections,deadline,join_only,latencies[i]); }));
+    }
+
+    for(auto& t:threads)
+        t.join();
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    FsLatencies all;
+
+    for(const auto& l:latencies)
+    {
+        all.publish.insert(all.publish.end(),l.publish.begin(),l.publish.end());
+        all.remove_send.insert(all.remove_send.end(),l.remove_send.begin(),l.remove_send.end());
+    }
+
+    size_t nb_requests = all.publish.size() + all.remove_send.size();
+
+    RsInfo() << name << ": " << nb_requests << " requests in " << elapsed << " s, " << nb_requests / elapsed << " requests/s, "
+             << generator.nbErrors() - errors_before << " errors" ;
+    printPercentiles("publish round trip",all.publish);
+    printPercentiles("remove send time",all.remove_send);
+    RsInfo() << "  RSS: " << currentRSS() / 1024 << " MB" ;
+}
+
+int main(int argc, char* argv[])
+{
+    uint32_t nb_clients = 2000;
+    uint32_t nb_connections = 100;
+    uint32_t nb_loops = 2;
+    uint32_t key_bits = 2048;
+    uint32_t duration_s = 30;
+    uint32_t remove_percent = 10;
+    uint32_t nb_requested_friends = 10;
+    uint16_t port = 2017;
+    uint32_t nb_io_workers = 2;
+    uint32_t nb_encryption_workers = std::max(1u,std::thread::hardware_concurrency());
+
+    argstream as(argc,argv);
+
+    as >> parameter( 'n',"clients", nb_clients, "number of synthetic clients, each with its own PGP key (default: 2000)", false )
+       >> parameter( 'c',"concurrency", nb_connections, "number of simultaneous connections (default: 100)", false )
+       >> parameter( 'l',"loops", nb_loops, "number of client event loops, that also decrypt the responses (default: 2)", false )
+       >> parameter( 'b',"key-bits", key_bits, "size of the PGP keys (default: 2048)", false )
+       >> parameter( 'd',"duration", duration_s, "duration of the mixed load phase in seconds (default: 30)", false )
+       >> parameter( 'r',"remove-percent", remove_percent, "percentage of remove requests in the mixed load phase (default: 10)", false )
+       >> parameter( 'f',"friends", nb_requested_friends, "number of friends requested by clients (default: 10)", false )
+       >> parameter( 'p',"port", port, "loopback port of the friend server (default: 2017)", false )
+       >> parameter( 'w',"io-workers", nb_io_workers, "number of server I/O threads (default: 2)", false )
+       >> parameter( 'e',"encryption-workers", nb_encryption_workers, "number of server encryption threads (default: number of cores)", false )
+       >> help( 'h', "help", "Display this Help" );
+
+    as.defaultErrorHandling(true, true);
+
+    nb_clients = std::max(1u,nb_clients);
+    nb_connections = std::max(1u,std::min(nb_connections,nb_clients));
+    nb_loops = std::max(1u,std::min(nb_loops,nb_connections));
+
+    std::string server_directory = RsDirUtil::makePath(BENCHMARK_DIRECTORY,"server");
+
+    if(!RsDirUtil::checkCreateDirectory(BENCHMARK_DIRECTORY) || !RsDirUtil::checkCreateDirectory(server_directory)
+            || !RsDirUtil::checkCreateDirectory(RsDirUtil::makePath(BENCHMARK_DIRECTORY,"clients")))
+    {
+        RsErr() << "Cannot create benchmark data directories." ;
+        return 1;
+    }
+
+    // Start from an empty server state, since clients are new at each run.
+
+    remove(RsDirUtil::makePath(server_directory,"fs_state.snapshot").c_str());
+    remove(RsDirUtil::makePath(server_directory,"fs_state.journal").c_str());
+
+    // 1 - synthetic clients, with their keys
+
+    PGPHandler::setPassphraseCallback(passphraseCallback);
+
+    std::vector<FsSyntheticClient> clients(nb_clients);
+    std::vector<RsPgpFingerprint> fingerprints;
+
+    {
+        std::unique_ptr<OpenPGPSDKHandler> pgp_handler(makePgpHandler());
+
+        if(!setupClientKeys(*pgp_handler,key_bits,clients,fingerprints))
+            return 1;
+    }
+
+    std::map<std::string,RsPeerId> invites;
+
+    for(uint32_t i=0;i<nb_clients;++i)
+    {
+        clients[i].ssl_id = RsPeerId::random();
+        clients[i].short_invite = makeShortInvite(clients[i].ssl_id,fingerprints[i],"fs load client " + std::to_string(i));
+
+        invites[clients[i].short_invite] = clients[i].ssl_id;
+    }
+
+    // 2 - friend server on loopback
+
+    FriendServer fs(server_directory,"127.0.0.1",port,nb_io_workers,std::max(1000u,nb_connections),nb_encryption_workers);
+    fs.start();
+
+    for(int i=0;i<50;++i)	// wait for the server to listen
+    {
+        int fd = connectToServer(port,false);
+
+        if(fd >= 0)
+        {
+            close(fd);
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    RsInfo() << "Friend server load benchmark: " << nb_clients << " clients, " << nb_connections << " connections on " << nb_loops << " loops, "
+             << remove_percent << "% removals, " << nb_encryption_workers << " encryption threads" ;
+
+    // 3 - load
+
+    FsLoadGenerator generator(port,invites,nb_requested_friends,remove_percent);
+
+    runPhase("Join (one publish per client)",generator,clients,nb_loops,nb_connections,0,true);
+    runPhase("Mixed publish/remove load",generator,clients,nb_loops,nb_connections,duration_s,false);
+
+    fs.fullstop();	// also stops the network, encryption and statistics threads of the server
+    return 0;
+}
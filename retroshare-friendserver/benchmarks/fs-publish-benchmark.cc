@@ -0,0 +1,167 @@
+/*
+ * RetroShare Friend Server
+ * Copyright (C) 2021-2021  retroshare team <retroshare.project@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-FileCopyrightText: Retroshare Team <contact@retroshare.cc>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+// Measures the cost of updating the lists of closest peers when clients publish, with synthetic
+// fingerprints and no network/PGP involved.
+//
+// The reference is the previous algorithm, which computed a SHA1 distance to every participant and updated
+// every list on each publish. It is only run for a sample of publishes, since it is quadratic.
+
+#include <chrono>
+#include <vector>
+
+#include "util/argstream.h"
+#include "util/rsdebug.h"
+#include "util/rsdir.h"
+#include "util/rsrandom.h"
+
+#include "friendserver.h"
+
+static const uint32_t NB_CLOSEST_PEERS = 10;
+
+typedef std::map<std::pair<RsFriendServer::PeerFriendshipLevel,PeerInfo::PeerDistance>,RsPeerId> ClosestPeersMap;
+
+class FsPublishBenchmark
+{
+public:
+    FsPublishBenchmark(uint32_t nb_peers) : mFs("fs-benchmark-data","127.0.0.1",2000,1,1,1)
+    {
+        for(uint32_t i=0;i<nb_peers;++i)
+            mPeers.push_back(std::make_pair(RsPeerId::random(),RsPgpFingerprint::random()));
+    }
+
+    // Publishes all peers once, then returns the number of publishes per second.
+
+    double publishAll()
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        for(const auto& p:mPeers)
+        {
+            mFs.publishPeer(p.first,p.second,std::string(),time(nullptr),std::map<RsPeerId,RsFriendServer::PeerFriendshipLevel>());
+        }
+
+        return mPeers.size() / secondsSince(start);
+    }
+
+    // Same with the previous full-scan algorithm, on a pool that already contains all peers.
+
+    double referencePublishes(uint32_t nb_publishes)
+    {
+        std::map<RsPeerId,std::pair<RsPgpFingerprint,ClosestPeersMap> > pool;
+        RsPgpFingerprint bias = RsPgpFingerprint::random();
+
+        for(const auto& p:mPeers)
+            pool[p.first].first = p.second;
+
+        auto start = std::chrono::steady_clock::now();
+
+        for(uint32_t i=0;i<nb_publishes;++i)
+        {
+            const auto& p(mPeers[RsRandom::random_u32() % mPeers.size()]);
+            auto& own(pool[p.first].second);
+
+            for(auto& it:pool)
+                if(it.first != p.first)
+                {
+                    auto res = (p.second ^ it.second.first)^bias;
+                    auto d = RsDirUtil::sha1sum(res.toByteArray(),res.SIZE_IN_BYTES);
+
+                    removeByDistance(d,it.second.second);
+                    it.second.second[std::make_pair(RsFriendServer::PeerFriendshipLevel::UNKNOWN,d)] = p.first;
+
+                    while(it.second.second.size() > NB_CLOSEST_PEERS)
+                        it.second.second.erase(std::prev(it.second.second.end()));
+
+                    removeByDistance(d,own);
+                    own[std::make_pair(RsFriendServer::PeerFriendshipLevel::UNKNOWN,d)] = it.first;
+
+                    while(own.size() > NB_CLOSEST_PEERS)
+                        own.erase(std::prev(own.end()));
+                }
+        }
+
+        return nb_publishes / secondsSince(start);
+    }
+
+private:
+    static double secondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    static void removeByDistance(const PeerInfo::PeerDistance& d,ClosestPeersMap& mp)
+    {
+        for(auto level: { RsFriendServer::PeerFriendshipLevel::UNKNOWN,RsFriendServer::PeerFriendshipLevel::NO_KEY,
+                          RsFriendServer::PeerFriendshipLevel::HAS_KEY,RsFriendServer::PeerFriendshipLevel::HAS_ACCEPTED_KEY })
+        {
+            auto it = mp.find(std::make_pair(level,d));
+
+            if(it != mp.end())
+            {
+                mp.erase(it);
+                return;
+            }
+        }
+    }
+
+    FriendServer mFs;
+    std::vector<std::pair<RsPeerId,RsPgpFingerprint> > mPeers;
+};
+
+int main(int argc, char* argv[])
+{
+    uint32_t nb_peers = 10000;
+    uint32_t nb_reference_publishes = 1000;
+
+    argstream as(argc,argv);
+
+    as >> parameter( 'n',"peers", nb_peers, "number of synthetic participants (default: 10000)", false )
+       >> parameter( 'r',"reference-publishes", nb_reference_publishes, "number of publishes measured with the previous algorithm (default: 1000, 0 to skip)", false )
+       >> help( 'h', "help", "Display this Help" );
+
+    as.defaultErrorHandling(true, true);
+
+    if(!RsDirUtil::checkCreateDirectory("fs-benchmark-data"))
+    {
+        RsErr() << "Cannot create benchmark data directory." ;
+        return 1;
+    }
+
+    FsPublishBenchmark bench(nb_peers);
+
+    RsInfo() << "Friend server publish benchmark with " << nb_peers << " participants:" ;
+
+    double joins = bench.publishAll();
+    RsInfo() << "  k-nearest index, first publish of each peer: " << joins << " publishes/s" ;
+
+    double republishes = bench.publishAll();
+    RsInfo() << "  k-nearest index, republish of each peer    : " << republishes << " publishes/s" ;
+
+    if(nb_reference_publishes > 0)
+    {
+        double reference = bench.referencePublishes(nb_reference_publishes);
+        RsInfo() << "  previous full scan algorithm, republish    : " << reference << " publishes/s" ;
+        RsInfo() << "  speedup: x" << republishes / reference ;
+    }
+
+    return 0;
+}
@@ -0,0 +1,50 @@
+# RetroShare friend server publish micro-benchmark qmake build script
+#
+# Copyright (C) 2021-2021, retroshare team <retroshare.project@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify it under
+# the terms of the GNU Affero General Public License as published by the
+# Free Software Foundation, either version 3 of the License, or (at your option)
+# any later version.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.
+# See the GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License along
+# with this program. If not, see <http://www.gnu.org/licenses/>.
+#
+# SPDX-FileCopyrightText: Retroshare Team <contact@retroshare.cc>
+# SPDX-License-Identifier: AGPL-3.0-or-later
+
+!include("../../retroshare.pri"): error("Could not include file ../../retroshare.pri")
+
+TARGET = fs-publish-benchmark
+
+!include("../../libretroshare/src/use_libretroshare.pri"):error("Including")
+
+INCLUDEPATH += ../src
+
+SOURCES += fs-publish-benchmark.cc \
+           ../src/friendserver.cc \
+           ../src/fspeerindex.cc \
+           ../src/fspoller.cc \
+           ../src/fsstatestore.cc \
+           ../src/fsstats.cc \
+           ../src/fsencryptionpool.cc \
+           ../src/network.cc
+
+HEADERS += ../src/friendserver.h \
+           ../src/fspeerindex.h \
+           ../src/fspoller.h \
+           ../src/fsstatestore.h \
+           ../src/fsstats.h \
+           ../src/fsencryptionpool.h \
+           ../src/network.h
+
+win32-g++|win32-clang-g++ {
+    dLib = ws2_32 iphlpapi crypt32
+    LIBS *= $$linkDynamicLibs(dLib)
+    CONFIG += console
+}
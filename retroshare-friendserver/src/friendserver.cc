@@ -4,8 +4,6 @@
 #include "util/rsbase64.h"
 #include "util/radix64.h"
 
-#include "crypto/hashstream.h"
-
 #include "pgp/pgpkeyutil.h"
 #include "pgp/rscertificate.h"
 #include "pgp/openpgpsdkhandler.h"
@@ -13,13 +11,24 @@
 #include "friendserver.h"
 #include "friend_server/fsitem.h"
 
+//#define DEBUG_FRIEND_SERVER 1
+
 static const rstime_t MAXIMUM_PEER_INACTIVE_DELAY    = 600;
 static const rstime_t DELAY_BETWEEN_TWO_AUTOWASH     =  60;
 static const rstime_t DELAY_BETWEEN_TWO_DEBUG_PRINT  =  10;
+static const rstime_t DELAY_BETWEEN_TWO_STATS_UPDATE =   5;
 static const uint32_t MAXIMUM_PEERS_TO_REQUEST       =  10;
+static const int      MAXIMUM_IDLE_WAIT_MS           = 1000;	// bounds the time needed to notice a stop request
+static const uint32_t MAXIMUM_POSITION_CACHE_SIZE    = 100000;
+static const uint32_t MAXIMUM_JOURNAL_EVENTS         = 10000;	// the journal is folded into a new snapshot beyond this
+static const uint32_t ENCRYPTION_QUEUE_SIZE_PER_WORKER = 16;
 
 void FriendServer::threadTick()
 {
+    static rstime_t last_autowash_TS = time(nullptr);
+    static rstime_t last_debugprint_TS = time(nullptr);
+    static rstime_t last_stats_TS = time(nullptr);
+
     // Listen to the network interface, capture incoming data etc.
 
     RsItem *item;
@@ -34,7 +43,9 @@ void FriendServer::threadTick()
 
             continue;
         }
+#ifdef DEBUG_FRIEND_SERVER
         std::cerr << "Received item: " << std::endl << *fsitem << std::endl;
+#endif
 
         switch(fsitem->PacketSubType())
         {
@@ -46,24 +57,41 @@ void FriendServer::threadTick()
         }
         delete item;
     }
-    std::this_thread::sleep_for(std::chrono::milliseconds(200));
 
-    static rstime_t last_autowash_TS = time(nullptr);
     rstime_t now = time(nullptr);
 
     if(last_autowash_TS + DELAY_BETWEEN_TWO_AUTOWASH < now)
     {
         last_autowash_TS = now;
         autoWash();
-    }
 
-    static rstime_t last_debugprint_TS = time(nullptr);
+        if(mStateStore->journalSize() > MAXIMUM_JOURNAL_EVENTS || mStateStore->journalNeedsCompaction())
+            mStateStore->writeSnapshot(mRandomPeerBias,mCurrentClientPeers);
+    }
 
     if(last_debugprint_TS + DELAY_BETWEEN_TWO_DEBUG_PRINT < now)
     {
         last_debugprint_TS = now;
         debugPrint(false);
     }
+
+    if(last_stats_TS + DELAY_BETWEEN_TWO_STATS_UPDATE < now)
+    {
+        last_stats_TS = now;
+        updateStatistics();
+    }
+
+    // Make the journal records durable. This is batched, at most once per second.
+
+    mStateStore->syncJournal(false);
+
+    // Sleep until the network interface has new items for us, or until the next periodic task is due.
+
+    rstime_t next_task_TS = std::min(std::min(last_autowash_TS + DELAY_BETWEEN_TWO_AUTOWASH,last_debugprint_TS + DELAY_BETWEEN_TWO_DEBUG_PRINT),
+                                     last_stats_TS + DELAY_BETWEEN_TWO_STATS_UPDATE) + 1;
+    int timeout_ms = std::min(MAXIMUM_IDLE_WAIT_MS,1000 * static_cast<int>(std::max(next_task_TS - now,(rstime_t)0)));
+
+    mni->waitForIncomingItems(timeout_ms);
 }
 
 void FriendServer::handleClientPublish(const RsFriendServerClientPublishItem *item)
@@ -78,8 +106,9 @@ void FriendServer::handleClientPublish(const RsFriendServerClientPublishItem *it
         // First of all, read PGP key and short invites, parse them, and check that they contain the same information
 
         RsPeerId pid;
+        std::vector<uint8_t> key_binary_data;
 
-        if(!handleIncomingClientData(item->pgp_public_key_b64,item->short_invite,pid))
+        if(!handleIncomingClientData(item->pgp_public_key_b64,item->short_invite,pid,key_binary_data))
         {
             RsErr() << "Client data is dropped because of error." ;
             return ;
@@ -93,24 +122,25 @@ void FriendServer::handleClientPublish(const RsFriendServerClientPublishItem *it
         // on friendship levels of other peers.
 
         updateClosestPeers(pi->first,pi->second.pgp_fingerprint,item->already_received_peers);
+        ++mNbPublishes;
 
         RsDbg() << "Sending response item to " << item->PeerId() ;
 
-        RsFriendServerServerResponseItem sr_item;
+        std::unique_ptr<RsFriendServerServerResponseItem> sr_item(new RsFriendServerServerResponseItem);
 
         std::set<RsPeerId> friends;
-        sr_item.unique_identifier = pi->second.last_identifier;
-        sr_item.friend_invites = computeListOfFriendInvites(pi->first,item->n_requested_friends,item->already_received_peers,friends);
-        sr_item.PeerId(item->PeerId());
+        sr_item->unique_identifier = pi->second.last_identifier;
+        sr_item->friend_invites = computeListOfFriendInvites(pi->first,item->n_requested_friends,item->already_received_peers,friends);
+        sr_item->PeerId(item->PeerId());
 
-        RsDbg() << "  Got " << sr_item.friend_invites.size() << " closest peers not in the list." ;
+        RsDbg() << "  Got " << sr_item->friend_invites.size() << " closest peers not in the list." ;
         RsDbg() << "  Updating local information for destination peer." ;
 
         // Update friendship levels of the peer that will receive the new list
 
         for(auto fr:friends)
         {
-            auto& p(pi->second.friendship_levels[fr]);
+            auto& p(friendshipLevel(pi->first,pi->second,fr));
 
             RsDbg() << "  Already a friend: " << fr << ", with local status " << static_cast<int>(p) ;
 
@@ -121,36 +151,17 @@ void FriendServer::handleClientPublish(const RsFriendServerClientPublishItem *it
             }
         }
 
-        // Now encrypt the item with the public PGP key of the destination. This prevents the wrong person to request for
-        // someone else's data.
-
-        RsDbg() << "  Encrypting item..." ;
-
-        RsFriendServerEncryptedServerResponseItem *encrypted_response_item = new RsFriendServerEncryptedServerResponseItem;
-        uint32_t serialized_clear_size = FsSerializer().size(&sr_item);
-        RsTemporaryMemory serialized_clear_mem(serialized_clear_size);
-        FsSerializer().serialise(&sr_item,serialized_clear_mem,&serialized_clear_size);
-
-        uint32_t encrypted_mem_size = serialized_clear_size+1000;	// leave some extra space
-        RsTemporaryMemory encrypted_mem(encrypted_mem_size);
-
-        if(!mPgpHandler->encryptDataBin(PGPHandler::pgpIdFromFingerprint(pi->second.pgp_fingerprint),
-                                        serialized_clear_mem,serialized_clear_size,
-                                        encrypted_mem,&encrypted_mem_size))
-        {
-            RsErr() << "Cannot encrypt item for PGP Id/FPR " << pi->second.pgp_fingerprint << ". Something went wrong." ;
-            return;
-        }
-        encrypted_response_item->PeerId(item->PeerId());
-        encrypted_response_item->bin_len = encrypted_mem_size;
-        encrypted_response_item->bin_data = malloc(encrypted_mem_size);
+        // Save the changes, so that they survive a restart.
 
-        memcpy(encrypted_response_item->bin_data,encrypted_mem,encrypted_mem_size);
+        mStateStore->journalPublish(pi->first,pi->second.pgp_fingerprint,pi->second.short_certificate,pi->second.last_connection_TS,
+                                    pi->second.last_identifier,item->already_received_peers,friends);
 
-        // Send the item.
+        // Now encrypt the item with the public PGP key of the destination. This prevents the wrong person to request for
+        // someone else's data. Encryption and sending are done by the encryption pool, so that the next requests can be
+        // handled meanwhile.
 
-        RsDbg() << "  Sending item..." ;
-        mni->SendItem(encrypted_response_item);
+        RsDbg() << "  Queueing item for encryption..." ;
+        mEncryptionPool->queueResponse(sr_item.release(),PGPHandler::pgpIdFromFingerprint(pi->second.pgp_fingerprint),key_binary_data);
     }
     catch(std::exception& e)
     {
@@ -233,7 +244,7 @@ std::map<std::string,RsFriendServer::PeerFriendshipLevel> FriendServer::computeL
     return res;
 }
 
-bool FriendServer::handleIncomingClientData(const std::string& pgp_public_key_b64,const std::string& short_invite_b64,RsPeerId& pid)
+bool FriendServer::handleIncomingClientData(const std::string& pgp_public_key_b64,const std::string& short_invite_b64,RsPeerId& pid,std::vector<uint8_t>& key_binary_data)
 {
     // 1 - Check that the incoming data is sound.
 
@@ -242,7 +253,6 @@ bool FriendServer::handleIncomingClientData(const std::string& pgp_public_key_b6
         RsDbg() << "  Checking item data...";
 
         std::string error_string;
-        std::vector<uint8_t> key_binary_data ;
 
         if(RsBase64::decode(pgp_public_key_b64,key_binary_data))
             throw std::runtime_error("  Cannot decode client pgp public key: \"" + pgp_public_key_b64 + "\". Wrong format??");
@@ -291,11 +301,7 @@ bool FriendServer::handleIncomingClientData(const std::string& pgp_public_key_b6
         }
         // Store/update the peer info
 
-        auto& pi(mCurrentClientPeers[shortInviteDetails.id]);
-
-        pi.short_certificate = short_invite_b64;
-        pi.last_connection_TS = time(nullptr);
-        pi.pgp_fingerprint = shortInviteDetails.fpr;
+        auto& pi(addOrUpdatePeer(shortInviteDetails.id,shortInviteDetails.fpr,short_invite_b64,time(nullptr)));
 
         while(pi.last_identifier == 0)					// reuse the same identifier (so it's not really a nonce, but it's kept secret whatsoever).
             pi.last_identifier = RsRandom::random_u64();
@@ -310,6 +316,57 @@ bool FriendServer::handleIncomingClientData(const std::string& pgp_public_key_b6
     }
 }
 
+void FriendServer::publishPeer(const RsPeerId& pid,const RsPgpFingerprint& fpr,const std::string& short_invite_b64,rstime_t TS,
+                               const std::map<RsPeerId,RsFriendServer::PeerFriendshipLevel>& friended_peers)
+{
+    addOrUpdatePeer(pid,fpr,short_invite_b64,TS);
+    updateClosestPeers(pid,fpr,friended_peers);
+}
+
+PeerInfo& FriendServer::addOrUpdatePeer(const RsPeerId& pid,const RsPgpFingerprint& fpr,const std::string& short_invite_b64,rstime_t TS)
+{
+    auto pit = mCurrentClientPeers.find(pid);
+
+    if(pit != mCurrentClientPeers.end() && pit->second.pgp_fingerprint != fpr)
+    {
+        RsWarn() << "  Peer " << pid << " comes back with a different PGP key. Dropping its previous data." ;
+        removePeer(pid);
+        pit = mCurrentClientPeers.end();
+    }
+
+    if(pit == mCurrentClientPeers.end())
+    {
+        pit = mCurrentClientPeers.insert(std::make_pair(pid,PeerInfo())).first;
+
+        pit->second.pgp_fingerprint = fpr;
+        pit->second.position = computePeerPosition(fpr);
+
+        mPeerIndex.insert(pid,pit->second.position);
+
+        // Other peers may have reported a friendship level for this peer before it arrived.
+
+        auto pending = mPendingFriendshipLevelRefs.find(pid);
+
+        if(pending != mPendingFriendshipLevelRefs.end())
+        {
+            pit->second.in_friendship_levels_of.swap(pending->second);
+            mPendingFriendshipLevelRefs.erase(pending);
+        }
+    }
+
+    auto& pi(pit->second);
+
+    mExpiryQueue.erase(std::make_pair(pi.last_connection_TS,pid));
+
+    pi.short_certificate = short_invite_b64;
+    pi.last_connection_TS = TS;
+
+    mExpiryQueue.insert(std::make_pair(pi.last_connection_TS,pid));
+    markDirty(pid,pi);
+
+    return pi;
+}
+
 void FriendServer::handleClientRemove(const RsFriendServerClientRemoveItem *item)
 {
     RsDbg() << "Received a client remove item:" << *item ;
@@ -339,48 +396,122 @@ void FriendServer::removePeer(const RsPeerId& peer_id)
     auto it = mCurrentClientPeers.find(peer_id);
 
     if(it != mCurrentClientPeers.end())
-        mCurrentClientPeers.erase(it);
-
-    for(auto& it:mCurrentClientPeers)
     {
-        // Also remove that peer from all n-closest lists
+        auto& pinfo(it->second);
 
-        for(auto pit(it.second.closest_peers.begin());pit!=it.second.closest_peers.end();)
-            if(pit->second == peer_id)
-            {
-                RsDbg() << "  Removing from n-closest peers of peer " << it.first ;
+        // Remove that peer from the n-closest lists that contain it. The reverse index tells which ones.
 
-                auto tmp(pit);
-                ++tmp;
-                it.second.closest_peers.erase(pit);
-                pit=tmp;
+        std::set<RsPeerId> lists_to_update;
+        lists_to_update.swap(pinfo.in_closest_peers_of);
+
+        for(const auto& qid:lists_to_update)
+        {
+            auto q = mCurrentClientPeers.find(qid);
+
+            if(q != mCurrentClientPeers.end())
+            {
+                RsDbg() << "  Removing from n-closest peers of peer " << qid ;
+                removeFromClosestPeers(qid,q->second,computePeerDistance(pinfo,q->second));
             }
-            else
-                ++pit;
+        }
 
-        // Also remove that peer from friendship levels of that particular peer.
+        // Also remove it from the reverse index of its own closest peers.
 
-        auto fit = it.second.friendship_levels.find(peer_id);
+        for(const auto& cp:pinfo.closest_peers)
+        {
+            auto q = mCurrentClientPeers.find(cp.second);
+
+            if(q != mCurrentClientPeers.end())
+                q->second.in_closest_peers_of.erase(peer_id);
+        }
 
-        if(fit != it.second.friendship_levels.end())
+        // Remove that peer from friendship levels of the peers that have one for it.
+
+        for(const auto& qid:pinfo.in_friendship_levels_of)
+        {
+            auto q = mCurrentClientPeers.find(qid);
+
+            if(q != mCurrentClientPeers.end())
+            {
+                RsDbg() << "  Removing from have_added_as_friend peers of peer " << qid ;
+                q->second.friendship_levels.erase(peer_id);
+            }
+        }
+
+        // Also remove it from the reverse index of the peers it has a friendship level for.
+
+        for(const auto& fl:pinfo.friendship_levels)
         {
-            RsDbg() << "  Removing from have_added_as_friend peers of peer " << it.first ;
-            it.second.friendship_levels.erase(fit);
+            auto q = mCurrentClientPeers.find(fl.first);
+
+            if(q != mCurrentClientPeers.end())
+                q->second.in_friendship_levels_of.erase(peer_id);
+            else
+            {
+                auto pending = mPendingFriendshipLevelRefs.find(fl.first);
+
+                if(pending != mPendingFriendshipLevelRefs.end())
+                {
+                    pending->second.erase(peer_id);
+
+                    if(pending->second.empty())
+                        mPendingFriendshipLevelRefs.erase(pending);
+                }
+            }
         }
+
+        mExpiryQueue.erase(std::make_pair(pinfo.last_connection_TS,peer_id));
+        mPeerIndex.remove(peer_id,pinfo.position);
+        mTotalClosestPeers -= pinfo.closest_peers.size();
+        mCurrentClientPeers.erase(it);
+        ++mDataGeneration;
+
+        if(!mReplayingJournal)
+            mStateStore->journalRemove(peer_id);
     }
 }
 
-PeerInfo::PeerDistance FriendServer::computePeerDistance(const RsPgpFingerprint& p1,const RsPgpFingerprint& p2)
+PeerInfo::PeerDistance FriendServer::computePeerPosition(const RsPgpFingerprint& fpr)
 {
-    auto res = (p1 ^ p2)^mRandomPeerBias;
-    auto res2 = RsDirUtil::sha1sum(res.toByteArray(),res.SIZE_IN_BYTES);	// sha1sum prevents reverse finding the random bias
+    if(mPositionCacheBias != mRandomPeerBias)
+    {
+        mPositionCache.clear();
+        mPositionCacheBias = mRandomPeerBias;
+    }
+
+    auto it = mPositionCache.find(fpr);
 
-    std::cerr << "Computing peer distance: p1=" << p1 << " p2=" << p2 << " p1^p2=" << (p1^p2) << " distance=" << res2 << std::endl;
+    if(it != mPositionCache.end())
+        return it->second;
 
-    return res2;
+    auto res = fpr^mRandomPeerBias;
+    auto pos = RsDirUtil::sha1sum(res.toByteArray(),res.SIZE_IN_BYTES);	// sha1sum prevents reverse finding the random bias
+
+    // Fingerprints are random, so dropping the first entry is as good as dropping a random one.
+
+    if(mPositionCache.size() >= MAXIMUM_POSITION_CACHE_SIZE)
+        mPositionCache.erase(mPositionCache.begin());
+
+    mPositionCache[fpr] = pos;
+    return pos;
 }
-FriendServer::FriendServer(const std::string& base_dir,const std::string& listening_address,uint16_t listening_port)
-    : mListeningAddress(listening_address),mListeningPort(listening_port)
+
+PeerInfo::PeerDistance FriendServer::computePeerDistance(const PeerInfo& p1,const PeerInfo& p2)
+{
+    auto res = p1.position ^ p2.position;
+
+#ifdef DEBUG_FRIEND_SERVER
+    std::cerr << "Computing peer distance: p1=" << p1.pgp_fingerprint << " p2=" << p2.pgp_fingerprint << " distance=" << res << std::endl;
+#endif
+
+    return res;
+}
+
+FriendServer::FriendServer(const std::string& base_dir,const std::string& listening_address,uint16_t listening_port,
+                           uint32_t nb_io_workers,uint32_t max_sessions,uint32_t nb_encryption_workers)
+    : mni(nullptr),mEncryptionPool(nullptr),mListeningAddress(listening_address),mListeningPort(listening_port),mNbIoWorkers(nb_io_workers),
+      mMaxSessions(max_sessions),mNbEncryptionWorkers(nb_encryption_workers),mDataGeneration(0),mLastPrintedDataGeneration(0),
+      mStatsServer(nullptr),mTotalClosestPeers(0),mNbPublishes(0),mNbPublishesAtLastStats(0),mLastStatsTS(time(nullptr))
 {
     RsDbg() << "Creating friend server." ;
     mBaseDirectory = base_dir;
@@ -395,167 +526,421 @@ FriendServer::FriendServer(const std::string& base_dir,const std::string& listen
 
     mPgpHandler = new OpenPGPSDKHandler(pgp_public_keyring_path,pgp_private_keyring_path,pgp_trustdb_path,pgp_lock_path);
 
-    // Random bias. Should be cryptographically safe.
+    // Random bias. Should be cryptographically safe. It is replaced by the one of the saved state, if any, since
+    // the saved positions depend on it.
 
     mRandomPeerBias = RsPgpFingerprint::random();
+
+    mStateStore = new FsStateStore(base_dir);
+    mReplayingJournal = false;
+
+    loadState();
+}
+
+void FriendServer::loadState()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    bool loaded = mStateStore->loadSnapshot(mRandomPeerBias,mCurrentClientPeers);
+    uint32_t nb_events = 0;
+
+    if(loaded)
+    {
+        rebuildIndexes();
+
+        mReplayingJournal = true;
+
+        nb_events = mStateStore->replayJournal(mRandomPeerBias,
+                   [this](const RsPeerId& pid,const RsPgpFingerprint& fpr,const std::string& short_invite,rstime_t TS,uint64_t identifier,
+                          const FsStateStore::FriendshipLevels& friended_peers,const std::set<RsPeerId>& keys_sent)
+        {
+            auto& pi(addOrUpdatePeer(pid,fpr,short_invite,TS));
+            pi.last_identifier = identifier;
+
+            updateClosestPeers(pid,fpr,friended_peers);
+
+            for(const auto& fr:keys_sent)
+            {
+                auto& p(friendshipLevel(pid,pi,fr));
+
+                if(static_cast<int>(p) < static_cast<int>(RsFriendServer::PeerFriendshipLevel::HAS_KEY))
+                    p = RsFriendServer::PeerFriendshipLevel::HAS_KEY;
+            }
+        },
+                   [this](const RsPeerId& pid) { removePeer(pid); });
+
+        mReplayingJournal = false;
+    }
+
+    if(!loaded || mStateStore->journalNeedsCompaction())
+        mStateStore->writeSnapshot(mRandomPeerBias,mCurrentClientPeers);
+
+    RsInfo() << "Friend server state restored: " << mCurrentClientPeers.size() << " peers, " << nb_events << " journal events replayed in "
+             << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << " ms." ;
+}
+
+void FriendServer::rebuildIndexes()
+{
+    for(const auto& it:mCurrentClientPeers)
+    {
+        mPeerIndex.insert(it.first,it.second.position);
+        mExpiryQueue.insert(std::make_pair(it.second.last_connection_TS,it.first));
+    }
+
+    for(auto& it:mCurrentClientPeers)
+    {
+        for(const auto& cp:it.second.closest_peers)
+        {
+            auto q = mCurrentClientPeers.find(cp.second);
+
+            if(q != mCurrentClientPeers.end())
+                q->second.in_closest_peers_of.insert(it.first);
+        }
+
+        for(const auto& fl:it.second.friendship_levels)
+        {
+            auto q = mCurrentClientPeers.find(fl.first);
+
+            if(q != mCurrentClientPeers.end())
+                q->second.in_friendship_levels_of.insert(it.first);
+            else
+                mPendingFriendshipLevelRefs[fl.first].insert(it.first);
+        }
+
+        updateRadius(it.first,it.second);
+        mTotalClosestPeers += it.second.closest_peers.size();
+        markDirty(it.first,it.second);
+    }
 }
 
 void FriendServer::run()
 {
     // 1 - create network interface.
 
-    mni = new FsNetworkInterface(mListeningAddress,mListeningPort);
+    mni = new FsNetworkInterface(mListeningAddress,mListeningPort,mNbIoWorkers,mMaxSessions);
     mni->start();
 
+    // 2 - encryption and sending of responses.
+
+    mEncryptionPool = new FsEncryptionPool(mni,mBaseDirectory,mNbEncryptionWorkers,ENCRYPTION_QUEUE_SIZE_PER_WORKER*std::max(1u,mNbEncryptionWorkers));
+
+    // 3 - statistics for monitoring.
+
+    mStatsServer = new FsStatsServer(RsDirUtil::makePath(mBaseDirectory,"fs_stats.sock"));
+    mStatsServer->start("fs stats");
+
     while(!shouldStop()) { threadTick() ; }
+
+    mStateStore->syncJournal(true);
+
+    // 4 - shutdown, in the reverse order: the encryption workers send through the network interface.
+
+    mStatsServer->fullstop();
+    delete mStatsServer;
+    mStatsServer = nullptr;
+
+    delete mEncryptionPool;		// stops the encryption workers
+    mEncryptionPool = nullptr;
+
+    mni->fullstop();
+    delete mni;					// stops the I/O workers and closes the sockets
+    mni = nullptr;
 }
 
 void FriendServer::autoWash()
 {
     rstime_t now = time(nullptr);
-    std::list<RsPeerId> to_remove;
 
-    for(std::map<RsPeerId,PeerInfo>::iterator it(mCurrentClientPeers.begin());it!=mCurrentClientPeers.end();++it)
-        if(it->second.last_connection_TS + MAXIMUM_PEER_INACTIVE_DELAY < now)
-        {
-            RsDbg() << "Removing client peer " << it->first << " because it's inactive for more than " << MAXIMUM_PEER_INACTIVE_DELAY << " seconds." ;
-            to_remove.push_back(it->first);
-        }
+    // The expiry queue is sorted by last connection time, so only expired peers are visited.
+
+    while(!mExpiryQueue.empty() && mExpiryQueue.begin()->first + MAXIMUM_PEER_INACTIVE_DELAY < now)
+    {
+        RsPeerId peer_id = mExpiryQueue.begin()->second;
+
+        RsDbg() << "Removing client peer " << peer_id << " because it's inactive for more than " << MAXIMUM_PEER_INACTIVE_DELAY << " seconds." ;
 
-    for(auto peer_id:to_remove)
+        mExpiryQueue.erase(mExpiryQueue.begin());
         removePeer(peer_id);
+    }
 }
 
-void FriendServer::updateClosestPeers(const RsPeerId& pid,const RsPgpFingerprint& fpr,const std::map<RsPeerId,RsFriendServer::PeerFriendshipLevel>& friended_peers)
+typedef std::map< std::pair<RsFriendServer::PeerFriendshipLevel,PeerInfo::PeerDistance>,RsPeerId > ClosestPeersMap;
+
+// Finds the entry of a closest peers list at the given distance, whatever its friendship level.
+
+static ClosestPeersMap::iterator findByDistance(const PeerInfo::PeerDistance& dist,ClosestPeersMap& mp)
 {
-    auto find_multi = [](PeerInfo::PeerDistance dist,std::map< std::pair<RsFriendServer::PeerFriendshipLevel,PeerInfo::PeerDistance>,RsPeerId >& mp)
-            -> std::map< std::pair<RsFriendServer::PeerFriendshipLevel,PeerInfo::PeerDistance>,RsPeerId >::iterator
+    auto it = mp.find(std::make_pair(RsFriendServer::PeerFriendshipLevel::UNKNOWN,dist)) ;
+
+    if(it == mp.end()) it = mp.find(std::make_pair(RsFriendServer::PeerFriendshipLevel::NO_KEY          ,dist));
+    if(it == mp.end()) it = mp.find(std::make_pair(RsFriendServer::PeerFriendshipLevel::HAS_KEY         ,dist));
+    if(it == mp.end()) it = mp.find(std::make_pair(RsFriendServer::PeerFriendshipLevel::HAS_ACCEPTED_KEY,dist));
+
+    return it;
+}
+
+void FriendServer::insertInClosestPeers(const RsPeerId& pid,PeerInfo& pinfo,RsFriendServer::PeerFriendshipLevel level,const PeerInfo::PeerDistance& d,const RsPeerId& closest_peer)
+{
+    mTotalClosestPeers -= pinfo.closest_peers.size();
+
+    auto& entry(pinfo.closest_peers[std::make_pair(level,d)]);
+
+    if(!entry.isNull() && entry != closest_peer)	// only happens for peers sharing the same PGP key
     {
-        auto it = mp.find(std::make_pair(RsFriendServer::PeerFriendshipLevel::UNKNOWN,dist)) ;
+        auto q = mCurrentClientPeers.find(entry);
 
-        if(it == mp.end()) it = mp.find(std::make_pair(RsFriendServer::PeerFriendshipLevel::NO_KEY          ,dist));
-        if(it == mp.end()) it = mp.find(std::make_pair(RsFriendServer::PeerFriendshipLevel::HAS_KEY         ,dist));
-        if(it == mp.end()) it = mp.find(std::make_pair(RsFriendServer::PeerFriendshipLevel::HAS_ACCEPTED_KEY,dist));
+        if(q != mCurrentClientPeers.end())
+            q->second.in_closest_peers_of.erase(pid);
+    }
+    entry = closest_peer;
 
-        return it;
-    };
-    auto remove_from_map = [find_multi](PeerInfo::PeerDistance dist,
-                                std::map< std::pair<RsFriendServer::PeerFriendshipLevel,
-                                PeerInfo::PeerDistance>,RsPeerId>& mp) -> bool
+    auto q = mCurrentClientPeers.find(closest_peer);
+
+    if(q != mCurrentClientPeers.end())
+        q->second.in_closest_peers_of.insert(pid);
+
+    while(pinfo.closest_peers.size() > MAXIMUM_PEERS_TO_REQUEST)
     {
-        auto mpit = find_multi(dist,mp);
+        auto last = std::prev(pinfo.closest_peers.end());
+        auto q = mCurrentClientPeers.find(last->second);
 
-        if(mpit != mp.end())
-        {
-            mp.erase(mpit);
-            return true;
-        }
-        else
-            return false;
-    };
+        if(q != mCurrentClientPeers.end())
+            q->second.in_closest_peers_of.erase(pid);
+
+        pinfo.closest_peers.erase(last);
+    }
+
+    mTotalClosestPeers += pinfo.closest_peers.size();
+    markDirty(pid,pinfo);
+    updateRadius(pid,pinfo);
+}
+
+void FriendServer::removeFromClosestPeers(const RsPeerId& pid,PeerInfo& pinfo,const PeerInfo::PeerDistance& d)
+{
+    auto mpit = findByDistance(d,pinfo.closest_peers);
+
+    if(mpit == pinfo.closest_peers.end())
+        return;
+
+    auto q = mCurrentClientPeers.find(mpit->second);
 
+    if(q != mCurrentClientPeers.end())
+        q->second.in_closest_peers_of.erase(pid);
+
+    pinfo.closest_peers.erase(mpit);
+    --mTotalClosestPeers;
+
+    markDirty(pid,pinfo);
+    updateRadius(pid,pinfo);
+}
+
+void FriendServer::updateRadius(const RsPeerId& pid,const PeerInfo& pinfo)
+{
+    // The radius is the largest distance at which a peer with UNKNOWN friendship level still enters the list.
+
+    PeerInfo::PeerDistance radius = FsPeerIndex::infiniteRadius();
+
+    if(pinfo.closest_peers.size() >= MAXIMUM_PEERS_TO_REQUEST)
+    {
+        const auto& worst(std::prev(pinfo.closest_peers.end())->first);
+
+        if(worst.first == RsFriendServer::PeerFriendshipLevel::UNKNOWN)
+            radius = worst.second;
+        else if(worst.first < RsFriendServer::PeerFriendshipLevel::UNKNOWN)
+            radius = PeerInfo::PeerDistance();
+    }
+
+    mPeerIndex.setRadius(pid,pinfo.position,radius);
+}
+
+void FriendServer::updateClosestPeers(const RsPeerId& pid,const RsPgpFingerprint& fpr,const std::map<RsPeerId,RsFriendServer::PeerFriendshipLevel>& friended_peers)
+{
     auto& pit(mCurrentClientPeers[pid]);
 
-    for(auto& it:mCurrentClientPeers)
-        if(it.first != pid)
-        {
-            // 1 - for all existing peers, update the level at which the given peer has added the peer as friend.
+    // 0 - remove the peer from the lists it currently belongs to. It is added back below with up to date friendship levels.
 
-            auto peer_iterator = friended_peers.find(it.first);
-            auto peer_friendship_level = (peer_iterator==friended_peers.end())? (RsFriendServer::PeerFriendshipLevel::UNKNOWN):(peer_iterator->second);
+    std::set<RsPeerId> lists_to_update;
+    lists_to_update.swap(pit.in_closest_peers_of);
 
-            PeerInfo::PeerDistance d = computePeerDistance(fpr,it.second.pgp_fingerprint);
+    for(const auto& qid:lists_to_update)
+    {
+        auto q = mCurrentClientPeers.find(qid);
 
-            // Remove the peer from the map. This is costly. I need to find something better. If the peer is already
-            // in the list, it has a map key with the same distance.
+        if(q != mCurrentClientPeers.end())
+            removeFromClosestPeers(qid,q->second,computePeerDistance(pit,q->second));
+    }
 
-            remove_from_map(d,it.second.closest_peers);
+    // 1 - for all existing peers, update the level at which the given peer has added the peer as friend.
+    //     Peers reported by the client get the reported level. All other peers get UNKNOWN, and the index
+    //     tells which of them would accept the given peer in their list, without looking at the others.
 
-            it.second.closest_peers[std::make_pair(peer_friendship_level,d)] = pid;
+    for(const auto& fit:friended_peers)
+    {
+        auto q = mCurrentClientPeers.find(fit.first);
 
-            while(it.second.closest_peers.size() > MAXIMUM_PEERS_TO_REQUEST)
-                it.second.closest_peers.erase(std::prev(it.second.closest_peers.end()));
+        if(fit.first != pid && q != mCurrentClientPeers.end())
+            insertInClosestPeers(q->first,q->second,fit.second,computePeerDistance(pit,q->second),pid);
+    }
 
-            // 2 - for the current peer, update the list of closest peers
+    std::list<std::pair<RsPeerId,PeerInfo::PeerDistance> > candidates;
 
-            auto pit2 = it.second.friendship_levels.find(pid);
-            peer_friendship_level = (pit2==it.second.friendship_levels.end())? (RsFriendServer::PeerFriendshipLevel::UNKNOWN):(pit2->second);
+    mPeerIndex.visitReverseClosest(pit.position,[&](const RsPeerId& qid,const PeerInfo::PeerDistance& d)
+    {
+        if(qid != pid && friended_peers.find(qid) == friended_peers.end())
+            candidates.push_back(std::make_pair(qid,d));
+    });
 
-            remove_from_map(d,pit.closest_peers);
+    for(const auto& c:candidates)
+        insertInClosestPeers(c.first,mCurrentClientPeers[c.first],RsFriendServer::PeerFriendshipLevel::UNKNOWN,c.second,pid);
 
-            pit.closest_peers[std::make_pair(peer_friendship_level,d)] = it.first;
+    // 2 - for the current peer, recompute the list of closest peers. All peers that have a friendship level for the current
+    //     peer are candidates. Among the others, that all have UNKNOWN level, only the closest ones can make it.
 
-            while(pit.closest_peers.size() > MAXIMUM_PEERS_TO_REQUEST)
-                pit.closest_peers.erase(std::prev(pit.closest_peers.end()));
-        }
+    for(const auto& cp:pit.closest_peers)
+    {
+        auto q = mCurrentClientPeers.find(cp.second);
+
+        if(q != mCurrentClientPeers.end())
+            q->second.in_closest_peers_of.erase(pid);
+    }
+    mTotalClosestPeers -= pit.closest_peers.size();
+    pit.closest_peers.clear();
+
+    for(const auto& qid:pit.in_friendship_levels_of)
+    {
+        auto q = mCurrentClientPeers.find(qid);
+
+        if(qid != pid && q != mCurrentClientPeers.end())
+            insertInClosestPeers(pid,pit,q->second.friendship_levels[pid],computePeerDistance(pit,q->second),qid);
+    }
+
+    candidates.clear();
+
+    mPeerIndex.visitClosest(pit.position,[&](const RsPeerId& qid,const PeerInfo::PeerDistance& d) -> bool
+    {
+        if(qid != pid && pit.in_friendship_levels_of.find(qid) == pit.in_friendship_levels_of.end())
+            candidates.push_back(std::make_pair(qid,d));
+
+        return candidates.size() < MAXIMUM_PEERS_TO_REQUEST;
+    });
+
+    for(const auto& c:candidates)
+        insertInClosestPeers(pid,pit,RsFriendServer::PeerFriendshipLevel::UNKNOWN,c.second,c.first);
+
+    updateRadius(pid,pit);
 
     // Also update the friendship levels for the current peer, of all friends from the list.
 
     for(auto it:friended_peers)
-        pit.friendship_levels[it.first] = it.second;
+        friendshipLevel(pid,pit,it.first) = it.second;
 }
 
-Sha1CheckSum FriendServer::computeDataHash()
+RsFriendServer::PeerFriendshipLevel& FriendServer::friendshipLevel(const RsPeerId& pid,PeerInfo& pinfo,const RsPeerId& friend_id)
 {
-    librs::crypto::HashStream s(librs::crypto::HashStream::SHA1);
+    markDirty(pid,pinfo);	// callers may modify the returned level
 
-    for(auto p(mCurrentClientPeers.begin());p!=mCurrentClientPeers.end();++p)
-    {
-        s << p->first;
+    auto it = pinfo.friendship_levels.find(friend_id);
 
-        const auto& inf(p->second);
+    if(it != pinfo.friendship_levels.end())
+        return it->second;
 
-        s << inf.pgp_fingerprint;
-        s << inf.short_certificate;
-        s << (uint64_t)inf.last_connection_TS;
-        s << inf.last_identifier;
+    auto q = mCurrentClientPeers.find(friend_id);
 
-        for(auto d(inf.closest_peers.begin());d!=inf.closest_peers.end();++d)
-        {
-            s << static_cast<uint32_t>(d->first.first) ;
-            s << d->first.second ;
-            s << d->second;
-        }
-        for(auto d:inf.friendship_levels)
-        {
-            s << d.first ;
-            s << static_cast<uint32_t>(d.second);
-        }
-    }
-    return s.hash();
+    if(q != mCurrentClientPeers.end())
+        q->second.in_friendship_levels_of.insert(pid);
+    else
+        mPendingFriendshipLevelRefs[friend_id].insert(pid);
+
+    return pinfo.friendship_levels[friend_id] = RsFriendServer::PeerFriendshipLevel::UNKNOWN;
 }
-void FriendServer::debugPrint(bool force)
+
+void FriendServer::markDirty(const RsPeerId& pid,PeerInfo& pinfo)
 {
-    auto h = computeDataHash();
+    ++mDataGeneration;
 
-    if((h != mCurrentDataHash) || force)
+    if(!pinfo.dirty)
     {
-        RsDbg() << "========== FriendServer statistics ============";
-        RsDbg() << "  Base directory: "<< mBaseDirectory;
-        RsDbg() << "  Random peer bias: "<< mRandomPeerBias;
-        RsDbg() << "  Current hash: "<< h;
-        RsDbg() << "  Network interface: ";
-        RsDbg() << "  Max peers in n-closest list: " << MAXIMUM_PEERS_TO_REQUEST;
-        RsDbg() << "  Current active peers: " << mCurrentClientPeers.size() ;
+        pinfo.dirty = true;
+        mDirtyPeers.push_back(pid);
+    }
+}
 
-        rstime_t now = time(nullptr);
+void FriendServer::updateStatistics()
+{
+    if(!mStatsServer)
+        return;
 
-        for(const auto& it:mCurrentClientPeers)
-        {
-            RsDbg() << "   " << it.first << ": identifier=" << std::hex << it.second.last_identifier << std::dec << " fpr: " << it.second.pgp_fingerprint << ", last contact: " << now - it.second.last_connection_TS << " secs ago.";
-            RsDbg() << "   Closest peers:" ;
+    rstime_t now = time(nullptr);
+    FsStatistics stats;
 
-            for(auto pit:it.second.closest_peers)
-                RsDbg() << "      " << pit.second << " distance=" << pit.first.second << " Peer reciprocal status:" << static_cast<int>(pit.first.first);
-        }
+    stats.nb_peers = mCurrentClientPeers.size();
+    stats.nb_publishes = mNbPublishes;
+    stats.data_generation = mDataGeneration;
 
-        RsDbg() << "===============================================";
+    if(now > mLastStatsTS)
+        stats.publishes_per_second = (mNbPublishes - mNbPublishesAtLastStats) / static_cast<double>(now - mLastStatsTS);
 
-        mCurrentDataHash = h;
-    }
+    if(!mCurrentClientPeers.empty())
+        stats.mean_closest_peers = mTotalClosestPeers / static_cast<double>(mCurrentClientPeers.size());
 
+    uint64_t nb_encryptions,encryption_time_us;
+    mEncryptionPool->getEncryptionStatistics(nb_encryptions,encryption_time_us);
+
+    if(nb_encryptions > 0)
+        stats.mean_encryption_time_ms = encryption_time_us / (1000.0 * nb_encryptions);
+
+    mStatsServer->update(stats);
+
+    mLastStatsTS = now;
+    mNbPublishesAtLastStats = mNbPublishes;
 }
 
+void FriendServer::debugPrint(bool force)
+{
+    if(mDataGeneration == mLastPrintedDataGeneration && !force)
+        return;
 
+    RsDbg() << "========== FriendServer statistics ============";
+    RsDbg() << "  Base directory: "<< mBaseDirectory;
+    RsDbg() << "  Random peer bias: "<< mRandomPeerBias;
+    RsDbg() << "  Data generation: "<< mDataGeneration;
+    RsDbg() << "  Network interface: ";
+    RsDbg() << "  Max peers in n-closest list: " << MAXIMUM_PEERS_TO_REQUEST;
+    RsDbg() << "  Current active peers: " << mCurrentClientPeers.size() ;
+    RsDbg() << "  " << (force?"All":"Changed") << " peers:" ;
 
+    rstime_t now = time(nullptr);
 
+    auto print = [now](const RsPeerId& pid,const PeerInfo& pinfo)
+    {
+        RsDbg() << "   " << pid << ": identifier=" << std::hex << pinfo.last_identifier << std::dec << " fpr: " << pinfo.pgp_fingerprint << ", last contact: " << now - pinfo.last_connection_TS << " secs ago.";
+        RsDbg() << "   Closest peers:" ;
+
+        for(auto pit:pinfo.closest_peers)
+            RsDbg() << "      " << pit.second << " distance=" << pit.first.second << " Peer reciprocal status:" << static_cast<int>(pit.first.first);
+    };
+
+    // Only peers that changed since the last print are shown, unless forced. Removed peers may still be in mDirtyPeers.
+
+    if(force)
+        for(const auto& it:mCurrentClientPeers)
+            print(it.first,it.second);
+
+    for(const auto& pid:mDirtyPeers)
+    {
+        auto it = mCurrentClientPeers.find(pid);
+
+        if(it == mCurrentClientPeers.end())
+            continue;
+
+        if(!force)
+            print(it->first,it->second);
+
+        it->second.dirty = false;
+    }
+    mDirtyPeers.clear();
+
+    RsDbg() << "===============================================";
+
+    mLastPrintedDataGeneration = mDataGeneration;
+}
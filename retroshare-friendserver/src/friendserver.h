@@ -27,6 +27,10 @@
 #include "retroshare/rsfriendserver.h"
 
 #include "network.h"
+#include "fspeerindex.h"
+#include "fsstatestore.h"
+#include "fsstats.h"
+#include "fsencryptionpool.h"
 
 class RsFriendServerClientRemoveItem;
 class RsFriendServerClientPublishItem;
@@ -76,9 +80,12 @@ class RsFriendServerClientPublishItem;
 //      friend server always returns the same list of friends to a given peer. To do so, participants are sorted
 //		for each peer, using a XOR distance such as:
 //
-//                   d(P1,P2) = P1 (XOR) P2 (XOR) R
+//                   d(P1,P2) = H(P1 XOR R) (XOR) H(P2 XOR R)
 //
-//      ...where R is a random bias.
+//      ...where R is a random bias and H is SHA1, so that the order cannot be predicted without knowing R. Since this
+//      is a true XOR metric over the hashed positions H(P XOR R), peers are kept in a binary trie (see FsPeerIndex)
+//      that gives the n closest peers of a peer, and the peers whose list a newcomer should enter, without
+//      computing the distance to every participant.
 //
 //      Since being in the n closest peers is not a reflexive relationship (P1 may be within the n closest peers
 //      to P2 but P2 may not be in the n closest peers to P1), selected friends for peer A are picked from both
@@ -115,6 +122,7 @@ struct PeerInfo
     std::string short_certificate;
     rstime_t last_connection_TS;
     uint64_t last_identifier;
+    PeerDistance position;		// H(pgp_fingerprint XOR R). Distances between peers are XORs of positions.
 
     // The following map contains the list of closest peers. The sorting is based
     // on a combination of the peer XOR distance and the friendship level, so that
@@ -123,15 +131,33 @@ struct PeerInfo
 
     std::map<std::pair<RsFriendServer::PeerFriendshipLevel,PeerDistance>,RsPeerId > closest_peers;	// limited in size.
 
+    // Reverse index of closest_peers: the peers that have the current peer in their list of closest peers.
+
+    std::set<RsPeerId> in_closest_peers_of;
+
     // Which peers have received the key for that particular peer, along with the direct friendship level: whether current peer has added each peer.
 
     std::map<RsPeerId,RsFriendServer::PeerFriendshipLevel> friendship_levels;	// unlimited in size, but no distance sorting.
+
+    // Reverse index of friendship_levels: the peers that have a friendship level for the current peer.
+
+    std::set<RsPeerId> in_friendship_levels_of;
+
+    // Set when the peer data changed since the last debug print.
+
+    bool dirty = false;
 };
 
 class FriendServer : public RsTickingThread
 {
 public:
-    FriendServer(const std::string& base_directory,const std::string& listening_address,uint16_t listening_port);
+    FriendServer(const std::string& base_directory,const std::string& listening_address,uint16_t listening_port,
+                 uint32_t nb_io_workers,uint32_t max_sessions,uint32_t nb_encryption_workers);
+
+    // Adds or refreshes a peer and updates the lists of closest peers, as a client publish does, but without
+    // network, PGP nor journal. Only meant for measuring the algorithms on synthetic peers, from a single thread.
+    void publishPeer(const RsPeerId& pid,const RsPgpFingerprint& fpr,const std::string& short_invite_b64,rstime_t TS,
+                     const std::map<RsPeerId,RsFriendServer::PeerFriendshipLevel>& friended_peers);
 
 private:
     // overloads RsTickingThread
@@ -150,32 +176,84 @@ private:
     // removes a single peer from all lists.
     void removePeer(const RsPeerId& peer_id);
 
-    // Adds the incoming peer data to the list of current clients and returns the
-    bool handleIncomingClientData(const std::string& pgp_public_key_b64, const std::string& short_invite_b64, RsPeerId &pid);
+    // Maintenance of the lists of closest peers, along with their reverse index and the radius stored in mPeerIndex.
+    void insertInClosestPeers(const RsPeerId& pid,PeerInfo& pinfo,RsFriendServer::PeerFriendshipLevel level,const PeerInfo::PeerDistance& d,const RsPeerId& closest_peer);
+    void removeFromClosestPeers(const RsPeerId& pid,PeerInfo& pinfo,const PeerInfo::PeerDistance& d);
+    void updateRadius(const RsPeerId& pid,const PeerInfo& pinfo);
+
+    // Returns the friendship level of pid for peer friend_id, creating it if needed while keeping the reverse index up to date.
+    RsFriendServer::PeerFriendshipLevel& friendshipLevel(const RsPeerId& pid,PeerInfo& pinfo,const RsPeerId& friend_id);
+
+    // Adds the incoming peer data to the list of current clients and returns the peer id and the binary public key.
+    bool handleIncomingClientData(const std::string& pgp_public_key_b64, const std::string& short_invite_b64, RsPeerId &pid, std::vector<uint8_t>& key_binary_data);
+
+    // Creates the peer if needed, and refreshes its certificate and last connection time.
+    PeerInfo& addOrUpdatePeer(const RsPeerId& pid,const RsPgpFingerprint& fpr,const std::string& short_invite_b64,rstime_t TS);
 
     // Computes the appropriate list of short invites to send to a given peer.
     std::map<std::string,RsFriendServer::PeerFriendshipLevel> computeListOfFriendInvites(const RsPeerId &pid, uint32_t nb_reqs_invites,
                                                                                          const std::map<RsPeerId,RsFriendServer::PeerFriendshipLevel>& already_known_peers,
                                                                                          std::set<RsPeerId>& chosen_peers) const;
 
-    // Compute the distance between peers using the random bias (It's not really a distance though. I'm not sure about the triangular inequality).
-    PeerInfo::PeerDistance computePeerDistance(const RsPgpFingerprint &p1, const RsPgpFingerprint &p2);
+    // Computes the position of a peer in the XOR space, using the random bias. Results are cached.
+    PeerInfo::PeerDistance computePeerPosition(const RsPgpFingerprint &fpr);
+
+    // Compute the distance between peers from their positions. This is a XOR metric, so the triangular inequality holds.
+    PeerInfo::PeerDistance computePeerDistance(const PeerInfo& p1, const PeerInfo& p2);
+
+    // Restores the state saved by the previous run, and rebuilds the indexes that are not saved.
+    void loadState();
+    void rebuildIndexes();
+
+    // Records that the data of a peer changed. This replaces hashing the whole participant data to detect changes.
+    void markDirty(const RsPeerId& pid,PeerInfo& pinfo);
 
     void autoWash();
     void debugPrint(bool force);
-    Sha1CheckSum computeDataHash();
+    void updateStatistics();
 
     // Local members
 
     FsNetworkInterface *mni;
     PGPHandler *mPgpHandler;
+    FsStateStore *mStateStore;
+    FsEncryptionPool *mEncryptionPool;
+    bool mReplayingJournal;
 
     std::string mBaseDirectory;
     RsPgpFingerprint mRandomPeerBias;
 
+    // Cache of peer positions, so that peers coming back after being washed out are not hashed again.
+    // It is bounded, and only valid for the bias it was computed with.
+
+    std::map<RsPgpFingerprint,PeerInfo::PeerDistance> mPositionCache;
+    RsPgpFingerprint mPositionCacheBias;
+
     std::map<RsPeerId, PeerInfo> mCurrentClientPeers;
+    FsPeerIndex mPeerIndex;
+
+    // Peers sorted by last_connection_TS, so that autoWash() only looks at expired peers.
+    std::set<std::pair<rstime_t,RsPeerId> > mExpiryQueue;
+
+    // Reverse index of friendship_levels for peers that are not (yet) participants. Moved into PeerInfo when they arrive.
+    std::map<RsPeerId,std::set<RsPeerId> > mPendingFriendshipLevelRefs;
     std::string mListeningAddress;
     uint16_t mListeningPort;
+    uint32_t mNbIoWorkers;
+    uint32_t mMaxSessions;
+    uint32_t mNbEncryptionWorkers;
+
+    // Change tracking. The generation is incremented on every change of the participant data.
+
+    uint64_t mDataGeneration;
+    uint64_t mLastPrintedDataGeneration;
+    std::vector<RsPeerId> mDirtyPeers;
+
+    // Statistics, maintained incrementally and pushed periodically to the stats socket.
 
-    Sha1CheckSum mCurrentDataHash;
+    FsStatsServer *mStatsServer;
+    uint64_t mTotalClosestPeers;		// sum of the sizes of all lists of closest peers
+    uint64_t mNbPublishes;
+    uint64_t mNbPublishesAtLastStats;
+    rstime_t mLastStatsTS;
 };
@@ -0,0 +1,204 @@
+/*
+ * RetroShare Friend Server
+ * Copyright (C) 2021-2021  retroshare team <retroshare.project@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-FileCopyrightText: Retroshare Team <contact@retroshare.cc>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#include <string.h>
+#include <chrono>
+#include <memory>
+
+#include "util/rsdebug.h"
+#include "util/rsdir.h"
+#include "util/rsmemory.h"
+#include "pgp/openpgpsdkhandler.h"
+#include "friend_server/fsitem.h"
+
+#include "fsencryptionpool.h"
+
+static const int FS_ENCRYPTION_WAIT_TIMEOUT_MS = 1000;	// bounds the time needed to notice a stop request
+
+//=========================================================================================================//
+//                                          FsEncryptionPool                                               //
+//=========================================================================================================//
+
+FsEncryptionPool::FsEncryptionPool(PQInterface *network,const std::string& base_directory,uint32_t nb_workers,uint32_t max_queue_size)
+    : mNetwork(network),mQueueMtx("FsEncryptionPool"),mMaxQueueSize(std::max(1u,max_queue_size)),mJobsInProgress(0),mNbEncryptions(0),mEncryptionTimeUs(0)
+{
+    for(uint32_t i=0;i<std::max(1u,nb_workers);++i)
+    {
+        mWorkers.push_back(new FsEncryptionWorker(this,base_directory));
+        mWorkers.back()->start("fs encryption");
+    }
+
+    RsDbg() << "Encryption pool started with " << mWorkers.size() << " workers, queue size " << mMaxQueueSize ;
+}
+
+FsEncryptionPool::~FsEncryptionPool()
+{
+    for(auto w:mWorkers)
+    {
+        w->fullstop();
+        delete w;
+    }
+
+    for(auto& job:mQueue)
+        delete job.item;
+}
+
+void FsEncryptionPool::queueResponse(RsFriendServerServerResponseItem *item,const RsPgpId& pgp_id,const std::vector<uint8_t>& public_key)
+{
+    RS_STACK_MUTEX(mQueueMtx);
+
+    mQueueNotFull.wait(mQueueMtx,[this]() { return mQueue.size() < mMaxQueueSize; });
+
+    mQueue.push_back(Job());
+    mQueue.back().item = item;
+    mQueue.back().pgp_id = pgp_id;
+    mQueue.back().public_key = public_key;
+
+    mQueueNotEmpty.notify_one();
+}
+
+bool FsEncryptionPool::waitForJob(Job& job,int timeout_ms)
+{
+    RS_STACK_MUTEX(mQueueMtx);
+
+    if(!mQueueNotEmpty.wait_for(mQueueMtx,std::chrono::milliseconds(timeout_ms),[this]() { return !mQueue.empty(); }))
+        return false;
+
+    job = std::move(mQueue.front());
+    mQueue.pop_front();
+    ++mJobsInProgress;
+
+    mQueueNotFull.notify_one();
+    return true;
+}
+
+void FsEncryptionPool::jobDone(uint64_t encryption_time_us,bool encrypted)
+{
+    if(encrypted)
+    {
+        ++mNbEncryptions;
+        mEncryptionTimeUs += encryption_time_us;
+    }
+
+    RS_STACK_MUTEX(mQueueMtx);
+    --mJobsInProgress;
+
+    if(mQueue.empty() && mJobsInProgress == 0)
+        mQueueDone.notify_all();
+}
+
+void FsEncryptionPool::waitForCompletion()
+{
+    RS_STACK_MUTEX(mQueueMtx);
+    mQueueDone.wait(mQueueMtx,[this]() { return mQueue.empty() && mJobsInProgress == 0; });
+}
+
+void FsEncryptionPool::getEncryptionStatistics(uint64_t& nb_encryptions,uint64_t& encryption_time_us)
+{
+    nb_encryptions = mNbEncryptions.exchange(0);
+    encryption_time_us = mEncryptionTimeUs.exchange(0);
+}
+
+//=========================================================================================================//
+//                                          FsEncryptionWorker                                             //
+//=========================================================================================================//
+
+FsEncryptionWorker::FsEncryptionWorker(FsEncryptionPool *pool,const std::string& base_directory)
+    : mPool(pool)
+{
+    // Same keyring files as the friend server's own handler. Workers never write them: keys of new clients
+    // are loaded in memory from the jobs.
+
+    std::string pgp_public_keyring_path  = RsDirUtil::makePath(base_directory,"pgp_public_keyring") ;
+    std::string pgp_lock_path            = RsDirUtil::makePath(base_directory,"pgp_lock") ;
+    std::string pgp_private_keyring_path = RsDirUtil::makePath(base_directory,"pgp_private_keyring") ;	// not used.
+    std::string pgp_trustdb_path         = RsDirUtil::makePath(base_directory,"pgp_trustdb") ;	        // not used.
+
+    mPgpHandler = new OpenPGPSDKHandler(pgp_public_keyring_path,pgp_private_keyring_path,pgp_trustdb_path,pgp_lock_path);
+}
+
+FsEncryptionWorker::~FsEncryptionWorker()
+{
+    delete mPgpHandler;
+}
+
+void FsEncryptionWorker::threadTick()
+{
+    FsEncryptionPool::Job job;
+
+    if(mPool->waitForJob(job,FS_ENCRYPTION_WAIT_TIMEOUT_MS))
+        processJob(job);
+}
+
+void FsEncryptionWorker::processJob(FsEncryptionPool::Job& job)
+{
+    std::unique_ptr<RsFriendServerServerResponseItem> item(job.item);
+    uint64_t encryption_time_us = 0;
+    bool encrypted = false;
+
+    try
+    {
+        if(!mPgpHandler->isPgpPubKeyAvailable(job.pgp_id))
+        {
+            RsPgpId pgp_id;
+            std::string error_string;
+
+            if(!mPgpHandler->LoadCertificateFromBinaryData(job.public_key.data(),job.public_key.size(),pgp_id,error_string))
+                throw std::runtime_error("Cannot load client's pgp public key: " + error_string) ;
+        }
+
+        uint32_t serialized_clear_size = FsSerializer().size(item.get());
+        RsTemporaryMemory serialized_clear_mem(serialized_clear_size);
+        FsSerializer().serialise(item.get(),serialized_clear_mem,&serialized_clear_size);
+
+        uint32_t encrypted_mem_size = serialized_clear_size+1000;	// leave some extra space
+        RsTemporaryMemory encrypted_mem(encrypted_mem_size);
+
+        auto start = std::chrono::steady_clock::now();
+
+        if(!mPgpHandler->encryptDataBin(job.pgp_id,serialized_clear_mem,serialized_clear_size,encrypted_mem,&encrypted_mem_size))
+            throw std::runtime_error("Cannot encrypt item for PGP Id " + job.pgp_id.toStdString() + ". Something went wrong.");
+
+        encryption_time_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        encrypted = true;
+
+        RsFriendServerEncryptedServerResponseItem *encrypted_response_item = new RsFriendServerEncryptedServerResponseItem;
+
+        encrypted_response_item->PeerId(item->PeerId());
+        encrypted_response_item->bin_len = encrypted_mem_size;
+        encrypted_response_item->bin_data = malloc(encrypted_mem_size);
+
+        memcpy(encrypted_response_item->bin_data,encrypted_mem,encrypted_mem_size);
+
+        mPool->mNetwork->SendItem(encrypted_response_item);
+    }
+    catch(std::exception& e)
+    {
+        RsErr() << "ERROR: " << e.what() ;
+
+        RsFriendServerStatusItem *status_item = new RsFriendServerStatusItem;
+        status_item->status = RsFriendServerStatusItem::END_OF_TRANSMISSION;
+        status_item->PeerId(item->PeerId());
+        mPool->mNetwork->SendItem(status_item);
+    }
+
+    mPool->jobDone(encryption_time_us,encrypted);
+}
@@ -0,0 +1,110 @@
+/*
+ * RetroShare Friend Server
+ * Copyright (C) 2021-2021  retroshare team <retroshare.project@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-FileCopyrightText: Retroshare Team <contact@retroshare.cc>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <list>
+#include <vector>
+#include <atomic>
+#include <condition_variable>
+
+#include "util/rsthreads.h"
+#include "pqi/pqi_base.h"
+#include "retroshare/rspeers.h"
+
+class PGPHandler;
+class FsEncryptionWorker;
+class RsFriendServerServerResponseItem;
+
+// Serializes, encrypts and sends the responses of the friend server.
+//
+// PGP encryption is by far the most expensive part of a request. It only needs the response and the public key of
+// the client, so it is done here by a pool of worker threads, while the graph of participants is only ever modified
+// by the FriendServer thread. The queue is bounded: when the workers cannot keep up, queueResponse() blocks, which
+// in turn slows down the reading of new requests.
+//
+// Each worker owns its PGP handler (loaded from the server's public keyring), since a PGP handler serializes
+// all its operations on a single mutex. Keys of new clients are passed along with the responses.
+
+class FsEncryptionPool
+{
+public:
+    FsEncryptionPool(PQInterface *network,const std::string& base_directory,uint32_t nb_workers,uint32_t max_queue_size);
+    ~FsEncryptionPool();
+
+    // Queues a response for the client whose PGP key is given. The item is sent to item->PeerId(), and is owned by the pool.
+    void queueResponse(RsFriendServerServerResponseItem *item,const RsPgpId& pgp_id,const std::vector<uint8_t>& public_key);
+
+    // Blocks until all queued responses have been sent.
+    void waitForCompletion();
+
+    // Number of encryptions, and total time spent encrypting (in microseconds), since the last call.
+    void getEncryptionStatistics(uint64_t& nb_encryptions,uint64_t& encryption_time_us);
+
+    uint32_t nbWorkers() const { return mWorkers.size(); }
+
+protected:
+    friend class FsEncryptionWorker;
+
+    struct Job
+    {
+        RsFriendServerServerResponseItem *item;
+        RsPgpId pgp_id;
+        std::vector<uint8_t> public_key;
+    };
+
+    // Returns false if no job arrived before the timeout.
+    bool waitForJob(Job& job,int timeout_ms);
+    void jobDone(uint64_t encryption_time_us,bool encrypted);
+
+    PQInterface *mNetwork;
+
+private:
+    // The conditions are waited on with mQueueMtx held by a RS_STACK_MUTEX, which they release while sleeping.
+    RsMutex mQueueMtx;
+    std::condition_variable_any mQueueNotEmpty;
+    std::condition_variable_any mQueueNotFull;
+    std::condition_variable_any mQueueDone;
+    std::list<Job> mQueue;
+    uint32_t mMaxQueueSize;
+    uint32_t mJobsInProgress;
+
+    std::atomic<uint64_t> mNbEncryptions;
+    std::atomic<uint64_t> mEncryptionTimeUs;
+
+    std::vector<FsEncryptionWorker*> mWorkers;
+};
+
+class FsEncryptionWorker: public RsTickingThread
+{
+public:
+    FsEncryptionWorker(FsEncryptionPool *pool,const std::string& base_directory);
+    virtual ~FsEncryptionWorker();
+
+    // Implements RsTickingThread
+    void threadTick() override;
+
+private:
+    void processJob(FsEncryptionPool::Job& job);
+
+    FsEncryptionPool *mPool;
+    PGPHandler *mPgpHandler;
+};
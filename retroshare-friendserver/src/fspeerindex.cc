@@ -0,0 +1,244 @@
+/*
+ * RetroShare Friend Server
+ * Copyright (C) 2021-2021  retroshare team <retroshare.project@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-FileCopyrightText: Retroshare Team <contact@retroshare.cc>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#include <string.h>
+#include <algorithm>
+
+#include "fspeerindex.h"
+
+static const uint32_t MAX_ENTRIES_PER_LEAF = 16;
+static const uint32_t MAX_DEPTH            = 8*Sha1CheckSum::SIZE_IN_BYTES;
+
+FsPeerIndex::FsPeerIndex() : mSize(0)
+{
+    mRoot.max_radius = Position();
+}
+
+FsPeerIndex::Position FsPeerIndex::infiniteRadius()
+{
+    unsigned char buf[Position::SIZE_IN_BYTES];
+    memset(buf,0xff,sizeof(buf));
+
+    return Position::fromBufferUnsafe(buf);
+}
+
+int FsPeerIndex::bit(const Position& p,uint32_t depth)
+{
+    return (p.toByteArray()[depth >> 3] >> (7 - (depth & 7))) & 1;
+}
+
+void FsPeerIndex::updateMaxRadius(Node& node)
+{
+    node.max_radius = Position();
+
+    if(node.isLeaf())
+    {
+        for(const auto& e:node.entries)
+            if(node.max_radius < e.radius)
+                node.max_radius = e.radius;
+    }
+    else
+        node.max_radius = std::max(node.children[0]->max_radius,node.children[1]->max_radius);
+}
+
+void FsPeerIndex::insert(const RsPeerId& pid,const Position& position)
+{
+    Entry e;
+    e.pid = pid;
+    e.position = position;
+    e.radius = infiniteRadius();	// a new peer has no closest peers yet
+
+    if(insert(mRoot,0,e))
+        ++mSize;
+}
+
+bool FsPeerIndex::insert(Node& node,uint32_t depth,const Entry& e)
+{
+    if(!node.isLeaf())
+    {
+        if(!insert(*node.children[bit(e.position,depth)],depth+1,e))
+            return false;
+
+        updateMaxRadius(node);
+        return true;
+    }
+
+    for(const auto& it:node.entries)
+        if(it.pid == e.pid)
+            return false;
+
+    node.entries.push_back(e);
+
+    // Split full leaves. Peers sharing the same position (same PGP key) cannot be separated, hence the depth limit.
+
+    if(node.entries.size() > MAX_ENTRIES_PER_LEAF && depth < MAX_DEPTH)
+    {
+        node.children[0].reset(new Node);
+        node.children[1].reset(new Node);
+
+        for(const auto& it:node.entries)
+            node.children[bit(it.position,depth)]->entries.push_back(it);
+
+        node.entries.clear();
+        node.entries.shrink_to_fit();
+
+        updateMaxRadius(*node.children[0]);
+        updateMaxRadius(*node.children[1]);
+    }
+    updateMaxRadius(node);
+    return true;
+}
+
+void FsPeerIndex::remove(const RsPeerId& pid,const Position& position)
+{
+    if(remove(mRoot,0,pid,position))
+        --mSize;
+}
+
+bool FsPeerIndex::remove(Node& node,uint32_t depth,const RsPeerId& pid,const Position& position)
+{
+    if(node.isLeaf())
+    {
+        auto it = std::find_if(node.entries.begin(),node.entries.end(),[&pid](const Entry& e) { return e.pid == pid; });
+
+        if(it == node.entries.end())
+            return false;
+
+        node.entries.erase(it);
+        updateMaxRadius(node);
+        return true;
+    }
+
+    if(!remove(*node.children[bit(position,depth)],depth+1,pid,position))
+        return false;
+
+    // Merge sibling leaves when they get small enough, so that the trie does not keep empty branches.
+
+    if(node.children[0]->isLeaf() && node.children[1]->isLeaf()
+            && node.children[0]->entries.size() + node.children[1]->entries.size() <= MAX_ENTRIES_PER_LEAF/2)
+    {
+        node.entries = std::move(node.children[0]->entries);
+        node.entries.insert(node.entries.end(),node.children[1]->entries.begin(),node.children[1]->entries.end());
+
+        node.children[0].reset();
+        node.children[1].reset();
+    }
+    updateMaxRadius(node);
+    return true;
+}
+
+void FsPeerIndex::setRadius(const RsPeerId& pid,const Position& position,const Position& radius)
+{
+    setRadius(mRoot,0,pid,position,radius);
+}
+
+bool FsPeerIndex::setRadius(Node& node,uint32_t depth,const RsPeerId& pid,const Position& position,const Position& radius)
+{
+    if(node.isLeaf())
+    {
+        for(auto& e:node.entries)
+            if(e.pid == pid)
+            {
+                e.radius = radius;
+                updateMaxRadius(node);
+                return true;
+            }
+        return false;
+    }
+
+    if(!setRadius(*node.children[bit(position,depth)],depth+1,pid,position,radius))
+        return false;
+
+    updateMaxRadius(node);
+    return true;
+}
+
+void FsPeerIndex::visitClosest(const Position& position,const std::function<bool(const RsPeerId&,const Position&)>& visitor) const
+{
+    visitClosest(mRoot,0,position,visitor);
+}
+
+bool FsPeerIndex::visitClosest(const Node& node,uint32_t depth,const Position& position,const std::function<bool(const RsPeerId&,const Position&)>& visitor) const
+{
+    if(node.isLeaf())
+    {
+        // All peers of this leaf are closer than peers of the subtrees visited afterwards, so sorting the leaf is enough.
+
+        std::vector<std::pair<Position,const Entry*> > v;
+
+        for(const auto& e:node.entries)
+            v.push_back(std::make_pair(e.position ^ position,&e));
+
+        std::sort(v.begin(),v.end(),[](const std::pair<Position,const Entry*>& a,const std::pair<Position,const Entry*>& b) { return a.first < b.first; });
+
+        for(const auto& it:v)
+            if(!visitor(it.second->pid,it.first))
+                return false;
+
+        return true;
+    }
+
+    // Peers on the same side as "position" for the current bit are closer than all the others.
+
+    int b = bit(position,depth);
+
+    return visitClosest(*node.children[b],depth+1,position,visitor)
+            && visitClosest(*node.children[1-b],depth+1,position,visitor);
+}
+
+void FsPeerIndex::visitReverseClosest(const Position& position,const std::function<void(const RsPeerId&,const Position&)>& visitor) const
+{
+    unsigned char lower_bound[Position::SIZE_IN_BYTES];
+    memset(lower_bound,0,sizeof(lower_bound));
+
+    visitReverseClosest(mRoot,0,position,lower_bound,visitor);
+}
+
+void FsPeerIndex::visitReverseClosest(const Node& node,uint32_t depth,const Position& position,unsigned char *lower_bound,
+                                      const std::function<void(const RsPeerId&,const Position&)>& visitor) const
+{
+    // lower_bound contains the bits of the distance that are fixed by the current prefix, and zeros afterwards, which
+    // is the smallest possible distance between "position" and any peer in this subtree.
+
+    if(memcmp(lower_bound,node.max_radius.toByteArray(),Position::SIZE_IN_BYTES) > 0)
+        return;
+
+    if(node.isLeaf())
+    {
+        for(const auto& e:node.entries)
+        {
+            Position d = e.position ^ position;
+
+            if(!(e.radius < d))
+                visitor(e.pid,d);
+        }
+        return;
+    }
+
+    int b = bit(position,depth);
+    unsigned char mask = 1 << (7 - (depth & 7));
+
+    visitReverseClosest(*node.children[b],depth+1,position,lower_bound,visitor);
+
+    lower_bound[depth >> 3] |= mask;
+    visitReverseClosest(*node.children[1-b],depth+1,position,lower_bound,visitor);
+    lower_bound[depth >> 3] &= ~mask;
+}
@@ -0,0 +1,92 @@
+/*
+ * RetroShare Friend Server
+ * Copyright (C) 2021-2021  retroshare team <retroshare.project@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-FileCopyrightText: Retroshare Team <contact@retroshare.cc>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <functional>
+
+#include "retroshare/rspeers.h"
+
+// Binary trie over the hashed positions of the friend server participants.
+//
+// Peers are sorted by the bits of their position, so that walking the trie while following the bits of a given position
+// enumerates peers in increasing XOR distance to that position. This gives the closest peers of a peer in O(K.log(N)).
+//
+// Each peer also stores a "radius": the largest distance at which a newcomer can still enter its list of closest
+// peers. Every node keeps the maximum radius of its subtree, which allows to find all peers whose list would accept
+// a given newcomer (reverse nearest neighbors) without visiting the whole trie.
+
+class FsPeerIndex
+{
+public:
+    typedef Sha1CheckSum Position;
+
+    FsPeerIndex();
+
+    void insert(const RsPeerId& pid,const Position& position);
+    void remove(const RsPeerId& pid,const Position& position);
+
+    void setRadius(const RsPeerId& pid,const Position& position,const Position& radius);
+
+    // Visits peers by increasing XOR distance to "position", until the visitor returns false.
+    void visitClosest(const Position& position,const std::function<bool(const RsPeerId& pid,const Position& distance)>& visitor) const;
+
+    // Visits all peers whose radius is not smaller than their distance to "position", in no particular order.
+    void visitReverseClosest(const Position& position,const std::function<void(const RsPeerId& pid,const Position& distance)>& visitor) const;
+
+    uint32_t size() const { return mSize; }
+
+    // Radius of a peer whose list of closest peers is not full yet: any newcomer enters it.
+    static Position infiniteRadius();
+
+private:
+    struct Entry
+    {
+        RsPeerId pid;
+        Position position;
+        Position radius;
+    };
+
+    struct Node
+    {
+        std::unique_ptr<Node> children[2];	// either both null (leaf) or both non null
+        std::vector<Entry> entries;			// only used in leaves
+        Position max_radius;
+
+        bool isLeaf() const { return !children[0]; }
+    };
+
+    static int bit(const Position& p,uint32_t depth);
+    static void updateMaxRadius(Node& node);
+
+    bool insert(Node& node,uint32_t depth,const Entry& e);
+    bool remove(Node& node,uint32_t depth,const RsPeerId& pid,const Position& position);
+    bool setRadius(Node& node,uint32_t depth,const RsPeerId& pid,const Position& position,const Position& radius);
+
+    bool visitClosest(const Node& node,uint32_t depth,const Position& position,const std::function<bool(const RsPeerId&,const Position&)>& visitor) const;
+    void visitReverseClosest(const Node& node,uint32_t depth,const Position& position,unsigned char *lower_bound,
+                             const std::function<void(const RsPeerId&,const Position&)>& visitor) const;
+
+    Node mRoot;
+    uint32_t mSize;
+};
@@ -0,0 +1,275 @@
+/*
+ * RetroShare Friend Server
+ * Copyright (C) 2021-2021  retroshare team <retroshare.project@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-FileCopyrightText: Retroshare Team <contact@retroshare.cc>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+#include <stdexcept>
+
+#include "util/rsdebug.h"
+
+#include "fspoller.h"
+
+static const int FS_POLLER_MAX_EVENTS = 256;
+
+#ifdef __linux__
+
+static uint32_t toEpollFlags(uint32_t flags)
+{
+    uint32_t res = 0;
+
+    if(flags & FsPoller::FS_POLL_READ)  res |= EPOLLIN | EPOLLRDHUP;
+    if(flags & FsPoller::FS_POLL_WRITE) res |= EPOLLOUT;
+
+    return res;
+}
+
+FsPoller::FsPoller()
+{
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+
+    if(mEpollFd < 0)
+        throw std::runtime_error("Cannot create epoll instance. errno=" + std::to_string(errno));
+}
+
+FsPoller::~FsPoller()
+{
+    close(mEpollFd);
+}
+
+bool FsPoller::add(int fd,uint32_t flags)
+{
+    struct epoll_event ev;
+    ev.events = toEpollFlags(flags);
+    ev.data.fd = fd;
+
+    if(epoll_ctl(mEpollFd,EPOLL_CTL_ADD,fd,&ev) < 0)
+    {
+        RsErr() << "FsPoller: cannot add fd " << fd << " to epoll set. errno=" << errno ;
+        return false;
+    }
+    return true;
+}
+
+bool FsPoller::modify(int fd,uint32_t flags)
+{
+    struct epoll_event ev;
+    ev.events = toEpollFlags(flags);
+    ev.data.fd = fd;
+
+    if(epoll_ctl(mEpollFd,EPOLL_CTL_MOD,fd,&ev) < 0)
+    {
+        RsErr() << "FsPoller: cannot modify fd " << fd << " in epoll set. errno=" << errno ;
+        return false;
+    }
+    return true;
+}
+
+bool FsPoller::remove(int fd)
+{
+    struct epoll_event ev;	// ignored, but older kernels require a non null pointer
+
+    return epoll_ctl(mEpollFd,EPOLL_CTL_DEL,fd,&ev) == 0;
+}
+
+int FsPoller::wait(std::vector<Event>& events,int timeout_ms)
+{
+    struct epoll_event evs[FS_POLLER_MAX_EVENTS];
+
+    events.clear();
+
+    int n = epoll_wait(mEpollFd,evs,FS_POLLER_MAX_EVENTS,timeout_ms);
+
+    if(n < 0)
+        return (errno == EINTR)?0:-1;
+
+    for(int i=0;i<n;++i)
+    {
+        Event e;
+        e.fd = evs[i].data.fd;
+        e.flags = 0;
+
+        if(evs[i].events & EPOLLIN)  e.flags |= FS_POLL_READ;
+        if(evs[i].events & EPOLLOUT) e.flags |= FS_POLL_WRITE;
+        if(evs[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) e.flags |= FS_POLL_ERROR;
+
+        events.push_back(e);
+    }
+    return n;
+}
+
+FsWakeupFd::FsWakeupFd()
+{
+    mReadFd = mWriteFd = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if(mReadFd < 0)
+        throw std::runtime_error("Cannot create eventfd. errno=" + std::to_string(errno));
+}
+
+FsWakeupFd::~FsWakeupFd()
+{
+    close(mReadFd);
+}
+
+void FsWakeupFd::notify()
+{
+    uint64_t one = 1;
+
+    if(write(mWriteFd,&one,sizeof(one)) < 0 && errno != EAGAIN)
+        RsErr() << "FsWakeupFd: cannot write to eventfd. errno=" << errno ;
+}
+
+void FsWakeupFd::drain()
+{
+    uint64_t value;
+
+    while(read(mReadFd,&value,sizeof(value)) > 0) ;
+}
+
+#else // __linux__
+
+FsPoller::FsPoller() : mPollerMtx("FsPoller") {}
+FsPoller::~FsPoller() {}
+
+bool FsPoller::add(int fd,uint32_t flags)
+{
+    RS_STACK_MUTEX(mPollerMtx);
+    mFds[fd] = flags;
+    return true;
+}
+
+bool FsPoller::modify(int fd,uint32_t flags)
+{
+    RS_STACK_MUTEX(mPollerMtx);
+
+    auto it = mFds.find(fd);
+
+    if(it == mFds.end())
+        return false;
+
+    it->second = flags;
+    return true;
+}
+
+bool FsPoller::remove(int fd)
+{
+    RS_STACK_MUTEX(mPollerMtx);
+    return mFds.erase(fd) > 0;
+}
+
+int FsPoller::wait(std::vector<Event>& events,int timeout_ms)
+{
+    std::vector<struct pollfd> pfds;
+
+    events.clear();
+
+    {
+        RS_STACK_MUTEX(mPollerMtx);
+
+        for(auto it:mFds)
+        {
+            struct pollfd p;
+            p.fd = it.first;
+            p.events = ((it.second & FS_POLL_READ)?POLLIN:0) | ((it.second & FS_POLL_WRITE)?POLLOUT:0);
+            p.revents = 0;
+            pfds.push_back(p);
+        }
+    }
+
+    int n = poll(pfds.data(),pfds.size(),timeout_ms);
+
+    if(n < 0)
+        return (errno == EINTR)?0:-1;
+
+    for(const auto& p:pfds)
+        if(p.revents != 0)
+        {
+            Event e;
+            e.fd = p.fd;
+            e.flags = 0;
+
+            if(p.revents & POLLIN)  e.flags |= FS_POLL_READ;
+            if(p.revents & POLLOUT) e.flags |= FS_POLL_WRITE;
+            if(p.revents & (POLLERR | POLLHUP | POLLNVAL)) e.flags |= FS_POLL_ERROR;
+
+            events.push_back(e);
+        }
+
+    return events.size();
+}
+
+FsWakeupFd::FsWakeupFd()
+{
+    int fds[2];
+
+    if(pipe(fds) < 0)
+        throw std::runtime_error("Cannot create wakeup pipe. errno=" + std::to_string(errno));
+
+    mReadFd = fds[0];
+    mWriteFd = fds[1];
+
+    fcntl(mReadFd ,F_SETFL,O_NONBLOCK);
+    fcntl(mWriteFd,F_SETFL,O_NONBLOCK);
+}
+
+FsWakeupFd::~FsWakeupFd()
+{
+    close(mReadFd);
+    close(mWriteFd);
+}
+
+void FsWakeupFd::notify()
+{
+    char c = 1;
+
+    if(write(mWriteFd,&c,1) < 0 && errno != EAGAIN)
+        RsErr() << "FsWakeupFd: cannot write to wakeup pipe. errno=" << errno ;
+}
+
+void FsWakeupFd::drain()
+{
+    char buf[64];
+
+    while(read(mReadFd,buf,sizeof(buf)) > 0) ;
+}
+
+#endif // __linux__
+
+bool FsWakeupFd::waitForNotification(int timeout_ms)
+{
+    struct pollfd p;
+    p.fd = mReadFd;
+    p.events = POLLIN;
+    p.revents = 0;
+
+    if(poll(&p,1,timeout_ms) <= 0)
+        return false;
+
+    drain();
+    return true;
+}
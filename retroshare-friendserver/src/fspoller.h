@@ -0,0 +1,92 @@
+/*
+ * RetroShare Friend Server
+ * Copyright (C) 2021-2021  retroshare team <retroshare.project@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-FileCopyrightText: Retroshare Team <contact@retroshare.cc>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <map>
+
+#include "util/rsthreads.h"
+
+// Minimal readiness notification layer used by the friend server network loop.
+// On Linux this is a thin wrapper over epoll. On other systems it falls back to poll(), in which
+// case changes made while another thread is inside wait() only take effect at the next call.
+
+class FsPoller
+{
+public:
+    enum {
+        FS_POLL_READ  = 0x01,
+        FS_POLL_WRITE = 0x02,
+        FS_POLL_ERROR = 0x04	// hang-up or socket error. Always reported, no need to ask for it.
+    };
+
+    struct Event
+    {
+        int fd;
+        uint32_t flags;
+    };
+
+    FsPoller();
+    ~FsPoller();
+
+    bool add(int fd,uint32_t flags);
+    bool modify(int fd,uint32_t flags);
+    bool remove(int fd);
+
+    // Waits at most timeout_ms milliseconds (-1 means forever) for some of the registered fds to be ready.
+    // Returns the number of events written into "events", or -1 in case of error.
+
+    int wait(std::vector<Event>& events,int timeout_ms);
+
+private:
+#ifdef __linux__
+    int mEpollFd;
+#else
+    RsMutex mPollerMtx;
+    std::map<int,uint32_t> mFds;
+#endif
+};
+
+// File descriptor that becomes readable when notify() is called. Used to wake up a thread
+// that sleeps in a poller or in waitForNotification().
+
+class FsWakeupFd
+{
+public:
+    FsWakeupFd();
+    ~FsWakeupFd();
+
+    int fd() const { return mReadFd; }
+
+    void notify();
+
+    // Returns true when a notification was received before the timeout. Pending notifications are consumed.
+    bool waitForNotification(int timeout_ms);
+
+    // Consumes all pending notifications without waiting.
+    void drain();
+
+private:
+    int mReadFd;
+    int mWriteFd;
+};
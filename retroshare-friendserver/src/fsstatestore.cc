@@ -0,0 +1,551 @@
+/*
+ * RetroShare Friend Server
+ * Copyright (C) 2021-2021  retroshare team <retroshare.project@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-FileCopyrightText: Retroshare Team <contact@retroshare.cc>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef WINDOWS_SYS
+#include <sys/mman.h>
+#endif
+
+#include "util/rsdebug.h"
+#include "util/rsdir.h"
+
+#include "friendserver.h"
+#include "fsstatestore.h"
+
+static const uint32_t FS_SNAPSHOT_MAGIC   = 0x52534653;	// "RSFS"
+static const uint32_t FS_JOURNAL_MAGIC    = 0x52534a4c;	// "RSJL"
+static const uint32_t FS_STATE_VERSION    = 1;
+
+static const uint8_t  FS_JOURNAL_PUBLISH  = 0x01;
+static const uint8_t  FS_JOURNAL_REMOVE   = 0x02;
+
+static const uint32_t FS_MAX_RECORD_SIZE  = 16*1024*1024;
+static const rstime_t FS_JOURNAL_SYNC_DELAY = 1;	// seconds between two fsyncs of the journal
+
+// Little endian, fixed size encoding, so that files can be moved between machines.
+
+class FsStateWriter
+{
+public:
+    void put8(uint8_t v) { mBuf.push_back(v); }
+    void put32(uint32_t v) { for(int i=0;i<4;++i) mBuf.push_back((v >> (8*i)) & 0xff); }
+    void put64(uint64_t v) { for(int i=0;i<8;++i) mBuf.push_back((v >> (8*i)) & 0xff); }
+
+    void putString(const std::string& s)
+    {
+        put32(s.size());
+        mBuf.insert(mBuf.end(),s.begin(),s.end());
+    }
+
+    template<class ID> void putId(const ID& id) { mBuf.insert(mBuf.end(),id.toByteArray(),id.toByteArray()+ID::SIZE_IN_BYTES); }
+
+    std::vector<uint8_t>& buffer() { return mBuf; }
+
+private:
+    std::vector<uint8_t> mBuf;
+};
+
+class FsStateReader
+{
+public:
+    FsStateReader(const uint8_t *data,size_t size) : mData(data),mSize(size),mOffset(0),mOk(true) {}
+
+    bool ok() const { return mOk; }
+    size_t offset() const { return mOffset; }
+    bool atEnd() const { return mOffset >= mSize; }
+
+    uint8_t get8() { return check(1)?mData[mOffset++]:0; }
+
+    uint32_t get32()
+    {
+        uint32_t v = 0;
+
+        if(check(4))
+            for(int i=0;i<4;++i)
+                v |= uint32_t(mData[mOffset++]) << (8*i);
+
+        return v;
+    }
+
+    uint64_t get64()
+    {
+        uint64_t v = 0;
+
+        if(check(8))
+            for(int i=0;i<8;++i)
+                v |= uint64_t(mData[mOffset++]) << (8*i);
+
+        return v;
+    }
+
+    std::string getString()
+    {
+        uint32_t len = get32();
+
+        if(!check(len))
+            return std::string();
+
+        std::string s((const char*)mData+mOffset,len);
+        mOffset += len;
+        return s;
+    }
+
+    template<class ID> ID getId()
+    {
+        if(!check(ID::SIZE_IN_BYTES))
+            return ID();
+
+        ID id = ID::fromBufferUnsafe(mData+mOffset);
+        mOffset += ID::SIZE_IN_BYTES;
+        return id;
+    }
+
+    // Returns a reader on the next n bytes, and skips them.
+    FsStateReader sub(size_t n)
+    {
+        if(!check(n))
+            return FsStateReader(nullptr,0);
+
+        FsStateReader r(mData+mOffset,n);
+        mOffset += n;
+        return r;
+    }
+
+private:
+    bool check(size_t n)
+    {
+        if(mOk && mSize - mOffset >= n && mOffset <= mSize)
+            return true;
+
+        mOk = false;
+        return false;
+    }
+
+    const uint8_t *mData;
+    size_t mSize;
+    size_t mOffset;
+    bool mOk;
+};
+
+// Read-only view of a whole file. Uses mmap when available, so that large snapshots are not copied.
+
+class FsMappedFile
+{
+public:
+    FsMappedFile(const std::string& path) : mData(nullptr),mSize(0),mMapped(false)
+    {
+        int fd = open(path.c_str(),O_RDONLY);
+
+        if(fd < 0)
+            return;
+
+        struct stat st;
+
+        if(fstat(fd,&st) == 0 && st.st_size > 0)
+        {
+            mSize = st.st_size;
+#ifndef WINDOWS_SYS
+            void *p = mmap(nullptr,mSize,PROT_READ,MAP_PRIVATE,fd,0);
+
+            if(p != MAP_FAILED)
+            {
+                mData = (const uint8_t*)p;
+                mMapped = true;
+            }
+#endif
+            if(!mMapped)
+            {
+                mCopy.resize(mSize);
+
+                if(read(fd,mCopy.data(),mSize) == (ssize_t)mSize)
+                    mData = mCopy.data();
+                else
+                    mSize = 0;
+            }
+        }
+        close(fd);
+    }
+
+    ~FsMappedFile()
+    {
+#ifndef WINDOWS_SYS
+        if(mMapped)
+            munmap((void*)mData,mSize);
+#endif
+    }
+
+    const uint8_t *data() const { return mData; }
+    size_t size() const { return mData?mSize:0; }
+
+private:
+    const uint8_t *mData;
+    size_t mSize;
+    bool mMapped;
+    std::vector<uint8_t> mCopy;
+};
+
+FsStateStore::FsStateStore(const std::string& base_directory)
+    : mJournal(nullptr),mGeneration(0),mJournalSize(0),mJournalCorrupted(false),mJournalNeedsSync(false),mLastJournalSyncTS(0)
+{
+    mSnapshotPath = RsDirUtil::makePath(base_directory,"fs_state.snapshot");
+    mJournalPath  = RsDirUtil::makePath(base_directory,"fs_state.journal");
+}
+
+FsStateStore::~FsStateStore()
+{
+    syncJournal(true);
+
+    if(mJournal)
+        fclose(mJournal);
+}
+
+bool FsStateStore::loadSnapshot(RsPgpFingerprint& bias,std::map<RsPeerId,PeerInfo>& peers)
+{
+    FsMappedFile file(mSnapshotPath);
+
+    if(file.size() == 0)
+        return false;
+
+    FsStateReader r(file.data(),file.size());
+
+    if(r.get32() != FS_SNAPSHOT_MAGIC || r.get32() != FS_STATE_VERSION)
+    {
+        RsErr() << "Friend server snapshot " << mSnapshotPath << " has a wrong format. Ignoring it." ;
+        return false;
+    }
+
+    uint64_t generation = r.get64();
+    RsPgpFingerprint snapshot_bias = r.getId<RsPgpFingerprint>();
+    uint32_t nb_peers = r.get32();
+
+    std::map<RsPeerId,PeerInfo> loaded_peers;
+
+    for(uint32_t i=0;i<nb_peers && r.ok();++i)
+    {
+        RsPeerId pid = r.getId<RsPeerId>();
+        PeerInfo& pi(loaded_peers[pid]);
+
+        pi.pgp_fingerprint    = r.getId<RsPgpFingerprint>();
+        pi.position           = r.getId<PeerInfo::PeerDistance>();
+        pi.last_connection_TS = static_cast<rstime_t>(r.get64());
+        pi.last_identifier    = r.get64();
+        pi.short_certificate  = r.getString();
+
+        uint32_t nb_levels = r.get32();
+
+        for(uint32_t j=0;j<nb_levels && r.ok();++j)
+        {
+            RsPeerId fid = r.getId<RsPeerId>();
+            pi.friendship_levels[fid] = static_cast<RsFriendServer::PeerFriendshipLevel>(r.get8());
+        }
+
+        uint32_t nb_closest = r.get32();
+
+        for(uint32_t j=0;j<nb_closest && r.ok();++j)
+        {
+            auto level = static_cast<RsFriendServer::PeerFriendshipLevel>(r.get8());
+            auto d = r.getId<PeerInfo::PeerDistance>();
+
+            pi.closest_peers[std::make_pair(level,d)] = r.getId<RsPeerId>();
+        }
+    }
+
+    if(!r.ok())
+    {
+        RsErr() << "Friend server snapshot " << mSnapshotPath << " is truncated. Ignoring it." ;
+        return false;
+    }
+
+    peers.swap(loaded_peers);
+    bias = snapshot_bias;
+    mGeneration = generation;
+
+    return true;
+}
+
+uint32_t FsStateStore::replayJournal(const RsPgpFingerprint& bias,
+                                     const std::function<void(const RsPeerId&,const RsPgpFingerprint&,const std::string&,rstime_t,uint64_t,
+                                                              const FriendshipLevels&,const std::set<RsPeerId>&)>& on_publish,
+                                     const std::function<void(const RsPeerId&)>& on_remove)
+{
+    uint32_t nb_events = 0;
+
+    {
+        FsMappedFile file(mJournalPath);
+        FsStateReader r(file.data(),file.size());
+
+        mJournalCorrupted = true;	// until proven otherwise
+
+        if(r.get32() != FS_JOURNAL_MAGIC || r.get32() != FS_STATE_VERSION || r.get64() != mGeneration || r.getId<RsPgpFingerprint>() != bias || !r.ok())
+        {
+            RsDbg() << "No journal matching the current snapshot. Nothing to replay." ;
+            return 0;
+        }
+
+        while(!r.atEnd())
+        {
+            uint32_t record_size = r.get32();
+            uint8_t type = r.get8();
+
+            if(!r.ok() || record_size > FS_MAX_RECORD_SIZE)
+                break;
+
+            FsStateReader rr = r.sub(record_size);
+
+            if(!r.ok())		// last record was not completely written
+                break;
+
+            RsPeerId pid = rr.getId<RsPeerId>();
+
+            if(type == FS_JOURNAL_PUBLISH)
+            {
+                RsPgpFingerprint fpr = rr.getId<RsPgpFingerprint>();
+                rstime_t TS = static_cast<rstime_t>(rr.get64());
+                uint64_t identifier = rr.get64();
+                std::string short_invite = rr.getString();
+
+                FriendshipLevels friended_peers;
+                std::set<RsPeerId> keys_sent;
+
+                uint32_t n = rr.get32();
+
+                for(uint32_t i=0;i<n && rr.ok();++i)
+                {
+                    RsPeerId fid = rr.getId<RsPeerId>();
+                    friended_peers[fid] = static_cast<RsFriendServer::PeerFriendshipLevel>(rr.get8());
+                }
+
+                n = rr.get32();
+
+                for(uint32_t i=0;i<n && rr.ok();++i)
+                    keys_sent.insert(rr.getId<RsPeerId>());
+
+                if(!rr.ok())
+                    break;
+
+                on_publish(pid,fpr,short_invite,TS,identifier,friended_peers,keys_sent);
+            }
+            else if(type == FS_JOURNAL_REMOVE)
+            {
+                if(!rr.ok())
+                    break;
+
+                on_remove(pid);
+            }
+            else
+                break;
+
+            ++nb_events;
+        }
+
+        mJournalCorrupted = !r.atEnd();
+    }
+
+    if(mJournalCorrupted)
+        RsErr() << "Friend server journal " << mJournalPath << " is truncated after " << nb_events << " events. It will be compacted." ;
+    else
+    {
+        mJournal = RsDirUtil::rs_fopen(mJournalPath.c_str(),"ab");
+        mJournalSize = nb_events;
+    }
+
+    return nb_events;
+}
+
+bool FsStateStore::writeSnapshot(const RsPgpFingerprint& bias,const std::map<RsPeerId,PeerInfo>& peers)
+{
+    FsStateWriter w;
+
+    w.put32(FS_SNAPSHOT_MAGIC);
+    w.put32(FS_STATE_VERSION);
+    w.put64(mGeneration+1);
+    w.putId(bias);
+    w.put32(peers.size());
+
+    for(const auto& it:peers)
+    {
+        const PeerInfo& pi(it.second);
+
+        w.putId(it.first);
+        w.putId(pi.pgp_fingerprint);
+        w.putId(pi.position);
+        w.put64(static_cast<uint64_t>(pi.last_connection_TS));
+        w.put64(pi.last_identifier);
+        w.putString(pi.short_certificate);
+
+        w.put32(pi.friendship_levels.size());
+
+        for(const auto& fl:pi.friendship_levels)
+        {
+            w.putId(fl.first);
+            w.put8(static_cast<uint8_t>(fl.second));
+        }
+
+        w.put32(pi.closest_peers.size());
+
+        for(const auto& cp:pi.closest_peers)
+        {
+            w.put8(static_cast<uint8_t>(cp.first.first));
+            w.putId(cp.first.second);
+            w.putId(cp.second);
+        }
+    }
+
+    // Write to a temporary file first, so that a crash never leaves a half written snapshot.
+
+    std::string tmp_path = mSnapshotPath + ".tmp";
+    FILE *f = RsDirUtil::rs_fopen(tmp_path.c_str(),"wb");
+
+    if(!f)
+    {
+        RsErr() << "Cannot open " << tmp_path << " for writing. Friend server state is not saved." ;
+        return false;
+    }
+
+    bool ok = (fwrite(w.buffer().data(),1,w.buffer().size(),f) == w.buffer().size());
+    ok = (fflush(f) == 0) && ok;
+#ifndef WINDOWS_SYS
+    ok = (fsync(fileno(f)) == 0) && ok;
+#endif
+    fclose(f);
+
+    if(!ok || !RsDirUtil::renameFile(tmp_path,mSnapshotPath))
+    {
+        RsErr() << "Cannot write friend server snapshot " << mSnapshotPath ;
+        return false;
+    }
+
+    ++mGeneration;
+
+    // The previous journal is now part of the snapshot. Start a new one.
+
+    return openJournal(bias);
+}
+
+bool FsStateStore::openJournal(const RsPgpFingerprint& bias)
+{
+    if(mJournal)
+        fclose(mJournal);
+
+    mJournal = RsDirUtil::rs_fopen(mJournalPath.c_str(),"wb");
+    mJournalSize = 0;
+    mJournalCorrupted = false;
+
+    if(!mJournal)
+    {
+        RsErr() << "Cannot open friend server journal " << mJournalPath ;
+        return false;
+    }
+
+    FsStateWriter w;
+
+    w.put32(FS_JOURNAL_MAGIC);
+    w.put32(FS_STATE_VERSION);
+    w.put64(mGeneration);
+    w.putId(bias);
+
+    fwrite(w.buffer().data(),1,w.buffer().size(),mJournal);
+    fflush(mJournal);
+    mJournalNeedsSync = true;
+
+    return true;
+}
+
+void FsStateStore::appendToJournal(const std::vector<uint8_t>& record)
+{
+    if(!mJournal || mJournalCorrupted)	// appending after a partially written record would make the rest unreadable
+        return;
+
+    if(fwrite(record.data(),1,record.size(),mJournal) != record.size() || fflush(mJournal) != 0)
+    {
+        RsErr() << "Cannot write to friend server journal " << mJournalPath << ". It will be compacted." ;
+        mJournalCorrupted = true;
+        return;
+    }
+    ++mJournalSize;
+    mJournalNeedsSync = true;
+}
+
+void FsStateStore::syncJournal(bool force)
+{
+    if(!mJournal || !mJournalNeedsSync)
+        return;
+
+    rstime_t now = time(nullptr);
+
+    if(!force && mLastJournalSyncTS + FS_JOURNAL_SYNC_DELAY > now)
+        return;
+
+#ifndef WINDOWS_SYS
+    if(fsync(fileno(mJournal)) != 0)
+        RsErr() << "Cannot sync friend server journal " << mJournalPath ;
+#endif
+    mJournalNeedsSync = false;
+    mLastJournalSyncTS = now;
+}
+
+void FsStateStore::journalPublish(const RsPeerId& pid,const RsPgpFingerprint& fpr,const std::string& short_invite,rstime_t TS,uint64_t identifier,
+                                  const FriendshipLevels& friended_peers,const std::set<RsPeerId>& keys_sent)
+{
+    FsStateWriter w;
+
+    w.putId(pid);
+    w.putId(fpr);
+    w.put64(static_cast<uint64_t>(TS));
+    w.put64(identifier);
+    w.putString(short_invite);
+
+    w.put32(friended_peers.size());
+
+    for(const auto& it:friended_peers)
+    {
+        w.putId(it.first);
+        w.put8(static_cast<uint8_t>(it.second));
+    }
+
+    w.put32(keys_sent.size());
+
+    for(const auto& it:keys_sent)
+        w.putId(it);
+
+    FsStateWriter record;
+
+    record.put32(w.buffer().size());
+    record.put8(FS_JOURNAL_PUBLISH);
+    record.buffer().insert(record.buffer().end(),w.buffer().begin(),w.buffer().end());
+
+    appendToJournal(record.buffer());
+}
+
+void FsStateStore::journalRemove(const RsPeerId& pid)
+{
+    FsStateWriter record;
+
+    record.put32(RsPeerId::SIZE_IN_BYTES);
+    record.put8(FS_JOURNAL_REMOVE);
+    record.putId(pid);
+
+    appendToJournal(record.buffer());
+}
@@ -0,0 +1,101 @@
+/*
+ * RetroShare Friend Server
+ * Copyright (C) 2021-2021  retroshare team <retroshare.project@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-FileCopyrightText: Retroshare Team <contact@retroshare.cc>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <map>
+#include <set>
+#include <vector>
+#include <functional>
+
+#include "util/rstime.h"
+#include "retroshare/rsfriendserver.h"
+
+struct PeerInfo;
+
+// On-disk state of the friend server, so that it comes back with its full neighbour graph after a restart.
+//
+// The state is made of two files in the base directory:
+//
+//   * a snapshot of all participants, with their closest peers and friendship levels. It is mmapped and
+//     loaded as is, so no distance needs to be computed at startup.
+//
+//   * an append-only journal of the publish/remove events that happened since the snapshot. Events are
+//     replayed at startup, which is cheap since each of them only touches a few lists.
+//
+// Journal records are flushed to the system when written, so they survive a crash of the process, but they are only
+// fsynced by syncJournal(), at most once per second. A power failure can therefore lose the events of the last two
+// seconds or so, which clients recover from at their next publish.
+//
+// The journal is folded into a new snapshot when it gets too long. Both files carry a generation number, so that a
+// journal that was already folded into the snapshot (e.g. crash right after writing the snapshot) is ignored.
+
+class FsStateStore
+{
+public:
+    typedef std::map<RsPeerId,RsFriendServer::PeerFriendshipLevel> FriendshipLevels;
+
+    FsStateStore(const std::string& base_directory);
+    ~FsStateStore();
+
+    // Loads the snapshot. Returns false if there is no usable snapshot, in which case peers and bias are left untouched.
+    bool loadSnapshot(RsPgpFingerprint& bias,std::map<RsPeerId,PeerInfo>& peers);
+
+    // Replays the journal on top of the snapshot. Only journals written with the same bias are replayed.
+    // Returns the number of events replayed.
+
+    uint32_t replayJournal(const RsPgpFingerprint& bias,
+                           const std::function<void(const RsPeerId& pid,const RsPgpFingerprint& fpr,const std::string& short_invite,rstime_t TS,uint64_t identifier,
+                                                    const FriendshipLevels& friended_peers,const std::set<RsPeerId>& keys_sent)>& on_publish,
+                           const std::function<void(const RsPeerId& pid)>& on_remove);
+
+    // Writes a new snapshot and starts a new, empty journal.
+    bool writeSnapshot(const RsPgpFingerprint& bias,const std::map<RsPeerId,PeerInfo>& peers);
+
+    void journalPublish(const RsPeerId& pid,const RsPgpFingerprint& fpr,const std::string& short_invite,rstime_t TS,uint64_t identifier,
+                        const FriendshipLevels& friended_peers,const std::set<RsPeerId>& keys_sent);
+    void journalRemove(const RsPeerId& pid);
+
+    // Fsyncs the records written since the last call. Unless force is true, this is done at most once per second, so
+    // that a burst of events costs a single fsync. Meant to be called at every tick.
+    void syncJournal(bool force);
+
+    // Number of events in the journal. Used to decide when to fold it into a snapshot.
+    uint32_t journalSize() const { return mJournalSize; }
+
+    // True when the journal could not be fully read, so that it should be folded into a snapshot before appending to it.
+    bool journalNeedsCompaction() const { return mJournalCorrupted; }
+
+private:
+    bool openJournal(const RsPgpFingerprint& bias);
+    void appendToJournal(const std::vector<uint8_t>& record);
+
+    std::string mSnapshotPath;
+    std::string mJournalPath;
+
+    FILE *mJournal;
+    uint64_t mGeneration;
+    uint32_t mJournalSize;
+    bool mJournalCorrupted;
+    bool mJournalNeedsSync;
+    rstime_t mLastJournalSyncTS;
+};
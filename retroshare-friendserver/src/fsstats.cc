@@ -0,0 +1,152 @@
+/*
+ * RetroShare Friend Server
+ * Copyright (C) 2021-2021  retroshare team <retroshare.project@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-FileCopyrightText: Retroshare Team <contact@retroshare.cc>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sstream>
+
+#ifndef WINDOWS_SYS
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "util/rsdebug.h"
+#include "util/rsnet.h"
+
+#include "fsstats.h"
+
+static const int FS_STATS_POLL_TIMEOUT_MS = 1000;	// bounds the time needed to notice a stop request
+
+#ifdef MSG_NOSIGNAL
+static const int FS_STATS_SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int FS_STATS_SEND_FLAGS = 0;
+#endif
+
+FsStatsServer::FsStatsServer(const std::string& socket_path)
+    : mStatsMtx("FsStatsServer"),mSocketPath(socket_path),mListeningSocket(-1)
+{
+#ifdef WINDOWS_SYS
+    RsWarn() << "Statistics socket is not available on this platform." ;
+#else
+    struct sockaddr_un addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if(mSocketPath.size() >= sizeof(addr.sun_path))
+    {
+        RsErr() << "Statistics socket path \"" << mSocketPath << "\" is too long. Statistics will not be available." ;
+        return;
+    }
+    strncpy(addr.sun_path,mSocketPath.c_str(),sizeof(addr.sun_path)-1);
+
+    mListeningSocket = socket(AF_UNIX,SOCK_STREAM,0);
+
+    if(mListeningSocket < 0)
+    {
+        RsErr() << "Cannot create statistics socket: errno=" << errno ;
+        return;
+    }
+    unix_fcntl_nonblock(mListeningSocket);
+
+    unlink(mSocketPath.c_str());	// left over by a previous run
+
+    if(bind(mListeningSocket,(struct sockaddr*)&addr,sizeof(addr)) < 0 || listen(mListeningSocket,8) < 0)
+    {
+        RsErr() << "Cannot listen on statistics socket \"" << mSocketPath << "\": errno=" << errno ;
+        close(mListeningSocket);
+        mListeningSocket = -1;
+        return;
+    }
+
+    mPoller.add(mListeningSocket,FsPoller::FS_POLL_READ);
+
+    RsDbg() << "Statistics available on local socket " << mSocketPath ;
+#endif
+}
+
+FsStatsServer::~FsStatsServer()
+{
+#ifndef WINDOWS_SYS
+    if(mListeningSocket >= 0)
+    {
+        close(mListeningSocket);
+        unlink(mSocketPath.c_str());
+    }
+#endif
+}
+
+void FsStatsServer::update(const FsStatistics& stats)
+{
+    RS_STACK_MUTEX(mStatsMtx);
+    mStats = stats;
+}
+
+std::string FsStatsServer::formatStatistics()
+{
+    FsStatistics s;
+    {
+        RS_STACK_MUTEX(mStatsMtx);
+        s = mStats;
+    }
+
+    std::ostringstream o;
+
+    o << "fs_peers "                   << s.nb_peers << "\n"
+      << "fs_publishes_total "         << s.nb_publishes << "\n"
+      << "fs_publishes_per_second "    << s.publishes_per_second << "\n"
+      << "fs_closest_peers_mean "      << s.mean_closest_peers << "\n"
+      << "fs_encryption_time_ms_mean " << s.mean_encryption_time_ms << "\n"
+      << "fs_data_generation "         << s.data_generation << "\n";
+
+    return o.str();
+}
+
+void FsStatsServer::threadTick()
+{
+    if(mListeningSocket < 0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(FS_STATS_POLL_TIMEOUT_MS));
+        return;
+    }
+
+#ifndef WINDOWS_SYS
+    std::vector<FsPoller::Event> events;
+
+    if(mPoller.wait(events,FS_STATS_POLL_TIMEOUT_MS) <= 0)
+        return;
+
+    int fd;
+
+    while((fd = accept(mListeningSocket,nullptr,nullptr)) >= 0)
+    {
+        // The text is much smaller than the socket buffer, so this never blocks.
+
+        std::string text = formatStatistics();
+
+        if(send(fd,text.c_str(),text.size(),FS_STATS_SEND_FLAGS) != (ssize_t)text.size())
+            RsWarn() << "Could not send statistics on local socket: errno=" << errno ;
+
+        close(fd);
+    }
+#endif
+}
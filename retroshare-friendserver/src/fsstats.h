@@ -0,0 +1,71 @@
+/*
+ * RetroShare Friend Server
+ * Copyright (C) 2021-2021  retroshare team <retroshare.project@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-FileCopyrightText: Retroshare Team <contact@retroshare.cc>
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include "util/rsthreads.h"
+#include "fspoller.h"
+
+// Figures exported by the friend server for monitoring.
+
+struct FsStatistics
+{
+    FsStatistics() : nb_peers(0),nb_publishes(0),publishes_per_second(0),mean_closest_peers(0),mean_encryption_time_ms(0),data_generation(0) {}
+
+    uint32_t nb_peers;
+    uint64_t nb_publishes;				// since startup
+    double   publishes_per_second;		// over the last statistics period
+    double   mean_closest_peers;		// mean size of the lists of closest peers
+    double   mean_encryption_time_ms;	// over the last statistics period
+    uint64_t data_generation;			// changes whenever the participant data changes
+};
+
+// Serves the latest statistics on a local (unix domain) socket. Each connection receives the statistics as
+// "name value" text lines, and is closed right away, so that a monitoring agent can scrape them with e.g.
+//
+//     socat - UNIX-CONNECT:<base directory>/fs_stats.sock
+//
+// Nothing is computed when serving: the friend server pushes new values with update().
+
+class FsStatsServer: public RsTickingThread
+{
+public:
+    FsStatsServer(const std::string& socket_path);
+    virtual ~FsStatsServer();
+
+    void update(const FsStatistics& stats);
+
+    // Implements RsTickingThread
+    virtual void threadTick() override;
+
+private:
+    std::string formatStatistics();
+
+    RsMutex mStatsMtx;
+    FsStatistics mStats;
+
+    std::string mSocketPath;
+    int mListeningSocket;
+    FsPoller mPoller;
+};
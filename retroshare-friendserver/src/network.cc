@@ -39,23 +39,246 @@
 #include "util/rsprint.h"
 #include "util/rsdebug.h"
 
-#include "pqi/pqithreadstreamer.h"
-#include "pqi/pqifdbin.h"
+#include "serialiser/rsserial.h"
 
 #include "network.h"
 #include "friend_server/fsitem.h"
 
-FsNetworkInterface::FsNetworkInterface(const std::string& listening_address,uint16_t listening_port)
+static const int      FS_NETWORK_WAIT_TIMEOUT_MS      = 500;		// only bounds the time needed to notice a stop request
+static const uint32_t FS_NETWORK_READ_CHUNK_SIZE      = 16384;
+static const int      FS_LISTEN_BACKLOG               = 128;
+static const rstime_t FS_MAX_CONNECTION_IDLE_TIME     = 60;		// sessions are short. Idle ones should not hold a slot forever.
+static const rstime_t FS_DELAY_BETWEEN_IDLE_CHECKS    = 5;
+
+#ifdef MSG_NOSIGNAL
+static const int FS_SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int FS_SEND_FLAGS = 0;
+#endif
+
+//=========================================================================================================//
+//                                          FsNetworkWorker                                                //
+//=========================================================================================================//
+
+FsNetworkWorker::FsNetworkWorker(FsNetworkInterface *parent)
+    : mParent(parent),mWorkerMtx("FsNetworkWorker")
+{
+}
+
+bool FsNetworkWorker::addConnection(const std::shared_ptr<ConnectionData>& c)
+{
+    {
+        RS_STACK_MUTEX(mWorkerMtx);
+        mConnections[c->socket] = c;
+    }
+    return mPoller.add(c->socket,FsPoller::FS_POLL_READ);
+}
+
+void FsNetworkWorker::removeConnection(int fd)
+{
+    mPoller.remove(fd);
+
+    RS_STACK_MUTEX(mWorkerMtx);
+    mConnections.erase(fd);
+}
+
+void FsNetworkWorker::threadTick()
+{
+    // Sleep until something happens on one of the sockets. The timeout is only there to let the thread notice stop requests.
+
+    std::vector<FsPoller::Event> events;
+
+    if(mPoller.wait(events,FS_NETWORK_WAIT_TIMEOUT_MS) < 0)
+    {
+        RsErr() << "Error while waiting for network events. errno=" << errno ;
+        std::this_thread::sleep_for(std::chrono::milliseconds(FS_NETWORK_WAIT_TIMEOUT_MS));
+        return;
+    }
+
+    for(const auto& ev:events)
+    {
+        std::shared_ptr<ConnectionData> c;
+
+        {
+            RS_STACK_MUTEX(mWorkerMtx);
+
+            auto it = mConnections.find(ev.fd);
+
+            if(it == mConnections.end())	// connection was closed in the meantime
+                continue;
+
+            c = it->second;
+        }
+
+        std::list<RsItem*> items;
+        bool active = true;
+
+        {
+            RS_STACK_MUTEX(c->mtx);
+
+            if(c->socket != ev.fd)
+                continue;
+
+            // Read first, so that the data sent right before a hang-up still gets processed.
+
+            if(ev.flags & (FsPoller::FS_POLL_READ | FsPoller::FS_POLL_ERROR))
+                active = locked_readIncomingData(*c,items);
+
+            if(active && (ev.flags & FsPoller::FS_POLL_WRITE))
+                active = locked_sendOutgoingData(*c);
+        }
+
+        if(!items.empty())
+            mParent->addIncomingItems(items);
+
+        if(!active)
+            mParent->closeConnection(c->peer_id);
+    }
+}
+
+bool FsNetworkWorker::locked_readIncomingData(ConnectionData& c,std::list<RsItem*>& items)
+{
+    unsigned char buf[FS_NETWORK_READ_CHUNK_SIZE];
+    bool active = true;
+
+    for(;;)
+    {
+        int n = recv(c.socket,(char*)buf,sizeof(buf),0);
+
+        if(n > 0)
+        {
+            c.in_buffer.insert(c.in_buffer.end(),buf,buf+n);
+            continue;
+        }
+
+        if(n == 0)		// connection closed by the client. Still process what has been received.
+        {
+            active = false;
+            break;
+        }
+
+        int err = rs_socket_error();
+
+        if(err == EINTR)
+            continue;
+
+        if(err != EWOULDBLOCK && err != EAGAIN)
+        {
+            RsErr() << "Error while reading from socket " << c.socket << ": errno=" << err ;
+            active = false;
+        }
+        break;
+    }
+
+    c.last_activity_TS = time(nullptr);
+
+    // Now extract all complete items from the buffer
+
+    const uint32_t header_size = getRsPktBaseSize();
+    uint32_t offset = 0;
+
+    while(c.in_buffer.size() - offset >= header_size)
+    {
+        uint32_t item_size = getRsItemSize(c.in_buffer.data() + offset);
+
+        if(item_size < header_size || item_size > getRsPktMaxSize())
+        {
+            RsErr() << "Peer " << c.peer_id << " sent an item with inconsistent size " << item_size << ". Dropping connection." ;
+            active = false;
+            break;
+        }
+
+        if(c.in_buffer.size() - offset < item_size)
+            break;
+
+        uint32_t size = item_size;
+        RsItem *item = FsSerializer().deserialise(c.in_buffer.data() + offset,&size);
+        offset += item_size;
+
+        if(!item)
+        {
+            RsErr() << "Cannot deserialise item of size " << item_size << " from peer " << c.peer_id << ". Dropping it." ;
+            continue;
+        }
+
+        item->PeerId(c.peer_id);
+        items.push_back(item);
+    }
+
+    c.in_buffer.erase(c.in_buffer.begin(),c.in_buffer.begin()+offset);
+
+    return active;
+}
+
+bool FsNetworkWorker::locked_sendOutgoingData(ConnectionData& c)
+{
+    size_t offset = 0;
+
+    while(offset < c.out_buffer.size())
+    {
+        int n = send(c.socket,(const char*)c.out_buffer.data() + offset,c.out_buffer.size() - offset,FS_SEND_FLAGS);
+
+        if(n > 0)
+        {
+            offset += n;
+            continue;
+        }
+
+        int err = rs_socket_error();
+
+        if(n < 0 && err == EINTR)
+            continue;
+
+        if(n < 0 && (err == EWOULDBLOCK || err == EAGAIN))
+            break;
+
+        RsErr() << "Error while writing to socket " << c.socket << ": errno=" << err ;
+        return false;
+    }
+
+    if(offset > 0)
+        c.last_activity_TS = time(nullptr);
+
+    c.out_buffer.erase(c.out_buffer.begin(),c.out_buffer.begin()+offset);
+
+    // Only ask to be woken up for writing when the socket could not take everything.
+
+    bool need_write = !c.out_buffer.empty();
+
+    if(need_write != c.waiting_for_write)
+    {
+        mPoller.modify(c.socket,FsPoller::FS_POLL_READ | (need_write?FsPoller::FS_POLL_WRITE:0));
+        c.waiting_for_write = need_write;
+    }
+    return true;
+}
+
+//=========================================================================================================//
+//                                         FsNetworkInterface                                              //
+//=========================================================================================================//
+
+FsNetworkInterface::FsNetworkInterface(const std::string& listening_address,uint16_t listening_port,uint32_t nb_io_workers,uint32_t max_sessions)
     : PQInterface(RsPeerId()),mFsNiMtx(std::string("FsNetworkInterface")),mListeningAddress(listening_address),mListeningPort(listening_port)
 {
     RS_STACK_MUTEX(mFsNiMtx);
 
+    mLastConnectionId = 0;
+    mListeningPaused = false;
+    mNextWorker = 0;
+    mMaxSessions = std::max(1u,max_sessions);
+    mLastIdleCheckTS = time(nullptr);
+
+    // Start the I/O workers. Their number never changes afterwards, whatever the number of clients.
+
+    for(uint32_t i=0;i<std::max(1u,nb_io_workers);++i)
+    {
+        mWorkers.push_back(new FsNetworkWorker(this));
+        mWorkers.back()->start("fs io worker");
+    }
+
     mClintListn = 0;
     mClintListn = socket(AF_INET, SOCK_STREAM, 0); // creating socket
 
-    int flags=1;
-    setsockopt(mClintListn,SOL_SOCKET,TCP_NODELAY,(char*)&flags,sizeof(flags));
-
     unix_fcntl_nonblock(mClintListn);
 
     struct sockaddr_in ipOfServer;
@@ -82,70 +305,97 @@ FsNetworkInterface::FsNetworkInterface(const std::string& listening_address,uint
         return;
     }
 
-    if(listen(mClintListn , 40) < 0)
+    if(listen(mClintListn , FS_LISTEN_BACKLOG) < 0)
     {
         RsErr() << "Error while calling listen: errno=" << errno ;
         return;
     }
 
+    mPoller.add(mClintListn,FsPoller::FS_POLL_READ);
+
     RsDbg() << "Network interface now listening for TCP on " << sockaddr_storage_tostring( *(sockaddr_storage*)&ipOfServer) ;
+    RsDbg() << "  I/O workers: " << mWorkers.size() << ", maximum simultaneous sessions: " << mMaxSessions ;
 }
 
 FsNetworkInterface::~FsNetworkInterface()
 {
+    for(auto w:mWorkers)
+    {
+        w->fullstop();
+        delete w;
+    }
+
     RS_STACK_MUTEX(mFsNiMtx);
     for(auto& it:mConnections)
     {
-        delete it.second.pqi_thread;
-        std::cerr << "Releasing socket " << it.second.socket << std::endl;
-        close(it.second.socket);
+        std::cerr << "Releasing socket " << it.second->socket << std::endl;
+        close(it.second->socket);
     }
     std::cerr << "Releasing listening socket " << mClintListn << std::endl;
     close(mClintListn);
+
+    for(auto item:mIncomingItems)
+        delete item;
 }
+
 void FsNetworkInterface::threadTick()
 {
-    // 1 - check for new connections
-
-    checkForNewConnections();
+    // This thread only accepts new connections. Reading/writing is done by the I/O workers.
 
-    // 2 - tick all streamers
-
-    std::list<RsPeerId> to_close;
+    std::vector<FsPoller::Event> events;
 
+    if(mPoller.wait(events,FS_NETWORK_WAIT_TIMEOUT_MS) < 0)
     {
-        RS_STACK_MUTEX(mFsNiMtx);
-        for(auto& it:mConnections)
-        {
-            it.second.pqi_thread->tick();
+        RsErr() << "Error while waiting for network events. errno=" << errno ;
+        std::this_thread::sleep_for(std::chrono::milliseconds(FS_NETWORK_WAIT_TIMEOUT_MS));
+        return;
+    }
 
-            if(!it.second.bio->isactive() && !it.second.bio->moretoread(0))
-                to_close.push_back(it.first);
-        }
+    for(const auto& ev:events)
+        if(ev.fd == mClintListn)
+            while(checkForNewConnections()) ;	// accept all pending connections at once
 
-        for(const auto& pid:to_close)
-            locked_closeConnection(pid);
-    }
+    rstime_t now = time(nullptr);
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    if(mLastIdleCheckTS + FS_DELAY_BETWEEN_IDLE_CHECKS < now)
+    {
+        mLastIdleCheckTS = now;
+        closeInactiveConnections();
+    }
 }
 
-static RsPeerId makePeerId(int t)
+static RsPeerId makePeerId(uint64_t t)
 {
     unsigned char s[RsPeerId::SIZE_IN_BYTES];
     memset(s,0,sizeof(s));
 
-    *reinterpret_cast<int*>(&s) = t;
+    memcpy(s,&t,sizeof(t));
     return RsPeerId::fromBufferUnsafe(s);
 }
 bool FsNetworkInterface::checkForNewConnections()
 {
-    // look for incoming data
+    // When the maximum number of sessions is reached, stop polling the listening socket. Incoming
+    // clients then wait in the listen backlog until some slots are released in closeConnection().
+
+    {
+        RS_STACK_MUTEX(mFsNiMtx);
+
+        if(mConnections.size() >= mMaxSessions)
+        {
+            if(!mListeningPaused)
+            {
+                RsWarn() << "Maximum number of sessions (" << mMaxSessions << ") reached. New connections will wait." ;
+                mPoller.remove(mClintListn);
+                mListeningPaused = true;
+            }
+            return false;
+        }
+    }
 
     struct sockaddr addr;
     socklen_t addr_len = sizeof(sockaddr);
 
-    int clintConnt = accept(mClintListn, &addr, &addr_len); // accept is a blocking call!
+    int clintConnt = accept(mClintListn, &addr, &addr_len); // listening socket is non blocking
 
     if(clintConnt < 0)
     {
@@ -163,44 +413,70 @@ bool FsNetworkInterface::checkForNewConnections()
     // Make the socket non blocking so that we can read from it and return if nothing comes
 
     int flags=1;
-    setsockopt(clintConnt,SOL_SOCKET,TCP_NODELAY,(char*)&flags,sizeof(flags));
+    setsockopt(clintConnt,IPPROTO_TCP,TCP_NODELAY,(char*)&flags,sizeof(flags));
 
     unix_fcntl_nonblock(clintConnt);
 
-    // Create connection info
+    // Create connection info. Virtual peer ids are never reused, so that a late response cannot reach
+    // a new client that happens to get the same socket number.
 
-    RsDbg() << "  Creating connection data." ;
+    auto c = std::make_shared<ConnectionData>();
+    c->socket = clintConnt;
+    c->client_address = addr;
+    c->last_activity_TS = time(nullptr);
 
-    ConnectionData c;
-    c.socket = clintConnt;
-    c.client_address = addr;
-    RsPeerId pid = makePeerId(clintConnt);
+    {
+        RS_STACK_MUTEX(mFsNiMtx);
 
-    RsDbg() << "  socket: " << clintConnt;
-    RsDbg() << "  client address: " <<  sockaddr_storage_tostring(*(sockaddr_storage*)&addr);
-    RsDbg() << "  peer id: " << pid ;
+        c->peer_id = makePeerId(++mLastConnectionId);
+        c->worker = mWorkers[mNextWorker++ % mWorkers.size()];
 
-    // Setup a pqistreamer to deserialize whatever comes from this connection
+        mConnections[c->peer_id] = c;
+    }
 
-    RsSerialiser *rss = new RsSerialiser ;
-    rss->addSerialType(new FsSerializer) ;
+    RsDbg() << "  socket: " << clintConnt << ", peer id: " << c->peer_id ;
 
-    RsFdBinInterface *bio = new RsFdBinInterface(clintConnt,true);
+    if(!c->worker->addConnection(c))
+        closeConnection(c->peer_id);
 
-    auto pqi = new pqithreadstreamer(this,rss, pid, bio,BIN_FLAGS_READABLE | BIN_FLAGS_WRITEABLE);
+    return true;
+}
 
-    c.pqi_thread = pqi;
-    c.bio = bio;
+void FsNetworkInterface::closeInactiveConnections()
+{
+    std::list<std::shared_ptr<ConnectionData> > connections;
+    std::list<RsPeerId> to_close;
+    rstime_t now = time(nullptr);
 
     {
         RS_STACK_MUTEX(mFsNiMtx);
-        mConnections[pid] = c;
 
-        pqi->start();
+        for(const auto& it:mConnections)
+            connections.push_back(it.second);
     }
 
-    RsDbg() << "  streamer has properly started." ;
-    return true;
+    for(const auto& c:connections)
+    {
+        RS_STACK_MUTEX(c->mtx);
+
+        if(c->last_activity_TS + FS_MAX_CONNECTION_IDLE_TIME < now)
+            to_close.push_back(c->peer_id);
+    }
+
+    for(const auto& pid:to_close)
+    {
+        RsDbg() << "Closing connection to virtual peer " << pid << " because it is inactive." ;
+        closeConnection(pid);
+    }
+}
+
+void FsNetworkInterface::addIncomingItems(std::list<RsItem*>& items)
+{
+    {
+        RS_STACK_MUTEX(mFsNiMtx);
+        mIncomingItems.splice(mIncomingItems.end(),items);
+    }
+    mItemsAvailable.notify();
 }
 
 bool FsNetworkInterface::RecvItem(RsItem *item)
@@ -209,16 +485,15 @@ bool FsNetworkInterface::RecvItem(RsItem *item)
 
     RsDbg() << "FsNetworkInterface: received item " << (void*)item;
 
-    auto it = mConnections.find(item->PeerId());
-
-    if(it == mConnections.end())
+    if(mConnections.find(item->PeerId()) == mConnections.end())
     {
         RsErr() << "Receiving an item for peer ID " << item->PeerId() << " but no connection is known for that peer." << std::endl;
         delete item;
         return false;
     }
 
-    it->second.incoming_items.push_back(item);
+    mIncomingItems.push_back(item);
+    mItemsAvailable.notify();
     return true;
 }
 
@@ -226,99 +501,141 @@ RsItem *FsNetworkInterface::GetItem()
 {
     RS_STACK_MUTEX(mFsNiMtx);
 
-    for(auto& it:mConnections)
-    {
-        if(!it.second.incoming_items.empty())
-        {
-            RsItem *item = it.second.incoming_items.front();
-            it.second.incoming_items.pop_front();
+    if(mIncomingItems.empty())
+        return nullptr;
 
-            RsDbg() << "FsNetworkInterface: returning item " << (void*)item << " to caller.";
-            return item;
-        }
-    }
-    return nullptr;
+    RsItem *item = mIncomingItems.front();
+    mIncomingItems.pop_front();
+
+    RsDbg() << "FsNetworkInterface: returning item " << (void*)item << " to caller.";
+    return item;
 }
 
-int FsNetworkInterface::SendItem(RsItem *item)
+bool FsNetworkInterface::waitForIncomingItems(int timeout_ms)
 {
-    RS_STACK_MUTEX(mFsNiMtx);
-
-    const auto& it = mConnections.find(item->PeerId());
-
-    if(it == mConnections.end())
     {
-        RsErr() << "Cannot send item to peer " << item->PeerId() << ": no pending sockets available." ;
-        delete item;
-        return 0;
+        RS_STACK_MUTEX(mFsNiMtx);
+
+        if(!mIncomingItems.empty())
+            return true;
     }
 
-    uint32_t ss;
-    return it->second.pqi_thread->SendItem(item,ss);
+    // Items pushed after the check above also write to the wakeup fd, so they cannot be missed.
+
+    return mItemsAvailable.waitForNotification(timeout_ms);
 }
 
-void FsNetworkInterface::closeConnection(const RsPeerId& peer_id)
+int FsNetworkInterface::SendItem(RsItem *item)
 {
-    RS_STACK_MUTEX(mFsNiMtx);
+    std::shared_ptr<ConnectionData> c;
 
-    locked_closeConnection(peer_id);
-}
-void FsNetworkInterface::locked_closeConnection(const RsPeerId& peer_id)
-{
-    RsDbg() << "Closing connection to virtual peer " << peer_id ;
+    {
+        RS_STACK_MUTEX(mFsNiMtx);
 
-    const auto& it = mConnections.find(peer_id);
+        const auto& it = mConnections.find(item->PeerId());
 
-    if(it == mConnections.end())
-    {
-        RsErr() << "  Cannot close connection to peer " << peer_id << ": no pending sockets available." ;
-        return;
+        if(it == mConnections.end())
+        {
+            RsErr() << "Cannot send item to peer " << item->PeerId() << ": no pending sockets available." ;
+            delete item;
+            return 0;
+        }
+        c = it->second;
     }
 
-    if(!it->second.incoming_items.empty())
+    // Serialize at the end of the outgoing buffer and try to send it right away. What the socket
+    // cannot take now will be sent by the I/O worker when the socket becomes writable.
+
+    FsSerializer serializer;
+    uint32_t size = serializer.size(item);
+    bool active = true;
+
     {
-        RsErr() << "  Trying to close an incoming connection with incoming items still pending! The items will be lost:" << std::endl;
+        RS_STACK_MUTEX(c->mtx);
 
-        for(auto& item:it->second.incoming_items)
+        if(c->socket < 0)
         {
-            RsErr() << *item;
+            RsErr() << "Cannot send item to peer " << item->PeerId() << ": connection is closed." ;
             delete item;
+            return 0;
         }
 
-        it->second.incoming_items.clear();
-    }
-    // Close the socket and delete everything.
+        size_t old_size = c->out_buffer.size();
+        c->out_buffer.resize(old_size + size);
 
-    close(it->second.socket);
-    it->second.pqi_thread->fullstop();
-    it->second.bio->close();
+        if(!serializer.serialise(item,c->out_buffer.data() + old_size,&size))
+        {
+            RsErr() << "Cannot serialise item for peer " << item->PeerId() << ". Item is dropped." ;
+            c->out_buffer.resize(old_size);
+            delete item;
+            return 0;
+        }
+        c->out_buffer.resize(old_size + size);
 
-    delete it->second.pqi_thread;
+        active = c->worker->locked_sendOutgoingData(*c);
+    }
+    delete item;
 
-    mConnections.erase(it);
+    if(!active)
+    {
+        closeConnection(c->peer_id);
+        return 0;
+    }
+    return size;
 }
 
-void FsNetworkInterface::debugPrint()
+void FsNetworkInterface::closeConnection(const RsPeerId& peer_id)
 {
-    RsDbg() << "    " << mClintListn ;	// listening socket
-    RsDbg() << "    Connections: " << mConnections.size() ;
-
-    for(auto& it:mConnections)
-        RsDbg() << "      " << it.first << ": from \"" << sockaddr_storage_tostring(*(sockaddr_storage*)(&it.second.client_address)) << "\", socket=" << it.second.socket ;
-
-    std::map<RsPeerId,ConnectionData> mConnections;
-}
+    RsDbg() << "Closing connection to virtual peer " << peer_id ;
 
+    std::shared_ptr<ConnectionData> c;
 
+    {
+        RS_STACK_MUTEX(mFsNiMtx);
 
+        const auto& it = mConnections.find(peer_id);
 
+        if(it == mConnections.end())
+        {
+            RsErr() << "  Cannot close connection to peer " << peer_id << ": no pending sockets available." ;
+            return;
+        }
+        c = it->second;
+        mConnections.erase(it);
 
+        // A slot was released. Accept new clients again if needed.
 
+        if(mListeningPaused && mConnections.size() < mMaxSessions)
+        {
+            mPoller.add(mClintListn,FsPoller::FS_POLL_READ);
+            mListeningPaused = false;
+        }
+    }
 
+    // Close the socket and delete everything. Items already received from this peer stay in the incoming queue.
 
+    RS_STACK_MUTEX(c->mtx);
 
+    if(c->socket < 0)
+        return;
 
+    if(!c->out_buffer.empty())
+        RsErr() << "  Closing connection with " << c->out_buffer.size() << " bytes still to send. They will be lost." ;
 
+    c->worker->removeConnection(c->socket);
+    close(c->socket);
+    c->socket = -1;
+}
 
+void FsNetworkInterface::debugPrint()
+{
+    RS_STACK_MUTEX(mFsNiMtx);
 
+    RsDbg() << "    " << mClintListn ;	// listening socket
+    RsDbg() << "    I/O workers: " << mWorkers.size() ;
+    RsDbg() << "    Connections: " << mConnections.size() << " (max: " << mMaxSessions << ")" << (mListeningPaused?" listening paused":"");
+    RsDbg() << "    Pending incoming items: " << mIncomingItems.size() ;
 
+    for(auto& it:mConnections)
+        RsDbg() << "      " << it.first << ": from \"" << sockaddr_storage_tostring(*(sockaddr_storage*)(&it.second->client_address)) << "\", socket=" << it.second->socket ;
+}
@@ -21,29 +21,79 @@
 
 #pragma once
 
+#include <list>
+#include <vector>
+#include <memory>
+
 #include "util/rsthreads.h"
+#include "util/rstime.h"
 #include "pqi/pqi_base.h"
 #include "retroshare/rspeers.h"
 
-class pqithreadstreamer;
-class RsFdBinInterface;
+#include "fspoller.h"
+
+class FsNetworkInterface;
+class FsNetworkWorker;
 
 struct ConnectionData
 {
+    ConnectionData() : mtx("FsConnectionData"),socket(-1),worker(nullptr),waiting_for_write(false),last_activity_TS(0) {}
+
+    RsMutex mtx;	// protects all fields below. Never acquire the FsNetworkInterface mutex while holding it.
+
+    RsPeerId peer_id;
     sockaddr client_address;
-    int socket;
-    pqithreadstreamer *pqi_thread;
-    RsFdBinInterface *bio;
+    int socket;					// -1 once the connection has been closed
+    FsNetworkWorker *worker;	// I/O worker that multiplexes this connection
 
-    std::list<RsItem*> incoming_items;
+    std::vector<uint8_t> in_buffer;		// received bytes that do not form a complete item yet
+    std::vector<uint8_t> out_buffer;	// serialized items that the socket could not take yet
+    bool waiting_for_write;
+    rstime_t last_activity_TS;
 };
 
-// This class handles multiple connections to the server and supplies RsItem elements
+// I/O worker thread. Each worker waits on its own subset of the client sockets (epoll on Linux), reads
+// incoming bytes, frames and deserializes items, and flushes outgoing data when sockets become writable.
+
+class FsNetworkWorker: public RsTickingThread
+{
+public:
+    FsNetworkWorker(FsNetworkInterface *parent);
+
+    bool addConnection(const std::shared_ptr<ConnectionData>& c);
+    void removeConnection(int fd);
+
+    // Sends as much as possible of c.out_buffer. Returns false if the connection is broken.
+    bool locked_sendOutgoingData(ConnectionData& c);
+
+    // Implements RsTickingThread
+
+    void threadTick() override;
+
+private:
+    bool locked_readIncomingData(ConnectionData& c,std::list<RsItem*>& items);
+
+    FsNetworkInterface *mParent;
+    FsPoller mPoller;
+
+    RsMutex mWorkerMtx;
+    std::map<int,std::shared_ptr<ConnectionData> > mConnections;	// indexed by socket
+};
+
+// This class handles multiple connections to the server and supplies RsItem elements.
+//
+// The FsNetworkInterface thread only accepts new connections, and hands them over to a fixed pool of
+// FsNetworkWorker threads, so that the number of threads does not depend on the number of clients. Complete items
+// are queued and the consumer is notified through a wakeup fd, so that it can block in waitForIncomingItems()
+// instead of polling.
+//
+// The number of simultaneous sessions is capped: when the cap is reached, the listening socket is not
+// polled anymore and new clients wait in the kernel's listen backlog until some sessions are closed.
 
 class FsNetworkInterface: public RsTickingThread, public PQInterface
 {
 public:
-    FsNetworkInterface(const std::string& listening_address,uint16_t listening_port) ;
+    FsNetworkInterface(const std::string& listening_address,uint16_t listening_port,uint32_t nb_io_workers,uint32_t max_sessions) ;
     virtual ~FsNetworkInterface() ;
 
     // basic functionality
@@ -56,6 +106,11 @@ public:
     int  SendItem(RsItem *item) override;
     RsItem *GetItem() override;
 
+    // Blocks until some incoming items are available, or the timeout (in milliseconds) expires.
+    // Returns true if items are available.
+
+    bool waitForIncomingItems(int timeout_ms);
+
     void closeConnection(const RsPeerId& peer_id);
 
     // Implements RsTickingThread
@@ -63,8 +118,11 @@ public:
     void threadTick() override;
 
 protected:
+    friend class FsNetworkWorker;
+
     bool checkForNewConnections();
-    void locked_closeConnection(const RsPeerId& peer_id);
+    void closeInactiveConnections();
+    void addIncomingItems(std::list<RsItem*>& items);
 
 private:
     RsMutex mFsNiMtx;
@@ -73,14 +131,20 @@ private:
     void stopListening();
 
     int mClintListn ;	// listening socket
-    std::map<RsPeerId,ConnectionData> mConnections;
-
-    std::string mListeningAddress;
-    uint16_t mListeningPort;
-};
-
-
+    bool mListeningPaused;
+    std::map<RsPeerId,std::shared_ptr<ConnectionData> > mConnections;
+    uint64_t mLastConnectionId;
 
+    std::list<RsItem*> mIncomingItems;
 
+    std::vector<FsNetworkWorker*> mWorkers;
+    uint32_t mNextWorker;
+    uint32_t mMaxSessions;
+    rstime_t mLastIdleCheckTS;
 
+    FsPoller mPoller;
+    FsWakeupFd mItemsAvailable;
 
+    std::string mListeningAddress;
+    uint16_t mListeningPort;
+};
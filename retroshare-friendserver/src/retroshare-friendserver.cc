@@ -48,11 +48,17 @@ int main(int argc, char* argv[])
 
     std::string base_directory = "FSData";
     std::string tor_executable_path ;
+    uint32_t nb_io_workers = 2;
+    uint32_t max_sessions = 1000;
+    uint32_t nb_encryption_workers = std::max(1u,std::thread::hardware_concurrency());
 
 	argstream as(argc,argv);
 
     as >> parameter( 'c',"base-dir", base_directory, "set base directory to store data files (keys, etc)", false )
        >> parameter( 't',"tor-executable", tor_executable_path, "set absolute path for tor executable", false )
+       >> parameter( 'w',"io-workers", nb_io_workers, "number of threads handling client connections (default: 2)", false )
+       >> parameter( 's',"max-sessions", max_sessions, "maximum number of simultaneous client sessions (default: 1000)", false )
+       >> parameter( 'e',"encryption-workers", nb_encryption_workers, "number of threads encrypting responses (default: number of cores)", false )
        >> help( 'h', "help", "Display this Help" );
 
 	as.defaultErrorHandling(true, true);
@@ -113,7 +119,7 @@ int main(int argc, char* argv[])
 
     // Now start the real thing.
 
-    FriendServer fs(base_directory,service_target_address,target_port);
+    FriendServer fs(base_directory,service_target_address,target_port,nb_io_workers,max_sessions,nb_encryption_workers);
     fs.start();
 
     RsDbg() << "";
@@ -26,9 +26,19 @@ TARGET = retroshare-friendserver
 
 SOURCES += retroshare-friendserver.cc \
            friendserver.cc \
+           fspeerindex.cc \
+           fspoller.cc \
+           fsstatestore.cc \
+           fsstats.cc \
+           fsencryptionpool.cc \
            network.cc 
 
 HEADERS += friendserver.h \
+           fspeerindex.h \
+           fspoller.h \
+           fsstatestore.h \
+           fsstats.h \
+           fsencryptionpool.h \
            network.h      \
            fsitem.h	   
 